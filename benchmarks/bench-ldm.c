@@ -0,0 +1,602 @@
+/*
+ * This file is part of linux-driver-management.
+ *
+ * Copyright © 2016-2018 Ikey Doherty
+ *
+ * linux-driver-management is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <umockdev.h>
+
+#include "ldm.h"
+#include "util.h"
+
+DEF_AUTOFREE(UMockdevTestbed, g_object_unref)
+
+/*
+ * Benchmarks for the expensive paths of the library, run against the
+ * recordings used by the test suite along with synthetic, scaled up trees.
+ *
+ * Each benchmark reports the mean wall time and the mean number of heap
+ * allocations per operation. Usage:
+ *
+ *      bench-ldm [FILTER]
+ *
+ * Only benchmarks whose name contains FILTER are run. The iteration counts
+ * may be scaled with the LDM_BENCH_SCALE environment variable, i.e. 0.1 for
+ * a quick smoke run, or 10 for more stable numbers.
+ */
+
+#define SYNTHETIC_USB_DEVICES 1000
+#define SYNTHETIC_USB_INTERFACES 10
+#define SYNTHETIC_PCI_FUNCTIONS 500
+
+static const gchar *bench_filter = NULL;
+static gdouble bench_scale = 1.0;
+
+/*
+ * Count heap allocations by interposing the allocator. Every library in the
+ * process, glib included, resolves malloc to these definitions first. This
+ * relies on the glibc internal entry points, and is skipped elsewhere.
+ */
+#ifdef __GLIBC__
+static guint64 bench_allocations = 0;
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+void *malloc(size_t size)
+{
+        __atomic_add_fetch(&bench_allocations, 1, __ATOMIC_RELAXED);
+        return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size)
+{
+        __atomic_add_fetch(&bench_allocations, 1, __ATOMIC_RELAXED);
+        return __libc_calloc(n, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+        __atomic_add_fetch(&bench_allocations, 1, __ATOMIC_RELAXED);
+        return __libc_realloc(ptr, size);
+}
+
+static inline guint64 bench_get_allocations(void)
+{
+        return __atomic_load_n(&bench_allocations, __ATOMIC_RELAXED);
+}
+#define BENCH_HAVE_ALLOCATIONS 1
+#else
+static inline guint64 bench_get_allocations(void)
+{
+        return 0;
+}
+#define BENCH_HAVE_ALLOCATIONS 0
+#endif
+
+typedef void (*BenchFunc)(gpointer data);
+
+/**
+ * bench_now:
+ *
+ * Monotonic time in nanoseconds
+ */
+static inline guint64 bench_now(void)
+{
+        struct timespec ts = { 0 };
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (guint64)ts.tv_sec * G_GUINT64_CONSTANT(1000000000) + (guint64)ts.tv_nsec;
+}
+
+/**
+ * bench_run:
+ * @name: Name of the benchmark, matched against the filter
+ * @iterations: Number of operations to time, before scaling
+ *
+ * Run @func once to warm up, then time the requested number of operations.
+ */
+static void bench_run(const gchar *name, guint iterations, BenchFunc func, gpointer data)
+{
+        guint64 start = 0, elapsed = 0;
+        guint64 allocations = 0;
+        guint n = 0;
+
+        if (bench_filter && !strstr(name, bench_filter)) {
+                return;
+        }
+
+        n = (guint)MAX(1.0, iterations * bench_scale);
+
+        func(data);
+
+        allocations = bench_get_allocations();
+        start = bench_now();
+        for (guint i = 0; i < n; i++) {
+                func(data);
+        }
+        elapsed = bench_now() - start;
+        allocations = bench_get_allocations() - allocations;
+
+        if (BENCH_HAVE_ALLOCATIONS) {
+                printf("%-56s %8u %14.0f %12.1f\n",
+                       name,
+                       n,
+                       (gdouble)elapsed / n,
+                       (gdouble)allocations / n);
+        } else {
+                printf("%-56s %8u %14.0f %12s\n", name, n, (gdouble)elapsed / n, "-");
+        }
+        fflush(stdout);
+}
+
+/**
+ * BenchManager:
+ *
+ * A manager over the current testbed, with its own copy of every test
+ * plugin so that provider caches can be invalidated on demand.
+ */
+typedef struct BenchManager {
+        LdmManager *manager;
+        GPtrArray *devices;
+        GPtrArray *plugins;
+} BenchManager;
+
+typedef struct BenchReplay {
+        LdmManager *plugins; /* Only holds the shared plugins */
+        const gchar *path;
+} BenchReplay;
+
+/**
+ * bench_load_plugins:
+ *
+ * Load every plain text and precompiled modalias file from @directory
+ */
+static void bench_load_plugins(GPtrArray *plugins, const gchar *directory)
+{
+        g_autoptr(GDir) dir = NULL;
+        g_autoptr(GPtrArray) names = NULL;
+        const gchar *name = NULL;
+
+        dir = g_dir_open(directory, 0, NULL);
+        if (!dir) {
+                return;
+        }
+
+        names = g_ptr_array_new_with_free_func(g_free);
+        while ((name = g_dir_read_name(dir)) != NULL) {
+                if (g_str_has_suffix(name, ".modaliases")) {
+                        g_ptr_array_add(names, g_build_filename(directory, name, NULL));
+                }
+        }
+        g_ptr_array_sort(names, (GCompareFunc)g_strcmp0);
+
+        for (guint i = 0; i < names->len; i++) {
+                LdmPlugin *plugin = ldm_modalias_plugin_new_from_filename(names->pdata[i]);
+
+                if (plugin) {
+                        g_ptr_array_add(plugins, g_object_ref_sink(plugin));
+                }
+        }
+}
+
+/**
+ * bench_manager_register:
+ *
+ * (Re)register our plugins, dropping all cached providers
+ */
+static void bench_manager_register(BenchManager *self)
+{
+        for (guint i = 0; i < self->plugins->len; i++) {
+                ldm_manager_add_plugin(self->manager, g_object_ref(self->plugins->pdata[i]));
+        }
+}
+
+static void bench_manager_init(BenchManager *self)
+{
+        self->manager = ldm_manager_new(LDM_MANAGER_FLAGS_NO_MONITOR);
+        self->devices = ldm_manager_get_devices(self->manager, LDM_DEVICE_TYPE_ANY);
+        self->plugins = g_ptr_array_new_with_free_func(g_object_unref);
+        bench_load_plugins(self->plugins, TEST_DATA_ROOT);
+        bench_manager_register(self);
+}
+
+static void bench_manager_clear(BenchManager *self)
+{
+        g_clear_pointer(&self->plugins, g_ptr_array_unref);
+        g_clear_pointer(&self->devices, g_ptr_array_unref);
+        g_clear_object(&self->manager);
+}
+
+static void bench_enumerate(__ldm_unused__ gpointer data)
+{
+        g_autoptr(LdmManager) manager = NULL;
+
+        manager = ldm_manager_new(LDM_MANAGER_FLAGS_NO_MONITOR);
+}
+
+static void bench_enumerate_gpu(__ldm_unused__ gpointer data)
+{
+        g_autoptr(LdmManager) manager = NULL;
+
+        manager = ldm_manager_new(LDM_MANAGER_FLAGS_NO_MONITOR | LDM_MANAGER_FLAGS_GPU_QUICK);
+}
+
+static void bench_providers(BenchManager *self)
+{
+        for (guint i = 0; i < self->devices->len; i++) {
+                g_autoptr(GPtrArray) providers = NULL;
+
+                providers = ldm_manager_get_providers(self->manager, self->devices->pdata[i]);
+        }
+}
+
+static void bench_providers_cold(gpointer data)
+{
+        BenchManager *self = data;
+
+        bench_manager_register(self);
+        bench_providers(self);
+}
+
+static void bench_providers_warm(gpointer data)
+{
+        bench_providers(data);
+}
+
+static void bench_provider_infos(gpointer data)
+{
+        BenchManager *self = data;
+        g_autoptr(GArray) infos = NULL;
+
+        bench_manager_register(self);
+        infos = ldm_manager_get_provider_infos(self->manager, LDM_DEVICE_TYPE_ANY);
+}
+
+static void bench_gpu_config(gpointer data)
+{
+        BenchManager *self = data;
+        g_autoptr(LdmGPUConfig) gpu = NULL;
+
+        gpu = ldm_gpu_config_new(self->manager);
+}
+
+static void bench_load_modalias(gpointer data)
+{
+        g_autoptr(LdmPlugin) plugin = NULL;
+
+        plugin = ldm_modalias_plugin_new_from_filename(data);
+        if (plugin) {
+                g_object_ref_sink(plugin);
+        }
+}
+
+/**
+ * bench_replay:
+ *
+ * Build the tree straight from the recording, as a batch job would, and
+ * resolve every provider through plugins shared with the job.
+ */
+static void bench_replay(gpointer data)
+{
+        BenchReplay *self = data;
+        g_autoptr(LdmManager) manager = NULL;
+        g_autoptr(GArray) infos = NULL;
+
+        manager = ldm_manager_new_from_source(LDM_DEVICE_SOURCE_UMOCKDEV, self->path, 0, NULL);
+        if (!manager) {
+                return;
+        }
+        ldm_manager_share_plugins(manager, self->plugins);
+        infos = ldm_manager_get_provider_infos(manager, LDM_DEVICE_TYPE_ANY);
+}
+
+/**
+ * bench_run_tree:
+ *
+ * Run a benchmark named for the tree it runs against
+ */
+static void bench_run_tree(const gchar *name, const gchar *label, guint iterations,
+                           BenchFunc func, gpointer data)
+{
+        g_autofree gchar *full_name = NULL;
+
+        full_name = g_strdup_printf("%s/%s", name, label);
+        bench_run(full_name, iterations, func, data);
+}
+
+/**
+ * bench_tree:
+ * @label: Short name for the tree in the report
+ * @iterations: Base number of operations for the cheaper benchmarks
+ *
+ * Run every benchmark against the tree in the current testbed
+ */
+static void bench_tree(const gchar *label, guint iterations)
+{
+        BenchManager manager = { 0 };
+
+        bench_run_tree("enumerate", label, iterations, bench_enumerate, NULL);
+        bench_run_tree("enumerate-gpu", label, iterations, bench_enumerate_gpu, NULL);
+
+        bench_manager_init(&manager);
+        bench_run_tree("providers-cold", label, iterations, bench_providers_cold, &manager);
+        bench_run_tree("providers-warm", label, iterations * 10, bench_providers_warm, &manager);
+        bench_run_tree("provider-infos", label, iterations, bench_provider_infos, &manager);
+        bench_run_tree("gpu-config", label, iterations, bench_gpu_config, &manager);
+        bench_manager_clear(&manager);
+}
+
+/**
+ * bench_recordings:
+ *
+ * Replay each of the test suite recordings in turn
+ */
+static void bench_recordings(void)
+{
+        g_autoptr(GDir) dir = NULL;
+        g_autoptr(GPtrArray) names = NULL;
+        BenchManager manager = { 0 };
+        const gchar *name = NULL;
+
+        dir = g_dir_open(TEST_DATA_ROOT, 0, NULL);
+        if (!dir) {
+                g_printerr("Failed to open %s\n", TEST_DATA_ROOT);
+                return;
+        }
+
+        names = g_ptr_array_new_with_free_func(g_free);
+        while ((name = g_dir_read_name(dir)) != NULL) {
+                if (g_str_has_suffix(name, ".umockdev")) {
+                        g_ptr_array_add(names, g_strdup(name));
+                }
+        }
+        g_ptr_array_sort(names, (GCompareFunc)g_strcmp0);
+
+        /* One set of plugins for every replay, loaded against an empty tree */
+        manager.manager = ldm_manager_new(LDM_MANAGER_FLAGS_NO_MONITOR);
+        manager.plugins = g_ptr_array_new_with_free_func(g_object_unref);
+        bench_load_plugins(manager.plugins, TEST_DATA_ROOT);
+        bench_manager_register(&manager);
+
+        for (guint i = 0; i < names->len; i++) {
+                autofree(UMockdevTestbed) *bed = NULL;
+                BenchReplay replay = { 0 };
+                g_autofree gchar *path = NULL;
+                g_autofree gchar *label = NULL;
+
+                path = g_build_filename(TEST_DATA_ROOT, names->pdata[i], NULL);
+                label = g_strndup(names->pdata[i], strlen(names->pdata[i]) - strlen(".umockdev"));
+
+                replay.plugins = manager.manager;
+                replay.path = path;
+                bench_run_tree("replay", label, 200, bench_replay, &replay);
+
+                bed = umockdev_testbed_new();
+                if (!umockdev_testbed_add_from_file(bed, path, NULL)) {
+                        g_printerr("Failed to load %s\n", path);
+                        continue;
+                }
+                bench_tree(label, 200);
+        }
+
+        bench_manager_clear(&manager);
+}
+
+/**
+ * bench_synthetic_usb:
+ *
+ * A large hub farm of composite USB devices, each with several interfaces
+ */
+static void bench_synthetic_usb(void)
+{
+        autofree(UMockdevTestbed) *bed = NULL;
+
+        bed = umockdev_testbed_new();
+
+        for (guint i = 0; i < SYNTHETIC_USB_DEVICES; i++) {
+                g_autofree gchar *device_name = NULL;
+                g_autofree gchar *vendor = NULL;
+                g_autofree gchar *product = NULL;
+                g_autofree gchar *device = NULL;
+                guint vendor_id = 0x1000 + (i % 64);
+
+                device_name = g_strdup_printf("1-%u", i + 1);
+                vendor = g_strdup_printf("%04x", vendor_id);
+                product = g_strdup_printf("%04x", i);
+
+                device = umockdev_testbed_add_device(bed,
+                                                     "usb",
+                                                     device_name,
+                                                     NULL,
+                                                     /* attributes */
+                                                     "idVendor",
+                                                     vendor,
+                                                     "idProduct",
+                                                     product,
+                                                     "bDeviceClass",
+                                                     "00",
+                                                     NULL,
+                                                     /* properties */
+                                                     "DEVTYPE",
+                                                     "usb_device",
+                                                     NULL);
+
+                for (guint j = 0; j < SYNTHETIC_USB_INTERFACES; j++) {
+                        g_autofree gchar *interface_name = NULL;
+                        g_autofree gchar *modalias = NULL;
+
+                        interface_name = g_strdup_printf("%s:1.%u", device_name, j);
+                        modalias = g_strdup_printf("usb:v%04Xp%04Xd0100dc00dsc00dp00"
+                                                   "ic03isc01ip01in%02X",
+                                                   vendor_id,
+                                                   i,
+                                                   j);
+
+                        g_free(umockdev_testbed_add_device(bed,
+                                                           "usb",
+                                                           interface_name,
+                                                           device,
+                                                           /* attributes */
+                                                           "bInterfaceClass",
+                                                           "03",
+                                                           "modalias",
+                                                           modalias,
+                                                           NULL,
+                                                           /* properties */
+                                                           "DEVTYPE",
+                                                           "usb_interface",
+                                                           NULL));
+                }
+        }
+
+        bench_tree("synthetic-usb-10k", 2);
+}
+
+/**
+ * bench_synthetic_pci:
+ *
+ * A large PCI topology, mostly network functions with a few GPUs
+ */
+static void bench_synthetic_pci(void)
+{
+        autofree(UMockdevTestbed) *bed = NULL;
+
+        bed = umockdev_testbed_new();
+
+        for (guint i = 0; i < SYNTHETIC_PCI_FUNCTIONS; i++) {
+                g_autofree gchar *name = NULL;
+                g_autofree gchar *modalias = NULL;
+                gboolean gpu = i % 50 == 0;
+                guint vendor = gpu ? 0x10de : 0x8086;
+                guint device_id = gpu ? 0x1c60 : 0x1500 + (i % 64);
+                guint class = gpu ? 0x030000 : 0x020000;
+                g_autofree gchar *vendor_attr = NULL;
+                g_autofree gchar *device_attr = NULL;
+                g_autofree gchar *class_attr = NULL;
+
+                name = g_strdup_printf("0000:%02x:%02x.%u", 1 + i / 64, (i / 8) % 8, i % 8);
+                vendor_attr = g_strdup_printf("0x%04x", vendor);
+                device_attr = g_strdup_printf("0x%04x", device_id);
+                class_attr = g_strdup_printf("0x%06x", class);
+                modalias = g_strdup_printf("pci:v%08Xd%08Xsv%08Xsd%08Xbc%02Xsc%02Xi00",
+                                           vendor,
+                                           device_id,
+                                           0x1558,
+                                           0x65a4,
+                                           class >> 16,
+                                           (class >> 8) & 0xff);
+
+                g_free(umockdev_testbed_add_device(bed,
+                                                   "pci",
+                                                   name,
+                                                   NULL,
+                                                   /* attributes */
+                                                   "class",
+                                                   class_attr,
+                                                   "vendor",
+                                                   vendor_attr,
+                                                   "device",
+                                                   device_attr,
+                                                   "boot_vga",
+                                                   i == 0 ? "1" : "0",
+                                                   "modalias",
+                                                   modalias,
+                                                   NULL,
+                                                   /* properties */
+                                                   "PCI_CLASS",
+                                                   class_attr + 2,
+                                                   NULL));
+        }
+
+        bench_tree("synthetic-pci-500", 20);
+}
+
+/**
+ * bench_modaliases:
+ *
+ * Time loading each of the test modalias files, text and precompiled
+ */
+static void bench_modaliases(void)
+{
+        static const gchar *directories[] = {
+                TEST_DATA_ROOT,
+                TEST_DATA_ROOT "/binary",
+        };
+
+        for (size_t i = 0; i < G_N_ELEMENTS(directories); i++) {
+                g_autoptr(GDir) dir = NULL;
+                const gchar *name = NULL;
+
+                dir = g_dir_open(directories[i], 0, NULL);
+                if (!dir) {
+                        continue;
+                }
+
+                while ((name = g_dir_read_name(dir)) != NULL) {
+                        g_autofree gchar *path = NULL;
+                        g_autofree gchar *label = NULL;
+
+                        if (!g_str_has_suffix(name, ".modaliases")) {
+                                continue;
+                        }
+
+                        path = g_build_filename(directories[i], name, NULL);
+                        label = g_strdup_printf("modalias-load/%s%s",
+                                                i == 0 ? "" : "binary/",
+                                                name);
+                        bench_run(label, 200, bench_load_modalias, path);
+                }
+        }
+}
+
+int main(int argc, char **argv)
+{
+        const gchar *scale = NULL;
+
+        if (argc > 1) {
+                bench_filter = argv[1];
+        }
+
+        scale = g_getenv("LDM_BENCH_SCALE");
+        if (scale) {
+                bench_scale = g_ascii_strtod(scale, NULL);
+                if (bench_scale <= 0.0) {
+                        bench_scale = 1.0;
+                }
+        }
+
+        printf("%-56s %8s %14s %12s\n", "benchmark", "ops", "ns/op", "allocs/op");
+
+        bench_modaliases();
+        bench_recordings();
+        bench_synthetic_pci();
+        bench_synthetic_usb();
+
+        return EXIT_SUCCESS;
+}
+
+/*
+ * Editor modelines  -  https://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: nil
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 expandtab:
+ * :indentSize=8:tabSize=8:noTabs=true:
+ */
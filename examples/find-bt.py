@@ -32,17 +32,20 @@ def main():
     manager = Ldm.Manager()
     manager.add_plugin(BluezPlugin())
 
-    # An alternative is just to see if the len(devices) is not empty.
-    devices = manager.get_devices(Ldm.DeviceType.BLUETOOTH)
-    providerset = [manager.get_providers(x) for x in devices if x.has_attribute(Ldm.DeviceAttribute.HOST)]
-    for providers in providerset:
-        device = providers[0].get_device()
-        for provider in providers:
-            print("Provider for {} ({} {}): {}".format(
-                device.get_path(),
-                device.get_vendor(),
-                device.get_name(),
-                provider.get_package()))
+    # Fetch every record in one call each, rather than walking the objects.
+    # An alternative is just to see if the list of devices is not empty.
+    hosts = {}
+    for record in manager.describe_devices(Ldm.DeviceType.BLUETOOTH).unpack():
+        path, name, vendor = record[0:3]
+        attributes = record[8]
+        if attributes & Ldm.DeviceAttribute.HOST:
+            hosts[path] = (vendor, name)
+
+    for (path, plugin, package, driver) in manager.describe_providers(Ldm.DeviceType.BLUETOOTH).unpack():
+        if path not in hosts:
+            continue
+        vendor, name = hosts[path]
+        print("Provider for {} ({} {}): {}".format(path, vendor, name, package))
 
 if __name__ == "__main__":
     main()
@@ -44,18 +44,25 @@ def main():
     manager = Ldm.Manager()
     manager.add_plugin(PretendyPlugin())
 
-    for device in manager.get_devices(Ldm.DeviceType.USB):
-        # Use gobject properties or methods
-        print("USB Device: {} {}".format(
-              device.props.vendor,
-              device.get_name()))
+    # Describe the devices and providers in bulk, crossing into the library
+    # once per query rather than once per device and again for each field.
+    # Each record is a plain tuple, see LDM_MANAGER_DEVICES_FORMAT
+    devices = manager.describe_devices(Ldm.DeviceType.USB).unpack()
+    hid = set(record[0] for record in manager.describe_devices(Ldm.DeviceType.HID).unpack())
 
-        if device.has_type(Ldm.DeviceType.HID):
+    packages = {}
+    for (path, plugin, package, driver) in manager.describe_providers(Ldm.DeviceType.USB).unpack():
+        packages.setdefault(path, []).append(package)
+
+    for record in devices:
+        path, name, vendor = record[0:3]
+        print("USB Device: {} {}".format(vendor, name))
+
+        if path in hid:
             print("\tHID Device!")
 
-        for provider in manager.get_providers(device):
-            plugin = provider.get_plugin()
-            print("\tSuggested package: {}".format(provider.get_package()))
+        for package in packages.get(path, []):
+            print("\tSuggested package: {}".format(package))
 
 if __name__ == "__main__":
     main()
@@ -17,6 +17,7 @@
 typedef int (*ldm_cli_command)(int argc, char **argv);
 
 int ldm_cli_configure(int argc, char **argv);
+int ldm_cli_snapshot(int argc, char **argv);
 int ldm_cli_status(int argc, char **argv);
 int ldm_cli_version(int argc, char **argv);
 
@@ -33,7 +33,7 @@ static GOptionEntry cli_entries[] = {
 
 static void print_usage(const char *progname)
 {
-        fprintf(stderr, "%s usage: [status]\n", progname);
+        fprintf(stderr, "%s usage: [status|snapshot]\n", progname);
         fprintf(stderr, "Run '%s --help' for further information\n", progname);
 }
 
@@ -47,12 +47,15 @@ int main(int argc, char **argv)
 
         opt_context = g_option_context_new(NULL);
         g_option_context_add_main_entries(opt_context, cli_entries, "linux-driver-management");
+        /* Leave any options following the subcommand to the subcommand */
+        g_option_context_set_strict_posix(opt_context, TRUE);
         g_option_context_set_summary(opt_context,
                                      "Interface with the linux-driver-management library");
         g_option_context_set_description(opt_context,
                                          "This tool accepts a number of subcommands:\n\
 \n\
         configure   - Attempt configuration of a subsystem\n\
+        snapshot    - Write the detected devices to a snapshot file\n\
         status      - Emit the status for known, detected devices\n\
         version     - Print the version and quit\n\
 ");
@@ -78,6 +81,8 @@ int main(int argc, char **argv)
 
         if (g_str_equal(opt_strings[0], "status")) {
                 command = &ldm_cli_status;
+        } else if (g_str_equal(opt_strings[0], "snapshot")) {
+                command = &ldm_cli_snapshot;
         } else if (g_str_equal(opt_strings[0], "configure")) {
                 command = &ldm_cli_configure;
         } else if (g_str_equal(opt_strings[0], "version")) {
@@ -0,0 +1,56 @@
+/*
+ * This file is part of linux-driver-management.
+ *
+ * Copyright © 2016-2018 Ikey Doherty
+ *
+ * linux-driver-management is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+#include "cli.h"
+#include "config.h"
+#include "ldm.h"
+#include "util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+int ldm_cli_snapshot(int argc, char **argv)
+{
+        g_autoptr(LdmManager) manager = NULL;
+        g_autoptr(GError) error = NULL;
+
+        if (argc != 2) {
+                fprintf(stderr, "Usage: %s snapshot FILE\n", g_get_prgname());
+                return EXIT_FAILURE;
+        }
+
+        /* Always enumerate afresh, a stored snapshot may predate the hardware */
+        manager = ldm_manager_new(LDM_MANAGER_FLAGS_NO_MONITOR);
+        if (!manager) {
+                fprintf(stderr, "Failed to initialiase LdmManager\n");
+                return EXIT_FAILURE;
+        }
+
+        if (!ldm_manager_export_snapshot(manager, argv[1], &error)) {
+                fprintf(stderr, "Failed to write snapshot: %s\n", error->message);
+                return EXIT_FAILURE;
+        }
+
+        return EXIT_SUCCESS;
+}
+
+/*
+ * Editor modelines  -  https://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: nil
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 expandtab:
+ * :indentSize=8:tabSize=8:noTabs=true:
+ */
@@ -11,94 +11,205 @@
 
 #include "cli.h"
 #include "config.h"
+#include "ldm-dbus.h"
 #include "ldm.h"
 #include "util.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 
-static void print_drivers(LdmManager *manager, LdmDevice *device)
+static gboolean opt_timings = FALSE;
+static gboolean opt_json = FALSE;
+static gchar *opt_format = NULL;
+
+static GOptionEntry status_entries[] = {
+        { "timings", 't', 0, G_OPTION_ARG_NONE, &opt_timings, "Print library timings", NULL },
+        { "json", 'j', 0, G_OPTION_ARG_NONE, &opt_json, "Shorthand for --format=json", NULL },
+        { "format",
+          'f',
+          0,
+          G_OPTION_ARG_STRING,
+          &opt_format,
+          "Output format: text, json or tsv",
+          "FORMAT" },
+        { 0 },
+};
+
+/**
+ * Output formats for the status command
+ */
+typedef enum {
+        STATUS_FORMAT_TEXT = 0,
+        STATUS_FORMAT_JSON,
+        STATUS_FORMAT_TSV,
+} StatusFormat;
+
+/**
+ * A device record as produced by ldm_dbus_build_devices, whether it came
+ * from ldm-daemon or our own manager.
+ */
+typedef struct {
+        const gchar *path;
+        const gchar *name;
+        const gchar *vendor;
+        const gchar *xorg_id;
+        guint32 types;
+        guint32 vendor_id;
+        guint32 product_id;
+        guint32 attributes;
+        const gchar **providers;
+        gint32 numa_node;
+        const gchar *local_cpulist;
+        guint32 link_width;
+        guint32 link_speed;
+        guint32 max_link_width;
+        guint32 max_link_speed;
+} StatusDevice;
+
+static void status_device_free(StatusDevice *device)
 {
-        g_autoptr(GPtrArray) providers = NULL;
+        g_free(device->providers);
+        g_free(device);
+}
 
+static StatusDevice *status_device_new(GVariant *record)
+{
+        StatusDevice *ret = g_new0(StatusDevice, 1);
+        g_autoptr(GVariant) providers = NULL;
+
+        /* Strings are borrowed from the record, which outlives us */
+        g_variant_get(record,
+                      "(&s&s&s&suuuu@as(i&suuuu))",
+                      &ret->path,
+                      &ret->name,
+                      &ret->vendor,
+                      &ret->xorg_id,
+                      &ret->types,
+                      &ret->vendor_id,
+                      &ret->product_id,
+                      &ret->attributes,
+                      &providers,
+                      &ret->numa_node,
+                      &ret->local_cpulist,
+                      &ret->link_width,
+                      &ret->link_speed,
+                      &ret->max_link_width,
+                      &ret->max_link_speed);
+        ret->providers = g_variant_get_strv(providers, NULL);
+
+        return ret;
+}
+
+static inline gboolean status_device_has_type(StatusDevice *device, LdmDeviceType mask)
+{
+        return (device->types & mask) == mask;
+}
+
+static void print_drivers(StatusDevice *device)
+{
         /* Look for provider options */
-        providers = ldm_manager_get_providers(manager, device);
-        if (providers->len < 1) {
+        if (!device || !device->providers[0]) {
                 return;
         }
 
         fprintf(stdout,
-                "\nLDM Providers for %s: %d\n",
-                ldm_device_get_name(device),
-                providers->len);
-
-        for (guint i = 0; i < providers->len; i++) {
-                LdmProvider *provider = providers->pdata[i];
-                const gchar *name = NULL;
+                "\nLDM Providers for %s: %u\n",
+                device->name,
+                g_strv_length((gchar **)device->providers));
 
-                name = ldm_provider_get_package(provider);
-                fprintf(stdout, " -  %s\n", name);
+        for (guint i = 0; device->providers[i]; i++) {
+                fprintf(stdout, " -  %s\n", device->providers[i]);
         }
 }
 /**
  * Handle pretty printing of a single device to the display
  */
-static void print_device(LdmDevice *device)
+static void print_device(StatusDevice *device)
 {
+        g_autoptr(GPtrArray) lines = NULL;
         gboolean gpu = FALSE;
-        /* PCI specific */
-        guint bus = 0, dev = 0;
-        gint func = 0;
 
-        gpu = ldm_device_has_type(device, LDM_DEVICE_TYPE_GPU);
+        gpu = status_device_has_type(device, LDM_DEVICE_TYPE_GPU);
+        lines = g_ptr_array_new_with_free_func(g_free);
 
         /* Pretty strings */
-        fprintf(stdout, " \u255E Device Name   : %s\n", ldm_device_get_name(device));
-        fprintf(stdout, " \u255E Manufacturer  : %s\n", ldm_device_get_vendor(device));
+        g_ptr_array_add(lines, g_strdup_printf("Device Name   : %s", device->name));
+        g_ptr_array_add(lines, g_strdup_printf("Manufacturer  : %s", device->vendor));
 
         /* Ids */
-        fprintf(stdout, " \u255E Product ID    : 0x%04x\n", ldm_device_get_product_id(device));
-        fprintf(stdout,
-                " %s Vendor ID     : 0x%04x\n",
-                gpu ? "\u255E" : "\u2558",
-                ldm_device_get_vendor_id(device));
+        g_ptr_array_add(lines, g_strdup_printf("Product ID    : 0x%04x", device->product_id));
+        g_ptr_array_add(lines, g_strdup_printf("Vendor ID     : 0x%04x", device->vendor_id));
 
-        if (!gpu) {
-                return;
+        /* Locality, for those placing work near the device */
+        if (device->numa_node >= 0) {
+                g_ptr_array_add(lines, g_strdup_printf("NUMA Node     : %d", device->numa_node));
+        }
+        if (*device->local_cpulist) {
+                g_ptr_array_add(lines,
+                                g_strdup_printf("Local CPUs    : %s", device->local_cpulist));
+        }
+        if (device->link_width > 0) {
+                g_ptr_array_add(lines,
+                                g_strdup_printf("PCIe Link     : x%u @ %.1f GT/s "
+                                                "(max x%u @ %.1f GT/s)",
+                                                device->link_width,
+                                                device->link_speed / 1000.0,
+                                                device->max_link_width,
+                                                device->max_link_speed / 1000.0));
         }
 
-        if (ldm_device_has_type(device, LDM_DEVICE_TYPE_PCI)) {
-                LdmPCIDevice *pci = LDM_PCI_DEVICE(device);
-                ldm_pci_device_get_address(pci, &bus, &dev, &func);
-                /* X.Org Address is decimal, not hex */
-                fprintf(stdout, " \u255E X.Org PCI ID  : PCI:%u:%u:%d\n", bus, dev, func);
+        if (gpu) {
+                if (*device->xorg_id) {
+                        g_ptr_array_add(lines,
+                                        g_strdup_printf("X.Org PCI ID  : %s", device->xorg_id));
+                }
+
+                /* GPU Specifics */
+                g_ptr_array_add(lines,
+                                g_strdup_printf("Boot VGA      : %s",
+                                                (device->attributes &
+                                                 LDM_DEVICE_ATTRIBUTE_BOOT_VGA)
+                                                    ? "yes"
+                                                    : "no"));
         }
 
-        /* GPU Specifics */
-        fprintf(stdout,
-                " \u2558 Boot VGA      : %s\n",
-                ldm_device_has_attribute(device, LDM_DEVICE_ATTRIBUTE_BOOT_VGA) ? "yes" : "no");
+        for (guint i = 0; i < lines->len; i++) {
+                fprintf(stdout,
+                        " %s %s\n",
+                        i + 1 < lines->len ? "\u255E" : "\u2558",
+                        (const gchar *)lines->pdata[i]);
+        }
 }
 
 /**
  * Handle pretty printing of the GPU configuration to the display
  */
-static void print_gpu_config(LdmManager *manager, LdmGPUConfig *config)
+static void print_gpu_config(GHashTable *devices, GVariant *config)
 {
-        LdmDevice *primary = NULL, *secondary = NULL;
-
-        primary = ldm_gpu_config_get_primary_device(config);
-        secondary = ldm_gpu_config_get_secondary_device(config);
-
-        if (ldm_gpu_config_has_type(config, LDM_GPU_TYPE_OPTIMUS)) {
+        StatusDevice *primary = NULL, *secondary = NULL, *detection = NULL;
+        const gchar *primary_path = NULL, *secondary_path = NULL, *detection_path = NULL;
+        guint32 gpu_type = 0;
+
+        /* Missing devices are sent as an empty path, which we'll never find */
+        g_variant_get(config,
+                      "(u&s&s&s)",
+                      &gpu_type,
+                      &primary_path,
+                      &secondary_path,
+                      &detection_path);
+        primary = g_hash_table_lookup(devices, primary_path);
+        secondary = g_hash_table_lookup(devices, secondary_path);
+        detection = g_hash_table_lookup(devices, detection_path);
+
+        if ((gpu_type & LDM_GPU_TYPE_OPTIMUS) == LDM_GPU_TYPE_OPTIMUS) {
                 fputs("\nNVIDIA Optimus\n", stdout);
-        } else if (ldm_gpu_config_has_type(config, LDM_GPU_TYPE_HYBRID)) {
+        } else if ((gpu_type & LDM_GPU_TYPE_HYBRID) == LDM_GPU_TYPE_HYBRID) {
                 fputs("\nHybrid Graphics\n", stdout);
-        } else if (ldm_gpu_config_has_type(config, LDM_GPU_TYPE_CROSSFIRE)) {
+        } else if ((gpu_type & LDM_GPU_TYPE_CROSSFIRE) == LDM_GPU_TYPE_CROSSFIRE) {
                 fputs("\nAMD Crossfire\n", stdout);
-        } else if (ldm_gpu_config_has_type(config, LDM_GPU_TYPE_SLI)) {
+        } else if ((gpu_type & LDM_GPU_TYPE_SLI) == LDM_GPU_TYPE_SLI) {
                 fputs("\nNVIDIA SLI\n", stdout);
-        } else if (ldm_gpu_config_has_type(config, LDM_GPU_TYPE_COMPOSITE)) {
+        } else if ((gpu_type & LDM_GPU_TYPE_COMPOSITE) == LDM_GPU_TYPE_COMPOSITE) {
                 fputs("\nComposite GPU\n", stdout);
         } else {
                 fputs("\nSimple GPU configuration\n", stdout);
@@ -106,10 +217,14 @@ static void print_gpu_config(LdmManager *manager, LdmGPUConfig *config)
 
         fputs("\n", stdout);
 
+        if (!primary) {
+                return;
+        }
+
         /* We're only concerned with primary vs secondary devices */
         fprintf(stdout,
                 " \u2552 Primary GPU%s\n",
-                ldm_gpu_config_has_type(config, LDM_GPU_TYPE_HYBRID) ? " (iGPU)" : "");
+                (gpu_type & LDM_GPU_TYPE_HYBRID) == LDM_GPU_TYPE_HYBRID ? " (iGPU)" : "");
         print_device(primary);
 
         if (!secondary) {
@@ -118,69 +233,67 @@ static void print_gpu_config(LdmManager *manager, LdmGPUConfig *config)
 
         fprintf(stdout,
                 "\n \u2552 Secondary GPU%s\n",
-                ldm_gpu_config_has_type(config, LDM_GPU_TYPE_HYBRID) ? " (dGPU)" : "");
+                (gpu_type & LDM_GPU_TYPE_HYBRID) == LDM_GPU_TYPE_HYBRID ? " (dGPU)" : "");
 
         print_device(secondary);
 
 emit_gpu_drivers:
 
         /* Only emit the drivers for the primary detection device */
-        print_drivers(manager, ldm_gpu_config_get_detection_device(config));
+        print_drivers(detection);
 }
 
 /**
  * Handle pretty printing of the core DMI platform device.
  */
-static void print_platform_device(LdmDevice *device)
+static void print_platform_device(StatusDevice *device)
 {
         fprintf(stdout, " \u2552 %s\n", "Hardware Platform");
-        fprintf(stdout, " \u255E %s : %s\n", "Platform Vendor", ldm_device_get_vendor(device));
-        fprintf(stdout, " \u2558 %s  : %s\n", "Platform Model", ldm_device_get_name(device));
+        fprintf(stdout, " \u255E %s : %s\n", "Platform Vendor", device->vendor);
+        fprintf(stdout, " \u2558 %s  : %s\n", "Platform Model", device->name);
         /* TODO: Add chassis */
 }
 
 /**
  * Handle pretty printing of the remaining devices.
  */
-static void print_non_gpu(LdmManager *manager, LdmDevice *device)
+static void print_non_gpu(StatusDevice *device)
 {
         const gchar *device_title = NULL;
-        g_autoptr(GPtrArray) providers = NULL;
 
         /* We've already handled GPU devices in a special fashion */
-        if (ldm_device_has_type(device, LDM_DEVICE_TYPE_GPU)) {
+        if (status_device_has_type(device, LDM_DEVICE_TYPE_GPU)) {
                 return;
         }
 
-        if (ldm_device_has_type(device, LDM_DEVICE_TYPE_PLATFORM)) {
+        if (status_device_has_type(device, LDM_DEVICE_TYPE_PLATFORM)) {
                 print_platform_device(device);
                 return;
         }
 
         /* Only emit actionable items here */
-        providers = ldm_manager_get_providers(manager, device);
-        if (providers->len < 1) {
+        if (!device->providers[0]) {
                 return;
         }
 
         /* Try to ascertain the primary role */
-        if (ldm_device_has_type(device, LDM_DEVICE_TYPE_AUDIO)) {
+        if (status_device_has_type(device, LDM_DEVICE_TYPE_AUDIO)) {
                 device_title = "Audio Device";
-        } else if (ldm_device_has_type(device, LDM_DEVICE_TYPE_HID)) {
+        } else if (status_device_has_type(device, LDM_DEVICE_TYPE_HID)) {
                 device_title = "HID Device";
-        } else if (ldm_device_has_type(device, LDM_DEVICE_TYPE_IMAGE)) {
+        } else if (status_device_has_type(device, LDM_DEVICE_TYPE_IMAGE)) {
                 device_title = "Image Device";
-        } else if (ldm_device_has_type(device, LDM_DEVICE_TYPE_PRINTER)) {
+        } else if (status_device_has_type(device, LDM_DEVICE_TYPE_PRINTER)) {
                 device_title = "Printer";
-        } else if (ldm_device_has_type(device, LDM_DEVICE_TYPE_STORAGE)) {
+        } else if (status_device_has_type(device, LDM_DEVICE_TYPE_STORAGE)) {
                 device_title = "Storage Device";
-        } else if (ldm_device_has_type(device, LDM_DEVICE_TYPE_VIDEO)) {
+        } else if (status_device_has_type(device, LDM_DEVICE_TYPE_VIDEO)) {
                 device_title = "Video Device";
-        } else if (ldm_device_has_type(device, LDM_DEVICE_TYPE_WIRELESS)) {
+        } else if (status_device_has_type(device, LDM_DEVICE_TYPE_WIRELESS)) {
                 device_title = "Wireless Device";
-        } else if (ldm_device_has_type(device, LDM_DEVICE_TYPE_PCI)) {
+        } else if (status_device_has_type(device, LDM_DEVICE_TYPE_PCI)) {
                 device_title = "PCI Device";
-        } else if (ldm_device_has_type(device, LDM_DEVICE_TYPE_USB)) {
+        } else if (status_device_has_type(device, LDM_DEVICE_TYPE_USB)) {
                 device_title = "USB Device";
         } else {
                 device_title = "Device";
@@ -189,25 +302,361 @@ static void print_non_gpu(LdmManager *manager, LdmDevice *device)
         fprintf(stdout, " \u2552 %s\n", device_title);
         print_device(device);
 
-        for (guint i = 0; i < providers->len; i++) {
-                LdmProvider *provider = providers->pdata[i];
-                fprintf(stdout,
-                        "  \u2558 Provider %02u  : %s\n",
-                        i + 1,
-                        ldm_provider_get_package(provider));
+        for (guint i = 0; device->providers[i]; i++) {
+                fprintf(stdout, "  \u2558 Provider %02u  : %s\n", i + 1, device->providers[i]);
         }
 
         fputs("\n", stdout);
 }
 
-int ldm_cli_status(__ldm_unused__ int argc, __ldm_unused__ char **argv)
+/**
+ * Handle pretty printing of the library instrumentation
+ */
+static void print_timings(LdmManager *manager)
+{
+        LdmManagerStats stats = { 0 };
+
+        fprintf(stdout, "\n \u2552 %s\n", "Timings");
+        if (!ldm_manager_get_stats(manager, &stats)) {
+                fprintf(stdout, " \u2558 %s\n", "Not available, built without instrumentation");
+                return;
+        }
+
+        fprintf(stdout, " \u255E Enumerate     : %.3f ms\n", (gdouble)stats.enumerate_time / 1e6);
+        fprintf(stdout, " \u255E Load          : %.3f ms\n", (gdouble)stats.load_time / 1e6);
+        fprintf(stdout, " \u255E Match         : %.3f ms\n", (gdouble)stats.match_time / 1e6);
+        fprintf(stdout, " \u255E Apply         : %.3f ms\n", (gdouble)stats.apply_time / 1e6);
+        fprintf(stdout,
+                " \u255E Devices       : %" G_GUINT64_FORMAT "\n",
+                stats.devices_constructed);
+        fprintf(stdout, " \u255E Plugin calls  : %" G_GUINT64_FORMAT "\n", stats.plugins_evaluated);
+        fprintf(stdout, " \u255E fnmatch calls : %" G_GUINT64_FORMAT "\n", stats.fnmatch_calls);
+        fprintf(stdout, " \u2558 Bytes read    : %" G_GUINT64_FORMAT "\n", stats.bytes_read);
+}
+
+/**
+ * Append @str as a JSON string literal, or null
+ */
+static void json_append_string(GString *out, const gchar *str)
+{
+        if (!str) {
+                g_string_append(out, "null");
+                return;
+        }
+
+        g_string_append_c(out, '"');
+        for (const gchar *c = str; *c; c++) {
+                switch (*c) {
+                case '"':
+                        g_string_append(out, "\\\"");
+                        break;
+                case '\\':
+                        g_string_append(out, "\\\\");
+                        break;
+                case '\n':
+                        g_string_append(out, "\\n");
+                        break;
+                case '\t':
+                        g_string_append(out, "\\t");
+                        break;
+                default:
+                        if ((guchar)*c < 0x20) {
+                                g_string_append_printf(out, "\\u%04x", (guint)(guchar)*c);
+                        } else {
+                                g_string_append_c(out, *c);
+                        }
+                        break;
+                }
+        }
+        g_string_append_c(out, '"');
+}
+
+/**
+ * Append @str as a single TSV field, so that our own separators survive
+ */
+static void tsv_append_string(GString *out, const gchar *str)
+{
+        for (const gchar *c = str; c && *c; c++) {
+                g_string_append_c(out, (*c == '\t' || *c == '\n') ? ' ' : *c);
+        }
+}
+
+/**
+ * Append the nick of every flag in @value, such as "gpu" or "pci", either
+ * as a JSON array or a comma separated TSV field.
+ */
+static void append_flags(GString *out, GType type, guint value, StatusFormat format)
+{
+        GFlagsClass *klass = g_type_class_ref(type);
+        gboolean first = TRUE;
+
+        if (format == STATUS_FORMAT_JSON) {
+                g_string_append_c(out, '[');
+        }
+
+        for (guint i = 0; i < klass->n_values; i++) {
+                GFlagsValue *flag = &klass->values[i];
+
+                if (flag->value == 0 || (value & flag->value) != flag->value) {
+                        continue;
+                }
+
+                if (!first) {
+                        g_string_append_c(out, ',');
+                }
+                first = FALSE;
+
+                if (format == STATUS_FORMAT_JSON) {
+                        json_append_string(out, flag->value_nick);
+                } else {
+                        g_string_append(out, flag->value_nick);
+                }
+        }
+
+        if (format == STATUS_FORMAT_JSON) {
+                g_string_append_c(out, ']');
+        }
+
+        g_type_class_unref(klass);
+}
+
+/**
+ * Write every device, then the GPU configuration, as a single JSON object
+ */
+static void write_json(GString *out, GPtrArray *devices, GVariant *config)
+{
+        const gchar *primary = NULL, *secondary = NULL, *detection = NULL;
+        guint32 gpu_type = 0;
+
+        g_string_append(out, "{\"devices\":[");
+        for (guint i = 0; i < devices->len; i++) {
+                StatusDevice *device = devices->pdata[i];
+
+                g_string_append(out, i > 0 ? ",{\"path\":" : "{\"path\":");
+                json_append_string(out, device->path);
+                g_string_append(out, ",\"name\":");
+                json_append_string(out, device->name);
+                g_string_append(out, ",\"vendor\":");
+                json_append_string(out, device->vendor);
+                g_string_append_printf(out,
+                                       ",\"vendor_id\":%u,\"product_id\":%u,\"xorg_id\":",
+                                       device->vendor_id,
+                                       device->product_id);
+                json_append_string(out, *device->xorg_id ? device->xorg_id : NULL);
+                g_string_append(out, ",\"types\":");
+                append_flags(out, LDM_TYPE_DEVICE_TYPE, device->types, STATUS_FORMAT_JSON);
+                g_string_append(out, ",\"attributes\":");
+                append_flags(out,
+                             LDM_TYPE_DEVICE_ATTRIBUTE,
+                             device->attributes,
+                             STATUS_FORMAT_JSON);
+                g_string_append(out, ",\"locality\":");
+                if (status_device_has_type(device, LDM_DEVICE_TYPE_PCI)) {
+                        g_string_append_printf(out,
+                                               "{\"numa_node\":%d,\"local_cpulist\":",
+                                               device->numa_node);
+                        json_append_string(out,
+                                           *device->local_cpulist ? device->local_cpulist : NULL);
+                        g_string_append_printf(out,
+                                               ",\"link_width\":%u,\"link_speed\":%u"
+                                               ",\"max_link_width\":%u,\"max_link_speed\":%u}",
+                                               device->link_width,
+                                               device->link_speed,
+                                               device->max_link_width,
+                                               device->max_link_speed);
+                } else {
+                        g_string_append(out, "null");
+                }
+                g_string_append(out, ",\"providers\":[");
+                for (guint j = 0; device->providers[j]; j++) {
+                        if (j > 0) {
+                                g_string_append_c(out, ',');
+                        }
+                        json_append_string(out, device->providers[j]);
+                }
+                g_string_append(out, "]}");
+        }
+
+        g_variant_get(config, "(u&s&s&s)", &gpu_type, &primary, &secondary, &detection);
+        g_string_append(out, "],\"gpu\":{\"types\":");
+        append_flags(out, LDM_TYPE_GPU_TYPE, gpu_type, STATUS_FORMAT_JSON);
+        g_string_append(out, ",\"primary\":");
+        json_append_string(out, *primary ? primary : NULL);
+        g_string_append(out, ",\"secondary\":");
+        json_append_string(out, *secondary ? secondary : NULL);
+        g_string_append(out, ",\"detection\":");
+        json_append_string(out, *detection ? detection : NULL);
+        g_string_append_c(out, '}');
+}
+
+/**
+ * Write one line per device, then one for the GPU configuration, each with
+ * a leading record type. List fields are comma separated.
+ */
+static void write_tsv(GString *out, GPtrArray *devices, GVariant *config)
+{
+        const gchar *primary = NULL, *secondary = NULL, *detection = NULL;
+        guint32 gpu_type = 0;
+
+        for (guint i = 0; i < devices->len; i++) {
+                StatusDevice *device = devices->pdata[i];
+
+                g_string_append(out, "device\t");
+                tsv_append_string(out, device->path);
+                g_string_append_c(out, '\t');
+                tsv_append_string(out, device->name);
+                g_string_append_c(out, '\t');
+                tsv_append_string(out, device->vendor);
+                g_string_append_printf(out,
+                                       "\t0x%04x\t0x%04x\t%s\t",
+                                       device->vendor_id,
+                                       device->product_id,
+                                       device->xorg_id);
+                append_flags(out, LDM_TYPE_DEVICE_TYPE, device->types, STATUS_FORMAT_TSV);
+                g_string_append_c(out, '\t');
+                append_flags(out,
+                             LDM_TYPE_DEVICE_ATTRIBUTE,
+                             device->attributes,
+                             STATUS_FORMAT_TSV);
+                g_string_append_c(out, '\t');
+                for (guint j = 0; device->providers[j]; j++) {
+                        if (j > 0) {
+                                g_string_append_c(out, ',');
+                        }
+                        tsv_append_string(out, device->providers[j]);
+                }
+                g_string_append_printf(out, "\t%d\t", device->numa_node);
+                tsv_append_string(out, device->local_cpulist);
+                g_string_append_printf(out,
+                                       "\t%u\t%u\t%u\t%u\n",
+                                       device->link_width,
+                                       device->link_speed,
+                                       device->max_link_width,
+                                       device->max_link_speed);
+        }
+
+        g_variant_get(config, "(u&s&s&s)", &gpu_type, &primary, &secondary, &detection);
+        g_string_append(out, "gpu\t");
+        append_flags(out, LDM_TYPE_GPU_TYPE, gpu_type, STATUS_FORMAT_TSV);
+        g_string_append_printf(out, "\t%s\t%s\t%s\n", primary, secondary, detection);
+}
+
+/**
+ * Append the library instrumentation to the machine readable output, with
+ * times in nanoseconds.
+ */
+static void write_timings(GString *out, LdmManager *manager, StatusFormat format)
+{
+        LdmManagerStats stats = { 0 };
+        gboolean available = ldm_manager_get_stats(manager, &stats);
+        const struct {
+                const gchar *name;
+                guint64 value;
+        } fields[] = {
+                { "enumerate_time", stats.enumerate_time },
+                { "load_time", stats.load_time },
+                { "match_time", stats.match_time },
+                { "apply_time", stats.apply_time },
+                { "devices_constructed", stats.devices_constructed },
+                { "plugins_evaluated", stats.plugins_evaluated },
+                { "fnmatch_calls", stats.fnmatch_calls },
+                { "bytes_read", stats.bytes_read },
+        };
+
+        if (format == STATUS_FORMAT_JSON) {
+                g_string_append(out, ",\"timings\":");
+                if (!available) {
+                        g_string_append(out, "null");
+                        return;
+                }
+        }
+
+        for (gsize i = 0; available && i < G_N_ELEMENTS(fields); i++) {
+                if (format == STATUS_FORMAT_JSON) {
+                        g_string_append_printf(out,
+                                               "%s\"%s\":%" G_GUINT64_FORMAT,
+                                               i > 0 ? "," : "{",
+                                               fields[i].name,
+                                               fields[i].value);
+                } else {
+                        g_string_append_printf(out,
+                                               "timing\t%s\t%" G_GUINT64_FORMAT "\n",
+                                               fields[i].name,
+                                               fields[i].value);
+                }
+        }
+
+        if (format == STATUS_FORMAT_JSON) {
+                g_string_append_c(out, '}');
+        }
+}
+
+/**
+ * Ask a running ldm-daemon for the device and GPU records, which saves
+ * enumerating and loading every modalias file ourselves.
+ */
+static gboolean status_query_daemon(GVariant **devices, GVariant **config)
+{
+        g_autoptr(GVariant) devices_reply = NULL;
+        g_autoptr(GVariant) config_reply = NULL;
+
+        devices_reply = ldm_dbus_call("GetDevices",
+                                      g_variant_new("(u)", (guint32)LDM_DEVICE_TYPE_ANY),
+                                      G_VARIANT_TYPE("(" LDM_DBUS_DEVICES_TYPE ")"));
+        if (!devices_reply) {
+                return FALSE;
+        }
+
+        config_reply = ldm_dbus_call("GetGPUConfig",
+                                     NULL,
+                                     G_VARIANT_TYPE("(" LDM_DBUS_GPU_CONFIG_TYPE ")"));
+        if (!config_reply) {
+                return FALSE;
+        }
+
+        *devices = g_variant_get_child_value(devices_reply, 0);
+        *config = g_variant_get_child_value(config_reply, 0);
+        return TRUE;
+}
+
+int ldm_cli_status(__ldm_unused__ int argc, char **argv)
 {
         g_autoptr(LdmManager) manager = NULL;
         g_autoptr(LdmGPUConfig) gpu_config = NULL;
-        g_autoptr(GPtrArray) devices = NULL;
+        g_autoptr(GVariant) devices = NULL;
+        g_autoptr(GVariant) config = NULL;
+        g_autoptr(GHashTable) records = NULL;
+        g_autoptr(GPtrArray) order = NULL;
+        g_autoptr(GOptionContext) opt_context = NULL;
+        g_autoptr(GError) error = NULL;
+        g_autoptr(GString) out = NULL;
+        GVariantIter iter = { 0 };
+        GVariant *record = NULL;
+        StatusFormat format = STATUS_FORMAT_TEXT;
+
+        opt_context = g_option_context_new(NULL);
+        g_option_context_add_main_entries(opt_context, status_entries, NULL);
+        if (!g_option_context_parse_strv(opt_context, &argv, &error)) {
+                fprintf(stderr, "Failed to parse arguments: %s\n", error->message);
+                return EXIT_FAILURE;
+        }
+
+        if (opt_json || g_strcmp0(opt_format, "json") == 0) {
+                format = STATUS_FORMAT_JSON;
+        } else if (g_strcmp0(opt_format, "tsv") == 0) {
+                format = STATUS_FORMAT_TSV;
+        } else if (opt_format && !g_str_equal(opt_format, "text")) {
+                fprintf(stderr, "Unknown output format: %s\n", opt_format);
+                return EXIT_FAILURE;
+        }
+
+        /* Timings only make sense for work done in this process */
+        if (!opt_timings && status_query_daemon(&devices, &config)) {
+                goto print;
+        }
 
         /* No need for hot plug events */
-        manager = ldm_manager_new(LDM_MANAGER_FLAGS_NO_MONITOR);
+        manager = ldm_manager_new(LDM_MANAGER_FLAGS_NO_MONITOR | LDM_MANAGER_FLAGS_SNAPSHOT);
         if (!manager) {
                 fprintf(stderr, "Failed to initialiase LdmManager\n");
                 return EXIT_FAILURE;
@@ -224,14 +673,55 @@ int ldm_cli_status(__ldm_unused__ int argc, __ldm_unused__ char **argv)
                 return EXIT_FAILURE;
         }
 
+        devices = g_variant_ref_sink(ldm_dbus_build_devices(manager, LDM_DEVICE_TYPE_ANY));
+        config = g_variant_ref_sink(ldm_dbus_build_gpu_config(gpu_config));
+
+print:
+        /* Records are borrowed from the devices variant */
+        records = g_hash_table_new_full(g_str_hash,
+                                        g_str_equal,
+                                        NULL,
+                                        (GDestroyNotify)status_device_free);
+        order = g_ptr_array_new();
+        g_variant_iter_init(&iter, devices);
+        while ((record = g_variant_iter_next_value(&iter)) != NULL) {
+                StatusDevice *device = status_device_new(record);
+
+                /* The devices variant keeps the strings alive */
+                g_variant_unref(record);
+                g_hash_table_replace(records, (gpointer)device->path, device);
+                g_ptr_array_add(order, device);
+        }
+
+        /* Machine readable output is built up front, and written at once */
+        if (format != STATUS_FORMAT_TEXT) {
+                out = g_string_sized_new(4096);
+                if (format == STATUS_FORMAT_JSON) {
+                        write_json(out, order, config);
+                } else {
+                        write_tsv(out, order, config);
+                }
+                if (opt_timings) {
+                        write_timings(out, manager, format);
+                }
+                if (format == STATUS_FORMAT_JSON) {
+                        g_string_append(out, "}\n");
+                }
+                fwrite(out->str, 1, out->len, stdout);
+                return EXIT_SUCCESS;
+        }
+
         /* Emit non GPU items here, platform first */
-        devices = ldm_manager_get_devices(manager, LDM_DEVICE_TYPE_ANY);
-        for (guint i = 0; i < devices->len; i++) {
-                print_non_gpu(manager, devices->pdata[i]);
+        for (guint i = 0; i < order->len; i++) {
+                print_non_gpu(order->pdata[i]);
         }
 
         /* Emit GPU config last for consistency */
-        print_gpu_config(manager, gpu_config);
+        print_gpu_config(records, config);
+
+        if (opt_timings) {
+                print_timings(manager);
+        }
 
         return EXIT_SUCCESS;
 }
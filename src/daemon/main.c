@@ -0,0 +1,397 @@
+/*
+ * This file is part of linux-driver-management.
+ *
+ * Copyright © 2016-2018 Ikey Doherty
+ *
+ * linux-driver-management is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+#define _GNU_SOURCE
+
+#include "config.h"
+
+#include <glib-unix.h>
+#include <signal.h>
+#include <stdlib.h>
+
+#include "ldm-dbus.h"
+#include "util.h"
+
+static const gchar ldm_daemon_introspection[] =
+    "<node>"
+    "  <interface name='" LDM_DBUS_INTERFACE "'>"
+    "    <method name='GetDevices'>"
+    "      <arg type='u' name='class_mask' direction='in'/>"
+    "      <arg type='" LDM_DBUS_DEVICES_TYPE "' name='devices' direction='out'/>"
+    "    </method>"
+    "    <method name='GetGPUConfig'>"
+    "      <arg type='" LDM_DBUS_GPU_CONFIG_TYPE "' name='config' direction='out'/>"
+    "    </method>"
+    "    <method name='GetDevicesForPackage'>"
+    "      <arg type='s' name='package' direction='in'/>"
+    "      <arg type='as' name='paths' direction='out'/>"
+    "    </method>"
+    "    <method name='GetDevicesForDriver'>"
+    "      <arg type='s' name='driver' direction='in'/>"
+    "      <arg type='as' name='paths' direction='out'/>"
+    "    </method>"
+    "    <signal name='DevicesChanged'/>"
+    "  </interface>"
+    "</node>";
+
+/* Seconds to let a package transaction settle before reloading the plugins */
+#define LDM_DAEMON_RELOAD_DELAY 2
+
+/**
+ * LdmDaemon:
+ *
+ * The one manager shared by every client, kept warm for the lifetime of
+ * the daemon and updated through hotplug. It is rebuilt whenever the
+ * system modalias plugins change, as driver packages come and go.
+ */
+typedef struct LdmDaemon {
+        GMainLoop *loop;
+        LdmManager *manager;
+        LdmGPUConfig *gpu_config; /* Built on first use, then follows hotplug */
+        GFileMonitor *plugin_monitor;
+        guint reload_source;
+        GDBusConnection *bus;
+        GDBusNodeInfo *introspection;
+        guint registration;
+        int exit_code;
+} LdmDaemon;
+
+static void ldm_daemon_devices_changed(LdmManager *manager, gpointer v);
+
+/**
+ * ldm_daemon_get_gpu_config:
+ *
+ * Return the GPU configuration, constructing it on first use
+ */
+static LdmGPUConfig *ldm_daemon_get_gpu_config(LdmDaemon *self)
+{
+        if (!self->gpu_config) {
+                self->gpu_config = ldm_gpu_config_new(self->manager);
+        }
+        return self->gpu_config;
+}
+
+/**
+ * ldm_daemon_paths:
+ *
+ * Reply with the paths of each device in the array
+ */
+static GVariant *ldm_daemon_paths(GPtrArray *devices)
+{
+        GVariantBuilder builder = { 0 };
+
+        g_variant_builder_init(&builder, G_VARIANT_TYPE_STRING_ARRAY);
+        for (guint i = 0; i < devices->len; i++) {
+                g_variant_builder_add(&builder, "s", ldm_device_get_path(devices->pdata[i]));
+        }
+
+        return g_variant_new("(as)", &builder);
+}
+
+static void ldm_daemon_method_call(__ldm_unused__ GDBusConnection *connection,
+                                   __ldm_unused__ const gchar *sender,
+                                   __ldm_unused__ const gchar *object_path,
+                                   __ldm_unused__ const gchar *interface_name,
+                                   const gchar *method_name, GVariant *parameters,
+                                   GDBusMethodInvocation *invocation, gpointer v)
+{
+        LdmDaemon *self = v;
+        g_autoptr(GPtrArray) devices = NULL;
+        GVariant *reply = NULL;
+
+        if (g_str_equal(method_name, "GetDevices")) {
+                guint32 class_mask = 0;
+
+                g_variant_get(parameters, "(u)", &class_mask);
+                reply = ldm_dbus_build_devices(self->manager, (LdmDeviceType)class_mask);
+                reply = g_variant_new_tuple(&reply, 1);
+        } else if (g_str_equal(method_name, "GetGPUConfig")) {
+                LdmGPUConfig *config = ldm_daemon_get_gpu_config(self);
+
+                if (!config) {
+                        g_dbus_method_invocation_return_error(invocation,
+                                                              G_DBUS_ERROR,
+                                                              G_DBUS_ERROR_FAILED,
+                                                              "No GPU configuration available");
+                        return;
+                }
+                reply = ldm_dbus_build_gpu_config(config);
+                reply = g_variant_new_tuple(&reply, 1);
+        } else if (g_str_equal(method_name, "GetDevicesForPackage")) {
+                const gchar *package = NULL;
+
+                g_variant_get(parameters, "(&s)", &package);
+                devices = ldm_manager_get_devices_for_package(self->manager, package);
+                reply = ldm_daemon_paths(devices);
+        } else if (g_str_equal(method_name, "GetDevicesForDriver")) {
+                const gchar *driver = NULL;
+
+                g_variant_get(parameters, "(&s)", &driver);
+                devices = ldm_manager_get_devices_for_driver(self->manager, driver);
+                reply = ldm_daemon_paths(devices);
+        }
+
+        if (!reply) {
+                g_dbus_method_invocation_return_error(invocation,
+                                                      G_DBUS_ERROR,
+                                                      G_DBUS_ERROR_UNKNOWN_METHOD,
+                                                      "Unknown method: %s",
+                                                      method_name);
+                return;
+        }
+
+        g_dbus_method_invocation_return_value(invocation, reply);
+}
+
+static const GDBusInterfaceVTable ldm_daemon_vtable = {
+        .method_call = ldm_daemon_method_call,
+};
+
+/**
+ * ldm_daemon_devices_changed:
+ *
+ * Hotplug changed the device tree, so let clients know rather than have
+ * them poll. The GPU configuration keeps itself up to date.
+ */
+static void ldm_daemon_devices_changed(__ldm_unused__ LdmManager *manager, gpointer v)
+{
+        LdmDaemon *self = v;
+        g_autoptr(GError) error = NULL;
+
+        if (!self->bus) {
+                return;
+        }
+
+        if (!g_dbus_connection_emit_signal(self->bus,
+                                           NULL,
+                                           LDM_DBUS_PATH,
+                                           LDM_DBUS_INTERFACE,
+                                           "DevicesChanged",
+                                           NULL,
+                                           &error)) {
+                g_warning("Failed to emit DevicesChanged: %s", error->message);
+        }
+}
+
+static void ldm_daemon_bus_acquired(GDBusConnection *connection, __ldm_unused__ const gchar *name,
+                                    gpointer v)
+{
+        LdmDaemon *self = v;
+        g_autoptr(GError) error = NULL;
+
+        self->bus = g_object_ref(connection);
+        self->registration =
+            g_dbus_connection_register_object(connection,
+                                              LDM_DBUS_PATH,
+                                              self->introspection->interfaces[0],
+                                              &ldm_daemon_vtable,
+                                              self,
+                                              NULL,
+                                              &error);
+        if (self->registration == 0) {
+                g_warning("Failed to register %s: %s", LDM_DBUS_PATH, error->message);
+                self->exit_code = EXIT_FAILURE;
+                g_main_loop_quit(self->loop);
+        }
+}
+
+static void ldm_daemon_name_lost(__ldm_unused__ GDBusConnection *connection, const gchar *name,
+                                 gpointer v)
+{
+        LdmDaemon *self = v;
+
+        g_warning("Lost (or failed to acquire) the name %s", name);
+        self->exit_code = EXIT_FAILURE;
+        g_main_loop_quit(self->loop);
+}
+
+/**
+ * ldm_daemon_prime_providers:
+ *
+ * Resolve every provider up front, purely for the side effect of filling
+ * the provider cache, so that no client waits on a cold manager.
+ */
+static void ldm_daemon_prime_providers(LdmManager *manager)
+{
+        g_hash_table_unref(ldm_manager_get_all_providers(manager, LDM_DEVICE_TYPE_ANY));
+}
+
+/**
+ * ldm_daemon_load:
+ *
+ * Build the shared manager with the current system modalias plugins
+ */
+static gboolean ldm_daemon_load(LdmDaemon *self)
+{
+        /* Hotplug events are received away from the busy main loop */
+        self->manager = ldm_manager_new(LDM_MANAGER_FLAGS_MONITOR_THREAD);
+        if (!self->manager) {
+                return FALSE;
+        }
+        if (!ldm_manager_add_system_modalias_plugins(self->manager)) {
+                g_warning("Failed to find any system modalias plugins");
+        }
+        ldm_daemon_prime_providers(self->manager);
+        g_signal_connect(self->manager,
+                         "devices-changed",
+                         G_CALLBACK(ldm_daemon_devices_changed),
+                         self);
+
+        return TRUE;
+}
+
+static void ldm_daemon_unload(LdmDaemon *self)
+{
+        g_clear_object(&self->gpu_config);
+        if (self->manager) {
+                g_signal_handlers_disconnect_by_data(self->manager, self);
+        }
+        g_clear_object(&self->manager);
+}
+
+/**
+ * ldm_daemon_reload:
+ *
+ * Plugins can't be removed from a manager, so start afresh with a new one,
+ * and let clients know their answers may have changed.
+ */
+static gboolean ldm_daemon_reload(gpointer v)
+{
+        LdmDaemon *self = v;
+
+        self->reload_source = 0;
+        g_debug("System modalias plugins changed, reloading");
+
+        ldm_daemon_unload(self);
+        if (!ldm_daemon_load(self)) {
+                g_warning("Failed to reinitialise LdmManager");
+                self->exit_code = EXIT_FAILURE;
+                g_main_loop_quit(self->loop);
+                return G_SOURCE_REMOVE;
+        }
+        ldm_daemon_devices_changed(self->manager, self);
+
+        return G_SOURCE_REMOVE;
+}
+
+/**
+ * ldm_daemon_plugins_changed:
+ *
+ * A driver package was installed or removed, so the providers we hold are
+ * stale. Wait for the transaction to settle, then reload once.
+ */
+static void ldm_daemon_plugins_changed(__ldm_unused__ GFileMonitor *monitor,
+                                       __ldm_unused__ GFile *file,
+                                       __ldm_unused__ GFile *other_file,
+                                       __ldm_unused__ GFileMonitorEvent event, gpointer v)
+{
+        LdmDaemon *self = v;
+
+        if (self->reload_source > 0) {
+                return;
+        }
+        self->reload_source =
+            g_timeout_add_seconds(LDM_DAEMON_RELOAD_DELAY, ldm_daemon_reload, self);
+}
+
+static gboolean ldm_daemon_quit(gpointer v)
+{
+        LdmDaemon *self = v;
+
+        g_main_loop_quit(self->loop);
+        return G_SOURCE_CONTINUE;
+}
+
+/**
+ * Main entry into ldm-daemon
+ *
+ * The manager is fully warmed up, with every provider resolved, before the
+ * name is requested on the bus, and again whenever the plugins change.
+ * Clients therefore never wait on a cold daemon, and simply do the work
+ * themselves until the name appears.
+ */
+int main(__ldm_unused__ int argc, __ldm_unused__ char **argv)
+{
+        LdmDaemon self = { 0 };
+        g_autoptr(GFile) plugin_dir = NULL;
+        g_autoptr(GError) error = NULL;
+        guint owner = 0;
+
+        self.introspection = g_dbus_node_info_new_for_xml(ldm_daemon_introspection, &error);
+        g_assert_no_error(error);
+
+        if (!ldm_daemon_load(&self)) {
+                g_printerr("Failed to initialise LdmManager\n");
+                return EXIT_FAILURE;
+        }
+
+        /* Follow driver packages being installed and removed */
+        plugin_dir = g_file_new_for_path(MODALIAS_DIR);
+        self.plugin_monitor =
+            g_file_monitor_directory(plugin_dir, G_FILE_MONITOR_NONE, NULL, &error);
+        if (self.plugin_monitor) {
+                g_signal_connect(self.plugin_monitor,
+                                 "changed",
+                                 G_CALLBACK(ldm_daemon_plugins_changed),
+                                 &self);
+        } else {
+                g_warning("Cannot watch %s for plugin changes: %s",
+                          MODALIAS_DIR,
+                          error->message);
+                g_clear_error(&error);
+        }
+
+        self.loop = g_main_loop_new(NULL, FALSE);
+        g_unix_signal_add(SIGINT, ldm_daemon_quit, &self);
+        g_unix_signal_add(SIGTERM, ldm_daemon_quit, &self);
+
+        owner = g_bus_own_name(G_BUS_TYPE_SYSTEM,
+                               LDM_DBUS_NAME,
+                               G_BUS_NAME_OWNER_FLAGS_NONE,
+                               ldm_daemon_bus_acquired,
+                               NULL,
+                               ldm_daemon_name_lost,
+                               &self,
+                               NULL);
+
+        g_main_loop_run(self.loop);
+
+        g_bus_unown_name(owner);
+        if (self.registration > 0) {
+                g_dbus_connection_unregister_object(self.bus, self.registration);
+        }
+        g_clear_object(&self.bus);
+        if (self.reload_source > 0) {
+                g_source_remove(self.reload_source);
+        }
+        if (self.plugin_monitor) {
+                g_signal_handlers_disconnect_by_data(self.plugin_monitor, &self);
+        }
+        g_clear_object(&self.plugin_monitor);
+        ldm_daemon_unload(&self);
+        g_main_loop_unref(self.loop);
+        g_dbus_node_info_unref(self.introspection);
+
+        return self.exit_code;
+}
+
+/*
+ * Editor modelines  -  https://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: nil
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 expandtab:
+ * :indentSize=8:tabSize=8:noTabs=true:
+ */
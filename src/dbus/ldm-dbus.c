@@ -0,0 +1,182 @@
+/*
+ * This file is part of linux-driver-management.
+ *
+ * Copyright © 2016-2018 Ikey Doherty
+ *
+ * linux-driver-management is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+#define _GNU_SOURCE
+
+#include "config.h"
+#include "ldm-dbus.h"
+#include "util.h"
+
+/**
+ * ldm_dbus_build_device:
+ *
+ * Append the record for a single device and its providers
+ */
+static void ldm_dbus_build_device(GVariantBuilder *builder, LdmDevice *device,
+                                  GPtrArray *providers)
+{
+        g_autofree gchar *xorg_id = NULL;
+        g_autofree gchar *name = ldm_utf8_dup(ldm_device_get_name(device));
+        g_autofree gchar *vendor = ldm_utf8_dup(ldm_device_get_vendor(device));
+        g_autofree gchar *cpulist = NULL;
+        g_auto(GVariantBuilder) packages = G_VARIANT_BUILDER_INIT(G_VARIANT_TYPE_STRING_ARRAY);
+        gint32 numa_node = -1;
+        guint32 link[4] = { 0 }; /* Current then maximum width and speed */
+
+        if (LDM_IS_PCI_DEVICE(device)) {
+                LdmPCIDevice *pci = LDM_PCI_DEVICE(device);
+
+                xorg_id = ldm_pci_device_get_xorg_bus_id(pci);
+                numa_node = (gint32)ldm_pci_device_get_numa_node(pci);
+                cpulist = ldm_utf8_dup(ldm_pci_device_get_local_cpulist(pci));
+                link[0] = (guint32)ldm_pci_device_get_link_width(pci);
+                link[1] = (guint32)ldm_pci_device_get_link_speed(pci);
+                link[2] = (guint32)ldm_pci_device_get_max_link_width(pci);
+                link[3] = (guint32)ldm_pci_device_get_max_link_speed(pci);
+        }
+
+        for (guint i = 0; providers && i < providers->len; i++) {
+                LdmProvider *provider = providers->pdata[i];
+                g_autofree gchar *package = ldm_utf8_dup(ldm_provider_get_package(provider));
+
+                g_variant_builder_add(&packages, "s", package);
+        }
+
+        g_variant_builder_add(builder,
+                              LDM_DBUS_DEVICE_TYPE,
+                              ldm_device_get_path(device),
+                              name,
+                              vendor,
+                              xorg_id ? xorg_id : "",
+                              (guint32)ldm_device_get_device_type(device),
+                              (guint32)ldm_device_get_vendor_id(device),
+                              (guint32)ldm_device_get_product_id(device),
+                              (guint32)ldm_device_get_attributes(device),
+                              &packages,
+                              numa_node,
+                              cpulist ? cpulist : "",
+                              link[0],
+                              link[1],
+                              link[2],
+                              link[3]);
+}
+
+/**
+ * ldm_dbus_build_devices:
+ * @class_mask: Bitwise mask of LdmDeviceType
+ *
+ * Describe every device matching @class_mask, along with its providers,
+ * in the order returned by #ldm_manager_get_devices.
+ *
+ * Returns: (transfer floating): A LDM_DBUS_DEVICES_TYPE variant
+ */
+GVariant *ldm_dbus_build_devices(LdmManager *manager, LdmDeviceType class_mask)
+{
+        g_autoptr(GPtrArray) devices = NULL;
+        g_autoptr(GHashTable) all_providers = NULL;
+        GVariantBuilder builder = { 0 };
+
+        /* Resolve all providers in one go */
+        all_providers = ldm_manager_get_all_providers(manager, class_mask);
+        devices = ldm_manager_get_devices(manager, class_mask);
+
+        g_variant_builder_init(&builder, G_VARIANT_TYPE(LDM_DBUS_DEVICES_TYPE));
+        for (guint i = 0; i < devices->len; i++) {
+                LdmDevice *device = devices->pdata[i];
+
+                ldm_dbus_build_device(&builder,
+                                      device,
+                                      g_hash_table_lookup(all_providers, device));
+        }
+
+        return g_variant_builder_end(&builder);
+}
+
+static inline const gchar *ldm_dbus_device_path(LdmDevice *device)
+{
+        return device ? ldm_device_get_path(device) : "";
+}
+
+/**
+ * ldm_dbus_build_gpu_config:
+ *
+ * Describe the GPU configuration, referring to devices by their path
+ *
+ * Returns: (transfer floating): A LDM_DBUS_GPU_CONFIG_TYPE variant
+ */
+GVariant *ldm_dbus_build_gpu_config(LdmGPUConfig *config)
+{
+        return g_variant_new(LDM_DBUS_GPU_CONFIG_TYPE,
+                             (guint32)ldm_gpu_config_get_gpu_type(config),
+                             ldm_dbus_device_path(ldm_gpu_config_get_primary_device(config)),
+                             ldm_dbus_device_path(ldm_gpu_config_get_secondary_device(config)),
+                             ldm_dbus_device_path(ldm_gpu_config_get_detection_device(config)));
+}
+
+/**
+ * ldm_dbus_call:
+ * @method: Method on LDM_DBUS_INTERFACE
+ * @parameters: (nullable): Method parameters
+ * @reply: Expected reply type
+ *
+ * Ask a running ldm-daemon, without activating one. Failure is not an
+ * error, as callers are expected to do the work themselves instead.
+ *
+ * Returns: (transfer full) (nullable): The reply, or NULL if the daemon is unavailable
+ */
+GVariant *ldm_dbus_call(const gchar *method, GVariant *parameters, const GVariantType *reply)
+{
+        g_autoptr(GVariant) params = parameters ? g_variant_ref_sink(parameters) : NULL;
+        g_autoptr(GDBusConnection) bus = NULL;
+        g_autoptr(GError) error = NULL;
+        GVariant *ret = NULL;
+
+        /* Allow bypassing the daemon, e.g. when debugging it */
+        if (!LDM_ENABLE_DAEMON || g_getenv("LDM_NO_DAEMON")) {
+                return NULL;
+        }
+
+        bus = g_bus_get_sync(G_BUS_TYPE_SYSTEM, NULL, &error);
+        if (!bus) {
+                g_debug("No system bus: %s", error->message);
+                return NULL;
+        }
+
+        ret = g_dbus_connection_call_sync(bus,
+                                          LDM_DBUS_NAME,
+                                          LDM_DBUS_PATH,
+                                          LDM_DBUS_INTERFACE,
+                                          method,
+                                          params,
+                                          reply,
+                                          G_DBUS_CALL_FLAGS_NO_AUTO_START,
+                                          LDM_DBUS_TIMEOUT,
+                                          NULL,
+                                          &error);
+        if (!ret) {
+                g_debug("ldm-daemon unavailable: %s", error->message);
+        }
+
+        return ret;
+}
+
+/*
+ * Editor modelines  -  https://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: nil
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 expandtab:
+ * :indentSize=8:tabSize=8:noTabs=true:
+ */
@@ -0,0 +1,89 @@
+/*
+ * This file is part of linux-driver-management.
+ *
+ * Copyright © 2016-2018 Ikey Doherty
+ *
+ * linux-driver-management is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+#pragma once
+
+#include <gio/gio.h>
+
+#include <ldm.h>
+
+G_BEGIN_DECLS
+
+/*
+ * Shared between ldm-daemon and its clients.
+ *
+ * The daemon keeps a single hotplug monitored LdmManager with the system
+ * modalias plugins loaded, and answers queries with plain GVariant records
+ * rather than objects. Clients build the same records from a local manager
+ * when the daemon isn't running, so that there is only one code path for
+ * consuming the results.
+ */
+#define LDM_DBUS_NAME "com.solus_project.LinuxDriverManagement"
+#define LDM_DBUS_PATH "/com/solus_project/LinuxDriverManagement"
+#define LDM_DBUS_INTERFACE "com.solus_project.LinuxDriverManagement.Manager"
+
+/* Time allowed for the daemon to answer, before falling back to local work */
+#define LDM_DBUS_TIMEOUT 2000
+
+/*
+ * A single device:
+ *      path, name, vendor, X.Org bus ID (or empty), LdmDeviceType,
+ *      vendor ID, product ID, LdmDeviceAttribute, provider packages,
+ *      locality
+ */
+#define LDM_DBUS_DEVICE_TYPE "(ssssuuuuas" LDM_DBUS_LOCALITY_TYPE ")"
+
+/*
+ * The locality of a PCI device:
+ *      NUMA node (or -1), local CPU list (or empty), current link width and
+ *      speed in MT/s, maximum link width and speed, with 0 for no PCIe link
+ */
+#define LDM_DBUS_LOCALITY_TYPE "(isuuuu)"
+#define LDM_DBUS_DEVICES_TYPE "a" LDM_DBUS_DEVICE_TYPE
+
+/*
+ * The GPU configuration:
+ *      LdmGPUType, primary, secondary (or empty) and detection device paths
+ */
+#define LDM_DBUS_GPU_CONFIG_TYPE "(usss)"
+
+/* Indices into LDM_DBUS_DEVICE_TYPE */
+enum {
+        LDM_DBUS_DEVICE_PATH = 0,
+        LDM_DBUS_DEVICE_NAME,
+        LDM_DBUS_DEVICE_VENDOR,
+        LDM_DBUS_DEVICE_XORG_ID,
+        LDM_DBUS_DEVICE_TYPES,
+        LDM_DBUS_DEVICE_VENDOR_ID,
+        LDM_DBUS_DEVICE_PRODUCT_ID,
+        LDM_DBUS_DEVICE_ATTRIBUTES,
+        LDM_DBUS_DEVICE_PROVIDERS,
+        LDM_DBUS_DEVICE_LOCALITY,
+};
+
+GVariant *ldm_dbus_build_devices(LdmManager *manager, LdmDeviceType class_mask);
+GVariant *ldm_dbus_build_gpu_config(LdmGPUConfig *config);
+GVariant *ldm_dbus_call(const gchar *method, GVariant *parameters, const GVariantType *reply);
+
+G_END_DECLS
+
+/*
+ * Editor modelines  -  https://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: nil
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 expandtab:
+ * :indentSize=8:tabSize=8:noTabs=true:
+ */
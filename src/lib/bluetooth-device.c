@@ -99,12 +99,12 @@ static void ldm_bluetooth_device_init(LdmBluetoothDevice *self)
  *
  * Add Bluetooth specific data, such as host controller state.
  */
-void ldm_bluetooth_device_init_private(LdmDevice *self, udev_device *device)
+void ldm_bluetooth_device_init_private(LdmDevice *self, LdmDeviceRecord *record)
 {
         const char *devtype = NULL;
 
         /* Figure out if we're a host controller */
-        devtype = udev_device_get_devtype(device);
+        devtype = ldm_device_record_get_devtype(record);
         if (devtype && g_str_equal(devtype, "host")) {
                 self->os.attributes |= LDM_DEVICE_ATTRIBUTE_HOST;
         }
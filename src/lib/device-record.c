@@ -0,0 +1,233 @@
+/*
+ * This file is part of linux-driver-management.
+ *
+ * Copyright © 2016-2018 Ikey Doherty
+ *
+ * linux-driver-management is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+#define _GNU_SOURCE
+
+#include <string.h>
+
+#include "device-record.h"
+
+struct _LdmDeviceRecord {
+        gint ref_count;
+        struct udev_device *udev; /* Live device, NULL for offline records */
+        LdmDeviceRecord *parent;  /* Owned, lazily wrapped for live devices */
+        gboolean parent_resolved;
+
+        /* Offline records only */
+        gchar *syspath;
+        const gchar *sysname; /* Points into syspath */
+        GHashTable *properties;
+        GHashTable *sysattrs;
+};
+
+/**
+ * ldm_device_record_new_from_udev:
+ * @device: Live udev device
+ *
+ * Wrap the udev device, which is referenced for the lifetime of the record
+ *
+ * Returns: (transfer full): A new record
+ */
+LdmDeviceRecord *ldm_device_record_new_from_udev(struct udev_device *device)
+{
+        LdmDeviceRecord *self = NULL;
+
+        g_return_val_if_fail(device != NULL, NULL);
+
+        self = g_new0(LdmDeviceRecord, 1);
+        self->ref_count = 1;
+        self->udev = udev_device_ref(device);
+
+        return self;
+}
+
+/**
+ * ldm_device_record_new:
+ * @parent: (nullable): Parent record, if any
+ * @syspath: Full sysfs path of the device, i.e. /sys/devices/...
+ *
+ * Construct a new offline record, with no properties or sysfs attributes
+ *
+ * Returns: (transfer full): A new record
+ */
+LdmDeviceRecord *ldm_device_record_new(LdmDeviceRecord *parent, const gchar *syspath)
+{
+        LdmDeviceRecord *self = NULL;
+        const gchar *sysname = NULL;
+
+        g_return_val_if_fail(syspath != NULL, NULL);
+
+        self = g_new0(LdmDeviceRecord, 1);
+        self->ref_count = 1;
+        self->parent = parent ? ldm_device_record_ref(parent) : NULL;
+        self->parent_resolved = TRUE;
+        self->syspath = g_strdup(syspath);
+        sysname = strrchr(self->syspath, '/');
+        self->sysname = sysname ? sysname + 1 : self->syspath;
+        self->properties = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+        self->sysattrs = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+
+        return self;
+}
+
+LdmDeviceRecord *ldm_device_record_ref(LdmDeviceRecord *self)
+{
+        g_atomic_int_inc(&self->ref_count);
+        return self;
+}
+
+void ldm_device_record_unref(LdmDeviceRecord *self)
+{
+        if (!self || !g_atomic_int_dec_and_test(&self->ref_count)) {
+                return;
+        }
+
+        g_clear_pointer(&self->parent, ldm_device_record_unref);
+        g_clear_pointer(&self->udev, udev_device_unref);
+        g_clear_pointer(&self->properties, g_hash_table_unref);
+        g_clear_pointer(&self->sysattrs, g_hash_table_unref);
+        g_free(self->syspath);
+        g_free(self);
+}
+
+/**
+ * ldm_device_record_set_property:
+ *
+ * Set a uevent property on an offline record
+ */
+void ldm_device_record_set_property(LdmDeviceRecord *self, const gchar *key, const gchar *value)
+{
+        g_return_if_fail(self->udev == NULL);
+
+        g_hash_table_replace(self->properties, g_strdup(key), g_strdup(value));
+}
+
+/**
+ * ldm_device_record_set_sysattr:
+ *
+ * Set a sysfs attribute on an offline record
+ */
+void ldm_device_record_set_sysattr(LdmDeviceRecord *self, const gchar *key, const gchar *value)
+{
+        g_return_if_fail(self->udev == NULL);
+
+        g_hash_table_replace(self->sysattrs, g_strdup(key), g_strdup(value));
+}
+
+const gchar *ldm_device_record_get_syspath(LdmDeviceRecord *self)
+{
+        return self->udev ? udev_device_get_syspath(self->udev) : self->syspath;
+}
+
+const gchar *ldm_device_record_get_sysname(LdmDeviceRecord *self)
+{
+        return self->udev ? udev_device_get_sysname(self->udev) : self->sysname;
+}
+
+const gchar *ldm_device_record_get_subsystem(LdmDeviceRecord *self)
+{
+        if (self->udev) {
+                return udev_device_get_subsystem(self->udev);
+        }
+        return g_hash_table_lookup(self->properties, "SUBSYSTEM");
+}
+
+const gchar *ldm_device_record_get_devtype(LdmDeviceRecord *self)
+{
+        if (self->udev) {
+                return udev_device_get_devtype(self->udev);
+        }
+        return g_hash_table_lookup(self->properties, "DEVTYPE");
+}
+
+const gchar *ldm_device_record_get_property(LdmDeviceRecord *self, const gchar *key)
+{
+        if (self->udev) {
+                return udev_device_get_property_value(self->udev, key);
+        }
+        return g_hash_table_lookup(self->properties, key);
+}
+
+/**
+ * ldm_device_record_get_sysattr:
+ *
+ * Read a sysfs attribute. For live records this is a sysfs read the first
+ * time around, so uevent properties should be preferred where possible.
+ */
+const gchar *ldm_device_record_get_sysattr(LdmDeviceRecord *self, const gchar *key)
+{
+        if (self->udev) {
+                return udev_device_get_sysattr_value(self->udev, key);
+        }
+        return g_hash_table_lookup(self->sysattrs, key);
+}
+
+/**
+ * ldm_device_record_get_parent:
+ *
+ * Returns: (transfer none) (nullable): The parent record, owned by @self
+ */
+LdmDeviceRecord *ldm_device_record_get_parent(LdmDeviceRecord *self)
+{
+        struct udev_device *parent = NULL;
+
+        if (self->parent_resolved) {
+                return self->parent;
+        }
+        self->parent_resolved = TRUE;
+
+        /* Owned by our udev device, which the new record references again */
+        parent = udev_device_get_parent(self->udev);
+        if (parent) {
+                self->parent = ldm_device_record_new_from_udev(parent);
+        }
+
+        return self->parent;
+}
+
+/**
+ * ldm_device_record_get_parent_with_subsystem_devtype:
+ * @subsystem: Subsystem of the wanted parent
+ * @devtype: (nullable): Device type of the wanted parent, or NULL for any
+ *
+ * Walk up the parents of the record, as the udev function of the same name
+ *
+ * Returns: (transfer none) (nullable): The closest matching parent
+ */
+LdmDeviceRecord *ldm_device_record_get_parent_with_subsystem_devtype(LdmDeviceRecord *self,
+                                                                     const gchar *subsystem,
+                                                                     const gchar *devtype)
+{
+        for (LdmDeviceRecord *parent = ldm_device_record_get_parent(self); parent;
+             parent = ldm_device_record_get_parent(parent)) {
+                if (g_strcmp0(ldm_device_record_get_subsystem(parent), subsystem) != 0) {
+                        continue;
+                }
+                if (!devtype || g_strcmp0(ldm_device_record_get_devtype(parent), devtype) == 0) {
+                        return parent;
+                }
+        }
+
+        return NULL;
+}
+
+/*
+ * Editor modelines  -  https://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: nil
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 expandtab:
+ * :indentSize=8:tabSize=8:noTabs=true:
+ */
@@ -0,0 +1,66 @@
+/*
+ * This file is part of linux-driver-management.
+ *
+ * Copyright © 2016-2018 Ikey Doherty
+ *
+ * linux-driver-management is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+#pragma once
+
+#include <glib.h>
+#include <libudev.h>
+
+G_BEGIN_DECLS
+
+/*
+ * LdmDeviceRecord
+ *
+ * Private stand-in for a udev_device, so that devices can be built from
+ * sources other than the live system. A record either wraps a live udev
+ * device, deferring every lookup to libudev, or carries its own properties
+ * and sysfs attributes, as loaded from a recording. Offline records have no
+ * sysfs behind them, so an attribute that wasn't recorded simply isn't set.
+ */
+typedef struct _LdmDeviceRecord LdmDeviceRecord;
+
+LdmDeviceRecord *ldm_device_record_new_from_udev(struct udev_device *device);
+LdmDeviceRecord *ldm_device_record_new(LdmDeviceRecord *parent, const gchar *syspath);
+LdmDeviceRecord *ldm_device_record_ref(LdmDeviceRecord *record);
+void ldm_device_record_unref(LdmDeviceRecord *record);
+
+void ldm_device_record_set_property(LdmDeviceRecord *record, const gchar *key,
+                                    const gchar *value);
+void ldm_device_record_set_sysattr(LdmDeviceRecord *record, const gchar *key,
+                                   const gchar *value);
+
+const gchar *ldm_device_record_get_syspath(LdmDeviceRecord *record);
+const gchar *ldm_device_record_get_sysname(LdmDeviceRecord *record);
+const gchar *ldm_device_record_get_subsystem(LdmDeviceRecord *record);
+const gchar *ldm_device_record_get_devtype(LdmDeviceRecord *record);
+const gchar *ldm_device_record_get_property(LdmDeviceRecord *record, const gchar *key);
+const gchar *ldm_device_record_get_sysattr(LdmDeviceRecord *record, const gchar *key);
+LdmDeviceRecord *ldm_device_record_get_parent(LdmDeviceRecord *record);
+LdmDeviceRecord *ldm_device_record_get_parent_with_subsystem_devtype(LdmDeviceRecord *record,
+                                                                     const gchar *subsystem,
+                                                                     const gchar *devtype);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(LdmDeviceRecord, ldm_device_record_unref)
+
+G_END_DECLS
+
+/*
+ * Editor modelines  -  https://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: nil
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 expandtab:
+ * :indentSize=8:tabSize=8:noTabs=true:
+ */
@@ -0,0 +1,442 @@
+/*
+ * This file is part of linux-driver-management.
+ *
+ * Copyright © 2016-2018 Ikey Doherty
+ *
+ * linux-driver-management is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+#define _GNU_SOURCE
+
+#include "device-table.h"
+#include "ldm-private.h"
+#include "manager-private.h"
+
+/**
+ * SECTION:device-table
+ * @Short_description: Immutable view of the devices known to an #LdmManager
+ * @see_also: #LdmManager
+ * @Title: LdmDeviceTable
+ *
+ * An LdmDeviceTable is a read-only copy of the root devices of an
+ * #LdmManager, along with their type buckets, as they stood at the end of
+ * a batch of changes. The manager publishes a new table after enumeration
+ * and after every batch of hotplug events, so a table never changes once
+ * it has been obtained.
+ *
+ * Unlike the rest of the manager API, #ldm_manager_get_device_table may be
+ * called from any thread, and takes no lock. Each table holds a reference
+ * to its devices, which remain valid for as long as the table does, even
+ * if they have since been removed from the manager.
+ *
+ * Only the immutable identity of each device, such as its name, path,
+ * type, vendor and attributes, may be read from another thread. Any sysfs
+ * read deferred by enumeration is done by the manager before publishing,
+ * so readers only ever see fully resolved devices. Children
+ * and providers still belong to the thread the manager runs in, which is
+ * why #ldm_device_table_foreach matches types without walking children.
+ */
+
+/**
+ * LdmDeviceTableEntry:
+ *
+ * A published root device, with the distinct types found in its subtree.
+ * Entries are shared by every table until the subtree changes.
+ */
+typedef struct LdmDeviceTableEntry {
+        gint ref_count;
+        LdmDevice *device; /* Referenced */
+        guint *types;      /* Distinct device types within the subtree */
+        guint n_types;
+} LdmDeviceTableEntry;
+
+struct _LdmDeviceTable {
+        gint ref_count;
+        guint generation;
+        GPtrArray *entries; /* LdmDeviceTableEntry, in manager order */
+
+        /* Entries by type, in the same order, shared with the previous table
+         * when unchanged. Each is a superset as with the manager buckets. */
+        GPtrArray *by_type[LDM_MANAGER_N_BUCKETS];
+};
+
+G_DEFINE_BOXED_TYPE(LdmDeviceTable, ldm_device_table, ldm_device_table_ref, ldm_device_table_unref)
+
+/**
+ * ldm_device_table_collect_types:
+ *
+ * Append the type of each device in the subtree, unless already known, and
+ * resolve the deferred fields so that readers never have to
+ */
+static void ldm_device_table_collect_types(LdmDevice *device, GArray *types)
+{
+        guint i = 0;
+
+        ldm_device_resolve(device, LDM_DEVICE_DEFERRED_ALL);
+
+        while (i < types->len && g_array_index(types, guint, i) != device->os.devtype) {
+                ++i;
+        }
+        if (i == types->len) {
+                g_array_append_val(types, device->os.devtype);
+        }
+
+        for (i = 0; i < device->tree.kids->len; i++) {
+                ldm_device_table_collect_types(device->tree.kids->pdata[i], types);
+        }
+}
+
+static LdmDeviceTableEntry *ldm_device_table_entry_new(LdmDevice *device)
+{
+        LdmDeviceTableEntry *entry = NULL;
+        GArray *types = NULL;
+
+        types = g_array_new(FALSE, FALSE, sizeof(guint));
+        ldm_device_table_collect_types(device, types);
+
+        entry = g_new0(LdmDeviceTableEntry, 1);
+        entry->ref_count = 1;
+        entry->device = g_object_ref(device);
+        entry->n_types = types->len;
+        entry->types = (guint *)(gpointer)g_array_free(types, FALSE);
+
+        return entry;
+}
+
+static LdmDeviceTableEntry *ldm_device_table_entry_ref(LdmDeviceTableEntry *entry)
+{
+        g_atomic_int_inc(&entry->ref_count);
+        return entry;
+}
+
+static void ldm_device_table_entry_unref(LdmDeviceTableEntry *entry)
+{
+        if (!g_atomic_int_dec_and_test(&entry->ref_count)) {
+                return;
+        }
+
+        g_object_unref(entry->device);
+        g_free(entry->types);
+        g_free(entry);
+}
+
+/**
+ * ldm_device_table_entry_match:
+ *
+ * Equivalent to #ldm_device_has_type on the published subtree
+ */
+static gboolean ldm_device_table_entry_match(LdmDeviceTableEntry *entry, guint types)
+{
+        for (guint i = 0; i < entry->n_types; i++) {
+                if ((entry->types[i] & types) == types) {
+                        return TRUE;
+                }
+        }
+
+        return FALSE;
+}
+
+static LdmDeviceTable *ldm_device_table_new(guint generation)
+{
+        LdmDeviceTable *self = NULL;
+
+        self = g_new0(LdmDeviceTable, 1);
+        self->ref_count = 1;
+        self->generation = generation;
+        self->entries =
+            g_ptr_array_new_with_free_func((GDestroyNotify)ldm_device_table_entry_unref);
+
+        return self;
+}
+
+/**
+ * ldm_device_table_ref:
+ *
+ * Returns: (transfer full): A new reference to the table
+ */
+LdmDeviceTable *ldm_device_table_ref(LdmDeviceTable *self)
+{
+        g_return_val_if_fail(self != NULL, NULL);
+
+        g_atomic_int_inc(&self->ref_count);
+        return self;
+}
+
+/**
+ * ldm_device_table_unref:
+ *
+ * Drop a reference to the table, freeing it along with its references to
+ * the devices once the last is gone. This may be called from any thread.
+ */
+void ldm_device_table_unref(LdmDeviceTable *self)
+{
+        if (!self || !g_atomic_int_dec_and_test(&self->ref_count)) {
+                return;
+        }
+
+        for (guint i = 0; i < LDM_MANAGER_N_BUCKETS; i++) {
+                g_clear_pointer(&self->by_type[i], g_ptr_array_unref);
+        }
+        g_ptr_array_unref(self->entries);
+        g_free(self);
+}
+
+/**
+ * ldm_device_table_get_generation:
+ *
+ * Each table published by a manager has a higher generation than the one
+ * before, so two tables of the same generation hold the same devices.
+ *
+ * Returns: The generation of the table
+ */
+guint ldm_device_table_get_generation(LdmDeviceTable *self)
+{
+        g_return_val_if_fail(self != NULL, 0);
+
+        return self->generation;
+}
+
+/**
+ * ldm_device_table_get_n_devices:
+ *
+ * Returns: The number of root devices in the table
+ */
+guint ldm_device_table_get_n_devices(LdmDeviceTable *self)
+{
+        g_return_val_if_fail(self != NULL, 0);
+
+        return self->entries->len;
+}
+
+/**
+ * ldm_device_table_get_device:
+ * @index: Index of the device, below #ldm_device_table_get_n_devices
+ *
+ * Root devices are in the same order as #ldm_manager_get_devices returned
+ * them when the table was published.
+ *
+ * Returns: (transfer none): The device at @index, owned by the table
+ */
+LdmDevice *ldm_device_table_get_device(LdmDeviceTable *self, guint index)
+{
+        LdmDeviceTableEntry *entry = NULL;
+
+        g_return_val_if_fail(self != NULL, NULL);
+        g_return_val_if_fail(index < self->entries->len, NULL);
+
+        entry = self->entries->pdata[index];
+        return entry->device;
+}
+
+/**
+ * ldm_device_table_foreach:
+ * @types: Bitwise mask of #LdmDeviceType, or #LDM_DEVICE_TYPE_ANY
+ * @func: (scope call): Function to call for each matching device
+ * @user_data: User data to pass to @func
+ *
+ * Call @func for every root device in the table which #ldm_device_has_type
+ * would have matched when the table was published, in table order. As with
+ * #ldm_manager_foreach, nothing is allocated, and the device is borrowed.
+ *
+ * Returns: FALSE if @func stopped the iteration, otherwise TRUE
+ */
+gboolean ldm_device_table_foreach(LdmDeviceTable *self, LdmDeviceType types, LdmDeviceFunc func,
+                                  gpointer user_data)
+{
+        GPtrArray *candidates = NULL;
+
+        g_return_val_if_fail(self != NULL, FALSE);
+        g_return_val_if_fail(func != NULL, FALSE);
+
+        candidates = self->entries;
+        for (guint i = 0; i < LDM_MANAGER_N_BUCKETS; i++) {
+                GPtrArray *bucket = self->by_type[i];
+
+                if ((types & (1u << i)) != 0 && bucket->len < candidates->len) {
+                        candidates = bucket;
+                }
+        }
+
+        for (guint i = 0; i < candidates->len; i++) {
+                LdmDeviceTableEntry *entry = candidates->pdata[i];
+
+                if (!ldm_device_table_entry_match(entry, types)) {
+                        continue;
+                }
+                if (!func(entry->device, user_data)) {
+                        return FALSE;
+                }
+        }
+
+        return TRUE;
+}
+
+/**
+ * ldm_manager_get_device_table:
+ *
+ * Grab the most recently published table of devices. This may be called
+ * from any thread without locking, and the table may then be read freely
+ * while the manager goes on to apply further changes.
+ *
+ * Returns: (transfer full): The current device table
+ */
+LdmDeviceTable *ldm_manager_get_device_table(LdmManager *self)
+{
+        LdmDeviceTable *table = NULL;
+
+        g_return_val_if_fail(self != NULL, NULL);
+
+        /* The writer keeps the old table alive until no reader is in here */
+        g_atomic_int_inc(&self->table.readers);
+        table = ldm_device_table_ref(g_atomic_pointer_get(&self->table.current));
+        g_atomic_int_add(&self->table.readers, -1);
+
+        return table;
+}
+
+/**
+ * ldm_manager_init_table:
+ *
+ * Publish an empty table, so that there is always a current one
+ */
+void ldm_manager_init_table(LdmManager *self)
+{
+        LdmDeviceTable *table = ldm_device_table_new(0);
+
+        for (guint i = 0; i < LDM_MANAGER_N_BUCKETS; i++) {
+                table->by_type[i] = g_ptr_array_new();
+        }
+
+        self->table.current = table;
+        self->table.entries =
+            g_hash_table_new_full(g_direct_hash,
+                                  g_direct_equal,
+                                  NULL,
+                                  (GDestroyNotify)ldm_device_table_entry_unref);
+        self->table.dirty = g_hash_table_new(g_direct_hash, g_direct_equal);
+}
+
+void ldm_manager_clear_table(LdmManager *self)
+{
+        g_clear_pointer(&self->table.dirty, g_hash_table_unref);
+        g_clear_pointer(&self->table.entries, g_hash_table_unref);
+        g_clear_pointer(&self->table.current, ldm_device_table_unref);
+}
+
+/**
+ * ldm_manager_touch_table:
+ * @device: Root device, or any device within its subtree
+ *
+ * The subtree of the root changed, or the root itself is new, so it needs
+ * a fresh entry in the next table
+ */
+void ldm_manager_touch_table(LdmManager *self, LdmDevice *device)
+{
+        while (device->tree.parent) {
+                device = device->tree.parent;
+        }
+        g_hash_table_add(self->table.dirty, device);
+}
+
+/**
+ * ldm_manager_untable_device:
+ * @device: Root device leaving the manager
+ *
+ * Drop the published entry of the root from the next table
+ */
+void ldm_manager_untable_device(LdmManager *self, LdmDevice *device)
+{
+        self->table.changed = TRUE;
+        g_hash_table_remove(self->table.dirty, device);
+        g_hash_table_remove(self->table.entries, device);
+}
+
+/**
+ * ldm_manager_publish_table:
+ *
+ * Publish the changes made since the last table, if any. Only the buckets
+ * that gained or lost a device, or hold one whose subtree changed, are
+ * rebuilt, as the rest are shared with the previous table.
+ *
+ * There is only ever one writer, the thread applying changes to the
+ * manager. The new table is swapped in atomically, and the previous one
+ * released once no reader can still be about to reference it.
+ */
+void ldm_manager_publish_table(LdmManager *self)
+{
+        LdmDeviceTable *previous = self->table.current;
+        LdmDeviceTable *table = NULL;
+        GHashTableIter iter = { 0 };
+        gpointer key = NULL;
+        guint buckets = self->table.buckets;
+
+        if (!self->table.changed && buckets == 0 && g_hash_table_size(self->table.dirty) == 0) {
+                return;
+        }
+
+        /* Fresh entries for changed subtrees, so every bucket holding them is stale */
+        g_hash_table_iter_init(&iter, self->table.dirty);
+        while (g_hash_table_iter_next(&iter, &key, NULL)) {
+                LdmDevice *device = key;
+
+                g_hash_table_insert(self->table.entries,
+                                    device,
+                                    ldm_device_table_entry_new(device));
+                buckets |= GPOINTER_TO_UINT(g_hash_table_lookup(self->buckets.masks, device));
+        }
+
+        table = ldm_device_table_new(previous->generation + 1);
+        for (guint i = 0; i < self->devices->len; i++) {
+                LdmDeviceTableEntry *entry = NULL;
+
+                entry = g_hash_table_lookup(self->table.entries, self->devices->pdata[i]);
+                g_ptr_array_add(table->entries, ldm_device_table_entry_ref(entry));
+        }
+
+        for (guint i = 0; i < LDM_MANAGER_N_BUCKETS; i++) {
+                GPtrArray *bucket = self->buckets.by_type[i];
+
+                if ((buckets & (1u << i)) == 0) {
+                        table->by_type[i] = g_ptr_array_ref(previous->by_type[i]);
+                        continue;
+                }
+
+                table->by_type[i] =
+                    g_ptr_array_new_full(bucket->len,
+                                         (GDestroyNotify)ldm_device_table_entry_unref);
+                for (guint j = 0; j < bucket->len; j++) {
+                        LdmDeviceTableEntry *entry = NULL;
+
+                        entry = g_hash_table_lookup(self->table.entries, bucket->pdata[j]);
+                        g_ptr_array_add(table->by_type[i], ldm_device_table_entry_ref(entry));
+                }
+        }
+
+        g_hash_table_remove_all(self->table.dirty);
+        self->table.buckets = 0;
+        self->table.changed = FALSE;
+
+        /* Any reader still between loading and referencing the old table has
+         * already announced itself, and new readers only see the new one */
+        g_atomic_pointer_set(&self->table.current, table);
+        while (g_atomic_int_get(&self->table.readers) > 0) {
+                g_thread_yield();
+        }
+        ldm_device_table_unref(previous);
+}
+
+/*
+ * Editor modelines  -  https://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: nil
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 expandtab:
+ * :indentSize=8:tabSize=8:noTabs=true:
+ */
@@ -0,0 +1,52 @@
+/*
+ * This file is part of linux-driver-management.
+ *
+ * Copyright © 2016-2018 Ikey Doherty
+ *
+ * linux-driver-management is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+#pragma once
+
+#include <glib-object.h>
+
+#include <device.h>
+#include <manager.h>
+
+G_BEGIN_DECLS
+
+typedef struct _LdmDeviceTable LdmDeviceTable;
+
+#define LDM_TYPE_DEVICE_TABLE ldm_device_table_get_type()
+
+GType ldm_device_table_get_type(void);
+
+LdmDeviceTable *ldm_manager_get_device_table(LdmManager *manager);
+
+LdmDeviceTable *ldm_device_table_ref(LdmDeviceTable *table);
+void ldm_device_table_unref(LdmDeviceTable *table);
+guint ldm_device_table_get_generation(LdmDeviceTable *table);
+guint ldm_device_table_get_n_devices(LdmDeviceTable *table);
+LdmDevice *ldm_device_table_get_device(LdmDeviceTable *table, guint index);
+gboolean ldm_device_table_foreach(LdmDeviceTable *table, LdmDeviceType types, LdmDeviceFunc func,
+                                  gpointer user_data);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(LdmDeviceTable, ldm_device_table_unref)
+
+G_END_DECLS
+
+/*
+ * Editor modelines  -  https://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: nil
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 expandtab:
+ * :indentSize=8:tabSize=8:noTabs=true:
+ */
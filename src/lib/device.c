@@ -14,6 +14,7 @@
 #include "device.h"
 #include "ldm-enums.h"
 #include "ldm-private.h"
+#include "stats.h"
 #include "util.h"
 
 /* Supported device types */
@@ -78,12 +79,12 @@ static void ldm_device_dispose(GObject *obj)
 {
         LdmDevice *self = LDM_DEVICE(obj);
 
-        g_clear_pointer(&self->tree.kids, g_hash_table_unref);
-        g_clear_pointer(&self->os.hwdb_info, g_hash_table_unref);
+        g_clear_pointer(&self->tree.modaliases, g_ptr_array_unref);
+        g_clear_pointer(&self->tree.kids, g_ptr_array_unref);
+        g_clear_pointer(&self->os.record, ldm_device_record_unref);
         g_clear_pointer(&self->os.sysfs_path, g_free);
         g_clear_pointer(&self->os.modalias, g_free);
         g_clear_pointer(&self->id.name, g_free);
-        g_clear_pointer(&self->id.vendor, g_free);
 
         G_OBJECT_CLASS(ldm_device_parent_class)->dispose(obj);
 }
@@ -242,12 +243,14 @@ static void ldm_device_get_property(GObject *object, guint id, GValue *value, GP
                 g_value_set_string(value, self->os.modalias);
                 break;
         case PROP_NAME:
+                ldm_device_resolve(self, LDM_DEVICE_DEFERRED_IDENTITY);
                 g_value_set_string(value, self->id.name);
                 break;
         case PROP_PRODUCT_ID:
                 g_value_set_int(value, self->id.product_id);
                 break;
         case PROP_VENDOR:
+                ldm_device_resolve(self, LDM_DEVICE_DEFERRED_IDENTITY);
                 g_value_set_string(value, self->id.vendor);
                 break;
         case PROP_VENDOR_ID:
@@ -257,6 +260,7 @@ static void ldm_device_get_property(GObject *object, guint id, GValue *value, GP
                 g_value_set_flags(value, self->os.devtype);
                 break;
         case PROP_ATTRIBUTES:
+                ldm_device_resolve(self, LDM_DEVICE_DEFERRED_ATTRIBUTES);
                 g_value_set_flags(value, self->os.attributes);
                 break;
         default:
@@ -272,11 +276,9 @@ static void ldm_device_get_property(GObject *object, guint id, GValue *value, GP
  */
 static void ldm_device_init(LdmDevice *self)
 {
-        /* Just set up the table for our properties */
-        self->os.hwdb_info = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
-
         /* We have sysfs ID to child mapping and own the child */
-        self->tree.kids = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_object_unref);
+        /* Most devices have no children at all, so don't preallocate */
+        self->tree.kids = g_ptr_array_new_full(0, g_object_unref);
 }
 
 /**
@@ -308,6 +310,7 @@ const gchar *ldm_device_get_modalias(LdmDevice *self)
 const gchar *ldm_device_get_name(LdmDevice *self)
 {
         g_return_val_if_fail(self != NULL, NULL);
+        ldm_device_resolve(self, LDM_DEVICE_DEFERRED_IDENTITY);
         return (const gchar *)self->id.name;
 }
 
@@ -325,6 +328,21 @@ const gchar *ldm_device_get_path(LdmDevice *self)
         return (const gchar *)self->os.sysfs_path;
 }
 
+/**
+ * ldm_device_get_subsystem:
+ *
+ * This function will return the kernel subsystem of this device, such
+ * as `pci` or `usb`. Devices restored from a snapshot only know their
+ * subsystem when it has a specialised #LdmDevice type.
+ *
+ * Returns: (transfer none) (nullable): The subsystem of the device
+ */
+const gchar *ldm_device_get_subsystem(LdmDevice *self)
+{
+        g_return_val_if_fail(self != NULL, NULL);
+        return self->os.subsystem;
+}
+
 /**
  * ldm_device_get_product_id:
  *
@@ -350,6 +368,7 @@ gint ldm_device_get_product_id(LdmDevice *self)
 const gchar *ldm_device_get_vendor(LdmDevice *self)
 {
         g_return_val_if_fail(self != NULL, NULL);
+        ldm_device_resolve(self, LDM_DEVICE_DEFERRED_IDENTITY);
         return (const gchar *)self->id.vendor;
 }
 
@@ -377,25 +396,58 @@ gint ldm_device_get_vendor_id(LdmDevice *self)
 }
 
 /**
- * ldm_device_new_from_udev:
+ * ldm_device_get_property:
+ * @key: udev property name, i.e. ID_MODEL_FROM_DATABASE
+ *
+ * Look up a udev (hwdb) property for this device, on demand, from the
+ * retained record. Nothing is copied, the returned string belongs to the
+ * record and lives as long as this device.
+ * This is private API between the manager and the device.
+ *
+ * Returns: (transfer none) (nullable): The property value, if set
+ */
+const gchar *ldm_device_get_property(LdmDevice *self, const gchar *key)
+{
+        g_return_val_if_fail(self != NULL, NULL);
+        g_return_val_if_fail(key != NULL, NULL);
+
+        if (!self->os.record) {
+                return NULL;
+        }
+
+        return ldm_device_record_get_property(self->os.record, key);
+}
+
+/**
+ * ldm_device_fallback_name:
+ *
+ * Name a device for which the hwdb has nothing, or only an empty string
+ */
+static gchar *ldm_device_fallback_name(LdmDevice *self)
+{
+        return g_strdup_printf("Device %x", self->id.product_id);
+}
+
+/**
+ * ldm_device_new_from_record:
  * @parent: (nullable): Parent device, if any.
- * @device: Associated udev device
- * @hwinfo: If set, the hwdb entry for this device.
+ * @record: Associated udev device, or offline record
  *
- * Construct a new LdmDevice from the given udev device and hwdb information.
+ * Construct a new LdmDevice from the given record. Only the name and
+ * vendor are extracted from the hwdb information up front, the record
+ * is retained so other properties can be fetched with #ldm_device_get_property.
  * This is private API between the manager and the device.
  */
-LdmDevice *ldm_device_new_from_udev(LdmDevice *parent, udev_device *device, udev_list *properties)
+LdmDevice *ldm_device_new_from_record(LdmDevice *parent, LdmDeviceRecord *record)
 {
-        udev_list *entry = NULL;
         LdmDevice *self = NULL;
-        gchar *lookup = NULL;
+        const gchar *lookup = NULL;
         const char *subsystem = NULL;
         GType special_type = 0;
-        const char *sysattr = NULL;
+        const char *modalias = NULL;
 
         /* Specialise the gtype here */
-        subsystem = udev_device_get_subsystem(device);
+        subsystem = ldm_device_record_get_subsystem(record);
         if (g_str_equal(subsystem, "usb")) {
                 special_type = LDM_TYPE_USB_DEVICE;
         } else if (g_str_equal(subsystem, "pci")) {
@@ -413,70 +465,259 @@ LdmDevice *ldm_device_new_from_udev(LdmDevice *parent, udev_device *device, udev
         }
 
         self = g_object_new(special_type, "parent", parent, NULL);
+        ldm_stats_add(LDM_STATS_DEVICES_CONSTRUCTED, 1);
 
         /* Set the absolute basics */
-        self->os.sysfs_path = g_strdup(udev_device_get_syspath(device));
-        sysattr = udev_device_get_sysattr_value(device, "modalias");
-        if (sysattr) {
-                self->os.modalias = g_strdup(sysattr);
+        self->os.sysfs_path = g_strdup(ldm_device_record_get_syspath(record));
+        self->os.subsystem = g_intern_string(subsystem);
+        /* The uevent copy avoids a sysfs read. Hand built devices may lack it. */
+        modalias = ldm_device_record_get_property(record, "MODALIAS");
+        if (!modalias) {
+                modalias = ldm_device_record_get_sysattr(record, "modalias");
         }
-
-        /* Shouldn't happen, but is definitely possible.. */
-        if (!properties) {
-                goto post_hwdb;
+        if (modalias) {
+                self->os.modalias = g_strdup(modalias);
         }
 
-        /* Duplicate the hardware data into a private table */
-        udev_list_entry_foreach(entry, properties)
-        {
-                const char *prop_id = NULL;
-                const char *value = NULL;
-
-                prop_id = udev_list_entry_get_name(entry);
-                value = udev_list_entry_get_value(entry);
-
-                g_hash_table_insert(self->os.hwdb_info, g_strdup(prop_id), g_strdup(value));
-        }
+        /* Retain the record for on demand property lookups */
+        self->os.record = ldm_device_record_ref(record);
 
         /* Set vendor from hwdb information */
-        lookup = g_hash_table_lookup(self->os.hwdb_info, "ID_VENDOR_FROM_DATABASE");
+        lookup = ldm_device_get_property(self, "ID_VENDOR_FROM_DATABASE");
         if (!lookup) {
-                lookup = g_hash_table_lookup(self->os.hwdb_info, "ID_VENDOR");
+                lookup = ldm_device_get_property(self, "ID_VENDOR");
         }
-        if (lookup) {
-                self->id.vendor = g_strdup(lookup);
+        if (lookup && *lookup) {
+                self->id.vendor = g_intern_string(lookup);
                 lookup = NULL;
         }
 
         /* Set name from hwdb information. TODO: Add fallback name! */
-        lookup = g_hash_table_lookup(self->os.hwdb_info, "ID_MODEL_FROM_DATABASE");
+        lookup = ldm_device_get_property(self, "ID_MODEL_FROM_DATABASE");
         if (!lookup) {
-                lookup = g_hash_table_lookup(self->os.hwdb_info, "ID_MODEL");
+                lookup = ldm_device_get_property(self, "ID_MODEL");
         }
-        if (lookup) {
+        if (lookup && *lookup) {
                 self->id.name = g_strdup(lookup);
                 lookup = NULL;
         }
 
-post_hwdb:
-
         if (special_type == LDM_TYPE_PCI_DEVICE) {
-                ldm_pci_device_init_private(self, device);
+                ldm_pci_device_init_private(self, record);
         } else if (special_type == LDM_TYPE_USB_DEVICE) {
-                ldm_usb_device_init_private(self, device);
+                ldm_usb_device_init_private(self, record);
         } else if (special_type == LDM_TYPE_DMI_DEVICE) {
-                ldm_dmi_device_init_private(self, device);
+                ldm_dmi_device_init_private(self, record);
         } else if (special_type == LDM_TYPE_BLUETOOTH_DEVICE) {
-                ldm_bluetooth_device_init_private(self, device);
+                ldm_bluetooth_device_init_private(self, record);
         }
 
-        if (!self->id.name) {
-                self->id.name = g_strdup_printf("Device %x", self->id.product_id);
+        if (!self->id.name && (self->os.deferred & LDM_DEVICE_DEFERRED_IDENTITY) == 0) {
+                self->id.name = ldm_device_fallback_name(self);
         }
 
         return self;
 }
 
+/**
+ * ldm_device_resolve_deferred:
+ * @deferred: Bitwise OR of the #LdmDeviceDeferred fields to resolve
+ *
+ * Second phase of construction from udev, performing the sysfs reads that
+ * were skipped by #ldm_device_new_from_record. Each field is only resolved
+ * once. Use the ldm_device_resolve wrapper rather than calling this.
+ *
+ * Devices are resolved in full by the manager before being published in
+ * an #LdmDeviceTable, so this only ever runs in the thread of the manager,
+ * and the fields are flagged as resolved once they have been written.
+ *
+ * This is private API between the device and its subclasses.
+ */
+void ldm_device_resolve_deferred(LdmDevice *self, guint deferred)
+{
+        guint pending = self->os.deferred & deferred;
+        GType type = G_OBJECT_TYPE(self);
+
+        if (pending == 0) {
+                return;
+        }
+
+        if (!self->os.record) {
+                goto done;
+        }
+        if (type == LDM_TYPE_PCI_DEVICE) {
+                ldm_pci_device_resolve_private(self, self->os.record, pending);
+        } else if (type == LDM_TYPE_DMI_DEVICE) {
+                ldm_dmi_device_resolve_private(self, self->os.record, pending);
+        }
+
+done:
+        g_atomic_int_and(&self->os.deferred, ~pending);
+}
+
+/**
+ * ldm_device_snapshot_type:
+ *
+ * Map a GType name stored in a snapshot back to one of our own device
+ * types. Anything unknown is rejected rather than instantiated.
+ */
+static GType ldm_device_snapshot_type(const gchar *name)
+{
+        GType types[] = {
+                LDM_TYPE_DEVICE,     LDM_TYPE_USB_DEVICE,       LDM_TYPE_PCI_DEVICE,
+                LDM_TYPE_DMI_DEVICE, LDM_TYPE_HID_DEVICE,       LDM_TYPE_BLUETOOTH_DEVICE,
+                LDM_TYPE_WIFI_DEVICE,
+        };
+
+        for (size_t i = 0; i < G_N_ELEMENTS(types); i++) {
+                if (g_str_equal(g_type_name(types[i]), name)) {
+                        return types[i];
+                }
+        }
+
+        return G_TYPE_INVALID;
+}
+
+/**
+ * ldm_device_snapshot_subsystem:
+ *
+ * Snapshots don't store the subsystem, but each of our specialised types
+ * is only ever constructed for a single one.
+ */
+static const gchar *ldm_device_snapshot_subsystem(GType type)
+{
+        if (type == LDM_TYPE_USB_DEVICE) {
+                return "usb";
+        } else if (type == LDM_TYPE_PCI_DEVICE) {
+                return "pci";
+        } else if (type == LDM_TYPE_DMI_DEVICE) {
+                return "dmi";
+        } else if (type == LDM_TYPE_HID_DEVICE) {
+                return "hid";
+        } else if (type == LDM_TYPE_BLUETOOTH_DEVICE) {
+                return "bluetooth";
+        } else if (type == LDM_TYPE_WIFI_DEVICE) {
+                return "ieee80211";
+        }
+
+        return NULL;
+}
+
+/**
+ * ldm_device_snapshot_append_uint:
+ *
+ * Append a numeric field to a snapshot line, in hexadecimal
+ */
+static void ldm_device_snapshot_append_uint(GString *line, guint64 value)
+{
+        g_string_append_printf(line, "\t%" G_GINT64_MODIFIER "x", value);
+}
+
+/**
+ * ldm_device_snapshot_uint:
+ *
+ * Parse a numeric snapshot field
+ *
+ * Returns: TRUE if @field held a valid number
+ */
+static gboolean ldm_device_snapshot_uint(const gchar *field, guint64 *value)
+{
+        return g_ascii_string_to_unsigned(field, 16, 0, G_MAXUINT, value, NULL);
+}
+
+/**
+ * ldm_device_save_snapshot:
+ * @line: Snapshot line to append the device fields to
+ *
+ * Store everything that was extracted from udev at construction time, so
+ * that an identical device can be rebuilt by #ldm_device_new_from_snapshot.
+ * The fields are appended in #LdmSnapshotField order.
+ * This is private API between the manager and the device.
+ */
+void ldm_device_save_snapshot(LdmDevice *self, GString *line)
+{
+        ldm_device_resolve(self, LDM_DEVICE_DEFERRED_ALL);
+
+        ldm_snapshot_append_field(line, G_OBJECT_TYPE_NAME(self));
+        ldm_snapshot_append_field(line, self->os.sysfs_path);
+        ldm_snapshot_append_field(line, self->os.modalias);
+        ldm_snapshot_append_field(line, self->id.name);
+        ldm_snapshot_append_field(line, self->id.vendor);
+        ldm_device_snapshot_append_uint(line, (guint)self->id.product_id);
+        ldm_device_snapshot_append_uint(line, (guint)self->id.vendor_id);
+        ldm_device_snapshot_append_uint(line, self->os.devtype);
+        ldm_device_snapshot_append_uint(line, self->os.attributes);
+
+        if (G_OBJECT_TYPE(self) == LDM_TYPE_PCI_DEVICE) {
+                ldm_pci_device_save_private(self, line);
+        } else {
+                ldm_snapshot_append_field(line, NULL);
+        }
+}
+
+/**
+ * ldm_device_new_from_snapshot:
+ * @parent: (nullable): Parent device, if any.
+ * @fields: The #LDM_SNAPSHOT_N_FIELDS fields of the device line
+ *
+ * Rebuild a device previously stored with #ldm_device_save_snapshot, without
+ * touching sysfs. No record is retained, so #ldm_device_get_property
+ * will not find anything for the new device.
+ * This is private API between the manager and the device.
+ *
+ * Returns: (transfer full) (nullable): A new device, or NULL if invalid
+ */
+LdmDevice *ldm_device_new_from_snapshot(LdmDevice *parent, gchar **fields)
+{
+        LdmDevice *self = NULL;
+        GType type = G_TYPE_INVALID;
+        guint64 product_id = 0;
+        guint64 vendor_id = 0;
+        guint64 devtype = 0;
+        guint64 attributes = 0;
+
+        type = ldm_device_snapshot_type(fields[LDM_SNAPSHOT_FIELD_TYPE]);
+        if (type == G_TYPE_INVALID || !*fields[LDM_SNAPSHOT_FIELD_PATH]) {
+                return NULL;
+        }
+        if (!ldm_device_snapshot_uint(fields[LDM_SNAPSHOT_FIELD_PRODUCT_ID], &product_id) ||
+            !ldm_device_snapshot_uint(fields[LDM_SNAPSHOT_FIELD_VENDOR_ID], &vendor_id) ||
+            !ldm_device_snapshot_uint(fields[LDM_SNAPSHOT_FIELD_DEVICE_TYPE], &devtype) ||
+            !ldm_device_snapshot_uint(fields[LDM_SNAPSHOT_FIELD_ATTRIBUTES], &attributes)) {
+                return NULL;
+        }
+
+        self = g_object_new(type, "parent", parent, NULL);
+        self->os.sysfs_path = g_strdup(fields[LDM_SNAPSHOT_FIELD_PATH]);
+        self->os.subsystem = g_intern_static_string(ldm_device_snapshot_subsystem(type));
+        if (*fields[LDM_SNAPSHOT_FIELD_MODALIAS]) {
+                self->os.modalias = g_strdup(fields[LDM_SNAPSHOT_FIELD_MODALIAS]);
+        }
+        if (*fields[LDM_SNAPSHOT_FIELD_VENDOR]) {
+                self->id.vendor = g_intern_string(fields[LDM_SNAPSHOT_FIELD_VENDOR]);
+        }
+        self->id.product_id = (gint)product_id;
+        self->id.vendor_id = (gint)vendor_id;
+        self->os.devtype = (guint)devtype;
+        self->os.attributes = (guint)attributes;
+
+        /* Empty fields were absent, as the live constructor treats them */
+        if (*fields[LDM_SNAPSHOT_FIELD_NAME]) {
+                self->id.name = g_strdup(fields[LDM_SNAPSHOT_FIELD_NAME]);
+        } else {
+                self->id.name = ldm_device_fallback_name(self);
+        }
+
+        if (type == LDM_TYPE_PCI_DEVICE &&
+            !ldm_pci_device_restore_private(self, fields[LDM_SNAPSHOT_FIELD_PRIVATE])) {
+                g_object_unref(g_object_ref_sink(self));
+                return NULL;
+        }
+
+        ldm_stats_add(LDM_STATS_DEVICES_CONSTRUCTED, 1);
+        return self;
+}
+
 /**
  * ldm_device_get_device_type:
  *
@@ -506,10 +747,6 @@ LdmDeviceType ldm_device_get_device_type(LdmDevice *self)
  */
 gboolean ldm_device_has_type(LdmDevice *self, LdmDeviceType mask)
 {
-        GHashTableIter iter = { 0 };
-        __ldm_unused__ void *key = NULL;
-        LdmDevice *value = NULL;
-
         g_return_val_if_fail(self != NULL, FALSE);
 
         /* Do we match? */
@@ -518,9 +755,8 @@ gboolean ldm_device_has_type(LdmDevice *self, LdmDeviceType mask)
         }
 
         /* Walk children */
-        g_hash_table_iter_init(&iter, self->tree.kids);
-        while (g_hash_table_iter_next(&iter, (void **)&key, (void **)&value)) {
-                if (ldm_device_has_type(value, mask)) {
+        for (guint i = 0; i < self->tree.kids->len; i++) {
+                if (ldm_device_has_type(self->tree.kids->pdata[i], mask)) {
                         return TRUE;
                 }
         }
@@ -537,6 +773,7 @@ gboolean ldm_device_has_type(LdmDevice *self, LdmDeviceType mask)
 LdmDeviceAttribute ldm_device_get_attributes(LdmDevice *self)
 {
         g_return_val_if_fail(self != NULL, LDM_DEVICE_ATTRIBUTE_ANY);
+        ldm_device_resolve(self, LDM_DEVICE_DEFERRED_ATTRIBUTES);
         return self->os.attributes;
 }
 
@@ -557,21 +794,18 @@ LdmDeviceAttribute ldm_device_get_attributes(LdmDevice *self)
  */
 gboolean ldm_device_has_attribute(LdmDevice *self, LdmDeviceAttribute mask)
 {
-        GHashTableIter iter = { 0 };
-        __ldm_unused__ void *key = NULL;
-        LdmDevice *value = NULL;
-
         g_return_val_if_fail(self != NULL, FALSE);
 
+        ldm_device_resolve(self, LDM_DEVICE_DEFERRED_ATTRIBUTES);
+
         /* Do we match? */
         if ((self->os.attributes & mask) == mask) {
                 return TRUE;
         }
 
         /* Walk children */
-        g_hash_table_iter_init(&iter, self->tree.kids);
-        while (g_hash_table_iter_next(&iter, (void **)&key, (void **)&value)) {
-                if (ldm_device_has_type(value, mask)) {
+        for (guint i = 0; i < self->tree.kids->len; i++) {
+                if (ldm_device_has_type(self->tree.kids->pdata[i], mask)) {
                         return TRUE;
                 }
         }
@@ -597,15 +831,131 @@ LdmDevice *ldm_device_get_parent(LdmDevice *self)
 /**
  * ldm_device_get_children:
  *
- * Return any child devices, if any
+ * Return any child devices, if any. This allocates a new list on each
+ * call, so tree walks should prefer #ldm_device_get_n_children and
+ * #ldm_device_get_child instead.
  *
  * Returns: (element-type Ldm.Device) (transfer container): a list of all child devices
  */
 GList *ldm_device_get_children(LdmDevice *self)
+{
+        GList *ret = NULL;
+
+        g_return_val_if_fail(self != NULL, NULL);
+
+        for (guint i = self->tree.kids->len; i > 0; i--) {
+                ret = g_list_prepend(ret, self->tree.kids->pdata[i - 1]);
+        }
+
+        return ret;
+}
+
+/**
+ * ldm_device_get_n_children:
+ *
+ * Returns: The number of child devices
+ */
+guint ldm_device_get_n_children(LdmDevice *self)
+{
+        g_return_val_if_fail(self != NULL, 0);
+
+        return self->tree.kids->len;
+}
+
+/**
+ * ldm_device_get_child:
+ * @index: Position of the child, less than #ldm_device_get_n_children
+ *
+ * Children are kept in the order they were added, and may be visited
+ * without allocating anything:
+ *
+ * |[<!-- language="C" -->
+ *      for (guint i = 0; i < ldm_device_get_n_children(device); i++) {
+ *              LdmDevice *child = ldm_device_get_child(device, i);
+ *      }
+ * ]|
+ *
+ * Returns: (transfer none): The child device at @index
+ */
+LdmDevice *ldm_device_get_child(LdmDevice *self, guint index)
+{
+        g_return_val_if_fail(self != NULL, NULL);
+        g_return_val_if_fail(index < self->tree.kids->len, NULL);
+
+        return self->tree.kids->pdata[index];
+}
+
+/**
+ * ldm_device_find_child:
+ *
+ * Find the position of the child with the given path. Devices only ever
+ * have a handful of children, so a linear scan beats hashing here.
+ */
+static gboolean ldm_device_find_child(LdmDevice *self, const gchar *path, guint *index)
+{
+        for (guint i = 0; i < self->tree.kids->len; i++) {
+                LdmDevice *child = self->tree.kids->pdata[i];
+
+                if (g_str_equal(child->os.sysfs_path, path)) {
+                        *index = i;
+                        return TRUE;
+                }
+        }
+
+        return FALSE;
+}
+
+/**
+ * ldm_device_collect_modaliases:
+ *
+ * Append the modalias of the device and its descendants, in preorder.
+ */
+static void ldm_device_collect_modaliases(LdmDevice *self, GPtrArray *modaliases)
+{
+        if (self->os.modalias) {
+                g_ptr_array_add(modaliases, self->os.modalias);
+        }
+        for (guint i = 0; i < self->tree.kids->len; i++) {
+                ldm_device_collect_modaliases(self->tree.kids->pdata[i], modaliases);
+        }
+}
+
+/**
+ * ldm_device_invalidate_modaliases:
+ *
+ * The subtree of this device changed, as did that of each ancestor.
+ */
+static void ldm_device_invalidate_modaliases(LdmDevice *self)
+{
+        for (LdmDevice *node = self; node; node = node->tree.parent) {
+                g_clear_pointer(&node->tree.modaliases, g_ptr_array_unref);
+        }
+}
+
+/**
+ * ldm_device_get_subtree_modaliases:
+ *
+ * Collect the modaliases of the device and all of its descendants into one
+ * contiguous vector, device first, so that matching may scan a flat array
+ * instead of walking the tree for every rule. The vector is cached until
+ * the children of the device change, and the strings are owned by the
+ * devices themselves.
+ *
+ * This is not thread safe, so the manager collects the vector before any
+ * concurrent matching takes place.
+ *
+ * Returns: (transfer none): Modaliases of the subtree, possibly empty
+ */
+GPtrArray *ldm_device_get_subtree_modaliases(LdmDevice *self)
 {
         g_return_val_if_fail(self != NULL, NULL);
 
-        return g_hash_table_get_values(self->tree.kids);
+        if (!self->tree.modaliases) {
+                self->tree.modaliases = g_ptr_array_new();
+                ldm_device_collect_modaliases(self, self->tree.modaliases);
+        }
+
+        return self->tree.modaliases;
 }
 
 /**
@@ -619,13 +969,22 @@ GList *ldm_device_get_children(LdmDevice *self)
  */
 void ldm_device_add_child(LdmDevice *self, LdmDevice *child)
 {
-        const gchar *id = NULL;
+        guint index = 0;
         g_return_if_fail(self != NULL);
 
-        id = ldm_device_get_path(child);
-        if (!g_hash_table_replace(self->tree.kids, g_strdup(id), g_object_ref_sink(child))) {
+        ldm_device_invalidate_modaliases(self);
+
+        /* Replace any existing child with the same path in place. The new one
+         * is claimed first, as it may only be kept alive by the old slot */
+        if (ldm_device_find_child(self, ldm_device_get_path(child), &index)) {
+                LdmDevice *old = self->tree.kids->pdata[index];
+
+                self->tree.kids->pdata[index] = g_object_ref_sink(child);
+                g_object_unref(old);
                 return;
         }
+
+        g_ptr_array_add(self->tree.kids, g_object_ref_sink(child));
 }
 
 /**
@@ -652,11 +1011,16 @@ void ldm_device_remove_child(LdmDevice *self, LdmDevice *child)
  */
 void ldm_device_remove_child_by_path(LdmDevice *self, const gchar *path)
 {
+        guint index = 0;
         g_return_if_fail(self != NULL);
 
-        if (!g_hash_table_remove(self->tree.kids, path)) {
+        if (!ldm_device_find_child(self, path, &index)) {
                 return;
         }
+
+        /* Retain the order of the remaining children */
+        ldm_device_invalidate_modaliases(self);
+        g_ptr_array_remove_index(self->tree.kids, index);
 }
 
 /**
@@ -667,9 +1031,14 @@ void ldm_device_remove_child_by_path(LdmDevice *self, const gchar *path)
  */
 LdmDevice *ldm_device_get_child_by_path(LdmDevice *self, const gchar *path)
 {
+        guint index = 0;
         g_return_val_if_fail(self != NULL, NULL);
 
-        return g_hash_table_lookup(self->tree.kids, path);
+        if (!ldm_device_find_child(self, path, &index)) {
+                return NULL;
+        }
+
+        return self->tree.kids->pdata[index];
 }
 
 /*
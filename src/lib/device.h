@@ -106,6 +106,7 @@ const gchar *ldm_device_get_modalias(LdmDevice *device);
 const gchar *ldm_device_get_name(LdmDevice *device);
 const gchar *ldm_device_get_path(LdmDevice *device);
 gint ldm_device_get_product_id(LdmDevice *device);
+const gchar *ldm_device_get_subsystem(LdmDevice *device);
 const gchar *ldm_device_get_vendor(LdmDevice *device);
 gint ldm_device_get_vendor_id(LdmDevice *device);
 LdmDeviceType ldm_device_get_device_type(LdmDevice *device);
@@ -116,6 +117,8 @@ gboolean ldm_device_has_attribute(LdmDevice *device, LdmDeviceAttribute mask);
 
 LdmDevice *ldm_device_get_parent(LdmDevice *device);
 GList *ldm_device_get_children(LdmDevice *device);
+guint ldm_device_get_n_children(LdmDevice *device);
+LdmDevice *ldm_device_get_child(LdmDevice *device, guint index);
 
 G_DEFINE_AUTOPTR_CLEANUP_FUNC(LdmDevice, g_object_unref)
 
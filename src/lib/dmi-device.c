@@ -101,19 +101,38 @@ static void ldm_dmi_device_init(LdmDMIDevice *self)
 
 /**
  * ldm_dmi_device_init_private:
- * @device: The udev device that we're being created from
+ * @record: The record that we're being created from
  *
- * Handle DMI specific initialisation
+ * Handle DMI specific initialisation. The board vendor and name live in
+ * their own sysfs attributes, so are deferred until first requested.
  */
-void ldm_dmi_device_init_private(LdmDevice *self, __ldm_unused__ udev_device *device)
+void ldm_dmi_device_init_private(LdmDevice *self, __ldm_unused__ LdmDeviceRecord *record)
+{
+        self->os.deferred |= LDM_DEVICE_DEFERRED_IDENTITY;
+}
+
+/**
+ * ldm_dmi_device_resolve_private:
+ * @record: The record that we were created from
+ * @deferred: The #LdmDeviceDeferred fields to resolve
+ *
+ * Handle the deferred DMI specific initialisation
+ */
+void ldm_dmi_device_resolve_private(LdmDevice *self, LdmDeviceRecord *record, guint deferred)
 {
         const char *sysattr = NULL;
 
-        sysattr = udev_device_get_sysattr_value(device, "board_vendor");
-        self->id.vendor = sysattr ? g_strdup(sysattr) : g_strdup("Unknown Vendor");
+        if ((deferred & LDM_DEVICE_DEFERRED_IDENTITY) == 0) {
+                return;
+        }
+
+        sysattr = ldm_device_record_get_sysattr(record, "board_vendor");
+        self->id.vendor =
+            sysattr ? g_intern_string(sysattr) : g_intern_static_string("Unknown Vendor");
         sysattr = NULL;
 
-        sysattr = udev_device_get_sysattr_value(device, "board_name");
+        sysattr = ldm_device_record_get_sysattr(record, "board_name");
+        g_free(self->id.name);
         self->id.name = sysattr ? g_strdup(sysattr) : g_strdup("Platform device");
 }
 
@@ -18,12 +18,16 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 #include "device.h"
 #include "glx-manager.h"
+#include "ldm-private.h"
 #include "pci-device.h"
+#include "stats.h"
 #include "util.h"
+#include "xorg-config.h"
 
 struct _LdmGLXManagerClass {
         GObjectClass parent_class;
@@ -57,6 +61,13 @@ struct _LdmGLXManagerClass {
  * Wayland compositors will set up offscreen surfaces with libGL_nvidia via glvnd and then
  * render the final result to the Intel device GL context (libGL_mesa). For non Optimus systems
  * they would simply use the primary GPU and GL implementation.
+ *
+ * The desired configuration is always computed up front, and hashed along with the identity
+ * of every file it touches into a small state file. When the hardware, drivers and files are
+ * exactly as they were left by the last run, nothing is rewritten or rescanned at all.
+ *
+ * Every path is normally absolute, but may be placed under another
+ * #LdmGLXManager:root, such as an image being prepared offline.
  */
 
 /*
@@ -69,22 +80,53 @@ struct _LdmGLXManagerClass {
 struct _LdmGLXManager {
         GObject parent;
 
+        gchar *root;
         gchar *stock_xorg_config;
         gchar *glx_xorg_config;
+        gchar *state_file;
+        gchar *hybrid_file;
+        gchar *gpu_cache_file;
+        gchar *module_directory;
 };
 
 G_DEFINE_TYPE(LdmGLXManager, ldm_glx_manager, G_TYPE_OBJECT)
 
+/* Property IDs */
+enum { PROP_ROOT = 1, N_PROPS };
+
+static GParamSpec *obj_properties[N_PROPS] = {
+        NULL,
+};
+
+typedef enum {
+        LDM_GLX_MODE_NONE = 0, /* Remove all of our configuration */
+        LDM_GLX_MODE_SIMPLE,
+        LDM_GLX_MODE_OPTIMUS,
+} LdmGLXMode;
+
+/*
+ * LdmGLXPlan
+ *
+ * Everything we want on disk for a given configuration, computed before
+ * touching any file, so it can be compared with what was last applied.
+ */
+typedef struct LdmGLXPlan {
+        LdmGLXMode mode;
+        gchar *xorg_config; /* Contents of the GLX snippet, unless LDM_GLX_MODE_NONE */
+        gchar *gpu_cache;   /* Contents of the GPU cache, unless LDM_GLX_MODE_NONE */
+        gsize gpu_cache_len;
+} LdmGLXPlan;
+
 /* Helpers for xorg configurations */
-static gboolean ldm_xorg_config_has_driver(const gchar *path, const gchar *driver);
-static gboolean ldm_xorg_config_write_simple(const gchar *path, LdmDevice *device);
-static gboolean ldm_xorg_config_write_optimus(const gchar *path, LdmDevice *device);
-static gboolean ldm_xorg_driver_present(LdmDevice *device);
+static gchar *ldm_xorg_config_build_simple(LdmGPUConfig *config, LdmDevice *device);
+static gchar *ldm_xorg_config_build_optimus(LdmDevice *device);
+static gboolean ldm_xorg_config_write(const gchar *path, const gchar *contents);
+static gboolean ldm_xorg_driver_present(LdmGLXManager *self, LdmDevice *device);
 
 /* Private helpers for our class */
-static gboolean ldm_glx_manager_configure_optimus(LdmGLXManager *self, LdmGPUConfig *config);
-static gboolean ldm_glx_manager_configure_simple(LdmGLXManager *self, LdmGPUConfig *config);
-static void ldm_glx_manager_nuke_legacy(void);
+static gboolean ldm_glx_manager_configure_optimus(LdmGLXManager *self, const LdmGLXPlan *plan);
+static gboolean ldm_glx_manager_configure_simple(LdmGLXManager *self, const LdmGLXPlan *plan);
+static void ldm_glx_manager_nuke_legacy(LdmGLXManager *self);
 
 /**
  * ldm_glx_manager_dispose:
@@ -95,12 +137,77 @@ static void ldm_glx_manager_dispose(GObject *obj)
 {
         LdmGLXManager *self = LDM_GLX_MANAGER(obj);
 
+        g_clear_pointer(&self->root, g_free);
         g_clear_pointer(&self->stock_xorg_config, g_free);
         g_clear_pointer(&self->glx_xorg_config, g_free);
+        g_clear_pointer(&self->state_file, g_free);
+        g_clear_pointer(&self->hybrid_file, g_free);
+        g_clear_pointer(&self->gpu_cache_file, g_free);
+        g_clear_pointer(&self->module_directory, g_free);
 
         G_OBJECT_CLASS(ldm_glx_manager_parent_class)->dispose(obj);
 }
 
+/**
+ * ldm_glx_manager_constructed:
+ *
+ * Place every path we manage or inspect under the root
+ */
+static void ldm_glx_manager_constructed(GObject *obj)
+{
+        LdmGLXManager *self = LDM_GLX_MANAGER(obj);
+        const gchar *root = self->root ? self->root : "/";
+
+        /* Primary X.Org configuration */
+        self->stock_xorg_config = g_build_filename(root, SYSCONFDIR, "X11", "xorg.conf", NULL);
+
+        /* Where we'll make our config changes */
+        self->glx_xorg_config =
+            g_build_filename(root, SYSCONFDIR, "X11", "xorg.conf.d", "00-ldm.conf", NULL);
+
+        /* Hash of the last applied configuration */
+        self->state_file = g_build_filename(root, LDM_GLX_STATE_FILE, NULL);
+
+        /* Tracking files for ldm-session-init */
+        self->hybrid_file = g_build_filename(root, LDM_HYBRID_FILE, NULL);
+        self->gpu_cache_file = g_build_filename(root, LDM_GPU_CACHE_FILE, NULL);
+
+        self->module_directory = g_build_filename(root, XORG_MODULE_DIRECTORY, NULL);
+
+        G_OBJECT_CLASS(ldm_glx_manager_parent_class)->constructed(obj);
+}
+
+static void ldm_glx_manager_set_property(GObject *object, guint id, const GValue *value,
+                                         GParamSpec *spec)
+{
+        LdmGLXManager *self = LDM_GLX_MANAGER(object);
+
+        switch (id) {
+        case PROP_ROOT:
+                g_clear_pointer(&self->root, g_free);
+                self->root = g_value_dup_string(value);
+                break;
+        default:
+                G_OBJECT_WARN_INVALID_PROPERTY_ID(object, id, spec);
+                break;
+        }
+}
+
+static void ldm_glx_manager_get_property(GObject *object, guint id, GValue *value,
+                                         GParamSpec *spec)
+{
+        LdmGLXManager *self = LDM_GLX_MANAGER(object);
+
+        switch (id) {
+        case PROP_ROOT:
+                g_value_set_string(value, self->root);
+                break;
+        default:
+                G_OBJECT_WARN_INVALID_PROPERTY_ID(object, id, spec);
+                break;
+        }
+}
+
 /**
  * ldm_glx_manager_class_init:
  *
@@ -112,6 +219,24 @@ static void ldm_glx_manager_class_init(LdmGLXManagerClass *klazz)
 
         /* gobject vtable hookup */
         obj_class->dispose = ldm_glx_manager_dispose;
+        obj_class->constructed = ldm_glx_manager_constructed;
+        obj_class->set_property = ldm_glx_manager_set_property;
+        obj_class->get_property = ldm_glx_manager_get_property;
+
+        /**
+         * LdmGLXManager:root
+         *
+         * Directory that every configuration and tracking file is placed
+         * under, or NULL for the running system.
+         */
+        obj_properties[PROP_ROOT] = g_param_spec_string("root",
+                                                        "Root directory",
+                                                        "Directory the managed files live under",
+                                                        NULL,
+                                                        G_PARAM_CONSTRUCT_ONLY |
+                                                            G_PARAM_READWRITE);
+
+        g_object_class_install_properties(obj_class, N_PROPS, obj_properties);
 }
 
 /**
@@ -119,14 +244,8 @@ static void ldm_glx_manager_class_init(LdmGLXManagerClass *klazz)
  *
  * Handle construction of the LdmGLXManager
  */
-static void ldm_glx_manager_init(LdmGLXManager *self)
+static void ldm_glx_manager_init(__ldm_unused__ LdmGLXManager *self)
 {
-        /* Primary X.Org configuration */
-        self->stock_xorg_config = g_build_filename(SYSCONFDIR, "X11", "xorg.conf", NULL);
-
-        /* Where we'll make our config changes */
-        self->glx_xorg_config =
-            g_build_filename(SYSCONFDIR, "X11", "xorg.conf.d", "00-ldm.conf", NULL);
 }
 
 /**
@@ -141,59 +260,6 @@ LdmGLXManager *ldm_glx_manager_new()
         return g_object_new(LDM_TYPE_GLX_MANAGER, NULL);
 }
 
-static gboolean ldm_xorg_config_has_driver(const gchar *path, const gchar *driver)
-{
-        FILE *fp = NULL;
-        char *bfr = NULL;
-        size_t n = 0;
-        ssize_t read = 0;
-        g_autofree gchar *driv_name = NULL;
-        gboolean ret = FALSE;
-
-        if (access(path, F_OK) != 0) {
-                return FALSE;
-        }
-
-        fp = fopen(path, "r");
-        if (!fp) {
-                return FALSE;
-        }
-
-        driv_name = g_strdup_printf("\"%s\"", driver);
-
-        while ((read = getline(&bfr, &n, fp)) > 0) {
-                gchar *work = NULL;
-
-                /* Strip the newline from it */
-                if (bfr[read - 1] == '\n') {
-                        bfr[read - 1] = '\0';
-                        --read;
-                }
-
-                /* Empty lines are uninteresting. */
-                if (read < 1) {
-                        continue;
-                }
-
-                work = g_strstrip(bfr);
-                if (g_str_has_prefix(work, "Driver") && g_str_has_suffix(work, driv_name)) {
-                        ret = TRUE;
-                        break;
-                }
-
-                free(bfr);
-                bfr = NULL;
-        }
-
-        if (bfr) {
-                free(bfr);
-        }
-
-        fclose(fp);
-
-        return ret;
-}
-
 /**
  * ldm_xorg_config_id:
  * @device: Device to find a "pretty" ID for
@@ -236,17 +302,14 @@ static inline const gchar *ldm_xorg_config_driver(LdmDevice *device)
 }
 
 /**
- * ldm_xorg_config_write_simple:
+ * ldm_xorg_config_write:
  * @path: File path to alter
- * @device: Device to emit into the X.Org configuration
+ * @contents: New contents of the file
  */
-static gboolean ldm_xorg_config_write_simple(const gchar *path, LdmDevice *device)
+static gboolean ldm_xorg_config_write(const gchar *path, const gchar *contents)
 {
         g_autoptr(GError) error = NULL;
         g_autofree gchar *dirname = NULL;
-        g_autofree gchar *contents = NULL;
-        const gchar *device_id = NULL;
-        const gchar *driver = NULL;
 
         dirname = g_path_get_dirname(path);
         if (!dirname) {
@@ -260,77 +323,129 @@ static gboolean ldm_xorg_config_write_simple(const gchar *path, LdmDevice *devic
                 return FALSE;
         }
 
+        /* Write the file */
+        if (!g_file_set_contents(path, contents, (gssize)strlen(contents), &error)) {
+                g_warning("Failed to set X.Org config %s: %s", path, error->message);
+                return FALSE;
+        }
+
+        return TRUE;
+}
+
+/**
+ * ldm_xorg_config_append_device:
+ * @index: Position of the device, 0 being the primary
+ * @bus_id: Whether to pin the section to the PCI address of the device
+ */
+static void ldm_xorg_config_append_device(GString *config, LdmDevice *device, guint index,
+                                          gboolean bus_id)
+{
+        const gchar *device_id = ldm_xorg_config_id(device);
+        g_autofree gchar *address = NULL;
+
+        if (index > 0) {
+                g_string_append_printf(config,
+                                       "\nSection \"Device\"\n"
+                                       "        Identifier \"%s Card %u\"\n",
+                                       device_id,
+                                       index);
+        } else {
+                g_string_append_printf(config,
+                                       "Section \"Device\"\n"
+                                       "        Identifier \"%s Card\"\n",
+                                       device_id);
+        }
+        g_string_append_printf(config, "        Driver \"%s\"\n", ldm_xorg_config_driver(device));
+        if (bus_id) {
+                address = ldm_pci_device_get_xorg_bus_id(LDM_PCI_DEVICE(device));
+                g_string_append_printf(config, "        BusID \"%s\"\n", address);
+        }
+        g_string_append_printf(config,
+                               "        VendorName \"%s\"\n"
+                               "        BoardName \"%s\"\n"
+                               "EndSection\n",
+                               ldm_device_get_vendor(device),
+                               ldm_device_get_name(device));
+}
+
+/**
+ * ldm_xorg_config_build_simple:
+ * @config: Configuration used to find any peers of the device
+ * @device: Device to emit into the X.Org configuration
+ *
+ * When other GPUs share the driver of @device, i.e. SLI, Crossfire or
+ * additional compute cards, each is given a section pinned to its PCI
+ * address, with @device always first so that it remains the primary.
+ *
+ * Returns: (transfer full) (nullable): The configuration, or NULL if the device is unsupported
+ */
+static gchar *ldm_xorg_config_build_simple(LdmGPUConfig *config, LdmDevice *device)
+{
+        g_autoptr(GPtrArray) gpus = NULL;
+        g_autoptr(GPtrArray) peers = NULL;
+        GString *xorg_config = NULL;
+        const gchar *driver = NULL;
+
         /* Construct prettified simple x.org configuration */
-        device_id = ldm_xorg_config_id(device);
         driver = ldm_xorg_config_driver(device);
         if (!driver) {
                 g_warning("SHOULD NOT HAPPEN: Missing driver translation on %s",
                           ldm_device_get_path(device));
-                return FALSE;
+                return NULL;
         }
 
-        contents = g_strdup_printf(
-            "Section \"Device\"\n"
-            "        Identifier \"%s Card\"\n"
-            "        Driver \"%s\"\n"
-            "        VendorName \"%s\"\n"
-            "        BoardName \"%s\"\n"
-            "EndSection\n",
-            device_id,
-            driver,
-            ldm_device_get_vendor(device),
-            ldm_device_get_name(device));
+        gpus = ldm_gpu_config_get_gpus(config);
+        peers = g_ptr_array_new();
+        for (guint i = 0; i < gpus->len; i++) {
+                LdmDevice *gpu = gpus->pdata[i];
 
-        /* Write the file */
-        if (!g_file_set_contents(path, contents, (gssize)strlen(contents), &error)) {
-                g_warning("Failed to set X.Org config %s: %s", path, error->message);
-                return FALSE;
+                if (gpu == device || !ldm_device_has_type(gpu, LDM_DEVICE_TYPE_PCI)) {
+                        continue;
+                }
+                if (g_strcmp0(ldm_xorg_config_driver(gpu), driver) == 0) {
+                        g_ptr_array_add(peers, gpu);
+                }
         }
 
-        return TRUE;
+        xorg_config = g_string_new(NULL);
+        ldm_xorg_config_append_device(xorg_config,
+                                      device,
+                                      0,
+                                      peers->len > 0 &&
+                                          ldm_device_has_type(device, LDM_DEVICE_TYPE_PCI));
+        for (guint i = 0; i < peers->len; i++) {
+                ldm_xorg_config_append_device(xorg_config, peers->pdata[i], i + 1, TRUE);
+        }
+
+        return g_string_free(xorg_config, FALSE);
 }
 
 /**
- * ldm_xorg_config_write_optimus:
- * @path: File path to alter
+ * ldm_xorg_config_build_optimus:
  * @device: Confguration for the Optimus setup
+ *
+ * Returns: (transfer full) (nullable): The configuration, or NULL if the device is unsupported
  */
-static gboolean ldm_xorg_config_write_optimus(const gchar *path, LdmDevice *device)
+static gchar *ldm_xorg_config_build_optimus(LdmDevice *device)
 {
-        g_autoptr(GError) error = NULL;
-        g_autofree gchar *dirname = NULL;
-        g_autofree gchar *contents = NULL;
         const gchar *device_id = NULL;
         const gchar *driver = NULL;
-        guint bus = 0, dev = 0;
-        gint func = 0;
-
-        dirname = g_path_get_dirname(path);
-        if (!dirname) {
-                return FALSE;
-        }
-
-        /* Make sure we have the leading directory first */
-        if (!g_file_test(dirname, G_FILE_TEST_IS_DIR) &&
-            g_mkdir_with_parents(dirname, 00755) != 0) {
-                g_warning("Failed to construct leading directory %s: %s", dirname, strerror(errno));
-                return FALSE;
-        }
+        g_autofree gchar *address = NULL;
 
         /* Bit of sanity if you please. */
         if (ldm_device_get_vendor_id(device) != LDM_PCI_VENDOR_ID_NVIDIA) {
                 g_message("Something is insane with configuration: %s is not an NVIDIA device!",
                           ldm_device_get_name(device));
-                return FALSE;
+                return NULL;
         }
         if (!ldm_device_has_type(device, LDM_DEVICE_TYPE_PCI)) {
                 g_message("Something is insane with configuration: %s is not a PCI device!",
                           ldm_device_get_name(device));
-                return FALSE;
+                return NULL;
         }
 
         /* Stash address for DRM style PCI ID */
-        ldm_pci_device_get_address(LDM_PCI_DEVICE(device), &bus, &dev, &func);
+        address = ldm_pci_device_get_xorg_bus_id(LDM_PCI_DEVICE(device));
 
         /* Construct prettified simple x.org configuration */
         device_id = ldm_xorg_config_id(device);
@@ -338,36 +453,26 @@ static gboolean ldm_xorg_config_write_optimus(const gchar *path, LdmDevice *devi
         if (!driver) {
                 g_warning("SHOULD NOT HAPPEN: Missing driver translation on %s",
                           ldm_device_get_path(device));
-                return FALSE;
+                return NULL;
         }
 
-        contents = g_strdup_printf(
+        return g_strdup_printf(
             "Section \"Module\"\n"
             "        Load \"modesetting\"\n"
             "EndSection\n\n"
             "Section \"Device\"\n"
             "        Identifier \"%s Card\"\n"
             "        Driver \"%s\"\n"
-            "        BusID \"PCI:%u:%u:%d\"\n"
+            "        BusID \"%s\"\n"
             "        Option \"AllowEmptyInitialConfiguration\"\n"
             "        VendorName \"%s\"\n"
             "        BoardName \"%s\"\n"
             "EndSection\n",
             device_id,
             driver,
-            bus,
-            dev,
-            func,
+            address,
             ldm_device_get_vendor(device),
             ldm_device_get_name(device));
-
-        /* Write the file */
-        if (!g_file_set_contents(path, contents, (gssize)strlen(contents), &error)) {
-                g_warning("Failed to set X.Org config %s: %s", path, error->message);
-                return FALSE;
-        }
-
-        return TRUE;
 }
 
 /**
@@ -382,7 +487,7 @@ static gboolean ldm_xorg_config_write_optimus(const gchar *path, LdmDevice *devi
  * Wayland world is KMS driven and in NVIDIA requires eglplatform, all of
  * which is automatic and doesn't require any kind of configuration.
  */
-static gboolean ldm_xorg_driver_present(LdmDevice *device)
+static gboolean ldm_xorg_driver_present(LdmGLXManager *self, LdmDevice *device)
 {
         g_autofree gchar *test_path = NULL;
         const gchar *drv_fragment = NULL;
@@ -398,7 +503,7 @@ static gboolean ldm_xorg_driver_present(LdmDevice *device)
                 return FALSE;
         }
 
-        test_path = g_build_filename(XORG_MODULE_DIRECTORY, "drivers", drv_fragment, NULL);
+        test_path = g_build_filename(self->module_directory, "drivers", drv_fragment, NULL);
         if (!test_path) {
                 return FALSE;
         }
@@ -411,35 +516,84 @@ static gboolean ldm_xorg_driver_present(LdmDevice *device)
  *
  * Nuke traces of the optimus configuration
  */
-static void ldm_glx_manager_nuke_optimus(void)
+static void ldm_glx_manager_nuke_optimus(LdmGLXManager *self)
 {
         /* Remove any existing hybrid tracking file */
-        if (g_file_test(LDM_HYBRID_FILE, G_FILE_TEST_EXISTS)) {
-                if (unlink(LDM_HYBRID_FILE) != 0) {
+        if (g_file_test(self->hybrid_file, G_FILE_TEST_EXISTS)) {
+                if (unlink(self->hybrid_file) != 0) {
                         g_warning("Failed to remove hybrid tracking file %s: %s",
-                                  LDM_HYBRID_FILE,
+                                  self->hybrid_file,
+                                  strerror(errno));
+                }
+        }
+}
+
+/**
+ * ldm_glx_manager_nuke_gpu_cache:
+ *
+ * Remove the persisted GPU topology, as nothing is configured for it
+ */
+static void ldm_glx_manager_nuke_gpu_cache(LdmGLXManager *self)
+{
+        if (g_file_test(self->gpu_cache_file, G_FILE_TEST_EXISTS)) {
+                if (unlink(self->gpu_cache_file) != 0) {
+                        g_warning("Failed to remove GPU cache file %s: %s",
+                                  self->gpu_cache_file,
                                   strerror(errno));
                 }
         }
 }
 
+/**
+ * ldm_glx_manager_save_gpu_cache:
+ *
+ * Persist the analysed topology we just configured, so that ldm-session-init
+ * can avoid building a new #LdmGPUConfig on every login. A failure here is
+ * not fatal, session init will just take the slow path.
+ */
+static void ldm_glx_manager_save_gpu_cache(LdmGLXManager *self, const LdmGLXPlan *plan)
+{
+        g_autoptr(GError) error = NULL;
+        g_autofree gchar *dirname = NULL;
+
+        dirname = g_path_get_dirname(self->gpu_cache_file);
+        if (!g_file_test(dirname, G_FILE_TEST_IS_DIR) &&
+            g_mkdir_with_parents(dirname, 00755) != 0) {
+                g_warning("Failed to construct leading directory %s: %s", dirname, strerror(errno));
+                return;
+        }
+
+        if (!g_file_set_contents(self->gpu_cache_file,
+                                 plan->gpu_cache,
+                                 (gssize)plan->gpu_cache_len,
+                                 &error)) {
+                g_warning("Failed to write GPU cache %s: %s", self->gpu_cache_file, error->message);
+        }
+}
+
 /**
  * ldm_glx_manager_nuke_user_configurations:
  *
  * Only nuke an existing /etc/X11/xorg.conf if it contains sections for proprietary
- * drivers.
+ * drivers. The file is scanned just the once for all of them.
  */
 static gboolean ldm_glx_manager_nuke_user_configurations(LdmGLXManager *self)
 {
-        gboolean ret = TRUE;
+        g_autoptr(LdmXorgConfig) xorg = NULL;
 
         static const gchar *xorg_drivers[] = {
                 "nvidia",
                 "fglrx",
         };
 
+        /* Nothing to remove */
+        xorg = ldm_xorg_config_scan(self->stock_xorg_config, NULL);
+        if (!xorg) {
+                return TRUE;
+        }
+
         for (guint i = 0; i < G_N_ELEMENTS(xorg_drivers); i++) {
-                if (!ldm_xorg_config_has_driver(self->stock_xorg_config, xorg_drivers[i])) {
+                if (!ldm_xorg_config_has_driver(xorg, xorg_drivers[i])) {
                         continue;
                 }
                 fprintf(stderr,
@@ -451,11 +605,12 @@ static gboolean ldm_glx_manager_nuke_user_configurations(LdmGLXManager *self)
                         g_warning("Failed to remove X11 config %s: %s",
                                   self->stock_xorg_config,
                                   strerror(errno));
-                        ret = FALSE;
+                        return FALSE;
                 }
+                break;
         }
 
-        return ret;
+        return TRUE;
 }
 
 /**
@@ -467,7 +622,8 @@ static gboolean ldm_glx_manager_nuke_user_configurations(LdmGLXManager *self)
 static void ldm_glx_manager_nuke_configurations(LdmGLXManager *self)
 {
         ldm_glx_manager_nuke_user_configurations(self);
-        ldm_glx_manager_nuke_optimus();
+        ldm_glx_manager_nuke_optimus(self);
+        ldm_glx_manager_nuke_gpu_cache(self);
 
         if (g_file_test(self->glx_xorg_config, G_FILE_TEST_EXISTS)) {
                 fprintf(stderr, "Removing now invalid X11 GLX config %s\n", self->glx_xorg_config);
@@ -484,7 +640,7 @@ static void ldm_glx_manager_nuke_configurations(LdmGLXManager *self)
  *
  * Attempt configuration of an Optimus system with proprietary drivers
  */
-static gboolean ldm_glx_manager_configure_optimus(LdmGLXManager *self, LdmGPUConfig *config)
+static gboolean ldm_glx_manager_configure_optimus(LdmGLXManager *self, const LdmGLXPlan *plan)
 {
         g_autoptr(GError) error = NULL;
         g_autofree gchar *dirname = NULL;
@@ -497,12 +653,11 @@ static gboolean ldm_glx_manager_configure_optimus(LdmGLXManager *self, LdmGPUCon
         ldm_glx_manager_nuke_user_configurations(self);
 
         /* Before we can write the hybrid bit, we have to be able to set the xorg config */
-        if (!ldm_xorg_config_write_optimus(self->glx_xorg_config,
-                                           ldm_gpu_config_get_secondary_device(config))) {
+        if (!ldm_xorg_config_write(self->glx_xorg_config, plan->xorg_config)) {
                 return FALSE;
         }
 
-        dirname = g_path_get_dirname(LDM_HYBRID_FILE);
+        dirname = g_path_get_dirname(self->hybrid_file);
         if (!dirname) {
                 return FALSE;
         }
@@ -515,9 +670,9 @@ static gboolean ldm_glx_manager_configure_optimus(LdmGLXManager *self, LdmGPUCon
         }
 
         /* Write the hybrid file contents now */
-        if (!g_file_set_contents(LDM_HYBRID_FILE, contents, (gssize)strlen(contents), &error)) {
+        if (!g_file_set_contents(self->hybrid_file, contents, (gssize)strlen(contents), &error)) {
                 g_warning("Failed to set hybrid file contents %s: %s",
-                          LDM_HYBRID_FILE,
+                          self->hybrid_file,
                           error->message);
                 return FALSE;
         }
@@ -530,14 +685,13 @@ static gboolean ldm_glx_manager_configure_optimus(LdmGLXManager *self, LdmGPUCon
  *
  * Attempt configuration of a simple proprietary driver
  */
-static gboolean ldm_glx_manager_configure_simple(LdmGLXManager *self, LdmGPUConfig *config)
+static gboolean ldm_glx_manager_configure_simple(LdmGLXManager *self, const LdmGLXPlan *plan)
 {
         /* Make sure we don't have Optimus! */
-        ldm_glx_manager_nuke_optimus();
+        ldm_glx_manager_nuke_optimus(self);
 
         /* Try to write new config first */
-        if (!ldm_xorg_config_write_simple(self->glx_xorg_config,
-                                          ldm_gpu_config_get_detection_device(config))) {
+        if (!ldm_xorg_config_write(self->glx_xorg_config, plan->xorg_config)) {
                 return FALSE;
         }
         /* Now try to nuke any existing user config */
@@ -545,63 +699,266 @@ static gboolean ldm_glx_manager_configure_simple(LdmGLXManager *self, LdmGPUConf
 }
 
 /**
- * ldm_glx_manager_apply_configuration:
- * @config: Valid LdmGPUConfiguration
- *
- * Attempt to apply the primary portion of the configuration per the systems current configuration.
- * If proprietary drivers are installed and enabled, they will be configured. If an Optimus system
- * is encountered then it will also be configured in X11, and in the installed display manager
- * configurations.
+ * ldm_glx_manager_plan:
  *
- * If it is not possible to "install" a configuration, then any changes we may have made will be
- * immediately unapplied and we'll go back to a "stock" configuration that intentionally removes any
- * enabling for the proprietary drivers we may have applied.
+ * Work out what the configuration should look like on disk, without
+ * touching any file
  *
- * This should only happen when the module isn't present for the primary detection device.
+ * Returns: FALSE if the configuration cannot be applied at all
  */
-gboolean ldm_glx_manager_apply_configuration(LdmGLXManager *self, LdmGPUConfig *config)
+static gboolean ldm_glx_manager_plan(LdmGLXManager *self, LdmGPUConfig *config,
+                                     LdmGLXPlan *plan)
 {
         LdmDevice *detection_device = NULL;
 
-        g_return_val_if_fail(self != NULL, FALSE);
-
-        /* Clean up before doing anything. */
-        ldm_glx_manager_nuke_legacy();
-
         detection_device = ldm_gpu_config_get_detection_device(config);
 
-        /* No primary device, this is fine, could be a chroot. */
-        if (!detection_device) {
-                ldm_glx_manager_nuke_configurations(self);
+        /* No primary device, this is fine, could be a chroot. If there isn't a valid
+         * driver for this device, remove configurations for it as well. */
+        if (!detection_device || !ldm_xorg_driver_present(self, detection_device)) {
+                plan->mode = LDM_GLX_MODE_NONE;
                 return TRUE;
         }
 
-        /* If there isn't a valid driver for this device, remove configurations for it */
-        if (!ldm_xorg_driver_present(detection_device)) {
-                ldm_glx_manager_nuke_configurations(self);
-                return TRUE;
+        /* TODO: Support SLI/Crossfire + Hybrid. Optimus only configures the
+         * secondary GPU, and no PRIME render offload sinks are emitted for
+         * any further GPUs, which are left to the modesetting driver. */
+        if (ldm_gpu_config_has_type(config, LDM_GPU_TYPE_OPTIMUS)) {
+                plan->mode = LDM_GLX_MODE_OPTIMUS;
+                plan->xorg_config =
+                    ldm_xorg_config_build_optimus(ldm_gpu_config_get_secondary_device(config));
+        } else {
+                /* Assume we're just a simple device. */
+                plan->mode = LDM_GLX_MODE_SIMPLE;
+                plan->xorg_config = ldm_xorg_config_build_simple(config, detection_device);
+        }
+        if (!plan->xorg_config) {
+                return FALSE;
         }
 
-        /* TODO: Support SLI/Crossfire + Hybrid etc. */
-        if (ldm_gpu_config_has_type(config, LDM_GPU_TYPE_OPTIMUS)) {
-                if (!ldm_glx_manager_configure_optimus(self, config)) {
-                        goto failed;
-                }
-                return TRUE;
+        plan->gpu_cache = ldm_gpu_config_build_cache(config, &plan->gpu_cache_len);
+        return TRUE;
+}
+
+/**
+ * ldm_glx_manager_checksum_file:
+ *
+ * Add the identity of a file to the state hash. The change time can't be
+ * forged with touch(1), and with the inode catches any replaced file, so
+ * nothing needs to be read.
+ */
+static void ldm_glx_manager_checksum_file(GChecksum *sum, const gchar *path)
+{
+        struct stat st = { 0 };
+        g_autofree gchar *line = NULL;
+
+        if (stat(path, &st) != 0) {
+                line = g_strdup_printf("%s\t-\n", path);
+        } else {
+                line = g_strdup_printf("%s\t%" G_GUINT64_FORMAT "\t%" G_GINT64_FORMAT
+                                       "\t%" G_GINT64_FORMAT ".%09ld\t%" G_GINT64_FORMAT
+                                       ".%09ld\n",
+                                       path,
+                                       (guint64)st.st_ino,
+                                       (gint64)st.st_size,
+                                       (gint64)st.st_mtim.tv_sec,
+                                       st.st_mtim.tv_nsec,
+                                       (gint64)st.st_ctim.tv_sec,
+                                       st.st_ctim.tv_nsec);
+        }
+
+        g_checksum_update(sum, (const guchar *)line, -1);
+}
+
+/**
+ * ldm_glx_manager_compute_state:
+ *
+ * Hash the plan along with the current identity of every file we manage or
+ * inspect, including the stock X.Org configuration we would otherwise scan.
+ *
+ * Returns: (transfer full): Hex encoded hash of the state
+ */
+static gchar *ldm_glx_manager_compute_state(LdmGLXManager *self, const LdmGLXPlan *plan)
+{
+        g_autoptr(GChecksum) sum = NULL;
+        g_autofree gchar *mode = NULL;
+        const gchar *paths[] = {
+                self->stock_xorg_config,
+                self->glx_xorg_config,
+                self->hybrid_file,
+                self->gpu_cache_file,
+        };
+
+        sum = g_checksum_new(G_CHECKSUM_SHA256);
+        mode = g_strdup_printf("%d\n", plan->mode);
+        g_checksum_update(sum, (const guchar *)mode, -1);
+
+        /* Contents are NUL terminated so that fields can't run together */
+        if (plan->xorg_config) {
+                g_checksum_update(sum,
+                                  (const guchar *)plan->xorg_config,
+                                  (gssize)strlen(plan->xorg_config) + 1);
         }
+        if (plan->gpu_cache) {
+                g_checksum_update(sum,
+                                  (const guchar *)plan->gpu_cache,
+                                  (gssize)plan->gpu_cache_len);
+                g_checksum_update(sum, (const guchar *)"", 1);
+        }
+
+        for (guint i = 0; i < G_N_ELEMENTS(paths); i++) {
+                ldm_glx_manager_checksum_file(sum, paths[i]);
+        }
+
+        return g_strdup(g_checksum_get_string(sum));
+}
 
-        /* Assume we're just a simple device. */
-        if (!ldm_glx_manager_configure_simple(self, config)) {
+/**
+ * ldm_glx_manager_state_is_current:
+ *
+ * Returns: TRUE if @state is exactly what we left behind last time
+ */
+static gboolean ldm_glx_manager_state_is_current(LdmGLXManager *self, const gchar *state)
+{
+        g_autofree gchar *contents = NULL;
+
+        if (!g_file_get_contents(self->state_file, &contents, NULL, NULL)) {
+                return FALSE;
+        }
+
+        return g_str_equal(g_strstrip(contents), state);
+}
+
+/**
+ * ldm_glx_manager_save_state:
+ *
+ * Record the state we just applied, once every file is in place. A failure
+ * here is not fatal, the next run will just apply everything again.
+ */
+static void ldm_glx_manager_save_state(LdmGLXManager *self, const LdmGLXPlan *plan)
+{
+        g_autoptr(GError) error = NULL;
+        g_autofree gchar *dirname = NULL;
+        g_autofree gchar *state = NULL;
+        g_autofree gchar *contents = NULL;
+
+        dirname = g_path_get_dirname(self->state_file);
+        if (!g_file_test(dirname, G_FILE_TEST_IS_DIR) &&
+            g_mkdir_with_parents(dirname, 00755) != 0) {
+                g_warning("Failed to construct leading directory %s: %s", dirname, strerror(errno));
+                return;
+        }
+
+        state = ldm_glx_manager_compute_state(self, plan);
+        contents = g_strconcat(state, "\n", NULL);
+        if (!g_file_set_contents(self->state_file, contents, -1, &error)) {
+                g_warning("Failed to write GLX state %s: %s", self->state_file, error->message);
+        }
+}
+
+/**
+ * ldm_glx_manager_nuke_state:
+ *
+ * Forget the last applied state, so that the next run starts from scratch
+ */
+static void ldm_glx_manager_nuke_state(LdmGLXManager *self)
+{
+        if (unlink(self->state_file) != 0 && errno != ENOENT) {
+                g_warning("Failed to remove GLX state %s: %s", self->state_file, strerror(errno));
+        }
+}
+
+/**
+ * ldm_glx_manager_apply:
+ *
+ * Implementation of #ldm_glx_manager_apply_configuration
+ */
+static gboolean ldm_glx_manager_apply(LdmGLXManager *self, LdmGPUConfig *config)
+{
+        LdmGLXPlan plan = { 0 };
+        g_autofree gchar *state = NULL;
+        gboolean ret = FALSE;
+
+        /* Clean up before doing anything. */
+        ldm_glx_manager_nuke_legacy(self);
+
+        if (!ldm_glx_manager_plan(self, config, &plan)) {
                 goto failed;
         }
 
-        return TRUE;
+        /* Nothing changed since we last ran, so there is nothing to write or rescan */
+        state = ldm_glx_manager_compute_state(self, &plan);
+        if (ldm_glx_manager_state_is_current(self, state)) {
+                ret = TRUE;
+                goto done;
+        }
+
+        switch (plan.mode) {
+        case LDM_GLX_MODE_OPTIMUS:
+                if (!ldm_glx_manager_configure_optimus(self, &plan)) {
+                        goto failed;
+                }
+                ldm_glx_manager_save_gpu_cache(self, &plan);
+                break;
+        case LDM_GLX_MODE_SIMPLE:
+                if (!ldm_glx_manager_configure_simple(self, &plan)) {
+                        goto failed;
+                }
+                ldm_glx_manager_save_gpu_cache(self, &plan);
+                break;
+        case LDM_GLX_MODE_NONE:
+        default:
+                ldm_glx_manager_nuke_configurations(self);
+                break;
+        }
+
+        ldm_glx_manager_save_state(self, &plan);
+        ret = TRUE;
+        goto done;
 
 failed:
 
         g_warning("Encountered fatal issue in driver configuration, restoring defaults");
         ldm_glx_manager_nuke_configurations(self);
-        return FALSE;
+        ldm_glx_manager_nuke_state(self);
+
+done:
+        g_free(plan.xorg_config);
+        g_free(plan.gpu_cache);
+        return ret;
+}
+
+/**
+ * ldm_glx_manager_apply_configuration:
+ * @config: Valid LdmGPUConfiguration
+ *
+ * Attempt to apply the primary portion of the configuration per the systems current configuration.
+ * If proprietary drivers are installed and enabled, they will be configured. If an Optimus system
+ * is encountered then it will also be configured in X11, and in the installed display manager
+ * configurations.
+ *
+ * If it is not possible to "install" a configuration, then any changes we may have made will be
+ * immediately unapplied and we'll go back to a "stock" configuration that intentionally removes any
+ * enabling for the proprietary drivers we may have applied.
+ *
+ * This should only happen when the module isn't present for the primary detection device.
+ *
+ * When the configuration and every file involved are exactly as the previous run left them,
+ * as recorded in a hash stored alongside the other tracking files, nothing is written or
+ * rescanned at all.
+ */
+gboolean ldm_glx_manager_apply_configuration(LdmGLXManager *self, LdmGPUConfig *config)
+{
+        gboolean ret = FALSE;
+        guint64 start = 0;
+
+        g_return_val_if_fail(self != NULL, FALSE);
+
+        start = ldm_stats_begin(LDM_STATS_PHASE_APPLY);
+        ret = ldm_glx_manager_apply(self, config);
+        ldm_stats_end(LDM_STATS_PHASE_APPLY, start);
+
+        return ret;
 }
 
 /**
@@ -610,7 +967,7 @@ failed:
  * Nuke previously constructed files from the old LDM implementation that are no longer
  * needed.
  */
-static void ldm_glx_manager_nuke_legacy()
+static void ldm_glx_manager_nuke_legacy(LdmGLXManager *self)
 {
         /* Garbage paths left over from old LDM, make sure they die */
         static const gchar *bad_paths[] = {
@@ -621,7 +978,9 @@ static void ldm_glx_manager_nuke_legacy()
         };
 
         for (guint i = 0; i < G_N_ELEMENTS(bad_paths); i++) {
-                const gchar *path = bad_paths[i];
+                g_autofree gchar *path = g_build_filename(self->root ? self->root : "/",
+                                                          bad_paths[i],
+                                                          NULL);
                 if (!g_file_test(path, G_FILE_TEST_EXISTS)) {
                         continue;
                 }
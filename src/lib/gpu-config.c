@@ -11,8 +11,14 @@
 
 #define _GNU_SOURCE
 
+#include <stdlib.h>
+#include <string.h>
+
 #include "gpu-config.h"
 #include "ldm-enums.h"
+#include "ldm-private.h"
+#include "manager-private.h"
+#include "pci-device.h"
 #include "util.h"
 
 struct _LdmGPUConfigClass {
@@ -30,6 +36,17 @@ struct _LdmGPUConfigClass {
  * what kind of configuration is present, and determine the primary vs secondary
  * GPUs, presence of Optimus/Hybrid GPUs, etc.
  *
+ * Every GPU is available through #ldm_gpu_config_get_gpus in topology order,
+ * and #ldm_gpu_config_select picks a single GPU by policy, such as the
+ * fastest discrete GPU or the one local to a NUMA node, using the PCIe link
+ * and locality reported by each #LdmPCIDevice.
+ *
+ * The configuration follows hotplug of the #LdmManager, so that external
+ * GPUs, i.e. in a Thunderbolt enclosure, are accounted for as they come and
+ * go. Only the set of GPUs is examined again, and #LdmGPUConfig::changed is
+ * emitted afterwards. The manager only monitors PCI hotplug once a
+ * configuration exists, unless #LdmManager:monitor-subsystems says otherwise.
+ *
  * C example:
  *
  * |[<!-- language="C" -->
@@ -47,15 +64,31 @@ struct _LdmGPUConfig {
         LdmDevice *primary;   /* Primary GPU */
         LdmDevice *secondary; /* Secondary GPU */
 
-        guint n_gpu;    /* How many GPUs we got? */
-        guint gpu_type; /* Primary type */
+        GPtrArray *gpus; /* Every GPU, in topology order */
+        guint n_gpu;     /* How many GPUs we got? */
+        guint gpu_type;  /* Primary type */
 };
 
+/**
+ * LdmGPUConfigSearch:
+ *
+ * Criteria for picking the fastest GPU from the topology
+ */
+typedef struct LdmGPUConfigSearch {
+        LdmDevice *not_like;   /* Device to skip */
+        gboolean non_boot_vga; /* Skip boot_vga devices */
+        gboolean discrete;     /* Skip devices without a PCIe link */
+        gboolean local;        /* Skip devices not on numa_node */
+        gint numa_node;
+} LdmGPUConfigSearch;
+
 static void ldm_gpu_config_set_property(GObject *object, guint id, const GValue *value,
                                         GParamSpec *spec);
 static void ldm_gpu_config_get_property(GObject *object, guint id, GValue *value, GParamSpec *spec);
 static void ldm_gpu_config_constructed(GObject *obj);
 static void ldm_gpu_config_analyze(LdmGPUConfig *self);
+static void ldm_gpu_config_device_added(LdmManager *manager, LdmDevice *device, gpointer v);
+static void ldm_gpu_config_device_removed(LdmManager *manager, LdmDevice *device, gpointer v);
 
 G_DEFINE_TYPE(LdmGPUConfig, ldm_gpu_config, G_TYPE_OBJECT)
 
@@ -66,6 +99,11 @@ static GParamSpec *obj_properties[N_PROPS] = {
         NULL,
 };
 
+/* Signal IDs */
+enum { SIGNAL_CHANGED = 0, N_SIGNALS };
+
+static guint obj_signals[N_SIGNALS] = { 0 };
+
 /**
  * ldm_gpu_config_dispose:
  *
@@ -73,6 +111,15 @@ static GParamSpec *obj_properties[N_PROPS] = {
  */
 static void ldm_gpu_config_dispose(GObject *obj)
 {
+        LdmGPUConfig *self = LDM_GPU_CONFIG(obj);
+
+        if (self->manager) {
+                g_signal_handlers_disconnect_by_data(self->manager, self);
+                g_object_remove_weak_pointer(G_OBJECT(self->manager), (gpointer *)&self->manager);
+                self->manager = NULL;
+        }
+        g_clear_pointer(&self->gpus, g_ptr_array_unref);
+
         G_OBJECT_CLASS(ldm_gpu_config_parent_class)->dispose(obj);
 }
 
@@ -91,6 +138,25 @@ static void ldm_gpu_config_class_init(LdmGPUConfigClass *klazz)
         obj_class->get_property = ldm_gpu_config_get_property;
         obj_class->set_property = ldm_gpu_config_set_property;
 
+        /**
+         * LdmGPUConfig::changed
+         * @config: The GPU configuration
+         *
+         * Emitted once a GPU has been added to, or removed from, the
+         * #LdmManager and the configuration has been examined again. The
+         * primary and secondary devices may differ afterwards, as may the
+         * #LdmGPUConfig:gpu-type.
+         */
+        obj_signals[SIGNAL_CHANGED] = g_signal_new("changed",
+                                                   LDM_TYPE_GPU_CONFIG,
+                                                   G_SIGNAL_RUN_LAST,
+                                                   0,
+                                                   NULL,
+                                                   NULL,
+                                                   NULL,
+                                                   G_TYPE_NONE,
+                                                   0);
+
         /**
          * LdmGPUConfig:manager: (type LdmManager) (transfer none)
          *
@@ -198,7 +264,26 @@ static void ldm_gpu_config_get_property(GObject *object, guint id, GValue *value
  */
 static void ldm_gpu_config_constructed(GObject *obj)
 {
-        ldm_gpu_config_analyze(LDM_GPU_CONFIG(obj));
+        LdmGPUConfig *self = LDM_GPU_CONFIG(obj);
+
+        /* Ask for PCI events before looking, so none slip between the two */
+        ldm_manager_monitor_gpus(self->manager);
+
+        self->gpus =
+            ldm_manager_get_devices(self->manager, LDM_DEVICE_TYPE_PCI | LDM_DEVICE_TYPE_GPU);
+        ldm_gpu_config_analyze(self);
+
+        /* Follow hotplug, bearing in mind the manager may go away first */
+        g_object_add_weak_pointer(G_OBJECT(self->manager), (gpointer *)&self->manager);
+        g_signal_connect(self->manager,
+                         "device-added",
+                         G_CALLBACK(ldm_gpu_config_device_added),
+                         self);
+        g_signal_connect(self->manager,
+                         "device-removed",
+                         G_CALLBACK(ldm_gpu_config_device_removed),
+                         self);
+
         G_OBJECT_CLASS(ldm_gpu_config_parent_class)->constructed(obj);
 }
 
@@ -239,6 +324,108 @@ static LdmDevice *ldm_gpu_config_search_boot(GPtrArray *devices, gboolean vga_bo
         return NULL;
 }
 
+/**
+ * ldm_gpu_config_bandwidth:
+ *
+ * Raw bandwidth of the PCIe link of a GPU, as lanes times the per lane
+ * transfer rate. This is only used to rank devices against each other.
+ */
+static guint64 ldm_gpu_config_bandwidth(LdmDevice *device)
+{
+        LdmPCIDevice *pci = NULL;
+
+        if (!LDM_IS_PCI_DEVICE(device)) {
+                return 0;
+        }
+
+        pci = LDM_PCI_DEVICE(device);
+        return (guint64)ldm_pci_device_get_link_width(pci) * ldm_pci_device_get_link_speed(pci);
+}
+
+/**
+ * ldm_gpu_config_is_discrete:
+ *
+ * Intel integrated GPUs are endpoints of the root complex itself and have
+ * no PCIe link of their own, so anything with a negotiated link may be
+ * discrete. APUs however hang their iGPU off an internal bridge, with a
+ * perfectly normal looking x16 link, so on its own this can't tell them
+ * apart. #ldm_gpu_config_select settles that by passing over the boot_vga
+ * device whenever another GPU has a link too, as the firmware boots from
+ * the iGPU of any hybrid system.
+ */
+static gboolean ldm_gpu_config_is_discrete(LdmDevice *device)
+{
+        if (!LDM_IS_PCI_DEVICE(device)) {
+                return FALSE;
+        }
+
+        return ldm_pci_device_get_link_width(LDM_PCI_DEVICE(device)) > 0;
+}
+
+/**
+ * ldm_gpu_config_search_fastest:
+ *
+ * Find the GPU with the most PCIe bandwidth matching the criteria. Ties go
+ * to the earlier device in topology order, so the boot_vga device wins
+ * whenever it qualifies.
+ *
+ * Returns: (transfer none) (nullable): The fastest GPU, if any matches
+ */
+static LdmDevice *ldm_gpu_config_search_fastest(GPtrArray *gpus, const LdmGPUConfigSearch *search)
+{
+        LdmDevice *best = NULL;
+        guint64 best_bandwidth = 0;
+
+        for (guint i = 0; i < gpus->len; i++) {
+                LdmDevice *device = gpus->pdata[i];
+                guint64 bandwidth = 0;
+
+                if (device == search->not_like) {
+                        continue;
+                }
+                if (search->non_boot_vga &&
+                    ldm_device_has_attribute(device, LDM_DEVICE_ATTRIBUTE_BOOT_VGA)) {
+                        continue;
+                }
+                if (search->discrete && !ldm_gpu_config_is_discrete(device)) {
+                        continue;
+                }
+                if (search->local &&
+                    (!LDM_IS_PCI_DEVICE(device) ||
+                     ldm_pci_device_get_numa_node(LDM_PCI_DEVICE(device)) != search->numa_node)) {
+                        continue;
+                }
+
+                bandwidth = ldm_gpu_config_bandwidth(device);
+                if (!best || bandwidth > best_bandwidth) {
+                        best = device;
+                        best_bandwidth = bandwidth;
+                }
+        }
+
+        return best;
+}
+
+/**
+ * ldm_gpu_config_sort_topology:
+ *
+ * The boot_vga device comes first, then everything else by sysfs path,
+ * which orders devices by their position in the PCI hierarchy.
+ */
+static gint ldm_gpu_config_sort_topology(gconstpointer a, gconstpointer b)
+{
+        LdmDevice *device_a = *(LdmDevice **)a;
+        LdmDevice *device_b = *(LdmDevice **)b;
+        gboolean boot_a = ldm_device_has_attribute(device_a, LDM_DEVICE_ATTRIBUTE_BOOT_VGA);
+        gboolean boot_b = ldm_device_has_attribute(device_b, LDM_DEVICE_ATTRIBUTE_BOOT_VGA);
+
+        if (boot_a != boot_b) {
+                return boot_a ? -1 : 1;
+        }
+
+        return g_strcmp0(ldm_device_get_path(device_a), ldm_device_get_path(device_b));
+}
+
 /**
  * ldm_gpu_config_do_optimus:
  *
@@ -308,16 +495,22 @@ static gboolean ldm_gpu_config_do_amd_hybrid(LdmGPUConfig *self, LdmDevice *prim
 /**
  * ldm_gpu_config_analyze:
  *
- * Ask the manager what the story is.
+ * Work out the story from the current set of GPUs, without going back to
+ * the manager, so that it may be repeated cheaply after hotplug.
  */
 static void ldm_gpu_config_analyze(LdmGPUConfig *self)
 {
-        g_autoptr(GPtrArray) devices = NULL;
+        GPtrArray *devices = self->gpus;
         LdmDevice *boot_vga = NULL;
         LdmDevice *non_boot_vga = NULL;
+        LdmGPUConfigSearch search = { 0 };
         gint vendor_id = 0;
 
-        devices = ldm_manager_get_devices(self->manager, LDM_DEVICE_TYPE_PCI | LDM_DEVICE_TYPE_GPU);
+        self->primary = NULL;
+        self->secondary = NULL;
+        self->gpu_type = LDM_GPU_TYPE_SIMPLE;
+
+        g_ptr_array_sort(devices, ldm_gpu_config_sort_topology);
         self->n_gpu = devices->len;
         if (self->n_gpu < 1) {
                 g_message("failed to discover any GPUs");
@@ -342,8 +535,11 @@ static void ldm_gpu_config_analyze(LdmGPUConfig *self)
         /* Ensure primary is properly set now */
         self->primary = boot_vga;
 
-        /* Find a non_boot_vga that isn't boot_vga */
-        non_boot_vga = ldm_gpu_config_search_boot(devices, FALSE, boot_vga);
+        /* Find the fastest non_boot_vga that isn't boot_vga, so that hybrid
+         * setups with several dGPUs offload to the best of them. */
+        search.not_like = boot_vga;
+        search.non_boot_vga = TRUE;
+        non_boot_vga = ldm_gpu_config_search_fastest(devices, &search);
 
         /* Optimus? */
         if (ldm_gpu_config_do_optimus(self, boot_vga, non_boot_vga)) {
@@ -374,6 +570,73 @@ static void ldm_gpu_config_analyze(LdmGPUConfig *self)
         self->gpu_type = LDM_GPU_TYPE_SIMPLE;
 }
 
+/**
+ * ldm_gpu_config_update:
+ *
+ * The set of GPUs changed, examine it again and let everyone know
+ */
+static void ldm_gpu_config_update(LdmGPUConfig *self)
+{
+        LdmDevice *primary = self->primary;
+        LdmDevice *secondary = self->secondary;
+        LdmDevice *detection = ldm_gpu_config_get_detection_device(self);
+        guint gpu_type = self->gpu_type;
+
+        ldm_gpu_config_analyze(self);
+
+        g_object_freeze_notify(G_OBJECT(self));
+        if (self->gpu_type != gpu_type) {
+                g_object_notify_by_pspec(G_OBJECT(self), obj_properties[PROP_TYPE]);
+        }
+        if (self->primary != primary) {
+                g_object_notify_by_pspec(G_OBJECT(self), obj_properties[PROP_PRIMARY]);
+        }
+        if (self->secondary != secondary) {
+                g_object_notify_by_pspec(G_OBJECT(self), obj_properties[PROP_SECONDARY]);
+        }
+        if (ldm_gpu_config_get_detection_device(self) != detection) {
+                g_object_notify_by_pspec(G_OBJECT(self), obj_properties[PROP_DETECTION]);
+        }
+        g_object_thaw_notify(G_OBJECT(self));
+
+        g_signal_emit(self, obj_signals[SIGNAL_CHANGED], 0);
+}
+
+/**
+ * ldm_gpu_config_device_added:
+ *
+ * A new device is available, such as a hotplugged external GPU
+ */
+static void ldm_gpu_config_device_added(__ldm_unused__ LdmManager *manager, LdmDevice *device,
+                                        gpointer v)
+{
+        LdmGPUConfig *self = v;
+
+        if (!ldm_device_has_type(device, LDM_DEVICE_TYPE_PCI | LDM_DEVICE_TYPE_GPU)) {
+                return;
+        }
+
+        g_ptr_array_add(self->gpus, g_object_ref(device));
+        ldm_gpu_config_update(self);
+}
+
+/**
+ * ldm_gpu_config_device_removed:
+ *
+ * A device is going away, drop it if it was one of our GPUs
+ */
+static void ldm_gpu_config_device_removed(__ldm_unused__ LdmManager *manager, LdmDevice *device,
+                                          gpointer v)
+{
+        LdmGPUConfig *self = v;
+
+        if (!g_ptr_array_remove(self->gpus, device)) {
+                return;
+        }
+
+        ldm_gpu_config_update(self);
+}
+
 /**
  * ldm_gpu_config_new:
  * @manager: (transfer none): Manager to query for a GPU config
@@ -509,6 +772,98 @@ LdmDevice *ldm_gpu_config_get_detection_device(LdmGPUConfig *self)
         return self->primary;
 }
 
+/**
+ * ldm_gpu_config_get_gpus:
+ *
+ * Get every GPU in this configuration in topology order, that is the
+ * boot_vga device first, followed by all other GPUs in the order of their
+ * position in the PCI hierarchy.
+ *
+ * Returns: (element-type Ldm.Device) (transfer container): Every GPU known to the configuration
+ */
+GPtrArray *ldm_gpu_config_get_gpus(LdmGPUConfig *self)
+{
+        GPtrArray *ret = NULL;
+
+        g_return_val_if_fail(self != NULL, NULL);
+
+        ret = g_ptr_array_new_full(self->n_gpu, g_object_unref);
+        for (guint i = 0; self->gpus && i < self->gpus->len; i++) {
+                g_ptr_array_add(ret, g_object_ref(self->gpus->pdata[i]));
+        }
+
+        return ret;
+}
+
+/**
+ * ldm_gpu_config_select:
+ * @policy: Policy used to pick the GPU
+ * @numa_node: NUMA node for #LDM_GPU_SELECT_NUMA_NODE, ignored otherwise
+ *
+ * Pick a single GPU from the topology according to @policy, so that a
+ * workload can be pinned to the most suitable card:
+ *
+ * #LDM_GPU_SELECT_BOOT returns the primary device.
+ *
+ * #LDM_GPU_SELECT_FASTEST_DISCRETE returns the discrete GPU with the most
+ * PCIe bandwidth, i.e. link width times link speed, as currently negotiated.
+ * A GPU is considered discrete when it has a PCIe link of its own. As the
+ * iGPU of an APU has one too, the boot_vga device is only considered when
+ * no other GPU has a link. A desktop booting from its dGPU, with the APU
+ * graphics also enabled, is therefore misjudged.
+ *
+ * #LDM_GPU_SELECT_NUMA_NODE returns the GPU with the most PCIe bandwidth
+ * among those attached to @numa_node.
+ *
+ * Ties always go to the earlier device in topology order.
+ *
+ * C example:
+ *
+ * |[<!-- language="C" -->
+ *      LdmDevice *device = ldm_gpu_config_select(gpu, LDM_GPU_SELECT_NUMA_NODE, 1);
+ *      if (!device) {
+ *              g_message("No GPU is local to node 1");
+ *      }
+ * ]|
+ *
+ * Returns: (transfer none) (nullable): The selected GPU, or NULL if none qualifies
+ */
+LdmDevice *ldm_gpu_config_select(LdmGPUConfig *self, LdmGPUSelect policy, gint numa_node)
+{
+        LdmGPUConfigSearch search = { 0 };
+        LdmDevice *ret = NULL;
+
+        g_return_val_if_fail(self != NULL, NULL);
+
+        if (!self->gpus) {
+                return NULL;
+        }
+
+        switch (policy) {
+        case LDM_GPU_SELECT_BOOT:
+                return self->primary;
+        case LDM_GPU_SELECT_FASTEST_DISCRETE:
+                /* boot_vga is likely an APU when anything else has a link */
+                search.discrete = TRUE;
+                search.non_boot_vga = TRUE;
+                ret = ldm_gpu_config_search_fastest(self->gpus, &search);
+                if (ret) {
+                        return ret;
+                }
+                search.non_boot_vga = FALSE;
+                break;
+        case LDM_GPU_SELECT_NUMA_NODE:
+                search.local = TRUE;
+                search.numa_node = numa_node;
+                break;
+        default:
+                g_warning("Unknown GPU selection policy %d", policy);
+                return NULL;
+        }
+
+        return ldm_gpu_config_search_fastest(self->gpus, &search);
+}
+
 /**
  * ldm_gpu_config_get_providers:
  *
@@ -533,6 +888,188 @@ GPtrArray *ldm_gpu_config_get_providers(LdmGPUConfig *self)
         return ldm_manager_get_providers(self->manager, ldm_gpu_config_get_detection_device(self));
 }
 
+/**
+ * ldm_gpu_config_get_best_provider:
+ *
+ * Get only the highest priority #LdmProvider for this GPU configuration, as
+ * determined by #ldm_manager_get_best_provider on the detection device.
+ * This is the preferred API when only the default driver is required.
+ *
+ * Returns: (transfer full) (nullable): The best provider, if any
+ */
+LdmProvider *ldm_gpu_config_get_best_provider(LdmGPUConfig *self)
+{
+        LdmDevice *device = NULL;
+
+        g_return_val_if_fail(self != NULL, NULL);
+
+        device = ldm_gpu_config_get_detection_device(self);
+        if (!device) {
+                return NULL;
+        }
+
+        return ldm_manager_get_best_provider(self->manager, device);
+}
+
+/**
+ * ldm_gpu_config_save_device:
+ *
+ * Store the identity of a GPU in the named group of the cache
+ */
+static void ldm_gpu_config_save_device(GKeyFile *file, const gchar *group, LdmDevice *device)
+{
+        g_autofree gchar *address = NULL;
+
+        address = g_path_get_basename(ldm_device_get_path(device));
+        g_key_file_set_string(file, group, "Address", address);
+        g_key_file_set_integer(file, group, "VendorID", ldm_device_get_vendor_id(device));
+        g_key_file_set_integer(file, group, "ProductID", ldm_device_get_product_id(device));
+}
+
+/**
+ * ldm_gpu_config_build_cache:
+ * @len: (out): Length of the returned data
+ *
+ * Serialise the topology exactly as #ldm_gpu_config_save_cache would store
+ * it, so callers can tell whether the stored cache is still current.
+ *
+ * Returns: (transfer full): The cache file contents
+ */
+gchar *ldm_gpu_config_build_cache(LdmGPUConfig *self, gsize *len)
+{
+        g_autoptr(GKeyFile) file = NULL;
+
+        file = g_key_file_new();
+        g_key_file_set_integer(file, "GPU", "Type", (gint)self->gpu_type);
+        if (self->primary) {
+                ldm_gpu_config_save_device(file, "Primary", self->primary);
+        }
+        if (self->secondary) {
+                ldm_gpu_config_save_device(file, "Secondary", self->secondary);
+        }
+
+        return g_key_file_to_data(file, len, NULL);
+}
+
+/**
+ * ldm_gpu_config_save_cache:
+ * @path: Location of the cache file
+ *
+ * Store the analysed GPU topology, that is the #LdmGPUType along with the
+ * PCI address and IDs of the primary and secondary devices. The cache may
+ * then be checked with #ldm_gpu_config_read_cache without constructing an
+ * #LdmManager at all.
+ *
+ * Returns: TRUE if the cache was written
+ */
+gboolean ldm_gpu_config_save_cache(LdmGPUConfig *self, const gchar *path)
+{
+        g_autoptr(GError) error = NULL;
+        g_autofree gchar *contents = NULL;
+        gsize len = 0;
+
+        g_return_val_if_fail(self != NULL, FALSE);
+        g_return_val_if_fail(path != NULL, FALSE);
+
+        contents = ldm_gpu_config_build_cache(self, &len);
+        if (!g_file_set_contents(path, contents, (gssize)len, &error)) {
+                g_warning("Failed to write GPU cache %s: %s", path, error->message);
+                return FALSE;
+        }
+
+        return TRUE;
+}
+
+/**
+ * ldm_gpu_config_read_sysattr:
+ *
+ * Read a numeric PCI attribute directly from sysfs
+ */
+static gboolean ldm_gpu_config_read_sysattr(const gchar *address, const gchar *attribute,
+                                            gint *value)
+{
+        g_autofree gchar *path = NULL;
+        g_autofree gchar *contents = NULL;
+
+        path = g_build_filename("/sys/bus/pci/devices", address, attribute, NULL);
+        if (!g_file_get_contents(path, &contents, NULL, NULL)) {
+                return FALSE;
+        }
+
+        *value = (gint)strtoll(contents, NULL, 0);
+        return TRUE;
+}
+
+/**
+ * ldm_gpu_config_check_device:
+ *
+ * Ensure the device stored in the named group of the cache is still
+ * present at the same address, with the same IDs.
+ */
+static gboolean ldm_gpu_config_check_device(GKeyFile *file, const gchar *group)
+{
+        g_autofree gchar *address = NULL;
+        gint vendor_id = 0;
+        gint product_id = 0;
+
+        if (!g_key_file_has_group(file, group)) {
+                return TRUE;
+        }
+
+        address = g_key_file_get_string(file, group, "Address", NULL);
+        if (!address || strchr(address, G_DIR_SEPARATOR) || g_str_equal(address, "..")) {
+                return FALSE;
+        }
+
+        if (!ldm_gpu_config_read_sysattr(address, "vendor", &vendor_id) ||
+            !ldm_gpu_config_read_sysattr(address, "device", &product_id)) {
+                return FALSE;
+        }
+
+        return vendor_id == g_key_file_get_integer(file, group, "VendorID", NULL) &&
+               product_id == g_key_file_get_integer(file, group, "ProductID", NULL);
+}
+
+/**
+ * ldm_gpu_config_read_cache:
+ * @path: Location of the cache file
+ * @gpu_type: (out): Location to store the cached #LdmGPUType
+ *
+ * Read the GPU topology previously stored with #ldm_gpu_config_save_cache.
+ * The cache is only trusted if the stored devices still exist at the same
+ * PCI addresses with the same IDs, which is checked directly in sysfs, so
+ * this is far cheaper than building a new #LdmGPUConfig.
+ *
+ * Returns: TRUE if the cache is valid for the current hardware
+ */
+gboolean ldm_gpu_config_read_cache(const gchar *path, LdmGPUType *gpu_type)
+{
+        g_autoptr(GKeyFile) file = NULL;
+        g_autoptr(GError) error = NULL;
+        gint type = 0;
+
+        g_return_val_if_fail(path != NULL, FALSE);
+        g_return_val_if_fail(gpu_type != NULL, FALSE);
+
+        file = g_key_file_new();
+        if (!g_key_file_load_from_file(file, path, G_KEY_FILE_NONE, NULL)) {
+                return FALSE;
+        }
+
+        type = g_key_file_get_integer(file, "GPU", "Type", &error);
+        if (error || type < 0 || (guint)type >= ((guint)LDM_GPU_TYPE_CROSSFIRE << 1)) {
+                return FALSE;
+        }
+
+        if (!ldm_gpu_config_check_device(file, "Primary") ||
+            !ldm_gpu_config_check_device(file, "Secondary")) {
+                return FALSE;
+        }
+
+        *gpu_type = (LdmGPUType)type;
+        return TRUE;
+}
+
 /*
  * Editor modelines  -  https://www.wireshark.org/tools/modelines.html
  *
@@ -51,6 +51,21 @@ typedef enum {
         LDM_GPU_TYPE_MAX,
 } LdmGPUType;
 
+/**
+ * LdmGPUSelect:
+ * @LDM_GPU_SELECT_BOOT: The GPU used to boot the system, i.e. the primary device
+ * @LDM_GPU_SELECT_FASTEST_DISCRETE: The discrete GPU with the widest PCIe link
+ * @LDM_GPU_SELECT_NUMA_NODE: The fastest GPU attached to a given NUMA node
+ *
+ * Policy used by #ldm_gpu_config_select to pick a single GPU from the
+ * topology, i.e. to pin a workload to the most suitable card.
+ */
+typedef enum {
+        LDM_GPU_SELECT_BOOT = 0,
+        LDM_GPU_SELECT_FASTEST_DISCRETE,
+        LDM_GPU_SELECT_NUMA_NODE,
+} LdmGPUSelect;
+
 #define LDM_TYPE_GPU_CONFIG ldm_gpu_config_get_type()
 #define LDM_GPU_CONFIG(o) (G_TYPE_CHECK_INSTANCE_CAST((o), LDM_TYPE_GPU_CONFIG, LdmGPUConfig))
 #define LDM_IS_GPU_CONFIG(o) (G_TYPE_CHECK_INSTANCE_TYPE((o), LDM_TYPE_GPU_CONFIG))
@@ -71,7 +86,12 @@ gboolean ldm_gpu_config_has_type(LdmGPUConfig *config, LdmGPUType mask);
 LdmDevice *ldm_gpu_config_get_primary_device(LdmGPUConfig *config);
 LdmDevice *ldm_gpu_config_get_secondary_device(LdmGPUConfig *config);
 LdmDevice *ldm_gpu_config_get_detection_device(LdmGPUConfig *config);
+GPtrArray *ldm_gpu_config_get_gpus(LdmGPUConfig *config);
+LdmDevice *ldm_gpu_config_select(LdmGPUConfig *config, LdmGPUSelect policy, gint numa_node);
 GPtrArray *ldm_gpu_config_get_providers(LdmGPUConfig *config);
+LdmProvider *ldm_gpu_config_get_best_provider(LdmGPUConfig *config);
+gboolean ldm_gpu_config_save_cache(LdmGPUConfig *config, const gchar *path);
+gboolean ldm_gpu_config_read_cache(const gchar *path, LdmGPUType *gpu_type);
 
 G_DEFINE_AUTOPTR_CLEANUP_FUNC(LdmGPUConfig, g_object_unref)
 
@@ -14,7 +14,9 @@
 #include <glib-object.h>
 #include <libudev.h>
 
+#include "device-record.h"
 #include "device.h"
+#include "gpu-config.h"
 #include "util.h"
 
 /*
@@ -30,6 +32,19 @@ struct _LdmDeviceClass {
         GInitiallyUnownedClass parent_class;
 };
 
+/*
+ * Construction from udev happens in two phases. Everything needed to build
+ * and filter the tree (path, subsystem, modalias, IDs and types) comes from
+ * the uevent properties, which udev reads in one go. Anything needing its
+ * own sysfs read is deferred, and resolved by ldm_device_resolve on first
+ * use, so devices nobody inspects never pay for it.
+ */
+typedef enum {
+        LDM_DEVICE_DEFERRED_ATTRIBUTES = 1 << 0, /* os.attributes (boot_vga), PCI locality */
+        LDM_DEVICE_DEFERRED_IDENTITY = 1 << 1,   /* id.name and id.vendor */
+        LDM_DEVICE_DEFERRED_ALL = LDM_DEVICE_DEFERRED_ATTRIBUTES | LDM_DEVICE_DEFERRED_IDENTITY,
+} LdmDeviceDeferred;
+
 /*
  * LdmDevice
  *
@@ -42,22 +57,25 @@ struct _LdmDevice {
 
         struct {
                 LdmDevice *parent;
-                GHashTable *kids;
+                GPtrArray *kids;       /* Owned, in order of insertion */
+                GPtrArray *modaliases; /* Lazily collected subtree modaliases */
         } tree;
 
         /* OS Data */
         struct {
                 gchar *sysfs_path;
                 gchar *modalias;
-                GHashTable *hwdb_info;
+                const gchar *subsystem;  /* Interned, nullable */
+                LdmDeviceRecord *record; /* Retained for lazy property lookups */
                 guint devtype;
                 guint attributes;
+                guint deferred; /* LdmDeviceDeferred, still to be resolved */
         } os;
 
         /* Identification */
         struct {
                 gchar *name;
-                gchar *vendor;
+                const gchar *vendor; /* Interned */
                 gint product_id;
                 gint vendor_id;
         } id;
@@ -71,18 +89,65 @@ DEF_AUTOFREE(udev_enum, udev_enumerate_unref)
 DEF_AUTOFREE(gchar, g_free)
 
 /* Private device API */
-LdmDevice *ldm_device_new_from_udev(LdmDevice *parent, udev_device *device, udev_list *properties);
+LdmDevice *ldm_device_new_from_record(LdmDevice *parent, LdmDeviceRecord *record);
+const gchar *ldm_device_get_property(LdmDevice *device, const gchar *key);
+void ldm_device_resolve_deferred(LdmDevice *device, guint deferred);
+void ldm_device_save_snapshot(LdmDevice *device, GString *line);
+LdmDevice *ldm_device_new_from_snapshot(LdmDevice *parent, gchar **fields);
+
+/**
+ * Fields of a device line in the snapshot, following the parent index
+ */
+typedef enum {
+        LDM_SNAPSHOT_FIELD_TYPE = 0,
+        LDM_SNAPSHOT_FIELD_PATH,
+        LDM_SNAPSHOT_FIELD_MODALIAS,
+        LDM_SNAPSHOT_FIELD_NAME,
+        LDM_SNAPSHOT_FIELD_VENDOR,
+        LDM_SNAPSHOT_FIELD_PRODUCT_ID,
+        LDM_SNAPSHOT_FIELD_VENDOR_ID,
+        LDM_SNAPSHOT_FIELD_DEVICE_TYPE,
+        LDM_SNAPSHOT_FIELD_ATTRIBUTES,
+        LDM_SNAPSHOT_FIELD_PRIVATE, /* Subclass specific, may be empty */
+        LDM_SNAPSHOT_N_FIELDS,
+} LdmSnapshotField;
+
+void ldm_snapshot_append_field(GString *line, const gchar *value);
 
-void ldm_dmi_device_init_private(LdmDevice *self, udev_device *device);
-void ldm_pci_device_init_private(LdmDevice *self, udev_device *device);
-void ldm_usb_device_init_private(LdmDevice *self, udev_device *device);
-void ldm_bluetooth_device_init_private(LdmDevice *self, udev_device *device);
+void ldm_dmi_device_init_private(LdmDevice *self, LdmDeviceRecord *record);
+void ldm_dmi_device_resolve_private(LdmDevice *self, LdmDeviceRecord *record, guint deferred);
+void ldm_pci_device_init_private(LdmDevice *self, LdmDeviceRecord *record);
+void ldm_pci_device_resolve_private(LdmDevice *self, LdmDeviceRecord *record, guint deferred);
+void ldm_pci_device_save_private(LdmDevice *self, GString *line);
+gboolean ldm_pci_device_restore_private(LdmDevice *self, const gchar *field);
+void ldm_usb_device_init_private(LdmDevice *self, LdmDeviceRecord *record);
+void ldm_bluetooth_device_init_private(LdmDevice *self, LdmDeviceRecord *record);
+
+/**
+ * ldm_device_resolve:
+ * @deferred: Bitwise OR of the #LdmDeviceDeferred fields about to be read
+ *
+ * Ensure the given fields have been resolved, which is only a flag test
+ * when they already have been. Safe to call from any thread.
+ */
+static inline void ldm_device_resolve(LdmDevice *device, guint deferred)
+{
+        guint pending = (guint)g_atomic_int_get((gint *)&device->os.deferred);
+
+        if (G_UNLIKELY((pending & deferred) != 0)) {
+                ldm_device_resolve_deferred(device, deferred);
+        }
+}
 
 /* private child APIs */
 void ldm_device_add_child(LdmDevice *device, LdmDevice *child);
 void ldm_device_remove_child(LdmDevice *device, LdmDevice *child);
 void ldm_device_remove_child_by_path(LdmDevice *device, const gchar *path);
 LdmDevice *ldm_device_get_child_by_path(LdmDevice *device, const gchar *path);
+GPtrArray *ldm_device_get_subtree_modaliases(LdmDevice *device);
+
+/* Private GPU topology cache API */
+gchar *ldm_gpu_config_build_cache(LdmGPUConfig *config, gsize *len);
 
 /*
  * Editor modelines  -  https://www.wireshark.org/tools/modelines.html
@@ -11,6 +11,7 @@
 
 #pragma once
 
+#include <device-table.h>
 #include <device.h>
 #include <glx-manager.h>
 #include <gpu-config.h>
@@ -0,0 +1,248 @@
+/*
+ * This file is part of linux-driver-management.
+ *
+ * Copyright © 2016-2018 Ikey Doherty
+ *
+ * linux-driver-management is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include "manager-private.h"
+
+/*
+ * With LDM_MANAGER_FLAGS_MONITOR_THREAD the udev monitor socket is serviced
+ * on a dedicated thread, so a busy consumer main loop can no longer cause
+ * the kernel to drop netlink messages. The thread does nothing more than
+ * drain the socket into a queue, and wake the consumer context, where the
+ * events are coalesced and applied exactly as they are without the thread.
+ *
+ * The device tree is therefore only ever touched from the consumer context
+ * and needs no locking. The handoff is shared by reference between the
+ * thread, any pending dispatch, and the manager, which breaks the link when
+ * disposed so that a late dispatch is harmless.
+ */
+struct LdmManagerMonitorThread {
+        gint ref_count;
+        GThread *thread;
+        GAsyncQueue *queue;    /* udev_device, produced by the thread */
+        GMainContext *context; /* Consumer context */
+        udev_monitor *monitor; /* Borrowed, only used by the thread */
+        int wakeup[2];         /* Pipe used to stop the thread */
+        gint scheduled;        /* Atomic, set while a dispatch is pending */
+        gint overrun;          /* Atomic, set when the kernel dropped events */
+        LdmManager *manager;   /* Only accessed from the consumer context */
+};
+
+static LdmManagerMonitorThread *ldm_manager_monitor_thread_ref(LdmManagerMonitorThread *self)
+{
+        g_atomic_int_inc(&self->ref_count);
+        return self;
+}
+
+static void ldm_manager_monitor_thread_unref(LdmManagerMonitorThread *self)
+{
+        if (!g_atomic_int_dec_and_test(&self->ref_count)) {
+                return;
+        }
+        g_async_queue_unref(self->queue);
+        g_main_context_unref(self->context);
+        g_free(self);
+}
+
+/**
+ * ldm_manager_monitor_thread_dispatch:
+ *
+ * Runs in the consumer context, feeding everything the thread has received
+ * into the coalescing queue.
+ */
+static gboolean ldm_manager_monitor_thread_dispatch(gpointer v)
+{
+        LdmManagerMonitorThread *self = v;
+        udev_device *device = NULL;
+
+        /* Reset first, so that anything queued from here on is dispatched again */
+        g_atomic_int_set(&self->scheduled, 0);
+
+        if (!self->manager) {
+                return G_SOURCE_REMOVE;
+        }
+
+        while ((device = g_async_queue_try_pop(self->queue)) != NULL) {
+                const char *action = udev_device_get_action(device);
+
+                if (action) {
+                        ldm_manager_queue_event(self->manager, device, action);
+                }
+                udev_device_unref(device);
+        }
+
+        if (g_atomic_int_compare_and_exchange(&self->overrun, 1, 0)) {
+                ldm_manager_handle_overrun(self->manager);
+        } else {
+                ldm_manager_schedule_flush(self->manager);
+        }
+
+        return G_SOURCE_REMOVE;
+}
+
+/**
+ * ldm_manager_monitor_thread_run:
+ *
+ * Thread body, draining the monitor socket until asked to stop.
+ */
+static gpointer ldm_manager_monitor_thread_run(gpointer v)
+{
+        LdmManagerMonitorThread *self = v;
+        struct pollfd fds[2] = {
+                { .fd = udev_monitor_get_fd(self->monitor), .events = POLLIN },
+                { .fd = self->wakeup[0], .events = POLLIN },
+        };
+
+        for (;;) {
+                udev_device *device = NULL;
+                GSource *source = NULL;
+                gboolean received = FALSE;
+
+                if (poll(fds, G_N_ELEMENTS(fds), -1) < 0) {
+                        if (errno == EINTR) {
+                                continue;
+                        }
+                        g_warning("Failed to poll udev monitor: %s", g_strerror(errno));
+                        break;
+                }
+
+                if (fds[1].revents != 0) {
+                        break;
+                }
+                if ((fds[0].revents & (POLLERR | POLLHUP | POLLNVAL)) != 0) {
+                        g_warning("udev monitor socket failed");
+                        break;
+                }
+
+                errno = 0;
+                while ((device = udev_monitor_receive_device(self->monitor)) != NULL) {
+                        g_async_queue_push(self->queue, device);
+                        received = TRUE;
+                        errno = 0;
+                }
+                if (errno == ENOBUFS) {
+                        g_atomic_int_set(&self->overrun, 1);
+                        received = TRUE;
+                }
+
+                if (!received || !g_atomic_int_compare_and_exchange(&self->scheduled, 0, 1)) {
+                        continue;
+                }
+
+                /* Attach rather than invoke, which runs it here if nobody owns the context */
+                source = g_idle_source_new();
+                g_source_set_priority(source, G_PRIORITY_DEFAULT);
+                g_source_set_callback(source,
+                                      ldm_manager_monitor_thread_dispatch,
+                                      ldm_manager_monitor_thread_ref(self),
+                                      (GDestroyNotify)ldm_manager_monitor_thread_unref);
+                g_source_attach(source, self->context);
+                g_source_unref(source);
+        }
+
+        ldm_manager_monitor_thread_unref(self);
+        return NULL;
+}
+
+/**
+ * ldm_manager_start_monitor_thread:
+ *
+ * Begin servicing the already configured udev monitor on a new thread,
+ * dispatching events to the thread default context of the caller.
+ *
+ * Returns: TRUE if the thread was started
+ */
+gboolean ldm_manager_start_monitor_thread(LdmManager *self)
+{
+        LdmManagerMonitorThread *thread = NULL;
+        g_autoptr(GError) error = NULL;
+
+        g_assert(self->monitor.udev != NULL);
+        g_assert(self->monitor.thread == NULL);
+
+        thread = g_new0(LdmManagerMonitorThread, 1);
+        thread->ref_count = 1;
+        thread->queue = g_async_queue_new_full((GDestroyNotify)udev_device_unref);
+        thread->context = g_main_context_ref_thread_default();
+        thread->monitor = self->monitor.udev;
+        thread->manager = self;
+
+        if (pipe2(thread->wakeup, O_CLOEXEC) != 0) {
+                g_warning("Failed to create monitor wakeup pipe: %s", g_strerror(errno));
+                ldm_manager_monitor_thread_unref(thread);
+                return FALSE;
+        }
+
+        /* The thread holds its own reference until it exits */
+        thread->thread = g_thread_try_new("ldm-monitor",
+                                          ldm_manager_monitor_thread_run,
+                                          ldm_manager_monitor_thread_ref(thread),
+                                          &error);
+        if (!thread->thread) {
+                g_warning("Failed to start monitor thread: %s", error->message);
+                close(thread->wakeup[0]);
+                close(thread->wakeup[1]);
+                /* Once for the thread that never ran, and once for ourselves */
+                ldm_manager_monitor_thread_unref(thread);
+                ldm_manager_monitor_thread_unref(thread);
+                return FALSE;
+        }
+
+        self->monitor.thread = thread;
+        return TRUE;
+}
+
+/**
+ * ldm_manager_stop_monitor_thread:
+ *
+ * Stop and join the monitor thread, if any, before the monitor is released.
+ * Any dispatch still pending in the consumer context becomes a no-op.
+ */
+void ldm_manager_stop_monitor_thread(LdmManager *self)
+{
+        LdmManagerMonitorThread *thread = self->monitor.thread;
+        const char stop = 0;
+
+        if (!thread) {
+                return;
+        }
+
+        while (write(thread->wakeup[1], &stop, sizeof(stop)) < 0 && errno == EINTR) {
+                ;
+        }
+        g_thread_join(thread->thread);
+        close(thread->wakeup[0]);
+        close(thread->wakeup[1]);
+
+        thread->manager = NULL;
+        thread->monitor = NULL;
+        self->monitor.thread = NULL;
+        ldm_manager_monitor_thread_unref(thread);
+}
+
+/*
+ * Editor modelines  -  https://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: nil
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 expandtab:
+ * :indentSize=8:tabSize=8:noTabs=true:
+ */
@@ -16,9 +16,327 @@
 #include "config.h"
 #include "manager-private.h"
 #include "plugin.h"
+#include "stats.h"
+#include "util.h"
 
 #include "plugins/modalias-plugin.h"
 
+/**
+ * ldm_manager_invalidate_all_providers:
+ *
+ * Drop every memoised provider result, as the set of plugins (or their
+ * ordering) has changed.
+ */
+void ldm_manager_invalidate_all_providers(LdmManager *self)
+{
+        g_hash_table_remove_all(self->provider_cache);
+        g_clear_pointer(&self->merged, ldm_modalias_merged_free);
+        ++self->generation;
+}
+
+/**
+ * ldm_manager_invalidate_descendants:
+ *
+ * Drop memoised results for all children of the device, recursively.
+ */
+static void ldm_manager_invalidate_descendants(LdmManager *self, LdmDevice *device)
+{
+        for (guint i = 0; i < device->tree.kids->len; i++) {
+                LdmDevice *child = device->tree.kids->pdata[i];
+
+                g_hash_table_remove(self->provider_cache, child);
+                ldm_manager_invalidate_descendants(self, child);
+        }
+}
+
+/**
+ * ldm_manager_invalidate_providers:
+ * @device: Device which is changing
+ *
+ * Drop memoised results for the device, as it is about to be removed, or
+ * gain a new child. Ancestors match on their children too, so these are
+ * dropped as well as any descendants.
+ */
+void ldm_manager_invalidate_providers(LdmManager *self, LdmDevice *device)
+{
+        for (LdmDevice *node = device; node; node = node->tree.parent) {
+                g_hash_table_remove(self->provider_cache, node);
+        }
+        ldm_manager_invalidate_descendants(self, device);
+        ldm_manager_index_device(self, device);
+        ++self->generation;
+}
+
+/**
+ * ldm_manager_reverse_insert:
+ *
+ * Count one more match for the device under @key, if any
+ */
+static void ldm_manager_reverse_insert(GHashTable *table, const gchar *key, LdmDevice *device)
+{
+        GHashTable *bucket = NULL;
+        guint count = 0;
+
+        if (!key) {
+                return;
+        }
+
+        bucket = g_hash_table_lookup(table, key);
+        if (!bucket) {
+                bucket = g_hash_table_new(g_direct_hash, g_direct_equal);
+                g_hash_table_insert(table, (gpointer)key, bucket);
+        }
+
+        count = GPOINTER_TO_UINT(g_hash_table_lookup(bucket, device));
+        g_hash_table_insert(bucket, device, GUINT_TO_POINTER(count + 1));
+}
+
+/**
+ * ldm_manager_reverse_remove:
+ *
+ * Count one less match for the device under @key, dropping the device once
+ * no provider refers to it, and the key once no device does.
+ */
+static void ldm_manager_reverse_remove(GHashTable *table, const gchar *key, LdmDevice *device)
+{
+        GHashTable *bucket = NULL;
+        guint count = 0;
+
+        if (!key) {
+                return;
+        }
+
+        bucket = g_hash_table_lookup(table, key);
+        if (!bucket) {
+                return;
+        }
+
+        count = GPOINTER_TO_UINT(g_hash_table_lookup(bucket, device));
+        if (count > 1) {
+                g_hash_table_insert(bucket, device, GUINT_TO_POINTER(count - 1));
+                return;
+        }
+
+        g_hash_table_remove(bucket, device);
+        if (g_hash_table_size(bucket) == 0) {
+                g_hash_table_remove(table, key);
+        }
+}
+
+/**
+ * ldm_manager_reverse_add:
+ * @device: Root device the provider was found for
+ * @providers: Providers already indexed for @device
+ * @provider: (transfer full): Provider to index
+ */
+static void ldm_manager_reverse_add(LdmManager *self, LdmDevice *device, GPtrArray *providers,
+                                    LdmProvider *provider)
+{
+        ldm_manager_reverse_insert(self->reverse.packages,
+                                   ldm_provider_get_package(provider),
+                                   device);
+        ldm_manager_reverse_insert(self->reverse.drivers,
+                                   ldm_provider_get_driver(provider),
+                                   device);
+        g_ptr_array_add(providers, provider);
+}
+
+/**
+ * ldm_manager_reverse_take:
+ *
+ * Remove the provider at @index from the reverse index
+ */
+static void ldm_manager_reverse_take(LdmManager *self, LdmDevice *device, GPtrArray *providers,
+                                     guint index)
+{
+        LdmProvider *provider = providers->pdata[index];
+
+        ldm_manager_reverse_remove(self->reverse.packages,
+                                   ldm_provider_get_package(provider),
+                                   device);
+        ldm_manager_reverse_remove(self->reverse.drivers,
+                                   ldm_provider_get_driver(provider),
+                                   device);
+        g_ptr_array_remove_index(providers, index);
+}
+
+/**
+ * ldm_manager_reverse_drop:
+ *
+ * Remove every provider of the root device from the reverse index
+ */
+static void ldm_manager_reverse_drop(LdmManager *self, LdmDevice *device)
+{
+        GPtrArray *providers = g_hash_table_lookup(self->reverse.devices, device);
+
+        if (!providers) {
+                return;
+        }
+
+        while (providers->len > 0) {
+                ldm_manager_reverse_take(self, device, providers, providers->len - 1);
+        }
+        g_hash_table_remove(self->reverse.devices, device);
+}
+
+/**
+ * ldm_manager_index_device:
+ * @device: Device which is new, or changing
+ *
+ * Queue the root of the device to be (re)indexed on the next reverse query,
+ * as providers may match on any device within the tree. Nothing is done
+ * until the reverse index has first been built.
+ */
+void ldm_manager_index_device(LdmManager *self, LdmDevice *device)
+{
+        LdmDevice *root = device;
+
+        if (!self->reverse.built) {
+                return;
+        }
+
+        while (root->tree.parent) {
+                root = root->tree.parent;
+        }
+        g_hash_table_add(self->reverse.dirty, root);
+}
+
+/**
+ * ldm_manager_unindex_device:
+ * @device: Root device being removed from the manager
+ *
+ * Drop the device from the reverse index, and any pending reindex.
+ */
+void ldm_manager_unindex_device(LdmManager *self, LdmDevice *device)
+{
+        if (!self->reverse.built) {
+                return;
+        }
+
+        g_hash_table_remove(self->reverse.dirty, device);
+        ldm_manager_reverse_drop(self, device);
+}
+
+/**
+ * ldm_manager_reverse_replace_plugin:
+ * @old_plugin: (nullable): Plugin being replaced
+ * @plugin: Newly registered plugin
+ *
+ * Update the reverse index for a plugin change by evaluating only the new
+ * plugin, rather than every plugin for every device. Devices still awaiting
+ * a full reindex are skipped, as they'll see the new plugin anyway.
+ */
+static void ldm_manager_reverse_replace_plugin(LdmManager *self, LdmPlugin *old_plugin,
+                                               LdmPlugin *plugin)
+{
+        GHashTableIter iter = { 0 };
+        gpointer device = NULL;
+        gpointer v = NULL;
+
+        if (!self->reverse.built) {
+                return;
+        }
+
+        g_hash_table_iter_init(&iter, self->reverse.devices);
+        while (g_hash_table_iter_next(&iter, &device, &v)) {
+                GPtrArray *providers = v;
+                LdmProvider *provider = NULL;
+
+                for (guint i = providers->len; old_plugin && i > 0; i--) {
+                        if (ldm_provider_get_plugin(providers->pdata[i - 1]) == old_plugin) {
+                                ldm_manager_reverse_take(self, device, providers, i - 1);
+                        }
+                }
+
+                if (g_hash_table_contains(self->reverse.dirty, device)) {
+                        continue;
+                }
+
+                provider = ldm_plugin_get_provider(plugin, device);
+                if (!provider) {
+                        continue;
+                }
+                if (g_object_is_floating(provider)) {
+                        g_object_ref_sink(provider);
+                }
+                ldm_manager_reverse_add(self, device, providers, provider);
+        }
+}
+
+/**
+ * ldm_manager_reverse_update:
+ *
+ * Build the reverse index on first use, or reindex whichever root devices
+ * have changed since the last query. Providers are taken from, and seed,
+ * the provider cache.
+ */
+static void ldm_manager_reverse_update(LdmManager *self)
+{
+        GHashTableIter iter = { 0 };
+        gpointer device = NULL;
+
+        if (!self->reverse.built) {
+                self->reverse.built = TRUE;
+                for (guint i = 0; i < self->devices->len; i++) {
+                        g_hash_table_add(self->reverse.dirty, self->devices->pdata[i]);
+                }
+        }
+
+        g_hash_table_iter_init(&iter, self->reverse.dirty);
+        while (g_hash_table_iter_next(&iter, &device, NULL)) {
+                g_autoptr(GPtrArray) resolved = NULL;
+                GPtrArray *providers = NULL;
+
+                ldm_manager_reverse_drop(self, device);
+
+                resolved = ldm_manager_get_providers(self, device);
+                providers = g_ptr_array_new_full(resolved->len, g_object_unref);
+                g_hash_table_insert(self->reverse.devices, g_object_ref(device), providers);
+
+                for (guint i = 0; i < resolved->len; i++) {
+                        ldm_manager_reverse_add(self,
+                                                device,
+                                                providers,
+                                                g_object_ref(resolved->pdata[i]));
+                }
+        }
+        g_hash_table_remove_all(self->reverse.dirty);
+}
+
+/**
+ * ldm_manager_insert_sorted:
+ *
+ * Insert the plugin into the sorted registry after all plugins of equal or
+ * higher priority, so that equal priorities retain their insert order.
+ */
+static void ldm_manager_insert_sorted(LdmManager *self, LdmPlugin *plugin)
+{
+        gint priority = ldm_plugin_get_priority(plugin);
+        guint index = 0;
+
+        for (index = 0; index < self->sorted_plugins->len; index++) {
+                if (ldm_plugin_get_priority(self->sorted_plugins->pdata[index]) < priority) {
+                        break;
+                }
+        }
+
+        g_ptr_array_insert(self->sorted_plugins, (gint)index, plugin);
+}
+
+/**
+ * ldm_manager_plugin_priority_changed:
+ *
+ * Reposition the plugin in the sorted registry. Cached provider results are
+ * sorted by priority, so they're no longer valid either.
+ */
+static void ldm_manager_plugin_priority_changed(GObject *plugin, __ldm_unused__ GParamSpec *spec,
+                                                LdmManager *self)
+{
+        g_ptr_array_remove(self->sorted_plugins, plugin);
+        ldm_manager_insert_sorted(self, LDM_PLUGIN(plugin));
+        ldm_manager_invalidate_all_providers(self);
+}
+
 /**
  * ldm_manager_add_plugin:
  * @plugin: (transfer full): New plugin to add.
@@ -31,6 +349,7 @@
 void ldm_manager_add_plugin(LdmManager *self, LdmPlugin *plugin)
 {
         const gchar *plugin_id = NULL;
+        LdmPlugin *old_plugin = NULL;
 
         g_return_if_fail(self != NULL);
         g_return_if_fail(plugin != NULL);
@@ -41,14 +360,48 @@ void ldm_manager_add_plugin(LdmManager *self, LdmPlugin *plugin)
                 plugin_id = G_OBJECT_CLASS_NAME(LDM_PLUGIN_GET_CLASS(plugin));
         }
 
-        if (g_hash_table_contains(self->plugins, plugin_id)) {
+        old_plugin = g_hash_table_lookup(self->plugins, plugin_id);
+        if (old_plugin) {
                 g_debug("replacing plugin '%s'", plugin_id);
+                g_signal_handlers_disconnect_by_data(old_plugin, self);
+                g_ptr_array_remove(self->sorted_plugins, old_plugin);
         } else {
                 g_debug("new plugin: %s", plugin_id);
         }
 
+        /* Before the old plugin is released, as its providers refer to it */
+        g_object_ref_sink(plugin);
+        ldm_manager_reverse_replace_plugin(self, old_plugin, plugin);
+
         /* Handle pythonic apis with non floating references */
-        g_hash_table_replace(self->plugins, g_strdup(plugin_id), g_object_ref_sink(plugin));
+        g_hash_table_replace(self->plugins, g_strdup(plugin_id), plugin);
+        ldm_manager_insert_sorted(self, plugin);
+        g_signal_connect(plugin,
+                         "notify::priority",
+                         G_CALLBACK(ldm_manager_plugin_priority_changed),
+                         self);
+
+        ldm_manager_invalidate_all_providers(self);
+}
+
+/**
+ * ldm_manager_register_modalias_plugin:
+ *
+ * Assign the next modalias priority to the plugin and add it to the manager.
+ */
+static gboolean ldm_manager_register_modalias_plugin(LdmManager *self, LdmPlugin *plugin)
+{
+        if (!plugin) {
+                return FALSE;
+        }
+
+        /* Enforce priority based on insert order */
+        ldm_plugin_set_priority(plugin, self->modalias_plugin_priority);
+        ++self->modalias_plugin_priority;
+
+        ldm_manager_add_plugin(self, plugin);
+
+        return TRUE;
 }
 
 /**
@@ -70,40 +423,61 @@ void ldm_manager_add_plugin(LdmManager *self, LdmPlugin *plugin)
 gboolean ldm_manager_add_modalias_plugin_for_path(LdmManager *self, const gchar *path)
 {
         LdmPlugin *plugin = NULL;
+        guint64 start = 0;
 
         if (!g_file_test(path, G_FILE_TEST_EXISTS)) {
                 return FALSE;
         }
 
+        start = ldm_stats_begin(LDM_STATS_PHASE_LOAD);
         plugin = ldm_modalias_plugin_new_from_filename(path);
+        ldm_stats_end(LDM_STATS_PHASE_LOAD, start);
 
-        /* Enforce priority based on insert order */
-        ldm_plugin_set_priority(plugin, self->modalias_plugin_priority);
-        ++self->modalias_plugin_priority;
+        return ldm_manager_register_modalias_plugin(self, plugin);
+}
 
-        ldm_manager_add_plugin(self, plugin);
+/**
+ * LdmManagerLoadJob:
+ *
+ * A single modalias file to be parsed on the loader pool
+ */
+typedef struct LdmManagerLoadJob {
+        const gchar *path;
+        LdmPlugin *plugin;
+} LdmManagerLoadJob;
 
-        return TRUE;
+/**
+ * ldm_manager_load_worker:
+ *
+ * Runs on the loader pool. Parsing touches nothing but the new plugin, so
+ * it is always safe to do concurrently.
+ */
+static void ldm_manager_load_worker(gpointer data, __ldm_unused__ gpointer user_data)
+{
+        LdmManagerLoadJob *job = data;
+
+        job->plugin = ldm_modalias_plugin_new_from_filename(job->path);
 }
 
 /**
- * ldm_manager_add_modalias_plugins_for_directory:
- * @directory: Path containing `*.modaliases` files
+ * ldm_manager_load_modalias_plugins:
  *
- * Attempt to bulk-add #LdmModaliasPlugin objects from the given directory to
- * ensure preservation of sort order and ease of use.
- *
- * This function is used to add well known modalias paths to the plugin and
- * construct plugins used for hardware detection.
+ * Parse every modalias file in the directory, concurrently, returning the
+ * plugins in glob order. Nothing but the new plugins is touched, so this
+ * may be called from any thread.
  *
- * Returns: TRUE if a new plugin was added
+ * Returns: (transfer full): The successfully parsed plugins
  */
-gboolean ldm_manager_add_modalias_plugins_for_directory(LdmManager *self, const gchar *directory)
+static GPtrArray *ldm_manager_load_modalias_plugins(const gchar *directory)
 {
         g_autofree gchar *glob_path = NULL;
         glob_t glo = { 0 };
-        gboolean ret = FALSE;
+        GPtrArray *ret = NULL;
+        g_autofree LdmManagerLoadJob *jobs = NULL;
+        GThreadPool *pool = NULL;
+        guint64 start = 0;
 
+        ret = g_ptr_array_new_with_free_func(g_object_unref);
         glob_path = g_strdup_printf("%s%s*.modaliases", directory, G_DIR_SEPARATOR_S);
 
         if (glob(glob_path, 0, NULL, &glo) != 0) {
@@ -114,9 +488,36 @@ gboolean ldm_manager_add_modalias_plugins_for_directory(LdmManager *self, const
                 goto cleanup;
         }
 
+        jobs = g_new0(LdmManagerLoadJob, glo.gl_pathc);
         for (size_t i = 0; i < glo.gl_pathc; i++) {
-                if (ldm_manager_add_modalias_plugin_for_path(self, glo.gl_pathv[i])) {
-                        ret = TRUE;
+                jobs[i].path = glo.gl_pathv[i];
+        }
+
+        /* Timed as a whole, as the files are parsed concurrently */
+        start = ldm_stats_begin(LDM_STATS_PHASE_LOAD);
+        if (glo.gl_pathc > 1) {
+                pool = g_thread_pool_new(ldm_manager_load_worker,
+                                         NULL,
+                                         (gint)MIN(g_get_num_processors(), glo.gl_pathc),
+                                         FALSE,
+                                         NULL);
+        }
+
+        for (size_t i = 0; i < glo.gl_pathc; i++) {
+                if (!pool || !g_thread_pool_push(pool, &jobs[i], NULL)) {
+                        ldm_manager_load_worker(&jobs[i], NULL);
+                }
+        }
+
+        /* Wait for every file to finish parsing */
+        if (pool) {
+                g_thread_pool_free(pool, FALSE, TRUE);
+        }
+        ldm_stats_end(LDM_STATS_PHASE_LOAD, start);
+
+        for (size_t i = 0; i < glo.gl_pathc; i++) {
+                if (jobs[i].plugin) {
+                        g_ptr_array_add(ret, g_object_ref_sink(jobs[i].plugin));
                 }
         }
 
@@ -126,68 +527,1138 @@ cleanup:
 }
 
 /**
- * ldm_manager_add_system_modalias_plugins:
- *
- * Attempt to add all modalias plugins directory from the modalias directory
- * set when the library was compiled.
+ * ldm_manager_register_modalias_plugins:
  *
- * This is a convenience wrapper around #ldm_manager_add_modalias_plugins_for_directory.
+ * Register the loaded plugins in glob order, so newer drivers get a higher
+ * priority.
  *
- * Returns: TRUE if any modalias plugins were added.
+ * Returns: TRUE if a new plugin was added
  */
-gboolean ldm_manager_add_system_modalias_plugins(LdmManager *self)
+static gboolean ldm_manager_register_modalias_plugins(LdmManager *self, GPtrArray *plugins)
 {
-        return ldm_manager_add_modalias_plugins_for_directory(self, MODALIAS_DIR);
-}
+        gboolean ret = FALSE;
 
-static gint ldm_manager_sort_by_priority(gconstpointer a, gconstpointer b)
-{
-        gint prioA = ldm_plugin_get_priority(ldm_provider_get_plugin(*(LdmProvider **)a));
-        gint prioB = ldm_plugin_get_priority(ldm_provider_get_plugin(*(LdmProvider **)b));
+        for (guint i = 0; i < plugins->len; i++) {
+                if (ldm_manager_register_modalias_plugin(self, plugins->pdata[i])) {
+                        ret = TRUE;
+                }
+        }
 
-        return prioB - prioA;
+        return ret;
 }
 
 /**
- * ldm_manager_get_providers:
+ * ldm_manager_add_modalias_plugins_for_directory:
+ * @directory: Path containing `*.modaliases` files
  *
- * Walk the plugins and find all known providers for the given device,
- * if they can support it. The returned #GPtrArray will free all elements
- * when it itself is freed.
+ * Attempt to bulk-add #LdmModaliasPlugin objects from the given directory to
+ * ensure preservation of sort order and ease of use.
  *
- * Returns: (element-type Ldm.Provider) (transfer container): a list of all possible providers
+ * This function is used to add well known modalias paths to the plugin and
+ * construct plugins used for hardware detection. The files are parsed
+ * concurrently, but are always added in glob order.
+ *
+ * Returns: TRUE if a new plugin was added
  */
-GPtrArray *ldm_manager_get_providers(LdmManager *self, LdmDevice *device)
+gboolean ldm_manager_add_modalias_plugins_for_directory(LdmManager *self, const gchar *directory)
 {
-        GPtrArray *ret = NULL;
-        __ldm_unused__ gpointer k = NULL;
-        LdmPlugin *plugin = NULL;
-        GHashTableIter iter = { 0 };
+        g_autoptr(GPtrArray) plugins = NULL;
 
-        g_return_val_if_fail(self != NULL, NULL);
+        g_return_val_if_fail(self != NULL, FALSE);
+        g_return_val_if_fail(directory != NULL, FALSE);
 
-        ret = g_ptr_array_new_with_free_func(g_object_unref);
+        plugins = ldm_manager_load_modalias_plugins(directory);
 
-        g_hash_table_iter_init(&iter, self->plugins);
-        while (g_hash_table_iter_next(&iter, &k, (void **)&plugin)) {
-                LdmProvider *provider = NULL;
+        return ldm_manager_register_modalias_plugins(self, plugins);
+}
 
-                /* See if this plugin supports the device */
-                provider = ldm_plugin_get_provider(plugin, device);
-                if (!provider) {
-                        continue;
-                }
+/**
+ * ldm_manager_load_thread:
+ *
+ * Runs on a worker thread, parsing the directory held in the task data
+ */
+static void ldm_manager_load_thread(GTask *task, __ldm_unused__ gpointer source, gpointer data,
+                                    __ldm_unused__ GCancellable *cancellable)
+{
+        if (g_task_return_error_if_cancelled(task)) {
+                return;
+        }
 
-                if (g_object_is_floating(provider)) {
-                        g_ptr_array_add(ret, g_object_ref_sink(provider));
-                } else {
-                        g_ptr_array_add(ret, provider);
-                }
+        g_task_return_pointer(task,
+                              ldm_manager_load_modalias_plugins(data),
+                              (GDestroyNotify)g_ptr_array_unref);
+}
+
+/**
+ * ldm_manager_load_ready:
+ *
+ * Back in the caller context, register the parsed plugins and complete the
+ * outer task.
+ */
+static void ldm_manager_load_ready(GObject *source, GAsyncResult *result, gpointer v)
+{
+        g_autoptr(GTask) task = v;
+        g_autoptr(GPtrArray) plugins = NULL;
+        GError *error = NULL;
+
+        plugins = g_task_propagate_pointer(G_TASK(result), &error);
+        if (!plugins) {
+                g_task_return_error(task, error);
+                return;
         }
 
-        g_ptr_array_sort(ret, ldm_manager_sort_by_priority);
+        g_task_return_boolean(task,
+                              ldm_manager_register_modalias_plugins(LDM_MANAGER(source), plugins));
+}
 
-        return ret;
+/**
+ * ldm_manager_add_modalias_plugins_for_directory_async:
+ * @directory: Path containing `*.modaliases` files
+ * @cancellable: (nullable): A #GCancellable, or NULL
+ * @callback: (scope async): Callback to invoke once the plugins are added
+ * @user_data: (closure): User data for @callback
+ *
+ * Asynchronous variant of #ldm_manager_add_modalias_plugins_for_directory.
+ * The files are read and parsed on a worker thread, and the plugins are
+ * then added in the thread default context of the caller, before
+ * @callback is invoked there.
+ */
+void ldm_manager_add_modalias_plugins_for_directory_async(LdmManager *self,
+                                                          const gchar *directory,
+                                                          GCancellable *cancellable,
+                                                          GAsyncReadyCallback callback,
+                                                          gpointer user_data)
+{
+        GTask *task = NULL;
+        g_autoptr(GTask) worker = NULL;
+
+        g_return_if_fail(self != NULL);
+        g_return_if_fail(directory != NULL);
+
+        task = g_task_new(self, cancellable, callback, user_data);
+        g_task_set_source_tag(task, ldm_manager_add_modalias_plugins_for_directory_async);
+
+        /* The outer task is owned by the worker callback */
+        worker = g_task_new(self, cancellable, ldm_manager_load_ready, task);
+        g_task_set_task_data(worker, g_strdup(directory), g_free);
+        g_task_run_in_thread(worker, ldm_manager_load_thread);
+}
+
+/**
+ * ldm_manager_add_modalias_plugins_for_directory_finish:
+ * @result: The #GAsyncResult passed to the callback
+ * @error: Return location for a #GError, or NULL
+ *
+ * Complete #ldm_manager_add_modalias_plugins_for_directory_async
+ *
+ * Returns: TRUE if a new plugin was added
+ */
+gboolean ldm_manager_add_modalias_plugins_for_directory_finish(LdmManager *self,
+                                                               GAsyncResult *result,
+                                                               GError **error)
+{
+        g_return_val_if_fail(g_task_is_valid(result, self), FALSE);
+
+        return g_task_propagate_boolean(G_TASK(result), error);
+}
+
+/**
+ * ldm_manager_add_system_modalias_plugins:
+ *
+ * Attempt to add all modalias plugins directory from the modalias directory
+ * set when the library was compiled.
+ *
+ * This is a convenience wrapper around #ldm_manager_add_modalias_plugins_for_directory.
+ *
+ * Returns: TRUE if any modalias plugins were added.
+ */
+gboolean ldm_manager_add_system_modalias_plugins(LdmManager *self)
+{
+        return ldm_manager_add_modalias_plugins_for_directory(self, MODALIAS_DIR);
+}
+
+/**
+ * ldm_manager_add_system_modalias_plugins_async:
+ * @cancellable: (nullable): A #GCancellable, or NULL
+ * @callback: (scope async): Callback to invoke once the plugins are added
+ * @user_data: (closure): User data for @callback
+ *
+ * Asynchronous variant of #ldm_manager_add_system_modalias_plugins, see
+ * #ldm_manager_add_modalias_plugins_for_directory_async.
+ */
+void ldm_manager_add_system_modalias_plugins_async(LdmManager *self, GCancellable *cancellable,
+                                                   GAsyncReadyCallback callback,
+                                                   gpointer user_data)
+{
+        ldm_manager_add_modalias_plugins_for_directory_async(self,
+                                                             MODALIAS_DIR,
+                                                             cancellable,
+                                                             callback,
+                                                             user_data);
+}
+
+/**
+ * ldm_manager_add_system_modalias_plugins_finish:
+ * @result: The #GAsyncResult passed to the callback
+ * @error: Return location for a #GError, or NULL
+ *
+ * Complete #ldm_manager_add_system_modalias_plugins_async
+ *
+ * Returns: TRUE if any modalias plugins were added.
+ */
+gboolean ldm_manager_add_system_modalias_plugins_finish(LdmManager *self, GAsyncResult *result,
+                                                        GError **error)
+{
+        return ldm_manager_add_modalias_plugins_for_directory_finish(self, result, error);
+}
+
+/**
+ * ldm_manager_share_plugins:
+ * @source: Manager to take the plugins from
+ *
+ * Add every plugin of @source to this manager, keeping their priorities.
+ * The plugins themselves are shared rather than copied, so the modalias
+ * files are parsed and indexed once no matter how many managers use them,
+ * which is how batch runs over many offline sources should be arranged.
+ *
+ * Plugins are immutable once loaded, so the managers may then be queried
+ * from different threads. Changing the priority of a shared plugin does
+ * affect every manager using it.
+ */
+void ldm_manager_share_plugins(LdmManager *self, LdmManager *source)
+{
+        g_return_if_fail(self != NULL);
+        g_return_if_fail(source != NULL);
+
+        for (guint i = 0; i < source->sorted_plugins->len; i++) {
+                ldm_manager_add_plugin(self, source->sorted_plugins->pdata[i]);
+        }
+
+        /* Modalias plugins added later still take precedence */
+        self->modalias_plugin_priority =
+            MAX(self->modalias_plugin_priority, source->modalias_plugin_priority);
+}
+
+/**
+ * ldm_manager_get_merged:
+ *
+ * Get the merged index over the registered modalias plugins, in priority
+ * order, (re)building it when the plugins have changed. Subclasses may
+ * override matching, so only plain modalias plugins take part, and the
+ * index is only worth having when two or more of them are registered.
+ *
+ * Returns: (transfer none) (nullable): The merged index, if any
+ */
+static LdmModaliasMerged *ldm_manager_get_merged(LdmManager *self)
+{
+        g_autoptr(GPtrArray) members = NULL;
+
+        if (self->merged && !ldm_modalias_merged_is_current(self->merged)) {
+                g_clear_pointer(&self->merged, ldm_modalias_merged_free);
+        }
+        if (self->merged) {
+                return self->merged;
+        }
+
+        members = g_ptr_array_new();
+        for (guint i = 0; i < self->sorted_plugins->len; i++) {
+                LdmPlugin *plugin = self->sorted_plugins->pdata[i];
+
+                if (G_OBJECT_TYPE(plugin) == LDM_TYPE_MODALIAS_PLUGIN) {
+                        g_ptr_array_add(members, plugin);
+                }
+        }
+        if (members->len < 2) {
+                return NULL;
+        }
+
+        self->merged = ldm_modalias_merged_new((LdmPlugin **)members->pdata, members->len);
+        return self->merged;
+}
+
+/**
+ * ldm_manager_is_merged:
+ * @slot: Next unvisited slot of the merged index
+ *
+ * Plugins are walked in priority order, the same order as the slots of the
+ * merged index, so only the next slot need ever be compared.
+ *
+ * Returns: TRUE if @plugin is answered by @slot of the merged index
+ */
+static inline gboolean ldm_manager_is_merged(LdmModaliasMerged *merged, guint slot,
+                                             LdmPlugin *plugin)
+{
+        return merged && slot < ldm_modalias_merged_get_n_plugins(merged) &&
+               ldm_modalias_merged_get_plugin(merged, slot) == plugin;
+}
+
+/**
+ * ldm_manager_take_provider:
+ *
+ * Append the provider, if any, sinking it when floating.
+ */
+static void ldm_manager_take_provider(GPtrArray *providers, LdmProvider *provider)
+{
+        if (!provider) {
+                return;
+        }
+
+        if (g_object_is_floating(provider)) {
+                g_ptr_array_add(providers, g_object_ref_sink(provider));
+        } else {
+                g_ptr_array_add(providers, provider);
+        }
+}
+
+/**
+ * LdmManagerMatchBatch:
+ *
+ * Completion tracking for one threaded resolve. Every job in the batch
+ * decrements the remaining count and signals once done.
+ */
+typedef struct LdmManagerMatchBatch {
+        GMutex lock;
+        GCond cond;
+        guint remaining;
+} LdmManagerMatchBatch;
+
+/**
+ * LdmManagerMatchJob:
+ *
+ * A single plugin evaluated against every device in the batch, storing
+ * one (possibly NULL) provider per device. Merged jobs instead evaluate
+ * every plugin of the merged index against a range of the devices, storing
+ * the provider of each slot in the row of its plugin, @stride apart.
+ */
+typedef struct LdmManagerMatchJob {
+        LdmManagerMatchBatch *batch;
+        LdmPlugin *plugin;
+        LdmDevice **devices;
+        LdmProvider **matches;
+        guint n_devices;
+
+        /* Merged jobs only */
+        LdmModaliasMerged *merged;
+        const guint *rows; /* Result row by slot */
+        gsize stride;
+} LdmManagerMatchJob;
+
+/**
+ * ldm_manager_match_merged:
+ *
+ * Match each device of the job through the merged index just the once
+ */
+static void ldm_manager_match_merged(LdmManagerMatchJob *job)
+{
+        guint n_slots = ldm_modalias_merged_get_n_plugins(job->merged);
+        g_autofree LdmProviderInfo *infos = g_new0(LdmProviderInfo, n_slots);
+
+        for (guint i = 0; i < job->n_devices; i++) {
+                if (ldm_modalias_merged_match(job->merged, job->devices[i], infos) == 0) {
+                        continue;
+                }
+                for (guint slot = 0; slot < n_slots; slot++) {
+                        if (!infos[slot].plugin) {
+                                continue;
+                        }
+                        job->matches[job->rows[slot] * job->stride + i] =
+                            ldm_provider_new_from_info(&infos[slot]);
+                }
+        }
+}
+
+/**
+ * ldm_manager_match_worker:
+ *
+ * Runs on the thread pool. Plugins must not modify the manager or device
+ * tree from ldm_plugin_get_provider, which is why threaded matching is opt-in.
+ */
+static void ldm_manager_match_worker(gpointer data, __ldm_unused__ gpointer user_data)
+{
+        LdmManagerMatchJob *job = data;
+
+        if (job->merged) {
+                ldm_manager_match_merged(job);
+        } else {
+                for (guint i = 0; i < job->n_devices; i++) {
+                        job->matches[i] = ldm_plugin_get_provider(job->plugin, job->devices[i]);
+                }
+        }
+
+        g_mutex_lock(&job->batch->lock);
+        --job->batch->remaining;
+        g_cond_signal(&job->batch->cond);
+        g_mutex_unlock(&job->batch->lock);
+}
+
+/**
+ * ldm_manager_resolve_threaded:
+ *
+ * Shard the plugins across the worker pool and wait for all of them to
+ * complete, then merge the results in priority order. Plugins covered by
+ * the merged index are evaluated together, sharding the devices instead.
+ */
+static void ldm_manager_resolve_threaded(LdmManager *self, GPtrArray *plugins,
+                                         LdmModaliasMerged *merged, LdmDevice **devices,
+                                         GPtrArray **results, guint n_devices)
+{
+        LdmManagerMatchBatch batch = { 0 };
+        g_autofree LdmManagerMatchJob *jobs = NULL;
+        g_autofree LdmProvider **matches = NULL;
+        g_autofree guint *rows = NULL;
+        guint n_chunks = 0;
+        guint n_jobs = 0;
+        guint slot = 0;
+
+        if (!self->match_pool) {
+                self->match_pool = g_thread_pool_new(ldm_manager_match_worker,
+                                                     NULL,
+                                                     (gint)g_get_num_processors(),
+                                                     FALSE,
+                                                     NULL);
+        }
+
+        if (merged) {
+                rows = g_new0(guint, ldm_modalias_merged_get_n_plugins(merged));
+                n_chunks = MIN(n_devices, g_get_num_processors());
+        }
+        jobs = g_new0(LdmManagerMatchJob, plugins->len + n_chunks);
+        matches = g_new0(LdmProvider *, (gsize)plugins->len * n_devices);
+
+        /* Plain jobs first, noting where each merged plugin stores its results */
+        for (guint i = 0; i < plugins->len; i++) {
+                if (ldm_manager_is_merged(merged, slot, plugins->pdata[i])) {
+                        rows[slot++] = i;
+                        continue;
+                }
+                jobs[n_jobs].batch = &batch;
+                jobs[n_jobs].plugin = plugins->pdata[i];
+                jobs[n_jobs].devices = devices;
+                jobs[n_jobs].matches = matches + (gsize)i * n_devices;
+                jobs[n_jobs].n_devices = n_devices;
+                ++n_jobs;
+        }
+
+        for (guint i = 0; i < n_chunks; i++) {
+                guint first = (guint)((guint64)n_devices * i / n_chunks);
+                guint last = (guint)((guint64)n_devices * (i + 1) / n_chunks);
+
+                jobs[n_jobs].batch = &batch;
+                jobs[n_jobs].devices = devices + first;
+                jobs[n_jobs].matches = matches + first;
+                jobs[n_jobs].n_devices = last - first;
+                jobs[n_jobs].merged = merged;
+                jobs[n_jobs].rows = rows;
+                jobs[n_jobs].stride = n_devices;
+                ++n_jobs;
+        }
+
+        g_mutex_init(&batch.lock);
+        g_cond_init(&batch.cond);
+        batch.remaining = n_jobs;
+
+        for (guint i = 0; i < n_jobs; i++) {
+                g_thread_pool_push(self->match_pool, &jobs[i], NULL);
+        }
+
+        g_mutex_lock(&batch.lock);
+        while (batch.remaining > 0) {
+                g_cond_wait(&batch.cond, &batch.lock);
+        }
+        g_mutex_unlock(&batch.lock);
+
+        g_mutex_clear(&batch.lock);
+        g_cond_clear(&batch.cond);
+
+        /* Merge on the calling thread, in plugin priority order */
+        for (guint i = 0; i < plugins->len; i++) {
+                for (guint j = 0; j < n_devices; j++) {
+                        ldm_manager_take_provider(results[j], matches[(gsize)i * n_devices + j]);
+                }
+        }
+}
+
+/**
+ * ldm_manager_resolve_serial:
+ * @infos: Scratch space for one record per slot of @merged
+ *
+ * Resolve a single device on the calling thread, in priority order. The
+ * plugins of the merged index are all answered by one lookup, made when
+ * the first of them is reached.
+ */
+static void ldm_manager_resolve_serial(LdmManager *self, LdmModaliasMerged *merged,
+                                       LdmDevice *device, GPtrArray *results, guint limit,
+                                       LdmProviderInfo *infos)
+{
+        GPtrArray *plugins = self->sorted_plugins;
+        gboolean matched = FALSE;
+        guint slot = 0;
+
+        for (guint i = 0; i < plugins->len; i++) {
+                LdmPlugin *plugin = plugins->pdata[i];
+
+                if (limit > 0 && results->len >= limit) {
+                        break;
+                }
+
+                if (!ldm_manager_is_merged(merged, slot, plugin)) {
+                        ldm_manager_take_provider(results, ldm_plugin_get_provider(plugin, device));
+                        continue;
+                }
+
+                if (!matched) {
+                        ldm_modalias_merged_match(merged, device, infos);
+                        matched = TRUE;
+                }
+                if (infos[slot].plugin) {
+                        ldm_manager_take_provider(results,
+                                                  ldm_provider_new_from_info(&infos[slot]));
+                }
+                ++slot;
+        }
+}
+
+/**
+ * ldm_manager_resolve_providers:
+ * @limit: Maximum number of providers per device, or 0 for no limit
+ *
+ * Ask each plugin, in priority order, for a provider for each device,
+ * appending them to the result array for that device. As the plugin
+ * registry is kept in priority order, the results are already sorted,
+ * and we can stop early for each device once @limit is reached.
+ */
+static void ldm_manager_resolve_providers(LdmManager *self, LdmDevice **devices,
+                                          GPtrArray **results, guint n_devices, guint limit)
+{
+        GPtrArray *plugins = self->sorted_plugins;
+        LdmModaliasMerged *merged = NULL;
+        g_autofree LdmProviderInfo *infos = NULL;
+        guint64 start = 0;
+        gboolean threaded = FALSE;
+
+        if (n_devices < 1) {
+                return;
+        }
+
+        start = ldm_stats_begin(LDM_STATS_PHASE_MATCH);
+        merged = ldm_manager_get_merged(self);
+
+        /* Limited queries are cheaper done serially, stopping early */
+        threaded = (self->flags & LDM_MANAGER_FLAGS_THREADED_MATCHING) ==
+                       LDM_MANAGER_FLAGS_THREADED_MATCHING &&
+                   plugins->len > 1 && limit == 0;
+
+        /* Gather each subtree once up front, as plugins may run concurrently.
+         * Deferred fields would otherwise be resolved racily on first use. */
+        for (guint j = 0; j < n_devices; j++) {
+                ldm_device_get_subtree_modaliases(devices[j]);
+                if (threaded) {
+                        ldm_device_resolve(devices[j], LDM_DEVICE_DEFERRED_ALL);
+                }
+        }
+
+        if (threaded) {
+                ldm_manager_resolve_threaded(self, plugins, merged, devices, results, n_devices);
+                goto done;
+        }
+
+        if (merged) {
+                infos = g_new0(LdmProviderInfo, ldm_modalias_merged_get_n_plugins(merged));
+        }
+        for (guint j = 0; j < n_devices; j++) {
+                ldm_manager_resolve_serial(self, merged, devices[j], results[j], limit, infos);
+        }
+
+done:
+        ldm_stats_end(LDM_STATS_PHASE_MATCH, start);
+}
+
+/**
+ * ldm_manager_copy_providers:
+ *
+ * Hand out a new container, sharing the providers
+ */
+static GPtrArray *ldm_manager_copy_providers(GPtrArray *providers)
+{
+        GPtrArray *ret = NULL;
+
+        ret = g_ptr_array_new_full(providers->len, g_object_unref);
+        for (guint i = 0; i < providers->len; i++) {
+                g_ptr_array_add(ret, g_object_ref(providers->pdata[i]));
+        }
+
+        return ret;
+}
+
+/**
+ * ldm_manager_collect_providers:
+ * @limit: Maximum number of providers to collect, or 0 for all of them
+ *
+ * Collect the sorted providers for just one device. Passing a @limit of 1
+ * will stop at the highest priority provider.
+ */
+static GPtrArray *ldm_manager_collect_providers(LdmManager *self, LdmDevice *device,
+                                                guint limit)
+{
+        GPtrArray *ret = NULL;
+
+        ret = g_ptr_array_new_with_free_func(g_object_unref);
+        ldm_manager_resolve_providers(self, &device, &ret, 1, limit);
+
+        return ret;
+}
+
+/**
+ * ldm_manager_get_providers:
+ *
+ * Walk the plugins and find all known providers for the given device,
+ * if they can support it. The returned #GPtrArray will free all elements
+ * when it itself is freed.
+ *
+ * Results are memoised per device until the plugins change, or the device
+ * itself changes, so repeated calls are cheap. Use #ldm_manager_get_generation
+ * to detect when previously returned results may be stale.
+ *
+ * Returns: (element-type Ldm.Provider) (transfer container): a list of all possible providers
+ */
+GPtrArray *ldm_manager_get_providers(LdmManager *self, LdmDevice *device)
+{
+        GPtrArray *ret = NULL;
+        GPtrArray *cached = NULL;
+
+        g_return_val_if_fail(self != NULL, NULL);
+        g_return_val_if_fail(device != NULL, NULL);
+
+        cached = g_hash_table_lookup(self->provider_cache, device);
+        if (!cached) {
+                cached = ldm_manager_collect_providers(self, device, 0);
+                g_hash_table_insert(self->provider_cache, g_object_ref(device), cached);
+        }
+
+        ret = ldm_manager_copy_providers(cached);
+
+        return ret;
+}
+
+/**
+ * ldm_manager_has_providers:
+ *
+ * Determine whether the device has any provider, through the same memoised
+ * results as #ldm_manager_get_providers but without copying them.
+ */
+gboolean ldm_manager_has_providers(LdmManager *self, LdmDevice *device)
+{
+        GPtrArray *cached = NULL;
+
+        cached = g_hash_table_lookup(self->provider_cache, device);
+        if (!cached) {
+                cached = ldm_manager_collect_providers(self, device, 0);
+                g_hash_table_insert(self->provider_cache, g_object_ref(device), cached);
+        }
+
+        return cached->len > 0;
+}
+
+/**
+ * LdmManagerProvidersJob:
+ *
+ * State for one ldm_manager_get_providers_async, captured in the caller
+ * context so that the worker never touches the manager.
+ */
+typedef struct LdmManagerProvidersJob {
+        LdmDevice *device;
+        GPtrArray *plugins; /* Private copy of the registry, in priority order */
+        guint generation;   /* Only cache if nothing changed in the meantime */
+} LdmManagerProvidersJob;
+
+static void ldm_manager_providers_job_free(LdmManagerProvidersJob *job)
+{
+        g_clear_object(&job->device);
+        g_clear_pointer(&job->plugins, g_ptr_array_unref);
+        g_free(job);
+}
+
+/**
+ * ldm_manager_providers_thread:
+ *
+ * Runs on a worker thread. As with #LDM_MANAGER_FLAGS_THREADED_MATCHING,
+ * plugins must not modify the manager or the device tree while matching.
+ */
+static void ldm_manager_providers_thread(GTask *task, __ldm_unused__ gpointer source,
+                                         gpointer data, __ldm_unused__ GCancellable *cancellable)
+{
+        LdmManagerProvidersJob *job = data;
+        GPtrArray *ret = NULL;
+        guint64 start = 0;
+
+        if (g_task_return_error_if_cancelled(task)) {
+                return;
+        }
+
+        start = ldm_stats_begin(LDM_STATS_PHASE_MATCH);
+        ret = g_ptr_array_new_with_free_func(g_object_unref);
+        for (guint i = 0; i < job->plugins->len; i++) {
+                ldm_manager_take_provider(ret,
+                                          ldm_plugin_get_provider(job->plugins->pdata[i],
+                                                                  job->device));
+        }
+        ldm_stats_end(LDM_STATS_PHASE_MATCH, start);
+
+        g_task_return_pointer(task, ret, (GDestroyNotify)g_ptr_array_unref);
+}
+
+/**
+ * ldm_manager_providers_ready:
+ *
+ * Back in the caller context, release the device tree, memoise the result
+ * if it is still current, and complete the outer task.
+ */
+static void ldm_manager_providers_ready(GObject *source, GAsyncResult *result, gpointer v)
+{
+        LdmManager *self = LDM_MANAGER(source);
+        g_autoptr(GTask) task = v;
+        LdmManagerProvidersJob *job = g_task_get_task_data(G_TASK(result));
+        GPtrArray *providers = NULL;
+        GError *error = NULL;
+
+        providers = g_task_propagate_pointer(G_TASK(result), &error);
+        ldm_manager_release_events(self);
+
+        if (!providers) {
+                g_task_return_error(task, error);
+                return;
+        }
+
+        if (job->generation == self->generation &&
+            !g_hash_table_contains(self->provider_cache, job->device)) {
+                g_hash_table_insert(self->provider_cache, g_object_ref(job->device), providers);
+                providers = ldm_manager_copy_providers(providers);
+        }
+
+        g_task_return_pointer(task, providers, (GDestroyNotify)g_ptr_array_unref);
+}
+
+/**
+ * ldm_manager_get_providers_async:
+ * @device: Device to find providers for
+ * @cancellable: (nullable): A #GCancellable, or NULL
+ * @callback: (scope async): Callback to invoke once the providers are known
+ * @user_data: (closure): User data for @callback
+ *
+ * Asynchronous variant of #ldm_manager_get_providers. The plugins are
+ * evaluated on a worker thread, and @callback is invoked in the thread
+ * default context of the caller. If the result is already memoised, no
+ * thread is used at all.
+ *
+ * Hotplug events, and #ldm_manager_rescan, are held back until the plugins
+ * have completed, so the device tree never changes underneath them.
+ */
+void ldm_manager_get_providers_async(LdmManager *self, LdmDevice *device,
+                                     GCancellable *cancellable, GAsyncReadyCallback callback,
+                                     gpointer user_data)
+{
+        GTask *task = NULL;
+        g_autoptr(GTask) worker = NULL;
+        LdmManagerProvidersJob *job = NULL;
+        GPtrArray *cached = NULL;
+
+        g_return_if_fail(self != NULL);
+        g_return_if_fail(device != NULL);
+
+        task = g_task_new(self, cancellable, callback, user_data);
+        g_task_set_source_tag(task, ldm_manager_get_providers_async);
+
+        cached = g_hash_table_lookup(self->provider_cache, device);
+        if (cached) {
+                g_task_return_pointer(task,
+                                      ldm_manager_copy_providers(cached),
+                                      (GDestroyNotify)g_ptr_array_unref);
+                g_object_unref(task);
+                return;
+        }
+
+        job = g_new0(LdmManagerProvidersJob, 1);
+        job->device = g_object_ref(device);
+        job->plugins = g_ptr_array_new_full(self->sorted_plugins->len, g_object_unref);
+        for (guint i = 0; i < self->sorted_plugins->len; i++) {
+                g_ptr_array_add(job->plugins, g_object_ref(self->sorted_plugins->pdata[i]));
+        }
+        job->generation = self->generation;
+
+        /* Anything lazily resolved must be done here, before the worker reads it */
+        ldm_device_get_subtree_modaliases(device);
+        ldm_device_resolve(device, LDM_DEVICE_DEFERRED_ALL);
+        ldm_manager_hold_events(self);
+
+        /* The outer task is owned by the worker callback */
+        worker = g_task_new(self, cancellable, ldm_manager_providers_ready, task);
+        g_task_set_task_data(worker, job, (GDestroyNotify)ldm_manager_providers_job_free);
+        g_task_run_in_thread(worker, ldm_manager_providers_thread);
+}
+
+/**
+ * ldm_manager_get_providers_finish:
+ * @result: The #GAsyncResult passed to the callback
+ * @error: Return location for a #GError, or NULL
+ *
+ * Complete #ldm_manager_get_providers_async
+ *
+ * Returns: (element-type Ldm.Provider) (transfer container): a list of all possible providers
+ */
+GPtrArray *ldm_manager_get_providers_finish(LdmManager *self, GAsyncResult *result,
+                                            GError **error)
+{
+        g_return_val_if_fail(g_task_is_valid(result, self), NULL);
+
+        return g_task_propagate_pointer(G_TASK(result), error);
+}
+
+/**
+ * ldm_manager_get_all_providers:
+ * @class_mask: Bitwise mask of LdmDeviceType
+ *
+ * Resolve the providers for every device matching @class_mask, as found by
+ * #ldm_manager_get_devices, in a single pass over the plugins. This is far
+ * cheaper than calling #ldm_manager_get_providers for each device in turn
+ * when building a full view of the system.
+ *
+ * Each value in the returned table is a #GPtrArray of #LdmProvider, sorted
+ * by priority, exactly as #ldm_manager_get_providers would have returned.
+ * Devices without any providers are still present with an empty array.
+ *
+ * Returns: (element-type Ldm.Device GLib.PtrArray) (transfer container): device to providers
+ */
+GHashTable *ldm_manager_get_all_providers(LdmManager *self, LdmDeviceType class_mask)
+{
+        GHashTable *ret = NULL;
+        g_autoptr(GPtrArray) devices = NULL;
+        g_autoptr(GPtrArray) pending = NULL;
+        g_autoptr(GPtrArray) results = NULL;
+
+        g_return_val_if_fail(self != NULL, NULL);
+
+        ret = g_hash_table_new_full(g_direct_hash,
+                                    g_direct_equal,
+                                    g_object_unref,
+                                    (GDestroyNotify)g_ptr_array_unref);
+        devices = ldm_manager_get_devices(self, class_mask);
+        pending = g_ptr_array_new();
+        results = g_ptr_array_new();
+
+        /* Seed cache entries for anything we haven't seen yet */
+        for (guint i = 0; i < devices->len; i++) {
+                LdmDevice *device = devices->pdata[i];
+                GPtrArray *cached = NULL;
+
+                if (g_hash_table_contains(self->provider_cache, device)) {
+                        continue;
+                }
+                cached = g_ptr_array_new_with_free_func(g_object_unref);
+                g_hash_table_insert(self->provider_cache, g_object_ref(device), cached);
+                g_ptr_array_add(pending, device);
+                g_ptr_array_add(results, cached);
+        }
+
+        /* One sweep through the plugins, in priority order */
+        ldm_manager_resolve_providers(self,
+                                      (LdmDevice **)pending->pdata,
+                                      (GPtrArray **)results->pdata,
+                                      pending->len,
+                                      0);
+
+        for (guint i = 0; i < devices->len; i++) {
+                LdmDevice *device = devices->pdata[i];
+                GPtrArray *cached = g_hash_table_lookup(self->provider_cache, device);
+
+                g_hash_table_insert(ret, g_object_ref(device), ldm_manager_copy_providers(cached));
+        }
+
+        return ret;
+}
+
+/**
+ * ldm_manager_append_infos:
+ *
+ * Append a record for each of the providers, borrowing their contents
+ */
+static void ldm_manager_append_infos(GArray *infos, GPtrArray *providers)
+{
+        for (guint i = 0; i < providers->len; i++) {
+                LdmProvider *provider = providers->pdata[i];
+                LdmProviderInfo info = {
+                        .plugin = ldm_provider_get_plugin(provider),
+                        .device = ldm_provider_get_device(provider),
+                        .package = ldm_provider_get_package(provider),
+                        .driver = ldm_provider_get_driver(provider),
+                };
+
+                g_array_append_val(infos, info);
+        }
+}
+
+/**
+ * ldm_manager_get_provider_infos:
+ * @class_mask: Bitwise mask of LdmDeviceType
+ *
+ * Resolve the providers for every device matching @class_mask, just like
+ * #ldm_manager_get_all_providers, but as plain #LdmProviderInfo records in
+ * one array, without constructing any #LdmProvider objects. The records are
+ * grouped by device, in the order of #ldm_manager_get_devices, and sorted
+ * by priority within each device.
+ *
+ * Devices with memoised providers are answered from the cache, and the
+ * remainder are matched with #ldm_plugin_match, or through one lookup for
+ * all of the modalias plugins together. Nothing new is cached, as
+ * no objects exist to cache. The records borrow the plugins and devices of
+ * the manager, so they must not be used once #ldm_manager_get_generation
+ * changes. Use #ldm_provider_new_from_info for anything longer lived.
+ *
+ * Returns: (element-type Ldm.ProviderInfo) (transfer full): All known matches
+ */
+GArray *ldm_manager_get_provider_infos(LdmManager *self, LdmDeviceType class_mask)
+{
+        GArray *ret = NULL;
+        GPtrArray *plugins = NULL;
+        LdmModaliasMerged *merged = NULL;
+        g_autofree LdmProviderInfo *infos = NULL;
+        GPtrArray *candidates = NULL;
+        guint64 start = 0;
+
+        g_return_val_if_fail(self != NULL, NULL);
+
+        plugins = self->sorted_plugins;
+        candidates = ldm_manager_get_candidates(self, class_mask);
+        ret = g_array_sized_new(FALSE, FALSE, sizeof(LdmProviderInfo), candidates->len);
+
+        start = ldm_stats_begin(LDM_STATS_PHASE_MATCH);
+        merged = ldm_manager_get_merged(self);
+        if (merged) {
+                infos = g_new0(LdmProviderInfo, ldm_modalias_merged_get_n_plugins(merged));
+        }
+        for (guint i = 0; i < candidates->len; i++) {
+                LdmDevice *device = candidates->pdata[i];
+                GPtrArray *cached = NULL;
+                gboolean matched = FALSE;
+                guint slot = 0;
+
+                if (!ldm_device_has_type(device, class_mask)) {
+                        continue;
+                }
+
+                cached = g_hash_table_lookup(self->provider_cache, device);
+                if (cached) {
+                        ldm_manager_append_infos(ret, cached);
+                        continue;
+                }
+
+                for (guint j = 0; j < plugins->len; j++) {
+                        LdmProviderInfo info = { 0 };
+
+                        if (!ldm_manager_is_merged(merged, slot, plugins->pdata[j])) {
+                                if (ldm_plugin_match(plugins->pdata[j], device, &info)) {
+                                        g_array_append_val(ret, info);
+                                }
+                                continue;
+                        }
+
+                        if (!matched) {
+                                ldm_modalias_merged_match(merged, device, infos);
+                                matched = TRUE;
+                        }
+                        if (infos[slot].plugin) {
+                                g_array_append_val(ret, infos[slot]);
+                        }
+                        ++slot;
+                }
+        }
+        ldm_stats_end(LDM_STATS_PHASE_MATCH, start);
+
+        return ret;
+}
+
+/**
+ * ldm_manager_describe_providers:
+ * @class_mask: Bitwise mask of LdmDeviceType
+ *
+ * Describe every provider #ldm_manager_get_provider_infos would return for
+ * @class_mask, in the same order, as a single #LDM_MANAGER_PROVIDERS_FORMAT
+ * variant. Records are keyed by device path, so they may be joined with
+ * those of #ldm_manager_describe_devices. Unlike the records, the variant
+ * copies its strings, so it stays valid however the manager changes.
+ *
+ * Returns: (transfer full): The provider records
+ */
+GVariant *ldm_manager_describe_providers(LdmManager *self, LdmDeviceType class_mask)
+{
+        g_autoptr(GArray) infos = NULL;
+        GVariantBuilder builder = { 0 };
+
+        g_return_val_if_fail(self != NULL, NULL);
+
+        infos = ldm_manager_get_provider_infos(self, class_mask);
+
+        g_variant_builder_init(&builder, G_VARIANT_TYPE(LDM_MANAGER_PROVIDERS_FORMAT));
+        for (guint i = 0; i < infos->len; i++) {
+                LdmProviderInfo *info = &g_array_index(infos, LdmProviderInfo, i);
+                /* Modalias files are free to name anything, GVariant demands UTF-8 */
+                g_autofree gchar *plugin = ldm_utf8_dup(ldm_plugin_get_name(info->plugin));
+                g_autofree gchar *package = ldm_utf8_dup(info->package);
+                g_autofree gchar *driver = ldm_utf8_dup(info->driver);
+
+                g_variant_builder_add(&builder,
+                                      "(ssss)",
+                                      ldm_device_get_path(info->device),
+                                      plugin,
+                                      package,
+                                      driver);
+        }
+
+        return g_variant_ref_sink(g_variant_builder_end(&builder));
+}
+
+/**
+ * ldm_manager_get_best_provider:
+ * @device: Device to find a provider for
+ *
+ * Find only the highest priority provider for the given device. Plugins are
+ * evaluated in descending priority order, returning as soon as any plugin
+ * matches, so this is much cheaper than #ldm_manager_get_providers when the
+ * remaining candidates are uninteresting.
+ *
+ * Returns: (transfer full) (nullable): The best #LdmProvider for the device, if any
+ */
+LdmProvider *ldm_manager_get_best_provider(LdmManager *self, LdmDevice *device)
+{
+        g_autoptr(GPtrArray) providers = NULL;
+        GPtrArray *cached = NULL;
+
+        g_return_val_if_fail(self != NULL, NULL);
+        g_return_val_if_fail(device != NULL, NULL);
+
+        /* Full results may already be known */
+        cached = g_hash_table_lookup(self->provider_cache, device);
+        if (cached) {
+                return cached->len > 0 ? g_object_ref(cached->pdata[0]) : NULL;
+        }
+
+        /* Partial results are not cached, as they're incomplete */
+        providers = ldm_manager_collect_providers(self, device, 1);
+        if (providers->len < 1) {
+                return NULL;
+        }
+
+        return g_object_ref(providers->pdata[0]);
+}
+
+/**
+ * ldm_manager_get_devices_for:
+ *
+ * Collect the devices in a reverse index bucket, in manager order
+ */
+static GPtrArray *ldm_manager_get_devices_for(LdmManager *self, GHashTable *table,
+                                              const gchar *key)
+{
+        GPtrArray *ret = NULL;
+        GHashTable *bucket = NULL;
+
+        ret = g_ptr_array_new_with_free_func(g_object_unref);
+
+        ldm_manager_reverse_update(self);
+        bucket = g_hash_table_lookup(table, key);
+        if (!bucket) {
+                return ret;
+        }
+
+        for (guint i = 0; i < self->devices->len && ret->len < g_hash_table_size(bucket); i++) {
+                LdmDevice *device = self->devices->pdata[i];
+
+                if (g_hash_table_contains(bucket, device)) {
+                        g_ptr_array_add(ret, g_object_ref(device));
+                }
+        }
+
+        return ret;
+}
+
+/**
+ * ldm_manager_get_devices_for_package:
+ * @package: Package or bundle name, as found by #ldm_provider_get_package
+ *
+ * Find every device with a provider for the given package, from any plugin.
+ * This answers "which devices need this package?" without resolving every
+ * device in turn.
+ *
+ * The manager keeps a reverse index from package to devices, built on
+ * first use, and from then on maintained incrementally. Hotplugged devices
+ * are indexed on the next query, while a newly registered plugin is only
+ * evaluated by itself, against the devices already known.
+ *
+ * Returns: (element-type Ldm.Device) (transfer container): Devices needing @package
+ */
+GPtrArray *ldm_manager_get_devices_for_package(LdmManager *self, const gchar *package)
+{
+        g_return_val_if_fail(self != NULL, NULL);
+        g_return_val_if_fail(package != NULL, NULL);
+
+        return ldm_manager_get_devices_for(self, self->reverse.packages, package);
+}
+
+/**
+ * ldm_manager_get_devices_for_driver:
+ * @driver: Kernel driver name, as found by #ldm_provider_get_driver
+ *
+ * Find every device with a provider using the given kernel driver, such as
+ * the driver of a matching #LdmModalias. This shares the reverse index used
+ * by #ldm_manager_get_devices_for_package.
+ *
+ * Returns: (element-type Ldm.Device) (transfer container): Devices using @driver
+ */
+GPtrArray *ldm_manager_get_devices_for_driver(LdmManager *self, const gchar *driver)
+{
+        g_return_val_if_fail(self != NULL, NULL);
+        g_return_val_if_fail(driver != NULL, NULL);
+
+        return ldm_manager_get_devices_for(self, self->reverse.drivers, driver);
+}
+
+/**
+ * ldm_manager_get_generation:
+ *
+ * The generation counter is bumped whenever results previously returned
+ * from #ldm_manager_get_providers may have become stale, i.e. when a plugin
+ * is added, replaced or reprioritised, or when devices are changed or removed.
+ * Callers may compare this value cheaply to know when to refresh.
+ *
+ * Returns: The current provider generation
+ */
+guint ldm_manager_get_generation(LdmManager *self)
+{
+        g_return_val_if_fail(self != NULL, 0);
+
+        return self->generation;
+}
+
+/**
+ * ldm_manager_get_stats:
+ * @stats: (out caller-allocates): Location to store the totals
+ *
+ * Fill @stats with the time spent in each phase of the library, along with
+ * the counters for the work done. The totals cover every manager in the
+ * current process, so callers interested in a single operation should take
+ * the difference between two calls.
+ *
+ * When the library is built without instrumentation, @stats is zeroed.
+ *
+ * Returns: TRUE if the library was built with instrumentation
+ */
+gboolean ldm_manager_get_stats(LdmManager *self, LdmManagerStats *stats)
+{
+        g_return_val_if_fail(self != NULL, FALSE);
+        g_return_val_if_fail(stats != NULL, FALSE);
+
+        ldm_stats_collect(stats);
+
+        return LDM_ENABLE_INSTRUMENTATION ? TRUE : FALSE;
 }
 
 /*
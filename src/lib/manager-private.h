@@ -13,9 +13,16 @@
 
 #include <glib-object.h>
 
+#include "device-table.h"
 #include "device.h"
 #include "ldm-private.h"
 #include "manager.h"
+#include "modalias-merged.h"
+
+typedef struct LdmManagerMonitorThread LdmManagerMonitorThread;
+
+/* One device bucket for each LdmDeviceType bit */
+#define LDM_MANAGER_N_BUCKETS 12
 
 struct _LdmManagerClass {
         GObjectClass parent_class;
@@ -23,27 +30,134 @@ struct _LdmManagerClass {
         /* Signals */
         void (*device_added)(LdmManager *self, LdmDevice *device);
         void (*device_removed)(LdmManager *self, LdmDevice *device);
+        void (*devices_changed)(LdmManager *self);
 };
 
 struct _LdmManager {
         GObject parent;
         GPtrArray *devices;
+        GHashTable *device_index; /* sysfs path to device */
+        GHashTable *enumerating;  /* Transient sysfs path to any device, children included */
         GHashTable *plugins;
+        GPtrArray *sorted_plugins; /* Highest priority first, owned by plugins */
+        LdmModaliasMerged *merged; /* Lazily built over the modalias plugins */
+
+        /* Root devices by type, borrowed from the devices array and in the same
+         * order. A root is bucketed under every type found in its subtree, and
+         * only leaves a bucket along with the manager, so each is a superset. */
+        struct {
+                GPtrArray *by_type[LDM_MANAGER_N_BUCKETS];
+                GHashTable *masks; /* Root device to the types it is bucketed under */
+        } buckets;
+
+        /* Published copy of the devices and buckets, readable from any thread */
+        struct {
+                LdmDeviceTable *current; /* Swapped atomically, never NULL */
+                gint readers;            /* Threads between loading and referencing current */
+                GHashTable *entries;     /* Root device to its published entry */
+                GHashTable *dirty;       /* Root devices with a stale entry, or none yet */
+                guint buckets;           /* Buckets changed since publishing, by type bit */
+                gboolean changed;        /* Root devices removed since publishing */
+        } table;
 
         gint modalias_plugin_priority;
 
+        /* Memoised provider results, device to GPtrArray of providers */
+        GHashTable *provider_cache;
+        guint generation;
+
+        /* Reverse provider index, built on first query and maintained from then on */
+        struct {
+                GHashTable *devices;  /* Root device to GPtrArray of every provider */
+                GHashTable *packages; /* Package to table of device to match count */
+                GHashTable *drivers;  /* Kernel driver to table of device to match count */
+                GHashTable *dirty;    /* Root devices awaiting (re)indexing */
+                gboolean built;
+        } reverse;
+
+        /* Lazily created worker pool for threaded matching */
+        GThreadPool *match_pool;
+
         /* Udev */
         udev_connection *udev;
 
         LdmManagerFlags flags;
+        gchar *snapshot_file;  /* Used with LDM_MANAGER_FLAGS_SNAPSHOT */
+        gboolean init_pending; /* LdmManager:deferred-init, until GAsyncInitable runs */
+
+        /* Where the devices come from */
+        struct {
+                LdmDeviceSource type;
+                gchar *file;   /* Offline sources only */
+                GError *error; /* Failure to load during construction */
+        } source;
+
+        /* Enumeration profile, NULL members use the defaults */
+        struct {
+                gchar **subsystems;
+                gchar **monitor_subsystems;
+                gchar **sysattr_matches;
+                gchar **property_matches;
+        } profile;
 
         struct {
-                udev_monitor *udev;  /* Connection to udev.. */
-                GIOChannel *channel; /* Main channel for poll main loop */
-                guint source;        /* GIO source */
+                udev_monitor *udev;              /* Connection to udev.. */
+                GIOChannel *channel;             /* Main channel for poll main loop */
+                guint source;                    /* GIO source */
+                LdmManagerMonitorThread *thread; /* With LDM_MANAGER_FLAGS_MONITOR_THREAD */
+
+                /* Events coalesced until the next flush */
+                GPtrArray *pending;       /* Arrival order, owns the events */
+                GHashTable *pending_path; /* sysfs path to live event */
+                GSource *flush_source;
+                guint coalesce_timeout; /* Milliseconds, 0 to flush per wakeup */
+                guint buffer_size;      /* Netlink receive buffer, 0 for default */
+                guint hold;             /* Workers reading the tree, events wait for 0 */
+                gboolean resync;        /* Rescan once the hold is released */
+                gboolean gpus;          /* PCI filter wanted, see ldm_manager_monitor_gpus */
         } monitor;
 };
 
+/* Private provider cache API */
+void ldm_manager_invalidate_providers(LdmManager *self, LdmDevice *device);
+void ldm_manager_invalidate_all_providers(LdmManager *self);
+gboolean ldm_manager_has_providers(LdmManager *self, LdmDevice *device);
+
+/* Private reverse index API */
+void ldm_manager_index_device(LdmManager *self, LdmDevice *device);
+void ldm_manager_unindex_device(LdmManager *self, LdmDevice *device);
+
+/* Private device bucket API */
+void ldm_manager_add_root(LdmManager *self, LdmDevice *device);
+GPtrArray *ldm_manager_get_candidates(LdmManager *self, LdmDeviceType types);
+
+/* Private device table API */
+void ldm_manager_init_table(LdmManager *self);
+void ldm_manager_clear_table(LdmManager *self);
+void ldm_manager_touch_table(LdmManager *self, LdmDevice *device);
+void ldm_manager_untable_device(LdmManager *self, LdmDevice *device);
+void ldm_manager_publish_table(LdmManager *self);
+
+/* Private hotplug API */
+void ldm_manager_queue_event(LdmManager *self, udev_device *device, const char *action);
+void ldm_manager_schedule_flush(LdmManager *self);
+void ldm_manager_handle_overrun(LdmManager *self);
+void ldm_manager_hold_events(LdmManager *self);
+void ldm_manager_release_events(LdmManager *self);
+gboolean ldm_manager_start_monitor_thread(LdmManager *self);
+void ldm_manager_stop_monitor_thread(LdmManager *self);
+void ldm_manager_monitor_gpus(LdmManager *self);
+
+/* Private enumeration snapshot API */
+gboolean ldm_manager_load_snapshot(LdmManager *self);
+gboolean ldm_manager_restore_snapshot(LdmManager *self, const gchar *path, gboolean check_key,
+                                      GError **error);
+void ldm_manager_save_snapshot(LdmManager *self);
+
+/* Private offline source API */
+gboolean ldm_manager_load_umockdev(LdmManager *self, const gchar *path, GError **error);
+void ldm_manager_push_records(LdmManager *self, GPtrArray *records);
+
 /*
  * Editor modelines  -  https://www.wireshark.org/tools/modelines.html
  *
@@ -0,0 +1,488 @@
+/*
+ * This file is part of linux-driver-management.
+ *
+ * Copyright © 2016-2018 Ikey Doherty
+ *
+ * linux-driver-management is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <gio/gio.h>
+#include <glib/gstdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "manager-private.h"
+
+#define LDM_SNAPSHOT_MAGIC "ldm-snapshot"
+#define LDM_SNAPSHOT_VERSION "2"
+
+/*
+ * The enumeration snapshot stores every device in the tree, along with a
+ * key describing the state of the system at the time. It is a line based
+ * file, cheap to write, and split in place from a private mapping when it
+ * is read back:
+ *
+ *      ldm-snapshot    2
+ *      key             <key>
+ *      <parent>        <type>  <path>  <modalias>  <name>  <vendor>  ...
+ *
+ * Every following line is a device, stored after its parent, which is
+ * referenced by its index among the device lines, or '-' for a root
+ * device, so that the tree can be rebuilt in a single pass. Fields are
+ * separated by tabs, with tabs, newlines and backslashes escaped.
+ */
+
+/**
+ * ldm_snapshot_append_field:
+ * @line: Snapshot line being built
+ * @value: (nullable): Value of the field, which is left empty when NULL
+ *
+ * Append a field, along with the preceding separator, to a snapshot line
+ */
+void ldm_snapshot_append_field(GString *line, const gchar *value)
+{
+        g_string_append_c(line, '\t');
+        for (const gchar *c = value; c && *c; c++) {
+                switch (*c) {
+                case '\t':
+                        g_string_append(line, "\\t");
+                        break;
+                case '\n':
+                        g_string_append(line, "\\n");
+                        break;
+                case '\\':
+                        g_string_append(line, "\\\\");
+                        break;
+                default:
+                        g_string_append_c(line, *c);
+                        break;
+                }
+        }
+}
+
+/**
+ * ldm_snapshot_split:
+ * @line: NUL terminated line, modified in place
+ * @fields: Array to store up to @n_fields fields in
+ *
+ * Split and unescape a snapshot line in place
+ *
+ * Returns: The number of fields in the line, or @n_fields + 1 if too many
+ */
+static guint ldm_snapshot_split(gchar *line, gchar **fields, guint n_fields)
+{
+        gchar *out = line;
+        guint n = 0;
+
+        fields[n++] = out;
+        for (const gchar *c = line; *c; c++) {
+                if (*c == '\t') {
+                        *out++ = '\0';
+                        if (n == n_fields) {
+                                return n_fields + 1;
+                        }
+                        fields[n++] = out;
+                } else if (*c == '\\' && c[1]) {
+                        ++c;
+                        *out++ = *c == 't' ? '\t' : *c == 'n' ? '\n' : *c;
+                } else {
+                        *out++ = *c;
+                }
+        }
+        *out = '\0';
+
+        return n;
+}
+
+/**
+ * ldm_snapshot_next_line:
+ *
+ * Terminate the line at @cursor in place, moving @cursor past it
+ *
+ * Returns: (nullable): The line, or NULL at the end of the data
+ */
+static gchar *ldm_snapshot_next_line(gchar **cursor, const gchar *end)
+{
+        gchar *line = *cursor;
+        gchar *newline = NULL;
+
+        if (line >= end) {
+                return NULL;
+        }
+
+        /* The data always ends in a newline, which has been checked */
+        newline = memchr(line, '\n', (gsize)(end - line));
+        *newline = '\0';
+        *cursor = newline + 1;
+
+        return line;
+}
+
+/**
+ * ldm_manager_snapshot_key_strv:
+ *
+ * Append an enumeration profile list to the snapshot key. Each entry is
+ * prefixed with its length, as entries may themselves contain separators,
+ * and `{"a,b"}` must never share a key with `{"a", "b"}`.
+ */
+static void ldm_manager_snapshot_key_strv(GString *key, gchar **strv)
+{
+        if (!strv) {
+                g_string_append(key, ";-");
+                return;
+        }
+
+        g_string_append_printf(key, ";%u", g_strv_length(strv));
+        for (gchar **s = strv; *s; s++) {
+                g_string_append_printf(key, ",%zu:%s", strlen(*s), *s);
+        }
+}
+
+/**
+ * ldm_manager_snapshot_key:
+ *
+ * Build a cheap change signal for the hardware we'd enumerate. The boot ID
+ * guards against kernel and driver changes, while the modification time and
+ * entry count of each device directory catch most hotplug activity.
+ *
+ * This is deliberately weak. sysfs does not reliably bump the modification
+ * time of these directories, so within a boot it is mostly the entry count
+ * that changes. Swapping one device for another keeps the count, and none
+ * of it notices attribute changes within a device directory, such as a
+ * driver being bound or a new hardware database changing names. Managers
+ * which need to follow those use hotplug or #ldm_manager_rescan.
+ *
+ * #LDM_MANAGER_FLAGS_GPU_QUICK is not part of the key, as the snapshot is
+ * always of the full tree, and narrowed when restored.
+ */
+static gchar *ldm_manager_snapshot_key(LdmManager *self)
+{
+        static const char *directories[] = {
+                "/sys/class/dmi/id",    "/sys/bus/usb/devices", "/sys/bus/pci/devices",
+                "/sys/class/ieee80211", "/sys/class/bluetooth", "/sys/bus/hid/devices",
+        };
+        g_autofree gchar *boot_id = NULL;
+        GString *key = NULL;
+
+        key = g_string_new(NULL);
+        if (g_file_get_contents("/proc/sys/kernel/random/boot_id", &boot_id, NULL, NULL)) {
+                g_string_append(key, g_strstrip(boot_id));
+        }
+
+        /* Differently filtered managers must never share a snapshot */
+        ldm_manager_snapshot_key_strv(key, self->profile.subsystems);
+        ldm_manager_snapshot_key_strv(key, self->profile.sysattr_matches);
+        ldm_manager_snapshot_key_strv(key, self->profile.property_matches);
+
+        for (size_t i = 0; i < G_N_ELEMENTS(directories); i++) {
+                g_autoptr(GDir) dir = NULL;
+                struct stat st = { 0 };
+                guint n_entries = 0;
+
+                if (stat(directories[i], &st) != 0) {
+                        g_string_append(key, ";-");
+                        continue;
+                }
+
+                dir = g_dir_open(directories[i], 0, NULL);
+                while (dir && g_dir_read_name(dir)) {
+                        ++n_entries;
+                }
+
+                g_string_append_printf(key,
+                                       ";%lld.%ld:%u",
+                                       (long long)st.st_mtim.tv_sec,
+                                       st.st_mtim.tv_nsec,
+                                       n_entries);
+        }
+
+        return g_string_free(key, FALSE);
+}
+
+/**
+ * ldm_manager_snapshot_is_quick:
+ *
+ * Whether #LDM_MANAGER_FLAGS_GPU_QUICK narrows what we enumerate, which the
+ * enumeration profile takes precedence over
+ */
+static gboolean ldm_manager_snapshot_is_quick(LdmManager *self)
+{
+        return (self->flags & LDM_MANAGER_FLAGS_GPU_QUICK) == LDM_MANAGER_FLAGS_GPU_QUICK &&
+               !self->profile.subsystems;
+}
+
+/**
+ * ldm_manager_restore_snapshot:
+ * @path: Snapshot file to read
+ * @check_key: Whether the snapshot must describe the running system
+ *
+ * Rebuild the device tree from a snapshot file. When @check_key is set the
+ * snapshot is only used if the key still matches the system, otherwise it
+ * is restored as is, such as for a snapshot taken on another machine.
+ * The system snapshot always holds the full tree, so with @check_key only
+ * the display controllers are kept for #LDM_MANAGER_FLAGS_GPU_QUICK, just
+ * as the live enumeration would find. Nothing is added to the manager
+ * unless the entire snapshot is valid.
+ *
+ * Returns: TRUE if the devices were restored from the snapshot
+ */
+gboolean ldm_manager_restore_snapshot(LdmManager *self, const gchar *path, gboolean check_key,
+                                      GError **error)
+{
+        g_autoptr(GMappedFile) mapped = NULL;
+        g_autoptr(GHashTable) known = NULL;
+        g_autoptr(GPtrArray) devices = NULL;
+        g_autoptr(GPtrArray) roots = NULL;
+        g_autofree gchar *key = NULL;
+        gchar *fields[LDM_SNAPSHOT_N_FIELDS + 1] = { 0 };
+        gchar *cursor = NULL;
+        const gchar *end = NULL;
+        gchar *line = NULL;
+        gsize len = 0;
+        gboolean quick = check_key && ldm_manager_snapshot_is_quick(self);
+        const guint display = LDM_DEVICE_TYPE_PCI | LDM_DEVICE_TYPE_GPU;
+
+        /* Writable maps are private, so the file itself is never modified */
+        mapped = g_mapped_file_new(path, TRUE, error);
+        if (!mapped) {
+                return FALSE;
+        }
+        cursor = g_mapped_file_get_contents(mapped);
+        len = g_mapped_file_get_length(mapped);
+        end = cursor + len;
+        if (len == 0 || end[-1] != '\n') {
+                goto corrupt;
+        }
+
+        line = ldm_snapshot_next_line(&cursor, end);
+        if (ldm_snapshot_split(line, fields, 2) != 2 ||
+            !g_str_equal(fields[0], LDM_SNAPSHOT_MAGIC) ||
+            !g_str_equal(fields[1], LDM_SNAPSHOT_VERSION)) {
+                g_set_error(error,
+                            G_IO_ERROR,
+                            G_IO_ERROR_NOT_SUPPORTED,
+                            "snapshot '%s' has an unsupported format",
+                            path);
+                return FALSE;
+        }
+
+        line = ldm_snapshot_next_line(&cursor, end);
+        if (!line || ldm_snapshot_split(line, fields, 2) != 2 || !g_str_equal(fields[0], "key")) {
+                goto corrupt;
+        }
+        if (check_key) {
+                key = ldm_manager_snapshot_key(self);
+                if (!g_str_equal(fields[1], key)) {
+                        g_set_error(error,
+                                    G_IO_ERROR,
+                                    G_IO_ERROR_FAILED,
+                                    "snapshot '%s' is stale",
+                                    path);
+                        return FALSE;
+                }
+        }
+
+        /* Path to device, and all devices by index, owned by the roots */
+        known = g_hash_table_new(g_str_hash, g_str_equal);
+        devices = g_ptr_array_new();
+        roots = g_ptr_array_new_with_free_func(g_object_unref);
+
+        while ((line = ldm_snapshot_next_line(&cursor, end)) != NULL) {
+                LdmDevice *parent = NULL;
+                LdmDevice *device = NULL;
+                guint64 index = 0;
+
+                if (ldm_snapshot_split(line, fields, G_N_ELEMENTS(fields)) !=
+                    G_N_ELEMENTS(fields)) {
+                        goto corrupt;
+                }
+
+                if (!g_str_equal(fields[0], "-")) {
+                        if (devices->len == 0 || !g_ascii_string_to_unsigned(fields[0],
+                                                                             10,
+                                                                             0,
+                                                                             devices->len - 1,
+                                                                             &index,
+                                                                             NULL)) {
+                                goto corrupt;
+                        }
+                        parent = devices->pdata[index];
+                }
+
+                device = ldm_device_new_from_snapshot(parent, fields + 1);
+                if (!device || g_hash_table_contains(known, device->os.sysfs_path)) {
+                        if (device) {
+                                g_object_unref(g_object_ref_sink(device));
+                        }
+                        goto corrupt;
+                }
+
+                g_hash_table_insert(known, device->os.sysfs_path, device);
+                g_ptr_array_add(devices, device);
+                if (parent) {
+                        ldm_device_add_child(parent, device);
+                } else {
+                        g_ptr_array_add(roots, g_object_ref_sink(device));
+                }
+        }
+
+        /* All valid, hand the roots over to the manager in their stored order */
+        for (guint i = 0; i < roots->len; i++) {
+                LdmDevice *device = roots->pdata[i];
+
+                if (quick && (device->os.devtype & display) != display) {
+                        continue;
+                }
+                ldm_manager_add_root(self, g_object_ref(device));
+        }
+
+        return TRUE;
+
+corrupt:
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "snapshot '%s' is corrupt", path);
+        return FALSE;
+}
+
+/**
+ * ldm_manager_load_snapshot:
+ *
+ * Attempt to rebuild the device tree from #LdmManager:snapshot-file, which
+ * is only used if the key still matches the system.
+ *
+ * Returns: TRUE if the devices were restored from the snapshot
+ */
+gboolean ldm_manager_load_snapshot(LdmManager *self)
+{
+        g_autoptr(GError) error = NULL;
+
+        if (ldm_manager_restore_snapshot(self, self->snapshot_file, TRUE, &error)) {
+                return TRUE;
+        }
+
+        if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA)) {
+                g_warning("%s", error->message);
+        } else {
+                g_debug("unable to use snapshot: %s", error->message);
+        }
+
+        return FALSE;
+}
+
+/**
+ * ldm_manager_save_device:
+ *
+ * Store the device and then its children, so parents always come first.
+ */
+static void ldm_manager_save_device(GString *out, LdmDevice *device, const gchar *parent_index,
+                                    guint *n_devices)
+{
+        g_autofree gchar *index = NULL;
+
+        index = g_strdup_printf("%u", (*n_devices)++);
+        g_string_append(out, parent_index);
+        ldm_device_save_snapshot(device, out);
+        g_string_append_c(out, '\n');
+
+        for (guint i = 0; i < device->tree.kids->len; i++) {
+                ldm_manager_save_device(out, device->tree.kids->pdata[i], index, n_devices);
+        }
+}
+
+/**
+ * ldm_manager_build_snapshot:
+ *
+ * Serialise the current device tree, in the snapshot format
+ *
+ * Returns: (transfer full): The snapshot contents
+ */
+static GString *ldm_manager_build_snapshot(LdmManager *self)
+{
+        g_autofree gchar *key = NULL;
+        GString *out = NULL;
+        guint n_devices = 0;
+
+        /* Most trees fit comfortably, sparing a few reallocations */
+        out = g_string_sized_new(8192);
+        g_string_append(out, LDM_SNAPSHOT_MAGIC "\t" LDM_SNAPSHOT_VERSION "\nkey");
+        key = ldm_manager_snapshot_key(self);
+        ldm_snapshot_append_field(out, key);
+        g_string_append_c(out, '\n');
+
+        for (guint i = 0; i < self->devices->len; i++) {
+                ldm_manager_save_device(out, self->devices->pdata[i], "-", &n_devices);
+        }
+
+        return out;
+}
+
+/**
+ * ldm_manager_save_snapshot:
+ *
+ * Store the current device tree to the snapshot file for the next manager
+ * to use. Failure isn't fatal, most likely we're simply not privileged
+ * enough to write the file. A #LDM_MANAGER_FLAGS_GPU_QUICK tree is only
+ * part of what the key describes, so it is never stored.
+ */
+void ldm_manager_save_snapshot(LdmManager *self)
+{
+        g_autoptr(GError) error = NULL;
+        g_autofree gchar *dirname = NULL;
+
+        if (ldm_manager_snapshot_is_quick(self)) {
+                return;
+        }
+
+        dirname = g_path_get_dirname(self->snapshot_file);
+        if (g_mkdir_with_parents(dirname, 00755) != 0 ||
+            !ldm_manager_export_snapshot(self, self->snapshot_file, &error)) {
+                g_debug("unable to write snapshot '%s': %s",
+                        self->snapshot_file,
+                        error ? error->message : g_strerror(errno));
+        }
+}
+
+/**
+ * ldm_manager_export_snapshot:
+ * @path: File to write the snapshot to
+ * @error: Return location for a #GError, or NULL
+ *
+ * Write the current device tree to @path, which may later be restored with
+ * #ldm_manager_new_from_source and #LDM_DEVICE_SOURCE_SNAPSHOT, on this or
+ * any other machine. Every device is stored along with what was resolved
+ * for it, such as the modalias, identifiers, names from the hardware
+ * database, device types and attributes, and its place in the tree.
+ *
+ * The snapshot is a compact line based format, typically a few KB, so it is
+ * cheap enough to collect from a large number of machines.
+ *
+ * Returns: TRUE if the snapshot was written
+ */
+gboolean ldm_manager_export_snapshot(LdmManager *self, const gchar *path, GError **error)
+{
+        g_autoptr(GString) contents = NULL;
+
+        g_return_val_if_fail(self != NULL, FALSE);
+        g_return_val_if_fail(path != NULL, FALSE);
+
+        contents = ldm_manager_build_snapshot(self);
+        return g_file_set_contents(path, contents->str, (gssize)contents->len, error);
+}
+
+/*
+ * Editor modelines  -  https://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: nil
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 expandtab:
+ * :indentSize=8:tabSize=8:noTabs=true:
+ */
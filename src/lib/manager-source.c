@@ -0,0 +1,258 @@
+/*
+ * This file is part of linux-driver-management.
+ *
+ * Copyright © 2016-2018 Ikey Doherty
+ *
+ * linux-driver-management is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+#define _GNU_SOURCE
+
+#include <gio/gio.h>
+#include <string.h>
+
+#include "manager-private.h"
+
+/*
+ * A umockdev recording, as written by umockdev-record, is a sequence of
+ * blank line separated blocks, one per device. Each block starts with the
+ * `P:` line giving the sysfs path, relative to /sys, followed by a line per
+ * uevent property (`E:`), sysfs attribute (`A:`, with newlines escaped),
+ * binary attribute (`H:`), link (`L:`) and so on. Devices are recorded
+ * before their parents, and recordings may simply be concatenated, so the
+ * same device can appear more than once.
+ *
+ * The file is split in place, and each block only becomes a record once
+ * every block is known, so that records can be built parents first.
+ */
+
+/**
+ * ldm_manager_umockdev_unescape:
+ *
+ * Undo the escaping of newlines and backslashes in an attribute, in place
+ */
+static void ldm_manager_umockdev_unescape(gchar *value)
+{
+        gchar *out = value;
+
+        for (const gchar *c = value; *c; c++) {
+                if (c[0] == '\\' && c[1] == 'n') {
+                        *out++ = '\n';
+                        c++;
+                } else if (c[0] == '\\' && c[1] == '\\') {
+                        *out++ = '\\';
+                        c++;
+                } else {
+                        *out++ = *c;
+                }
+        }
+        *out = '\0';
+}
+
+/**
+ * ldm_manager_umockdev_parent:
+ *
+ * Find the closest recorded ancestor of @path, which is what udev would
+ * consider the parent, as directories such as `bluetooth/` aren't devices.
+ */
+static LdmDeviceRecord *ldm_manager_umockdev_parent(GHashTable *records, const gchar *path)
+{
+        g_autofree gchar *ancestor = g_strdup(path);
+        gchar *slash = NULL;
+
+        while ((slash = strrchr(ancestor, '/')) != NULL && slash != ancestor) {
+                LdmDeviceRecord *record = NULL;
+
+                *slash = '\0';
+                record = g_hash_table_lookup(records, ancestor);
+                if (record) {
+                        return record;
+                }
+        }
+
+        return NULL;
+}
+
+static gint ldm_manager_umockdev_compare(gconstpointer a, gconstpointer b)
+{
+        return strcmp(*(const gchar **)a, *(const gchar **)b);
+}
+
+/**
+ * ldm_manager_umockdev_apply:
+ *
+ * Fill the record in from the lines of its block
+ */
+static void ldm_manager_umockdev_apply(LdmDeviceRecord *record, GPtrArray *lines)
+{
+        const gchar *subsystem_link = NULL;
+
+        for (guint i = 0; i < lines->len; i++) {
+                gchar *line = lines->pdata[i];
+                gchar *value = NULL;
+
+                value = strchr(line + 3, '=');
+                if (!value) {
+                        continue;
+                }
+                *value++ = '\0';
+
+                switch (line[0]) {
+                case 'E':
+                        ldm_device_record_set_property(record, line + 3, value);
+                        break;
+                case 'A':
+                        ldm_manager_umockdev_unescape(value);
+                        ldm_device_record_set_sysattr(record, line + 3, value);
+                        break;
+                case 'L':
+                        if (g_str_equal(line + 3, "subsystem")) {
+                                subsystem_link = value;
+                        }
+                        break;
+                default:
+                        /* Binary attributes, device nodes and symlinks */
+                        break;
+                }
+        }
+
+        /* Older recordings only have the subsystem as a link */
+        if (!ldm_device_record_get_subsystem(record) && subsystem_link) {
+                const gchar *subsystem = strrchr(subsystem_link, '/');
+
+                ldm_device_record_set_property(record,
+                                               "SUBSYSTEM",
+                                               subsystem ? subsystem + 1 : subsystem_link);
+        }
+}
+
+/**
+ * ldm_manager_load_umockdev:
+ * @path: umockdev recording to read
+ *
+ * Build the device tree from a umockdev recording, applying the enumeration
+ * profile as udev would have done. Nothing is added to the manager unless
+ * the entire recording is valid.
+ *
+ * Returns: TRUE if the devices were loaded from the recording
+ */
+gboolean ldm_manager_load_umockdev(LdmManager *self, const gchar *path, GError **error)
+{
+        g_autofree gchar *contents = NULL;
+        g_autoptr(GHashTable) blocks = NULL;
+        g_autoptr(GHashTable) known = NULL;
+        g_autoptr(GPtrArray) paths = NULL;
+        g_autoptr(GPtrArray) records = NULL;
+        GPtrArray *block = NULL;
+        GHashTableIter iter = { 0 };
+        gpointer key = NULL;
+        guint line_number = 0;
+
+        if (!g_file_get_contents(path, &contents, NULL, error)) {
+                return FALSE;
+        }
+
+        /* Full sysfs path to the lines of its first block */
+        blocks = g_hash_table_new_full(g_str_hash,
+                                       g_str_equal,
+                                       g_free,
+                                       (GDestroyNotify)g_ptr_array_unref);
+
+        for (gchar *line = contents, *next = NULL; line; line = next) {
+                gchar *sysfs_path = NULL;
+
+                ++line_number;
+                next = strchr(line, '\n');
+                if (next) {
+                        *next++ = '\0';
+                }
+
+                if (line[0] == '\0') {
+                        block = NULL;
+                        continue;
+                }
+                if (!g_ascii_isupper(line[0]) || line[1] != ':' || line[2] != ' ') {
+                        goto malformed;
+                }
+
+                if (line[0] != 'P') {
+                        /* Lines of a repeated device are dropped, along with the block */
+                        if (!block && !g_hash_table_size(blocks)) {
+                                goto malformed;
+                        }
+                        if (block) {
+                                g_ptr_array_add(block, line);
+                        }
+                        continue;
+                }
+
+                sysfs_path = g_str_has_prefix(line + 3, "/sys/")
+                                 ? g_strdup(line + 3)
+                                 : g_strconcat("/sys", line + 3, NULL);
+                if (g_hash_table_contains(blocks, sysfs_path)) {
+                        g_free(sysfs_path);
+                        block = NULL;
+                        continue;
+                }
+                block = g_ptr_array_new();
+                g_hash_table_insert(blocks, sysfs_path, block);
+        }
+
+        if (g_hash_table_size(blocks) == 0) {
+                g_set_error(error,
+                            G_IO_ERROR,
+                            G_IO_ERROR_INVALID_DATA,
+                            "recording '%s' contains no devices",
+                            path);
+                return FALSE;
+        }
+
+        /* Parents sort ahead of their children, as an ancestor is a prefix */
+        paths = g_ptr_array_sized_new(g_hash_table_size(blocks));
+        g_hash_table_iter_init(&iter, blocks);
+        while (g_hash_table_iter_next(&iter, &key, NULL)) {
+                g_ptr_array_add(paths, key);
+        }
+        g_ptr_array_sort(paths, ldm_manager_umockdev_compare);
+
+        known = g_hash_table_new(g_str_hash, g_str_equal);
+        records = g_ptr_array_new_full(paths->len, (GDestroyNotify)ldm_device_record_unref);
+        for (guint i = 0; i < paths->len; i++) {
+                const gchar *sysfs_path = paths->pdata[i];
+                LdmDeviceRecord *record = NULL;
+
+                record = ldm_device_record_new(ldm_manager_umockdev_parent(known, sysfs_path),
+                                               sysfs_path);
+                ldm_manager_umockdev_apply(record, g_hash_table_lookup(blocks, sysfs_path));
+                g_hash_table_insert(known, (gpointer)ldm_device_record_get_syspath(record), record);
+                g_ptr_array_add(records, record);
+        }
+
+        ldm_manager_push_records(self, records);
+        return TRUE;
+
+malformed:
+        g_set_error(error,
+                    G_IO_ERROR,
+                    G_IO_ERROR_INVALID_DATA,
+                    "line %u of recording '%s' is malformed",
+                    line_number,
+                    path);
+        return FALSE;
+}
+
+/*
+ * Editor modelines  -  https://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: nil
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 expandtab:
+ * :indentSize=8:tabSize=8:noTabs=true:
+ */
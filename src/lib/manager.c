@@ -11,13 +11,19 @@
 
 #define _GNU_SOURCE
 
+#include <errno.h>
+#include <fnmatch.h>
+#include <gio/gio.h>
 #include <libudev.h>
+#include <string.h>
 
+#include "config.h"
 #include "device.h"
 #include "ldm-enums.h"
 #include "ldm-private.h"
 #include "manager-private.h"
 #include "manager.h"
+#include "stats.h"
 #include "util.h"
 
 static void ldm_manager_set_property(GObject *object, guint id, const GValue *value,
@@ -26,24 +32,56 @@ static void ldm_manager_get_property(GObject *object, guint id, GValue *value, G
 static void ldm_manager_constructed(GObject *obj);
 
 static void ldm_manager_init_udev_monitor(LdmManager *self);
+static void ldm_manager_attach_udev_monitor(LdmManager *self);
 static void ldm_manager_init_udev_static(LdmManager *self);
+static gboolean ldm_manager_enumerate(LdmManager *self, GError **error);
 static void ldm_manager_push_sysfs(LdmManager *self, const char *sysfs_path);
-static void ldm_manager_push_device(LdmManager *self, udev_device *device, gboolean emit_signal);
-static void ldm_manager_remove_device(LdmManager *self, udev_device *device);
+static gboolean ldm_manager_push_device(LdmManager *self, LdmDeviceRecord *record,
+                                        gboolean emit_signal);
+static gboolean ldm_manager_remove_device(LdmManager *self, LdmDeviceRecord *record);
 static gboolean ldm_manager_io_ready(GIOChannel *source, GIOCondition condition, gpointer v);
+static void ldm_manager_flush_events(LdmManager *self);
 static LdmDevice *ldm_manager_get_device_parent(LdmManager *self, const char *subsystem,
-                                                udev_device *device);
-static void ldm_manager_emit_usb(LdmManager *self, udev_device *device);
+                                                LdmDeviceRecord *record);
+static gboolean ldm_manager_emit_usb(LdmManager *self, LdmDeviceRecord *record);
+
+/**
+ * LdmManagerEvent:
+ *
+ * Hotplug events for a single sysfs path, coalesced until the next flush.
+ * Each flag records net effect of the events seen so far, so that a device
+ * which comes and goes within the window is never constructed at all.
+ */
+typedef struct LdmManagerEvent {
+        udev_device *device; /* Most recent udev event for the path */
+        gboolean removed;    /* Remove the existing device */
+        gboolean added;      /* Construct the device afresh */
+        gboolean bound;      /* USB bind event was seen */
+} LdmManagerEvent;
+
+/* Default netlink receive buffer, large enough to ride out a hub reset */
+#define LDM_MANAGER_MONITOR_BUFFER_SIZE (4 * 1024 * 1024)
 
 /* Property IDs */
-enum { PROP_FLAGS = 1, N_PROPS };
+enum { PROP_FLAGS = 1,
+       PROP_SNAPSHOT_FILE,
+       PROP_SUBSYSTEMS,
+       PROP_MONITOR_SUBSYSTEMS,
+       PROP_SYSATTR_MATCHES,
+       PROP_PROPERTY_MATCHES,
+       PROP_COALESCE_TIMEOUT,
+       PROP_MONITOR_BUFFER_SIZE,
+       PROP_SOURCE,
+       PROP_SOURCE_FILE,
+       PROP_DEFERRED_INIT,
+       N_PROPS };
 
 static GParamSpec *obj_properties[N_PROPS] = {
         NULL,
 };
 
 /* Signal IDs */
-enum { SIGNAL_DEVICE_ADDED = 0, SIGNAL_DEVICE_REMOVED, N_SIGNALS };
+enum { SIGNAL_DEVICE_ADDED = 0, SIGNAL_DEVICE_REMOVED, SIGNAL_DEVICES_CHANGED, N_SIGNALS };
 
 static guint obj_signals[N_SIGNALS] = { 0 };
 
@@ -77,9 +115,45 @@ static guint obj_signals[N_SIGNALS] = { 0 };
  *      var manager = new Ldm.Manager();
  *      var devices = manager.get_devices();
  * ]|
+ *
+ * When constructed with #LDM_MANAGER_FLAGS_SNAPSHOT, the manager will store
+ * the enumerated devices in #LdmManager:snapshot-file. Subsequent managers
+ * will rebuild the devices from that file without touching sysfs, as long
+ * as the hardware appears to be unchanged. #ldm_manager_export_snapshot
+ * writes the same compact format on demand, so the device tree of any
+ * machine can be collected and evaluated elsewhere.
+ *
+ * Hotplug events are normally received in the main context. With
+ * #LDM_MANAGER_FLAGS_MONITOR_THREAD they are instead received on a dedicated
+ * thread, so that a busy main loop cannot cause events to be lost, and then
+ * handed to the thread default context at the time of construction. In
+ * either mode the devices are only ever modified, and signals emitted, in
+ * that context, so the manager should only be used from there.
+ *
+ * Consumers only interested in some devices can restrict the enumeration
+ * with #ldm_manager_new_full, or the #LdmManager:sysattr-matches and
+ * #LdmManager:property-matches properties, so that nothing else is ever
+ * constructed.
+ *
+ * Devices need not come from the running system. #ldm_manager_new_from_source
+ * builds the devices from a snapshot file, or a umockdev recording, instead
+ * of udev. Such managers never monitor for hotplug events, and don't touch
+ * the main context, so a batch job may evaluate many machines at once, each
+ * manager on its own thread. Loading the modalias plugins once, and handing
+ * them to each manager with #ldm_manager_share_plugins, avoids parsing them
+ * for every machine.
+ *
+ * Interactive applications should prefer #ldm_manager_new_async,
+ * #ldm_manager_add_system_modalias_plugins_async and
+ * #ldm_manager_get_providers_async, which do the slow work on a worker
+ * thread and complete in the thread default context of the caller.
  */
 
-G_DEFINE_TYPE(LdmManager, ldm_manager, G_TYPE_OBJECT)
+static void ldm_manager_async_initable_init(GAsyncInitableIface *iface);
+
+G_DEFINE_TYPE_WITH_CODE(LdmManager, ldm_manager, G_TYPE_OBJECT,
+                        G_IMPLEMENT_INTERFACE(G_TYPE_ASYNC_INITABLE,
+                                              ldm_manager_async_initable_init))
 
 /**
  * ldm_manager_dispose:
@@ -96,19 +170,63 @@ static void ldm_manager_dispose(GObject *obj)
                 self->monitor.source = 0;
         }
 
+        /* The thread must be gone before the monitor it reads from */
+        ldm_manager_stop_monitor_thread(self);
+
+        /* Drop pending hotplug events */
+        if (self->monitor.flush_source) {
+                g_source_destroy(self->monitor.flush_source);
+                g_clear_pointer(&self->monitor.flush_source, g_source_unref);
+        }
+        g_clear_pointer(&self->monitor.pending_path, g_hash_table_unref);
+        g_clear_pointer(&self->monitor.pending, g_ptr_array_unref);
+
         /* Clear out the monitor */
-        if (self->monitor.udev) {
+        if (self->monitor.channel) {
                 g_io_channel_shutdown(self->monitor.channel, FALSE, NULL);
                 g_clear_pointer(&self->monitor.channel, g_io_channel_unref);
-                g_clear_pointer(&self->monitor.udev, udev_monitor_unref);
         }
+        g_clear_pointer(&self->monitor.udev, udev_monitor_unref);
 
-        g_clear_pointer(&self->udev, udev_unref);
-
-        /* clean ourselves up */
+        /* clean ourselves up, before udev as devices retain udev_device refs */
+        for (guint i = 0; i < LDM_MANAGER_N_BUCKETS; i++) {
+                g_clear_pointer(&self->buckets.by_type[i], g_ptr_array_unref);
+        }
+        g_clear_pointer(&self->buckets.masks, g_hash_table_unref);
+        ldm_manager_clear_table(self);
+        g_clear_pointer(&self->device_index, g_hash_table_unref);
         g_clear_pointer(&self->devices, g_ptr_array_unref);
 
+        g_clear_pointer(&self->udev, udev_unref);
+
+        if (self->match_pool) {
+                g_thread_pool_free(self->match_pool, FALSE, TRUE);
+                self->match_pool = NULL;
+        }
+        g_clear_pointer(&self->merged, ldm_modalias_merged_free);
+        g_clear_pointer(&self->provider_cache, g_hash_table_unref);
+        g_clear_pointer(&self->reverse.devices, g_hash_table_unref);
+        g_clear_pointer(&self->reverse.packages, g_hash_table_unref);
+        g_clear_pointer(&self->reverse.drivers, g_hash_table_unref);
+        g_clear_pointer(&self->reverse.dirty, g_hash_table_unref);
+        if (self->plugins) {
+                GHashTableIter iter = { 0 };
+                gpointer plugin = NULL;
+
+                g_hash_table_iter_init(&iter, self->plugins);
+                while (g_hash_table_iter_next(&iter, NULL, &plugin)) {
+                        g_signal_handlers_disconnect_by_data(plugin, self);
+                }
+        }
+        g_clear_pointer(&self->sorted_plugins, g_ptr_array_unref);
         g_clear_pointer(&self->plugins, g_hash_table_unref);
+        g_clear_pointer(&self->snapshot_file, g_free);
+        g_clear_pointer(&self->source.file, g_free);
+        g_clear_error(&self->source.error);
+        g_clear_pointer(&self->profile.subsystems, g_strfreev);
+        g_clear_pointer(&self->profile.monitor_subsystems, g_strfreev);
+        g_clear_pointer(&self->profile.sysattr_matches, g_strfreev);
+        g_clear_pointer(&self->profile.property_matches, g_strfreev);
 
         G_OBJECT_CLASS(ldm_manager_parent_class)->dispose(obj);
 }
@@ -170,6 +288,26 @@ static void ldm_manager_class_init(LdmManagerClass *klazz)
                          1,
                          LDM_TYPE_DEVICE);
 
+        /**
+         * LdmManager::devices-changed
+         * @manager: The manager owning the devices
+         *
+         * Emitted once after each batch of hotplug events has been processed,
+         * if any device was added or removed. Consumers only interested in
+         * refreshing a view should prefer this over the per-device signals,
+         * as plugging in a single dock may produce dozens of those.
+         */
+        obj_signals[SIGNAL_DEVICES_CHANGED] =
+            g_signal_new("devices-changed",
+                         LDM_TYPE_MANAGER,
+                         G_SIGNAL_RUN_LAST,
+                         G_STRUCT_OFFSET(LdmManagerClass, devices_changed),
+                         NULL,
+                         NULL,
+                         NULL,
+                         G_TYPE_NONE,
+                         0);
+
         /**
          * LdmManager:flags
          *
@@ -182,9 +320,182 @@ static void ldm_manager_class_init(LdmManagerClass *klazz)
                                                         LDM_TYPE_MANAGER_FLAGS,
                                                         LDM_MANAGER_FLAGS_NONE,
                                                         G_PARAM_CONSTRUCT_ONLY | G_PARAM_READWRITE);
+
+        /**
+         * LdmManager:snapshot-file
+         *
+         * Location of the enumeration snapshot used with #LDM_MANAGER_FLAGS_SNAPSHOT
+         */
+        obj_properties[PROP_SNAPSHOT_FILE] =
+            g_param_spec_string("snapshot-file",
+                                "Snapshot file",
+                                "Location of the enumeration snapshot",
+                                LDM_SNAPSHOT_FILE,
+                                G_PARAM_CONSTRUCT_ONLY | G_PARAM_READWRITE);
+
+        /**
+         * LdmManager:subsystems
+         *
+         * The udev subsystems to enumerate, or NULL for the defaults. An
+         * empty list places no restriction on the subsystem.
+         */
+        obj_properties[PROP_SUBSYSTEMS] =
+            g_param_spec_boxed("subsystems",
+                               "Subsystems",
+                               "Subsystems to enumerate",
+                               G_TYPE_STRV,
+                               G_PARAM_CONSTRUCT_ONLY | G_PARAM_READWRITE);
+
+        /**
+         * LdmManager:monitor-subsystems
+         *
+         * The udev subsystems to monitor for hotplug events, or NULL for the
+         * defaults. An empty list places no restriction on the subsystem.
+         * Each entry may take the form `subsystem/devtype` to only receive
+         * events for that device type, with the filter applied in the kernel.
+         *
+         * The defaults only include PCI once an #LdmGPUConfig is created for
+         * the manager, as nothing else follows PCI hotplug.
+         */
+        obj_properties[PROP_MONITOR_SUBSYSTEMS] =
+            g_param_spec_boxed("monitor-subsystems",
+                               "Monitor subsystems",
+                               "Subsystems to monitor for hotplug events",
+                               G_TYPE_STRV,
+                               G_PARAM_CONSTRUCT_ONLY | G_PARAM_READWRITE);
+
+        /**
+         * LdmManager:sysattr-matches
+         *
+         * Additional sysfs attribute matches for enumerated devices, in the
+         * form `name=pattern`, or just `name` to require the attribute exists.
+         */
+        obj_properties[PROP_SYSATTR_MATCHES] =
+            g_param_spec_boxed("sysattr-matches",
+                               "Sysattr matches",
+                               "Sysfs attribute matches for enumerated devices",
+                               G_TYPE_STRV,
+                               G_PARAM_CONSTRUCT_ONLY | G_PARAM_READWRITE);
+
+        /**
+         * LdmManager:property-matches
+         *
+         * Additional udev property matches for enumerated devices, in the
+         * form `name=pattern`. Entries without a pattern are ignored.
+         */
+        obj_properties[PROP_PROPERTY_MATCHES] =
+            g_param_spec_boxed("property-matches",
+                               "Property matches",
+                               "Udev property matches for enumerated devices",
+                               G_TYPE_STRV,
+                               G_PARAM_CONSTRUCT_ONLY | G_PARAM_READWRITE);
+
+        /**
+         * LdmManager:coalesce-timeout
+         *
+         * Window in milliseconds over which hotplug events are collected
+         * before being processed as one batch. With the default of 0 every
+         * event pending on a wakeup is processed as one batch.
+         */
+        obj_properties[PROP_COALESCE_TIMEOUT] =
+            g_param_spec_uint("coalesce-timeout",
+                              "Coalesce timeout",
+                              "Window in milliseconds for coalescing hotplug events",
+                              0,
+                              G_MAXUINT,
+                              0,
+                              G_PARAM_READWRITE);
+
+        /**
+         * LdmManager:monitor-buffer-size
+         *
+         * Size in bytes of the netlink receive buffer for hotplug events, or
+         * 0 to keep the system default. Should the buffer still overflow, the
+         * manager resynchronises with sysfs.
+         */
+        obj_properties[PROP_MONITOR_BUFFER_SIZE] =
+            g_param_spec_uint("monitor-buffer-size",
+                              "Monitor buffer size",
+                              "Netlink receive buffer size for hotplug events",
+                              0,
+                              G_MAXINT,
+                              LDM_MANAGER_MONITOR_BUFFER_SIZE,
+                              G_PARAM_CONSTRUCT_ONLY | G_PARAM_READWRITE);
+
+        /**
+         * LdmManager:source
+         *
+         * Where the devices come from. Offline sources are read from
+         * #LdmManager:source-file, see #ldm_manager_new_from_source.
+         */
+        obj_properties[PROP_SOURCE] = g_param_spec_enum("source",
+                                                        "Device source",
+                                                        "Where the devices come from",
+                                                        LDM_TYPE_DEVICE_SOURCE,
+                                                        LDM_DEVICE_SOURCE_UDEV,
+                                                        G_PARAM_CONSTRUCT_ONLY | G_PARAM_READWRITE);
+
+        /**
+         * LdmManager:source-file
+         *
+         * File to read the devices from, for an offline #LdmManager:source
+         */
+        obj_properties[PROP_SOURCE_FILE] =
+            g_param_spec_string("source-file",
+                                "Source file",
+                                "File to read the devices from",
+                                NULL,
+                                G_PARAM_CONSTRUCT_ONLY | G_PARAM_READWRITE);
+
+        /**
+         * LdmManager:deferred-init
+         *
+         * Leave enumeration to g_async_initable_init_async(), which then runs
+         * it on a worker thread, rather than doing it during construction.
+         * A manager built with this set has no devices until initialised.
+         * It is set by #ldm_manager_new_async, and bindings constructing the
+         * manager through #GAsyncInitable directly should set it too.
+         */
+        obj_properties[PROP_DEFERRED_INIT] =
+            g_param_spec_boolean("deferred-init",
+                                 "Deferred initialisation",
+                                 "Enumerate from GAsyncInitable rather than on construction",
+                                 FALSE,
+                                 G_PARAM_CONSTRUCT_ONLY | G_PARAM_WRITABLE);
+
         g_object_class_install_properties(obj_class, N_PROPS, obj_properties);
 }
 
+/**
+ * ldm_manager_dup_property_matches:
+ *
+ * Copy the property matches, dropping any without a pattern, as udev has
+ * no notion of a property which need only exist.
+ */
+static gchar **ldm_manager_dup_property_matches(const GValue *value)
+{
+        gchar **matches = g_value_get_boxed(value);
+        GPtrArray *valid = NULL;
+
+        if (!matches) {
+                return NULL;
+        }
+
+        valid = g_ptr_array_new();
+        for (gchar **match = matches; *match; match++) {
+                const gchar *equals = strchr(*match, '=');
+
+                if (!equals || equals == *match) {
+                        g_warning("Ignoring property match without a pattern: %s", *match);
+                        continue;
+                }
+                g_ptr_array_add(valid, g_strdup(*match));
+        }
+        g_ptr_array_add(valid, NULL);
+
+        return (gchar **)g_ptr_array_free(valid, FALSE);
+}
+
 static void ldm_manager_set_property(GObject *object, guint id, const GValue *value,
                                      GParamSpec *spec)
 {
@@ -194,6 +505,42 @@ static void ldm_manager_set_property(GObject *object, guint id, const GValue *va
         case PROP_FLAGS:
                 self->flags = g_value_get_flags(value);
                 break;
+        case PROP_SNAPSHOT_FILE:
+                g_clear_pointer(&self->snapshot_file, g_free);
+                self->snapshot_file = g_value_dup_string(value);
+                break;
+        case PROP_SUBSYSTEMS:
+                g_clear_pointer(&self->profile.subsystems, g_strfreev);
+                self->profile.subsystems = g_value_dup_boxed(value);
+                break;
+        case PROP_MONITOR_SUBSYSTEMS:
+                g_clear_pointer(&self->profile.monitor_subsystems, g_strfreev);
+                self->profile.monitor_subsystems = g_value_dup_boxed(value);
+                break;
+        case PROP_SYSATTR_MATCHES:
+                g_clear_pointer(&self->profile.sysattr_matches, g_strfreev);
+                self->profile.sysattr_matches = g_value_dup_boxed(value);
+                break;
+        case PROP_PROPERTY_MATCHES:
+                g_clear_pointer(&self->profile.property_matches, g_strfreev);
+                self->profile.property_matches = ldm_manager_dup_property_matches(value);
+                break;
+        case PROP_COALESCE_TIMEOUT:
+                self->monitor.coalesce_timeout = g_value_get_uint(value);
+                break;
+        case PROP_MONITOR_BUFFER_SIZE:
+                self->monitor.buffer_size = g_value_get_uint(value);
+                break;
+        case PROP_SOURCE:
+                self->source.type = g_value_get_enum(value);
+                break;
+        case PROP_SOURCE_FILE:
+                g_clear_pointer(&self->source.file, g_free);
+                self->source.file = g_value_dup_string(value);
+                break;
+        case PROP_DEFERRED_INIT:
+                self->init_pending = g_value_get_boolean(value);
+                break;
         default:
                 G_OBJECT_WARN_INVALID_PROPERTY_ID(object, id, spec);
                 break;
@@ -208,6 +555,33 @@ static void ldm_manager_get_property(GObject *object, guint id, GValue *value, G
         case PROP_FLAGS:
                 g_value_set_flags(value, self->flags);
                 break;
+        case PROP_SNAPSHOT_FILE:
+                g_value_set_string(value, self->snapshot_file);
+                break;
+        case PROP_SUBSYSTEMS:
+                g_value_set_boxed(value, self->profile.subsystems);
+                break;
+        case PROP_MONITOR_SUBSYSTEMS:
+                g_value_set_boxed(value, self->profile.monitor_subsystems);
+                break;
+        case PROP_SYSATTR_MATCHES:
+                g_value_set_boxed(value, self->profile.sysattr_matches);
+                break;
+        case PROP_PROPERTY_MATCHES:
+                g_value_set_boxed(value, self->profile.property_matches);
+                break;
+        case PROP_COALESCE_TIMEOUT:
+                g_value_set_uint(value, self->monitor.coalesce_timeout);
+                break;
+        case PROP_MONITOR_BUFFER_SIZE:
+                g_value_set_uint(value, self->monitor.buffer_size);
+                break;
+        case PROP_SOURCE:
+                g_value_set_enum(value, self->source.type);
+                break;
+        case PROP_SOURCE_FILE:
+                g_value_set_string(value, self->source.file);
+                break;
         default:
                 G_OBJECT_WARN_INVALID_PROPERTY_ID(object, id, spec);
                 break;
@@ -223,6 +597,11 @@ static void ldm_manager_constructed(GObject *obj)
 {
         LdmManager *self = LDM_MANAGER(obj);
 
+        /* Offline sources have no use for udev, nor anything to monitor */
+        if (self->source.type != LDM_DEVICE_SOURCE_UDEV) {
+                goto static_init;
+        }
+
         /* Get udev going */
         self->udev = udev_new();
         g_assert(self->udev != NULL);
@@ -236,11 +615,144 @@ static void ldm_manager_constructed(GObject *obj)
         ldm_manager_init_udev_monitor(self);
 
 static_init:
-        ldm_manager_init_udev_static(self);
+        /* LdmManager:deferred-init enumerates on a worker from init_async */
+        if (self->init_pending) {
+                goto done;
+        }
+
+        ldm_manager_attach_udev_monitor(self);
+        ldm_manager_enumerate(self, &self->source.error);
 
+done:
         G_OBJECT_CLASS(ldm_manager_parent_class)->constructed(obj);
 }
 
+/**
+ * ldm_manager_enumerate:
+ *
+ * Build the initial device tree from the source, or for udev, from the
+ * snapshot where possible. This touches nothing outside of the manager, so
+ * during asynchronous construction it runs on a worker thread, before the
+ * monitor is attached.
+ *
+ * Returns: FALSE if an offline source could not be loaded
+ */
+static gboolean ldm_manager_enumerate(LdmManager *self, GError **error)
+{
+        gboolean ret = TRUE;
+        guint64 start = 0;
+
+        start = ldm_stats_begin(LDM_STATS_PHASE_ENUMERATE);
+        switch (self->source.type) {
+        case LDM_DEVICE_SOURCE_SNAPSHOT:
+                ret = ldm_manager_restore_snapshot(self, self->source.file, FALSE, error);
+                break;
+        case LDM_DEVICE_SOURCE_UMOCKDEV:
+                ret = ldm_manager_load_umockdev(self, self->source.file, error);
+                break;
+        case LDM_DEVICE_SOURCE_UDEV:
+        default:
+                if ((self->flags & LDM_MANAGER_FLAGS_SNAPSHOT) != LDM_MANAGER_FLAGS_SNAPSHOT) {
+                        ldm_manager_init_udev_static(self);
+                } else if (!ldm_manager_load_snapshot(self)) {
+                        ldm_manager_init_udev_static(self);
+                        ldm_manager_save_snapshot(self);
+                }
+                break;
+        }
+        ldm_stats_end(LDM_STATS_PHASE_ENUMERATE, start);
+        ldm_manager_publish_table(self);
+
+        return ret;
+}
+
+/**
+ * ldm_manager_init_thread:
+ *
+ * Runs on a worker thread, enumerating for #ldm_manager_new_async
+ */
+static void ldm_manager_init_thread(GTask *task, gpointer source, __ldm_unused__ gpointer data,
+                                    __ldm_unused__ GCancellable *cancellable)
+{
+        GError *error = NULL;
+
+        if (g_task_return_error_if_cancelled(task)) {
+                return;
+        }
+
+        if (!ldm_manager_enumerate(LDM_MANAGER(source), &error)) {
+                g_task_return_error(task, error);
+                return;
+        }
+        g_task_return_boolean(task, TRUE);
+}
+
+/**
+ * ldm_manager_init_ready:
+ *
+ * Enumeration is complete, so back in the caller context we can begin
+ * dispatching the hotplug events the kernel has buffered in the meantime.
+ */
+static void ldm_manager_init_ready(GObject *source, GAsyncResult *result, gpointer v)
+{
+        g_autoptr(GTask) task = v;
+        g_autoptr(GError) error = NULL;
+
+        ldm_manager_attach_udev_monitor(LDM_MANAGER(source));
+
+        if (!g_task_propagate_boolean(G_TASK(result), &error)) {
+                g_task_return_error(task, g_steal_pointer(&error));
+                return;
+        }
+
+        g_task_return_boolean(task, TRUE);
+}
+
+/**
+ * ldm_manager_init_async:
+ *
+ * GAsyncInitable implementation. Managers constructed without
+ * #LdmManager:deferred-init have already enumerated, so complete immediately.
+ */
+static void ldm_manager_init_async(GAsyncInitable *initable, int io_priority,
+                                   GCancellable *cancellable, GAsyncReadyCallback callback,
+                                   gpointer user_data)
+{
+        LdmManager *self = LDM_MANAGER(initable);
+        GTask *task = NULL;
+        g_autoptr(GTask) worker = NULL;
+
+        task = g_task_new(self, cancellable, callback, user_data);
+        g_task_set_priority(task, io_priority);
+        g_task_set_source_tag(task, ldm_manager_init_async);
+
+        if (!self->init_pending) {
+                g_task_return_boolean(task, TRUE);
+                g_object_unref(task);
+                return;
+        }
+        self->init_pending = FALSE;
+
+        /* The outer task is owned by the worker callback */
+        worker = g_task_new(self, cancellable, ldm_manager_init_ready, task);
+        g_task_set_priority(worker, io_priority);
+        g_task_run_in_thread(worker, ldm_manager_init_thread);
+}
+
+static gboolean ldm_manager_init_finish(GAsyncInitable *initable, GAsyncResult *result,
+                                        GError **error)
+{
+        g_return_val_if_fail(g_task_is_valid(result, initable), FALSE);
+
+        return g_task_propagate_boolean(G_TASK(result), error);
+}
+
+static void ldm_manager_async_initable_init(GAsyncInitableIface *iface)
+{
+        iface->init_async = ldm_manager_init_async;
+        iface->init_finish = ldm_manager_init_finish;
+}
+
 /**
  * ldm_manager_init:
  *
@@ -251,224 +763,964 @@ static void ldm_manager_init(LdmManager *self)
         /* Devices is an array of devices in the order that we encounter them */
         self->devices = g_ptr_array_new_full(30, g_object_unref);
 
+        /* Index of sysfs path to device, with both owned by the devices array */
+        self->device_index = g_hash_table_new(g_str_hash, g_str_equal);
+
+        /* Type buckets over the same devices */
+        for (guint i = 0; i < LDM_MANAGER_N_BUCKETS; i++) {
+                self->buckets.by_type[i] = g_ptr_array_new();
+        }
+        self->buckets.masks = g_hash_table_new(g_direct_hash, g_direct_equal);
+
+        /* Published table of the same, initially empty */
+        ldm_manager_init_table(self);
+
         /* Plugin table is a mapping from plugin name to plugin */
         self->plugins = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_object_unref);
+        self->sorted_plugins = g_ptr_array_new();
+
+        /* Provider cache holds a ref to each device key, so it can never dangle */
+        self->provider_cache = g_hash_table_new_full(g_direct_hash,
+                                                     g_direct_equal,
+                                                     g_object_unref,
+                                                     (GDestroyNotify)g_ptr_array_unref);
+
+        /* Reverse index keys are interned, and each bucket maps device to count */
+        self->reverse.devices = g_hash_table_new_full(g_direct_hash,
+                                                      g_direct_equal,
+                                                      g_object_unref,
+                                                      (GDestroyNotify)g_ptr_array_unref);
+        self->reverse.packages = g_hash_table_new_full(g_str_hash,
+                                                       g_str_equal,
+                                                       NULL,
+                                                       (GDestroyNotify)g_hash_table_unref);
+        self->reverse.drivers = g_hash_table_new_full(g_str_hash,
+                                                      g_str_equal,
+                                                      NULL,
+                                                      (GDestroyNotify)g_hash_table_unref);
+        self->reverse.dirty = g_hash_table_new(g_direct_hash, g_direct_equal);
 }
 
 /**
- * ldm_manager_init_udev_static:
+ * LdmManagerMatchFunc:
  *
- * Enumerate the existing devices on the system, and pass them all of to
- * be added, assuming we don't already know about the device.
+ * Signature shared by the udev_enumerate_add_match_sysattr and
+ * udev_enumerate_add_match_property functions
  */
-static void ldm_manager_init_udev_static(LdmManager *self)
+typedef int (*LdmManagerMatchFunc)(udev_enum *ue, const char *key, const char *value);
+
+/**
+ * ldm_manager_add_matches:
+ *
+ * Push each `key=value` match from the profile into the enumerator
+ */
+static void ldm_manager_add_matches(udev_enum *ue, gchar **matches, LdmManagerMatchFunc func)
 {
-        autofree(udev_enum) *ue = NULL;
-        udev_list *list = NULL, *entry = NULL;
-        static const char *subsystems[] = {
-                "dmi",       "usb",       "pci",
-                "ieee80211", "bluetooth", "hid", /*< As child of USB typically */
-        };
-        /* For LDM_MANAGER_FLAGS_GPU_QUICK */
-        static const char *subsystems_minimal[] = {
-                "pci",
-        };
+        if (!matches) {
+                return;
+        }
+
+        for (gchar **match = matches; *match; match++) {
+                g_auto(GStrv) split = g_strsplit(*match, "=", 2);
+
+                if (!split[0] || func(ue, split[0], split[1]) != 0) {
+                        g_warning("Failed to add match: %s", *match);
+                }
+        }
+}
+
+/**
+ * ldm_manager_add_subsystems:
+ *
+ * Restrict the enumerator to the given subsystems
+ */
+static void ldm_manager_add_subsystems(udev_enum *ue, const char *const *subsystems,
+                                       gsize n_subsystems)
+{
+        for (gsize i = 0; i < n_subsystems; i++) {
+                const char *sub = subsystems[i];
+                if (udev_enumerate_add_match_subsystem(ue, sub) != 0) {
+                        g_warning("Failed to add subsystem match: %s", sub);
+                }
+        }
+}
+
+/* Default subsystems to enumerate */
+static const char *ldm_manager_subsystems[] = {
+        "dmi",       "usb",       "pci",
+        "ieee80211", "bluetooth", "hid", /*< As child of USB typically */
+};
+
+/* For LDM_MANAGER_FLAGS_GPU_QUICK */
+static const char *ldm_manager_subsystems_minimal[] = {
+        "pci",
+};
+
+/**
+ * ldm_manager_new_enumerate:
+ *
+ * Build and scan an enumerator for the devices matching our profile.
+ */
+static udev_enum *ldm_manager_new_enumerate(LdmManager *self)
+{
+        udev_enum *ue = NULL;
 
         /* Set up the enumerator */
         ue = udev_enumerate_new(self->udev);
         g_assert(ue != NULL);
 
-        if ((self->flags & LDM_MANAGER_FLAGS_GPU_QUICK) == LDM_MANAGER_FLAGS_GPU_QUICK) {
-                for (size_t i = 0; i < G_N_ELEMENTS(subsystems_minimal); i++) {
-                        const char *sub = subsystems_minimal[i];
-                        if (udev_enumerate_add_match_subsystem(ue, sub) != 0) {
-                                g_warning("Failed to add subsystem match: %s", sub);
-                        }
+        if (self->profile.subsystems) {
+                ldm_manager_add_subsystems(ue,
+                                           (const char *const *)self->profile.subsystems,
+                                           g_strv_length(self->profile.subsystems));
+        } else if ((self->flags & LDM_MANAGER_FLAGS_GPU_QUICK) == LDM_MANAGER_FLAGS_GPU_QUICK) {
+                ldm_manager_add_subsystems(ue,
+                                           ldm_manager_subsystems_minimal,
+                                           G_N_ELEMENTS(ldm_manager_subsystems_minimal));
+                /* Only display controllers, so nothing else is ever constructed */
+                if (udev_enumerate_add_match_sysattr(ue, "class", "0x03*") != 0) {
+                        g_warning("Failed to add display class match");
                 }
         } else {
-                for (size_t i = 0; i < G_N_ELEMENTS(subsystems); i++) {
-                        const char *sub = subsystems[i];
-                        if (udev_enumerate_add_match_subsystem(ue, sub) != 0) {
-                                g_warning("Failed to add subsystem match: %s", sub);
-                        }
-                }
+                ldm_manager_add_subsystems(ue,
+                                           ldm_manager_subsystems,
+                                           G_N_ELEMENTS(ldm_manager_subsystems));
         }
 
+        ldm_manager_add_matches(ue,
+                                self->profile.sysattr_matches,
+                                udev_enumerate_add_match_sysattr);
+        ldm_manager_add_matches(ue,
+                                self->profile.property_matches,
+                                udev_enumerate_add_match_property);
+
         /* Scan the devices. Due to umockdev we won't check this return. */
         udev_enumerate_scan_devices(ue);
 
+        return ue;
+}
+
+/**
+ * ldm_manager_begin_enumeration:
+ *
+ * Track every device built from here on by its sysfs path, so that each
+ * child finds its parent with a single lookup. Nothing may be removed
+ * until ldm_manager_end_enumeration, as the map holds no references.
+ */
+static void ldm_manager_begin_enumeration(LdmManager *self)
+{
+        g_assert(self->enumerating == NULL);
+        self->enumerating = g_hash_table_new(g_str_hash, g_str_equal);
+}
+
+static void ldm_manager_end_enumeration(LdmManager *self)
+{
+        g_clear_pointer(&self->enumerating, g_hash_table_unref);
+}
+
+/**
+ * ldm_manager_init_udev_static:
+ *
+ * Enumerate the existing devices on the system, and pass them all of to
+ * be added, assuming we don't already know about the device.
+ */
+static void ldm_manager_init_udev_static(LdmManager *self)
+{
+        autofree(udev_enum) *ue = NULL;
+        udev_list *list = NULL, *entry = NULL;
+
+        ue = ldm_manager_new_enumerate(self);
+
         /* Grab head */
         list = udev_enumerate_get_list_entry(ue);
 
         /* Walk said list */
+        ldm_manager_begin_enumeration(self);
         udev_list_entry_foreach(entry, list)
         {
                 ldm_manager_push_sysfs(self, udev_list_entry_get_name(entry));
         }
+        ldm_manager_end_enumeration(self);
+}
+
+/**
+ * LdmManagerRecordFunc:
+ *
+ * Signature shared by the ldm_device_record_get_sysattr and
+ * ldm_device_record_get_property functions
+ */
+typedef const gchar *(*LdmManagerRecordFunc)(LdmDeviceRecord *record, const gchar *key);
+
+/**
+ * ldm_manager_match_value:
+ *
+ * Check a single `key=value` profile match against an offline record, with
+ * the same fnmatch semantics udev applies.
+ */
+static gboolean ldm_manager_match_value(LdmDeviceRecord *record, const gchar *match,
+                                        LdmManagerRecordFunc func)
+{
+        g_auto(GStrv) split = g_strsplit(match, "=", 2);
+        const gchar *value = NULL;
+
+        if (!split[0]) {
+                return FALSE;
+        }
+
+        value = func(record, split[0]);
+        if (!value) {
+                return FALSE;
+        }
+
+        /* Without a pattern the key need only exist */
+        return !split[1] || fnmatch(split[1], value, 0) == 0;
+}
+
+/**
+ * ldm_manager_match_record:
+ *
+ * Apply our enumeration profile to an offline record, exactly as
+ * ldm_manager_new_enumerate has udev do for the live system. Any of the
+ * subsystems and properties may match, but every sysattr must.
+ */
+static gboolean ldm_manager_match_record(LdmManager *self, LdmDeviceRecord *record)
+{
+        const char *subsystem = NULL;
+        const char *pci_class = NULL;
+
+        subsystem = ldm_device_record_get_subsystem(record);
+        if (!subsystem) {
+                return FALSE;
+        }
+
+        if (self->profile.subsystems) {
+                if (self->profile.subsystems[0] &&
+                    !g_strv_contains((const gchar *const *)self->profile.subsystems, subsystem)) {
+                        return FALSE;
+                }
+        } else if ((self->flags & LDM_MANAGER_FLAGS_GPU_QUICK) == LDM_MANAGER_FLAGS_GPU_QUICK) {
+                pci_class = ldm_device_record_get_sysattr(record, "class");
+                if (!g_str_equal(subsystem, "pci") || !pci_class ||
+                    fnmatch("0x03*", pci_class, 0) != 0) {
+                        return FALSE;
+                }
+        } else {
+                gboolean known = FALSE;
+
+                for (size_t i = 0; i < G_N_ELEMENTS(ldm_manager_subsystems) && !known; i++) {
+                        known = g_str_equal(ldm_manager_subsystems[i], subsystem);
+                }
+                if (!known) {
+                        return FALSE;
+                }
+        }
+
+        for (gchar **match = self->profile.sysattr_matches; match && *match; match++) {
+                if (!ldm_manager_match_value(record, *match, ldm_device_record_get_sysattr)) {
+                        return FALSE;
+                }
+        }
+
+        if (!self->profile.property_matches || !self->profile.property_matches[0]) {
+                return TRUE;
+        }
+        for (gchar **match = self->profile.property_matches; *match; match++) {
+                if (ldm_manager_match_value(record, *match, ldm_device_record_get_property)) {
+                        return TRUE;
+                }
+        }
+
+        return FALSE;
+}
+
+/**
+ * ldm_manager_push_records:
+ * @records: (element-type LdmDeviceRecord): Every record of the source, parents first
+ *
+ * Build the device tree from an offline source, just as
+ * ldm_manager_init_udev_static does from the live system.
+ */
+void ldm_manager_push_records(LdmManager *self, GPtrArray *records)
+{
+        ldm_manager_begin_enumeration(self);
+        for (guint i = 0; i < records->len; i++) {
+                LdmDeviceRecord *record = records->pdata[i];
+
+                if (ldm_manager_match_record(self, record)) {
+                        ldm_manager_push_device(self, record, FALSE);
+                }
+        }
+        ldm_manager_end_enumeration(self);
+}
+
+/**
+ * ldm_manager_collect_stale:
+ *
+ * Gather every device no longer present in sysfs. Children of a stale
+ * device are not collected, as they go along with their parent.
+ */
+static void ldm_manager_collect_stale(LdmDevice *device, GHashTable *present, GPtrArray *stale)
+{
+        if (!g_hash_table_contains(present, device->os.sysfs_path)) {
+                g_ptr_array_add(stale, g_object_ref(device));
+                return;
+        }
+
+        for (guint i = 0; i < device->tree.kids->len; i++) {
+                ldm_manager_collect_stale(device->tree.kids->pdata[i], present, stale);
+        }
+}
+
+G_STATIC_ASSERT(LDM_DEVICE_TYPE_MAX == 1 << LDM_MANAGER_N_BUCKETS);
+
+/**
+ * ldm_manager_subtree_types:
+ *
+ * Every type found within the subtree, i.e. that #ldm_device_has_type could
+ * possibly match the device for.
+ */
+static guint ldm_manager_subtree_types(LdmDevice *device)
+{
+        guint ret = device->os.devtype;
+
+        for (guint i = 0; i < device->tree.kids->len; i++) {
+                ret |= ldm_manager_subtree_types(device->tree.kids->pdata[i]);
+        }
+
+        return ret;
+}
+
+/**
+ * ldm_manager_bucket_insert:
+ *
+ * Insert the root into the bucket, retaining the order of the devices array.
+ * The newest root, or one gaining a child right after it arrived, is the
+ * common case and simply appended.
+ */
+static void ldm_manager_bucket_insert(LdmManager *self, GPtrArray *bucket, LdmDevice *device)
+{
+        guint index = 0;
+
+        if (self->devices->pdata[self->devices->len - 1] == device) {
+                g_ptr_array_add(bucket, device);
+                return;
+        }
+
+        for (guint i = 0; i < self->devices->len && index < bucket->len; i++) {
+                LdmDevice *node = self->devices->pdata[i];
+
+                if (node == device) {
+                        break;
+                }
+                if (bucket->pdata[index] == node) {
+                        ++index;
+                }
+        }
+
+        g_ptr_array_insert(bucket, (gint)index, device);
+}
+
+/**
+ * ldm_manager_bucket_device:
+ * @types: Types now found within the subtree, in addition to those known
+ *
+ * Add the root to the bucket of any type its subtree gained since it was
+ * last bucketed, as new children arrive after their parent.
+ */
+static void ldm_manager_bucket_device(LdmManager *self, LdmDevice *device, guint types)
+{
+        guint known = GPOINTER_TO_UINT(g_hash_table_lookup(self->buckets.masks, device));
+        guint added = types & ~known;
+
+        types |= known;
+
+        if (added == 0) {
+                return;
+        }
+
+        for (guint i = 0; i < LDM_MANAGER_N_BUCKETS; i++) {
+                if ((added & (1u << i)) != 0) {
+                        ldm_manager_bucket_insert(self, self->buckets.by_type[i], device);
+                }
+        }
+        g_hash_table_insert(self->buckets.masks, device, GUINT_TO_POINTER(types));
+        self->table.buckets |= added;
+}
+
+/**
+ * ldm_manager_unbucket_device:
+ *
+ * Drop the root from every bucket it was added to
+ */
+static void ldm_manager_unbucket_device(LdmManager *self, LdmDevice *device)
+{
+        guint known = GPOINTER_TO_UINT(g_hash_table_lookup(self->buckets.masks, device));
+
+        for (guint i = 0; i < LDM_MANAGER_N_BUCKETS; i++) {
+                if ((known & (1u << i)) != 0) {
+                        g_ptr_array_remove(self->buckets.by_type[i], device);
+                }
+        }
+        g_hash_table_remove(self->buckets.masks, device);
+        self->table.buckets |= known;
+}
+
+/**
+ * ldm_manager_add_root:
+ * @device: (transfer full): New root device
+ *
+ * Append a root device to the manager, indexing it by path and type
+ */
+void ldm_manager_add_root(LdmManager *self, LdmDevice *device)
+{
+        g_ptr_array_add(self->devices, device);
+        g_hash_table_insert(self->device_index, device->os.sysfs_path, device);
+        ldm_manager_bucket_device(self, device, ldm_manager_subtree_types(device));
+        ldm_manager_touch_table(self, device);
+}
+
+/**
+ * ldm_manager_get_candidates:
+ * @types: Bitwise mask of #LdmDeviceType
+ *
+ * Find the smallest bucket which holds every root device matching @types,
+ * falling back to all of them for #LDM_DEVICE_TYPE_ANY. Candidates must
+ * still be checked with #ldm_device_has_type.
+ *
+ * Returns: (transfer none): The candidate root devices, in manager order
+ */
+GPtrArray *ldm_manager_get_candidates(LdmManager *self, LdmDeviceType types)
+{
+        GPtrArray *ret = self->devices;
+
+        for (guint i = 0; i < LDM_MANAGER_N_BUCKETS; i++) {
+                GPtrArray *bucket = self->buckets.by_type[i];
+
+                if ((types & (1u << i)) != 0 && bucket->len < ret->len) {
+                        ret = bucket;
+                }
+        }
+
+        return ret;
+}
+
+/**
+ * ldm_manager_forget_device:
+ *
+ * Remove a known device from the tree, whether a child or a root.
+ */
+static void ldm_manager_forget_device(LdmManager *self, LdmDevice *node)
+{
+        LdmDevice *parent = node->tree.parent;
+
+        ldm_manager_invalidate_providers(self, node);
+
+        if (parent) {
+                ldm_device_remove_child_by_path(parent, node->os.sysfs_path);
+                ldm_manager_touch_table(self, parent);
+                return;
+        }
+
+        /*  Emit signal for the device removal */
+        g_signal_emit(self, obj_signals[SIGNAL_DEVICE_REMOVED], 0, node);
+
+        /* Remove from our known devices, indexes first as the array owns it */
+        ldm_manager_unindex_device(self, node);
+        ldm_manager_unbucket_device(self, node);
+        ldm_manager_untable_device(self, node);
+        g_hash_table_remove(self->device_index, node->os.sysfs_path);
+        g_ptr_array_remove(self->devices, node);
+}
+
+/**
+ * ldm_manager_resync:
+ *
+ * Re-enumerate through udev and diff the result against the devices we
+ * already know about by sysfs path. Devices that are still present are
+ * left untouched, along with their memoised providers, and signals are
+ * only emitted for real changes.
+ *
+ * Returns: TRUE if any device was added or removed
+ */
+static gboolean ldm_manager_resync(LdmManager *self)
+{
+        autofree(udev_enum) *ue = NULL;
+        udev_list *list = NULL, *entry = NULL;
+        g_autoptr(GHashTable) present = NULL;
+        g_autoptr(GPtrArray) stale = NULL;
+        g_autoptr(GPtrArray) added = NULL;
+        gboolean changed = FALSE;
+        guint64 start = 0;
+
+        start = ldm_stats_begin(LDM_STATS_PHASE_ENUMERATE);
+        ue = ldm_manager_new_enumerate(self);
+        list = udev_enumerate_get_list_entry(ue);
+
+        /* Names are owned by the enumerator */
+        present = g_hash_table_new(g_str_hash, g_str_equal);
+        udev_list_entry_foreach(entry, list)
+        {
+                g_hash_table_add(present, (gpointer)udev_list_entry_get_name(entry));
+        }
+
+        /* Drop whatever went away */
+        stale = g_ptr_array_new_with_free_func(g_object_unref);
+        for (guint i = 0; i < self->devices->len; i++) {
+                ldm_manager_collect_stale(self->devices->pdata[i], present, stale);
+        }
+        for (guint i = 0; i < stale->len; i++) {
+                ldm_manager_forget_device(self, stale->pdata[i]);
+        }
+        changed = stale->len > 0;
+
+        /* Push the new devices in enumeration order, keeping parents first */
+        added = g_ptr_array_new_with_free_func((GDestroyNotify)ldm_device_record_unref);
+        ldm_manager_begin_enumeration(self);
+        udev_list_entry_foreach(entry, list)
+        {
+                autofree(udev_device) *device = NULL;
+                LdmDeviceRecord *record = NULL;
+
+                device = udev_device_new_from_syspath(self->udev, udev_list_entry_get_name(entry));
+                if (!device) {
+                        continue;
+                }
+                record = ldm_device_record_new_from_udev(device);
+                if (!ldm_manager_push_device(self, record, TRUE)) {
+                        ldm_device_record_unref(record);
+                        continue;
+                }
+                g_ptr_array_add(added, record);
+                changed = TRUE;
+        }
+        ldm_manager_end_enumeration(self);
+
+        /* USB devices are only announced once their interfaces exist */
+        for (guint i = 0; i < added->len; i++) {
+                ldm_manager_emit_usb(self, added->pdata[i]);
+        }
+        ldm_stats_end(LDM_STATS_PHASE_ENUMERATE, start);
+
+        return changed;
+}
+
+/**
+ * ldm_manager_init_udev_monitor:
+ *
+ * Set up the udev monitor and begin receiving, so that no event is lost
+ * while we enumerate. See ldm_manager_attach_udev_monitor.
+ */
+static void ldm_manager_init_udev_monitor(LdmManager *self)
+{
+        /* Only the USB device types we build, so the kernel drops the rest.
+         * PCI is added by ldm_manager_monitor_gpus once something follows GPUs */
+        static const char *default_filters[] = {
+                "usb/usb_device", "usb/usb_interface", "hid", "bluetooth", "ieee80211",
+        };
+        const char *const *subsystem_filters = default_filters;
+        guint n_filters = G_N_ELEMENTS(default_filters);
+
+        if (self->profile.monitor_subsystems) {
+                subsystem_filters = (const char *const *)self->profile.monitor_subsystems;
+                n_filters = g_strv_length(self->profile.monitor_subsystems);
+        }
+
+        self->monitor.udev = udev_monitor_new_from_netlink(self->udev, "udev");
+        if (!self->monitor.udev) {
+                g_warning("udev monitoring is unavailable");
+                return;
+        }
+
+        /* Install hotplug filters */
+        for (guint i = 0; i < n_filters; i++) {
+                g_auto(GStrv) filter = g_strsplit(subsystem_filters[i], "/", 2);
+
+                if (!filter[0] ||
+                    udev_monitor_filter_add_match_subsystem_devtype(self->monitor.udev,
+                                                                    filter[0],
+                                                                    filter[1]) != 0) {
+                        g_warning("Unable to install %s filter", subsystem_filters[i]);
+                        g_clear_pointer(&self->monitor.udev, udev_monitor_unref);
+                        return;
+                }
+        }
+        if (self->monitor.gpus && !self->profile.monitor_subsystems &&
+            udev_monitor_filter_add_match_subsystem_devtype(self->monitor.udev, "pci", NULL) != 0) {
+                g_warning("Unable to install pci filter");
+        }
+
+        /* Needs CAP_NET_ADMIN to exceed rmem_max, so failure isn't fatal */
+        if (self->monitor.buffer_size > 0 &&
+            udev_monitor_set_receive_buffer_size(self->monitor.udev,
+                                                 (int)self->monitor.buffer_size) != 0) {
+                g_debug("Unable to set monitor buffer size to %u", self->monitor.buffer_size);
+        }
+
+        if (udev_monitor_enable_receiving(self->monitor.udev) != 0) {
+                g_warning("Failed to enable monitor receiving");
+                g_clear_pointer(&self->monitor.udev, udev_monitor_unref);
+                return;
+        }
+}
+
+/**
+ * ldm_manager_monitor_gpus:
+ *
+ * Extend the default hotplug filters to the PCI subsystem, so that external
+ * GPUs are seen by an #LdmGPUConfig. Managers without a GPU config never wake
+ * for PCI events. Custom #LdmManager:monitor-subsystems are left untouched,
+ * and once installed the filter remains for the lifetime of the manager.
+ */
+void ldm_manager_monitor_gpus(LdmManager *self)
+{
+        if (self->monitor.gpus) {
+                return;
+        }
+        self->monitor.gpus = TRUE;
+
+        /* Not yet set up, ldm_manager_init_udev_monitor installs it */
+        if (!self->monitor.udev || self->profile.monitor_subsystems) {
+                return;
+        }
+
+        if (udev_monitor_filter_add_match_subsystem_devtype(self->monitor.udev, "pci", NULL) != 0 ||
+            udev_monitor_filter_update(self->monitor.udev) != 0) {
+                g_warning("Unable to install pci filter");
+        }
+}
+
+/**
+ * ldm_manager_attach_udev_monitor:
+ *
+ * Start dispatching events from the (already receiving) monitor. Anything
+ * arriving before this point is buffered in the socket, and devices we
+ * enumerated in the meantime are simply not duplicated.
+ */
+static void ldm_manager_attach_udev_monitor(LdmManager *self)
+{
+        int fd = 0;
+
+        if (!self->monitor.udev) {
+                return;
+        }
+
+        /* Optionally service the socket away from the consumer main loop */
+        if ((self->flags & LDM_MANAGER_FLAGS_MONITOR_THREAD) == LDM_MANAGER_FLAGS_MONITOR_THREAD &&
+            ldm_manager_start_monitor_thread(self)) {
+                return;
+        }
+
+        /* Now let's hook up monitoring. */
+        fd = udev_monitor_get_fd(self->monitor.udev);
+        self->monitor.channel = g_io_channel_unix_new(fd);
+        /* Don't do anything fancy with the channel */
+        g_io_channel_set_encoding(self->monitor.channel, NULL, NULL);
+        self->monitor.source =
+            g_io_add_watch(self->monitor.channel, G_IO_IN, ldm_manager_io_ready, self);
+}
+
+/**
+ * ldm_manager_event_free:
+ *
+ * Free a previously queued LdmManagerEvent
+ */
+static void ldm_manager_event_free(LdmManagerEvent *event)
+{
+        g_clear_pointer(&event->device, udev_device_unref);
+        g_free(event);
+}
+
+/**
+ * ldm_manager_queue_event:
+ *
+ * Fold the udev event into any pending event for the same sysfs path.
+ */
+void ldm_manager_queue_event(LdmManager *self, udev_device *device, const char *action)
+{
+        LdmManagerEvent *event = NULL;
+        const char *sysfs_path = NULL;
+
+        if (!self->monitor.pending) {
+                self->monitor.pending =
+                    g_ptr_array_new_with_free_func((GDestroyNotify)ldm_manager_event_free);
+                self->monitor.pending_path = g_hash_table_new(g_str_hash, g_str_equal);
+        }
+
+        sysfs_path = udev_device_get_syspath(device);
+        event = g_hash_table_lookup(self->monitor.pending_path, sysfs_path);
+        if (!event) {
+                event = g_new0(LdmManagerEvent, 1);
+                g_ptr_array_add(self->monitor.pending, event);
+        }
+
+        /* Keep the most recent view of the device, keyed on its own path */
+        g_clear_pointer(&event->device, udev_device_unref);
+        event->device = udev_device_ref(device);
+        g_hash_table_replace(self->monitor.pending_path,
+                             (gpointer)udev_device_get_syspath(device),
+                             event);
+
+        if (g_str_equal(action, "add")) {
+                event->added = TRUE;
+        } else if (g_str_equal(action, "bind")) {
+                event->bound = TRUE;
+        } else if (g_str_equal(action, "remove")) {
+                /* Removing a device we never constructed cancels it out */
+                if (!event->added) {
+                        event->removed = TRUE;
+                }
+                event->added = FALSE;
+                event->bound = FALSE;
+        }
+}
+
+/**
+ * ldm_manager_flush_timeout:
+ *
+ * The coalescing window has passed, process everything we've seen.
+ */
+static gboolean ldm_manager_flush_timeout(gpointer v)
+{
+        LdmManager *self = v;
+
+        g_clear_pointer(&self->monitor.flush_source, g_source_unref);
+        ldm_manager_flush_events(self);
+
+        return G_SOURCE_REMOVE;
+}
+
+/**
+ * ldm_manager_flush_events:
+ *
+ * Apply every pending event in the order it first arrived, which keeps
+ * parents ahead of their children, and emit a single change notification.
+ * Bound USB devices are only announced once the whole batch is applied,
+ * as their interfaces arrive after them.
+ */
+static void ldm_manager_flush_events(LdmManager *self)
+{
+        g_autoptr(GPtrArray) pending = NULL;
+        g_autoptr(GPtrArray) bound = NULL;
+        gboolean changed = FALSE;
+
+        /* Keep queueing while a worker reads the tree */
+        if (!self->monitor.pending || self->monitor.hold > 0) {
+                return;
+        }
+
+        /* Steal the queue, as signal handlers may cause more events to queue */
+        pending = g_steal_pointer(&self->monitor.pending);
+        g_clear_pointer(&self->monitor.pending_path, g_hash_table_unref);
+
+        bound = g_ptr_array_new_with_free_func((GDestroyNotify)ldm_device_record_unref);
+        for (guint i = 0; i < pending->len; i++) {
+                LdmManagerEvent *event = pending->pdata[i];
+                g_autoptr(LdmDeviceRecord) record = NULL;
+
+                record = ldm_device_record_new_from_udev(event->device);
+                if (event->removed && ldm_manager_remove_device(self, record)) {
+                        changed = TRUE;
+                }
+                if (event->added && ldm_manager_push_device(self, record, TRUE)) {
+                        changed = TRUE;
+                }
+                if (event->bound) {
+                        g_ptr_array_add(bound, g_steal_pointer(&record));
+                }
+        }
+
+        /* USB devices are only announced once their interfaces exist */
+        for (guint i = 0; i < bound->len; i++) {
+                if (ldm_manager_emit_usb(self, bound->pdata[i])) {
+                        changed = TRUE;
+                }
+        }
+        ldm_manager_publish_table(self);
+
+        if (changed) {
+                g_signal_emit(self, obj_signals[SIGNAL_DEVICES_CHANGED], 0);
+        }
+}
+
+/**
+ * ldm_manager_schedule_flush:
+ *
+ * Process the queued events now, or once the coalescing window has passed.
+ * The timer is attached to the context dispatching the events.
+ */
+void ldm_manager_schedule_flush(LdmManager *self)
+{
+        GSource *current = NULL;
+
+        if (self->monitor.coalesce_timeout == 0) {
+                ldm_manager_flush_events(self);
+                return;
+        }
+
+        /* Fixed window from the first event, so a busy bus can't starve us */
+        if (self->monitor.flush_source) {
+                return;
+        }
+
+        current = g_main_current_source();
+        self->monitor.flush_source = g_timeout_source_new(self->monitor.coalesce_timeout);
+        g_source_set_callback(self->monitor.flush_source, ldm_manager_flush_timeout, self, NULL);
+        g_source_attach(self->monitor.flush_source,
+                        current ? g_source_get_context(current) : NULL);
 }
 
 /**
- * ldm_manager_init_udev_monitor:
+ * ldm_manager_handle_overrun:
  *
- * Set up the udev monitor and attach the file descriptor to the main event
- * context to enable receiving the events on the idle loop.
+ * The kernel dropped events as the receive buffer overflowed, so we can
+ * no longer trust the tree. Apply what we did see, and then diff against
+ * a fresh enumeration to pick up anything we missed.
  */
-static void ldm_manager_init_udev_monitor(LdmManager *self)
+void ldm_manager_handle_overrun(LdmManager *self)
 {
-        int fd = 0;
-        static const char *subsystem_filters[] = {
-                "usb",
-                "hid",
-                "bluetooth",
-                "ieee80211",
-        };
-
-        self->monitor.udev = udev_monitor_new_from_netlink(self->udev, "udev");
-        if (!self->monitor.udev) {
-                g_warning("udev monitoring is unavailable");
-                return;
-        }
+        g_debug("udev monitor overrun, resynchronising");
+        ldm_manager_rescan(self);
+}
 
-        /* Install hotplug filters */
-        for (guint i = 0; i < G_N_ELEMENTS(subsystem_filters); i++) {
-                const char *subsystem = subsystem_filters[i];
+/**
+ * ldm_manager_hold_events:
+ *
+ * A worker thread is about to read the device tree, so hold back any
+ * changes to it until the matching ldm_manager_release_events. Events
+ * continue to be received and coalesced in the meantime.
+ */
+void ldm_manager_hold_events(LdmManager *self)
+{
+        ++self->monitor.hold;
+}
 
-                if (udev_monitor_filter_add_match_subsystem_devtype(self->monitor.udev,
-                                                                    subsystem,
-                                                                    NULL) != 0) {
-                        g_warning("Unable to install %s filter", subsystem);
-                        g_clear_pointer(&self->monitor.udev, udev_monitor_unref);
-                        return;
-                }
-        }
+/**
+ * ldm_manager_release_events:
+ *
+ * Drop a hold, applying whatever arrived while the last one was in place.
+ */
+void ldm_manager_release_events(LdmManager *self)
+{
+        g_assert(self->monitor.hold > 0);
 
-        if (udev_monitor_enable_receiving(self->monitor.udev) != 0) {
-                g_warning("Failed to enable monitor receiving");
-                g_clear_pointer(&self->monitor.udev, udev_monitor_unref);
+        if (--self->monitor.hold > 0) {
                 return;
         }
 
-        /* Now let's hook up monitoring. */
-        fd = udev_monitor_get_fd(self->monitor.udev);
-        self->monitor.channel = g_io_channel_unix_new(fd);
-        /* Don't do anything fancy with the channel */
-        g_io_channel_set_encoding(self->monitor.channel, NULL, NULL);
-        self->monitor.source =
-            g_io_add_watch(self->monitor.channel, G_IO_IN, ldm_manager_io_ready, self);
+        if (self->monitor.resync) {
+                self->monitor.resync = FALSE;
+                ldm_manager_rescan(self);
+        } else if (self->monitor.pending && !self->monitor.flush_source) {
+                ldm_manager_schedule_flush(self);
+        }
 }
 
 /**
  * ldm_manager_io_ready:
  *
- * We have I/O on the udev channel, do something with it.
+ * We have I/O on the udev channel, so drain every pending event into the
+ * queue before processing any of them.
  */
 static gboolean ldm_manager_io_ready(__ldm_unused__ GIOChannel *source, GIOCondition condition,
                                      gpointer v)
 {
         LdmManager *self = v;
-        autofree(udev_device) *device = NULL;
-        const char *action = NULL;
+        guint n_events = 0;
+        gboolean overrun = FALSE;
 
         /* Only want G_IO_IN here. */
         if ((condition & G_IO_IN) != G_IO_IN) {
                 return TRUE;
         }
 
-        device = udev_monitor_receive_device(self->monitor.udev);
-        if (!device) {
-                /* Remove polling now, something is badly wrong. */
-                g_warning("Failed to receive device!");
-                return FALSE;
+        for (;;) {
+                autofree(udev_device) *device = NULL;
+                const char *action = NULL;
+
+                /* The monitor socket is non blocking, so NULL means drained */
+                errno = 0;
+                device = udev_monitor_receive_device(self->monitor.udev);
+                if (!device) {
+                        overrun = errno == ENOBUFS;
+                        break;
+                }
+                ++n_events;
+
+                action = udev_device_get_action(device);
+                if (!action) {
+                        continue;
+                }
+
+                ldm_manager_queue_event(self, device, action);
         }
 
-        action = udev_device_get_action(device);
-        if (!action) {
+        if (overrun) {
+                ldm_manager_handle_overrun(self);
                 return TRUE;
         }
 
-        /* Interesting actions */
-        if (g_str_equal(action, "add")) {
-                ldm_manager_push_device(self, device, TRUE);
-        } else if (g_str_equal(action, "remove")) {
-                ldm_manager_remove_device(self, device);
-        } else if (g_str_equal(action, "bind")) {
-                ldm_manager_emit_usb(self, device);
+        if (n_events == 0) {
+                /* Remove polling now, something is badly wrong. */
+                g_warning("Failed to receive device!");
+                return FALSE;
         }
 
+        ldm_manager_schedule_flush(self);
+
         /* Keep the source around */
         return TRUE;
 }
 
 /*
- * Walk devices and find the matching device.
- * We originally used a hashtable internally but that has the undesirable
+ * Find the matching device by its sysfs path.
+ * We originally used only a hashtable internally but that has the undesirable
  * effect that we lose our original sorting as it came from udev, and not
  * only did it make test suites unreliable, it also meant we could encounter
- * PCI devices in the wrong order too.
+ * PCI devices in the wrong order too. The devices array retains the order,
+ * whilst the device_index provides constant time lookups.
  */
 static gboolean ldm_manager_device_by_sysfs_path(LdmManager *self, const char *sysfs_path,
-                                                 LdmDevice **out_device, guint *out_index)
+                                                 LdmDevice **out_device)
 {
-        if (out_device) {
-                *out_device = NULL;
-        }
-        if (out_index) {
-                *out_index = 0;
-        }
-
-        /* Find the device */
-        for (guint i = 0; i < self->devices->len; i++) {
-                LdmDevice *node = NULL;
-
-                node = self->devices->pdata[i];
-                if (!g_str_equal(node->os.sysfs_path, sysfs_path)) {
-                        continue;
-                }
+        LdmDevice *node = NULL;
 
-                if (out_device) {
-                        *out_device = node;
-                }
-                if (out_index) {
-                        *out_index = i;
-                }
-                return TRUE;
+        node = g_hash_table_lookup(self->device_index, sysfs_path);
+        if (out_device) {
+                *out_device = node;
         }
 
-        return FALSE;
+        return node != NULL;
 }
 
 /**
  * ldm_manager_remove_device:
  *
  * Attempt removal of a previously registered device or interface.
+ * Returns TRUE if a known device was removed.
  */
-static void ldm_manager_remove_device(LdmManager *self, udev_device *device)
+static gboolean ldm_manager_remove_device(LdmManager *self, LdmDeviceRecord *record)
 {
         LdmDevice *parent = NULL;
         const char *subsystem = NULL;
         const char *sysfs_path = NULL;
         LdmDevice *node = NULL;
-        guint index = 0;
 
-        subsystem = udev_device_get_subsystem(device);
-        sysfs_path = udev_device_get_syspath(device);
+        subsystem = ldm_device_record_get_subsystem(record);
+        sysfs_path = ldm_device_record_get_syspath(record);
 
         /* Got a parent? Remove from there */
-        parent = ldm_manager_get_device_parent(self, subsystem, device);
+        parent = ldm_manager_get_device_parent(self, subsystem, record);
         if (parent) {
-                ldm_device_remove_child_by_path(parent, sysfs_path);
-                return;
+                node = ldm_device_get_child_by_path(parent, sysfs_path);
+        } else {
+                ldm_manager_device_by_sysfs_path(self, sysfs_path, &node);
+        }
+        if (!node) {
+                return FALSE;
         }
 
-        if (!ldm_manager_device_by_sysfs_path(self, sysfs_path, &node, &index)) {
-                return;
-        };
-
-        /*  Emit signal for the device removal */
-        g_signal_emit(self, obj_signals[SIGNAL_DEVICE_REMOVED], 0, node);
-
-        /* Remove from our known devices */
-        g_ptr_array_remove_index(self->devices, index);
+        ldm_manager_forget_device(self, node);
+        return TRUE;
 }
 
 /**
@@ -480,10 +1732,15 @@ static void ldm_manager_remove_device(LdmManager *self, udev_device *device)
 static void ldm_manager_push_sysfs(LdmManager *self, const char *sysfs_path)
 {
         autofree(udev_device) *device = NULL;
+        g_autoptr(LdmDeviceRecord) record = NULL;
 
         device = udev_device_new_from_syspath(self->udev, sysfs_path);
+        if (!device) {
+                return;
+        }
 
-        ldm_manager_push_device(self, device, FALSE);
+        record = ldm_device_record_new_from_udev(device);
+        ldm_manager_push_device(self, record, FALSE);
 }
 
 /**
@@ -491,26 +1748,27 @@ static void ldm_manager_push_sysfs(LdmManager *self, const char *sysfs_path)
  *
  * Return the USB parent device for this usb_interface
  */
-static LdmDevice *ldm_manager_get_usb_parent(LdmManager *self, udev_device *device)
+static LdmDevice *ldm_manager_get_usb_parent(LdmManager *self, LdmDeviceRecord *record)
 {
-        udev_device *udev_parent = NULL;
+        LdmDeviceRecord *record_parent = NULL;
         const char *sysfs_path = NULL;
         const char *devtype = NULL;
         LdmDevice *node = NULL;
 
-        devtype = udev_device_get_devtype(device);
+        devtype = ldm_device_record_get_devtype(record);
         if (!devtype || !g_str_equal(devtype, "usb_interface")) {
                 return NULL;
         }
 
-        udev_parent = udev_device_get_parent_with_subsystem_devtype(device, "usb", "usb_device");
-        if (!udev_parent) {
+        record_parent =
+            ldm_device_record_get_parent_with_subsystem_devtype(record, "usb", "usb_device");
+        if (!record_parent) {
                 return NULL;
         }
 
-        sysfs_path = udev_device_get_syspath(udev_parent);
+        sysfs_path = ldm_device_record_get_syspath(record_parent);
 
-        if (!ldm_manager_device_by_sysfs_path(self, sysfs_path, &node, NULL)) {
+        if (!ldm_manager_device_by_sysfs_path(self, sysfs_path, &node)) {
                 return NULL;
         };
 
@@ -522,22 +1780,31 @@ static LdmDevice *ldm_manager_get_usb_parent(LdmManager *self, udev_device *devi
  *
  * Return the parent device node for a subsystem device on the USB interface
  */
-static LdmDevice *ldm_manager_get_interface_parent(LdmManager *self, udev_device *device)
+static LdmDevice *ldm_manager_get_interface_parent(LdmManager *self, LdmDeviceRecord *record)
 {
-        udev_device *udev_parent = NULL;
+        LdmDeviceRecord *record_parent = NULL;
         LdmDevice *parent_usb_device = NULL;
         LdmDevice *parent_interface = NULL;
         const char *sysfs_path = NULL;
 
         /* Grab immediate udev usb_interface parent */
-        udev_parent = udev_device_get_parent_with_subsystem_devtype(device, "usb", "usb_interface");
-        if (!udev_parent) {
+        record_parent =
+            ldm_device_record_get_parent_with_subsystem_devtype(record, "usb", "usb_interface");
+        if (!record_parent) {
                 return NULL;
         }
 
+        /* During enumeration the interface is a single lookup away */
+        sysfs_path = ldm_device_record_get_syspath(record_parent);
+        if (self->enumerating) {
+                parent_interface = g_hash_table_lookup(self->enumerating, sysfs_path);
+                if (parent_interface) {
+                        return parent_interface;
+                }
+        }
+
         /* Find the root level USB device */
-        sysfs_path = udev_device_get_syspath(udev_parent);
-        parent_usb_device = ldm_manager_get_usb_parent(self, udev_parent);
+        parent_usb_device = ldm_manager_get_usb_parent(self, record_parent);
         if (!parent_usb_device) {
                 return NULL;
         }
@@ -558,14 +1825,14 @@ static LdmDevice *ldm_manager_get_interface_parent(LdmManager *self, udev_device
  * added device or interface.
  */
 static LdmDevice *ldm_manager_get_device_parent(LdmManager *self, const char *subsystem,
-                                                udev_device *device)
+                                                LdmDeviceRecord *record)
 {
-        udev_device *direct_parent = NULL;
+        LdmDeviceRecord *direct_parent = NULL;
         const char *parent_subsystem = NULL;
 
         /* Simple usb_interface->usb parent */
         if (g_str_equal(subsystem, "usb")) {
-                return ldm_manager_get_usb_parent(self, device);
+                return ldm_manager_get_usb_parent(self, record);
         }
 
         /* We don't parent PCI physical devices */
@@ -574,106 +1841,126 @@ static LdmDevice *ldm_manager_get_device_parent(LdmManager *self, const char *su
         }
 
         /* Attempt to grab direct PCI parent (no middle interface) */
-        direct_parent = udev_device_get_parent(device);
-        parent_subsystem = udev_device_get_subsystem(direct_parent);
+        direct_parent = ldm_device_record_get_parent(record);
+        parent_subsystem = direct_parent ? ldm_device_record_get_subsystem(direct_parent) : NULL;
         if (parent_subsystem && g_str_equal(parent_subsystem, "pci")) {
                 LdmDevice *parent = NULL;
                 if (ldm_manager_device_by_sysfs_path(self,
-                                                     udev_device_get_syspath(direct_parent),
-                                                     &parent,
-                                                     NULL)) {
+                                                     ldm_device_record_get_syspath(direct_parent),
+                                                     &parent)) {
                         return parent;
                 }
                 return NULL;
         }
 
-        return ldm_manager_get_interface_parent(self, device);
+        return ldm_manager_get_interface_parent(self, record);
 }
 
 /**
  * ldm_manager_emit_usb:
  *
  * We won't emit the USB device until we know its "finished", i.e. the
- * bind event has been received for the usb_device
+ * bind event has been received for the usb_device. Returns TRUE if the
+ * signal was emitted.
  */
-static void ldm_manager_emit_usb(LdmManager *self, udev_device *device)
+static gboolean ldm_manager_emit_usb(LdmManager *self, LdmDeviceRecord *record)
 {
         const char *sysfs_path = NULL;
         const char *devtype = NULL;
         const char *subsystem = NULL;
         LdmDevice *node = NULL;
 
-        subsystem = udev_device_get_subsystem(device);
+        subsystem = ldm_device_record_get_subsystem(record);
 
         /* Must be a USB device */
         if (!g_str_equal(subsystem, "usb")) {
-                return;
+                return FALSE;
         }
 
-        devtype = udev_device_get_devtype(device);
+        devtype = ldm_device_record_get_devtype(record);
         if (!devtype || !g_str_equal(devtype, "usb_device")) {
-                return;
+                return FALSE;
         }
 
-        sysfs_path = udev_device_get_syspath(device);
-        if (!ldm_manager_device_by_sysfs_path(self, sysfs_path, &node, NULL)) {
-                return;
+        sysfs_path = ldm_device_record_get_syspath(record);
+        if (!ldm_manager_device_by_sysfs_path(self, sysfs_path, &node)) {
+                return FALSE;
         };
 
         g_signal_emit(self, obj_signals[SIGNAL_DEVICE_ADDED], 0, node);
+        return TRUE;
 }
 
 /**
  * ldm_manager_push_device:
- * @device: The udev device to add
+ * @record: The udev device, or offline record, to add
  *
- * This will handle the real work of adding a new device to the manager
+ * This will handle the real work of adding a new device to the manager,
+ * returning TRUE if the device was added.
  */
-static void ldm_manager_push_device(LdmManager *self, udev_device *device, gboolean emit_signal)
+static gboolean ldm_manager_push_device(LdmManager *self, LdmDeviceRecord *record,
+                                        gboolean emit_signal)
 {
         LdmDevice *ldm_device = NULL;
         LdmDevice *parent = NULL;
         const char *sysfs_path = NULL;
         const char *subsystem = NULL;
-        udev_list *properties = NULL;
 
-        sysfs_path = udev_device_get_syspath(device);
+        sysfs_path = ldm_device_record_get_syspath(record);
 
         /* Don't dupe these guys. */
-        if (ldm_manager_device_by_sysfs_path(self, sysfs_path, NULL, NULL)) {
-                return;
+        if (ldm_manager_device_by_sysfs_path(self, sysfs_path, NULL)) {
+                return FALSE;
         }
 
         /* Get our basic information */
-        subsystem = udev_device_get_subsystem(device);
-        properties = udev_device_get_properties_list_entry(device);
+        subsystem = ldm_device_record_get_subsystem(record);
+        if (!subsystem) {
+                return FALSE;
+        }
 
-        parent = ldm_manager_get_device_parent(self, subsystem, device);
+        parent = ldm_manager_get_device_parent(self, subsystem, record);
 
         /* Don't push the child interface again to the parent, i.e. monitor vs enumerate */
-        if (parent && g_hash_table_contains(parent->tree.kids, sysfs_path)) {
-                return;
+        if (parent && ldm_device_get_child_by_path(parent, sysfs_path)) {
+                return FALSE;
         }
 
         /* Build the actual device now */
-        ldm_device = ldm_device_new_from_udev(parent, device, properties);
+        ldm_device = ldm_device_new_from_record(parent, record);
+        if (self->enumerating) {
+                g_hash_table_insert(self->enumerating, ldm_device->os.sysfs_path, ldm_device);
+        }
 
         if (parent) {
+                LdmDevice *root = parent;
+
+                /* Parent providers may now match via the new child */
+                ldm_manager_invalidate_providers(self, parent);
                 ldm_device_add_child(parent, ldm_device);
-                return;
+
+                /* The child may well bring a new type to its root */
+                while (root->tree.parent) {
+                        root = root->tree.parent;
+                }
+                ldm_manager_bucket_device(self, root, ldm_device->os.devtype);
+                ldm_manager_touch_table(self, root);
+                return TRUE;
         }
 
-        g_ptr_array_add(self->devices, g_object_ref_sink(ldm_device));
+        ldm_manager_add_root(self, g_object_ref_sink(ldm_device));
+        ldm_manager_index_device(self, ldm_device);
 
         /*  Emit signal for the new device. */
         if (!emit_signal) {
-                return;
+                return TRUE;
         }
         /* Don't emit signal for USB here */
         if (g_str_equal(subsystem, "usb")) {
-                return;
+                return TRUE;
         }
         g_signal_emit(self, obj_signals[SIGNAL_DEVICE_ADDED], 0, ldm_device);
+        return TRUE;
 }
 
 /**
@@ -691,6 +1978,192 @@ LdmManager *ldm_manager_new(LdmManagerFlags flags)
         return g_object_new(LDM_TYPE_MANAGER, "flags", flags, NULL);
 }
 
+/**
+ * ldm_manager_new_full:
+ * @flags: Control behaviour of the new manager.
+ * @subsystems: (nullable) (array zero-terminated=1): udev subsystems to enumerate
+ * @monitor_subsystems: (nullable) (array zero-terminated=1): udev subsystems to monitor
+ *
+ * Construct a new LdmManager that only enumerates, and monitors, the given
+ * subsystems. Passing NULL for either retains the defaults for @flags, so
+ * consumers need only pay for the devices they actually use.
+ *
+ * C example:
+ *
+ * |[<!-- language="C" -->
+ *      const gchar *wireless[] = { "pci", "usb", "ieee80211", NULL };
+ *      LdmManager *manager = ldm_manager_new_full(LDM_MANAGER_FLAGS_NONE, wireless, wireless);
+ * ]|
+ *
+ * Returns: (transfer full): A newly created #LdmManager
+ */
+LdmManager *ldm_manager_new_full(LdmManagerFlags flags, const gchar *const *subsystems,
+                                 const gchar *const *monitor_subsystems)
+{
+        return g_object_new(LDM_TYPE_MANAGER,
+                            "flags",
+                            flags,
+                            "subsystems",
+                            subsystems,
+                            "monitor-subsystems",
+                            monitor_subsystems,
+                            NULL);
+}
+
+/**
+ * ldm_manager_new_async:
+ * @flags: Control behaviour of the new manager.
+ * @cancellable: (nullable): A #GCancellable, or NULL
+ * @callback: (scope async): Callback to invoke once the manager is ready
+ * @user_data: (closure): User data for @callback
+ *
+ * Construct a new LdmManager, as #ldm_manager_new does, but without
+ * blocking. The devices are enumerated on a worker thread, and @callback
+ * is then invoked in the thread default context of the caller, where
+ * #ldm_manager_new_finish should be used to obtain the manager. Hotplug
+ * events occurring in the meantime are not lost, and are processed as
+ * soon as the manager is ready.
+ */
+void ldm_manager_new_async(LdmManagerFlags flags, GCancellable *cancellable,
+                           GAsyncReadyCallback callback, gpointer user_data)
+{
+        g_async_initable_new_async(LDM_TYPE_MANAGER,
+                                   G_PRIORITY_DEFAULT,
+                                   cancellable,
+                                   callback,
+                                   user_data,
+                                   "flags",
+                                   flags,
+                                   "deferred-init",
+                                   TRUE,
+                                   NULL);
+}
+
+/**
+ * ldm_manager_new_finish:
+ * @result: The #GAsyncResult passed to the callback of #ldm_manager_new_async
+ * @error: Return location for a #GError, or NULL
+ *
+ * Complete the construction started with #ldm_manager_new_async
+ *
+ * Returns: (transfer full) (nullable) (constructor): The new #LdmManager, or NULL on error
+ */
+LdmManager *ldm_manager_new_finish(GAsyncResult *result, GError **error)
+{
+        g_autoptr(GObject) source = NULL;
+        GObject *ret = NULL;
+
+        g_return_val_if_fail(G_IS_ASYNC_RESULT(result), NULL);
+
+        source = g_async_result_get_source_object(result);
+        ret = g_async_initable_new_finish(G_ASYNC_INITABLE(source), result, error);
+
+        return ret ? LDM_MANAGER(ret) : NULL;
+}
+
+/**
+ * ldm_manager_new_from_source:
+ * @source: Where the devices come from
+ * @path: (nullable): File to read the devices from, for an offline @source
+ * @flags: Control behaviour of the new manager.
+ * @error: Return location for a #GError, or NULL
+ *
+ * Construct a new LdmManager with the devices from @source, rather than the
+ * running system. Any enumeration profile is applied just as it would be
+ * to udev, so #LDM_MANAGER_FLAGS_GPU_QUICK still restricts a recording to
+ * its display controllers. A snapshot is restored as it was stored, and
+ * unlike #LDM_MANAGER_FLAGS_SNAPSHOT, is used whatever hardware the stored
+ * key describes.
+ *
+ * C example:
+ *
+ * |[<!-- language="C" -->
+ *      g_autoptr(GError) error = NULL;
+ *      LdmManager *manager = ldm_manager_new_from_source(LDM_DEVICE_SOURCE_UMOCKDEV,
+ *                                                        "laptop.umockdev",
+ *                                                        LDM_MANAGER_FLAGS_NONE,
+ *                                                        &error);
+ * ]|
+ *
+ * Returns: (transfer full) (nullable): A newly created #LdmManager, or NULL on error
+ */
+LdmManager *ldm_manager_new_from_source(LdmDeviceSource source, const gchar *path,
+                                        LdmManagerFlags flags, GError **error)
+{
+        g_autoptr(LdmManager) self = NULL;
+
+        g_return_val_if_fail(source == LDM_DEVICE_SOURCE_UDEV || path != NULL, NULL);
+
+        self = g_object_new(LDM_TYPE_MANAGER,
+                            "flags",
+                            flags,
+                            "source",
+                            source,
+                            "source-file",
+                            path,
+                            NULL);
+        if (self->source.error) {
+                g_propagate_error(error, g_steal_pointer(&self->source.error));
+                return NULL;
+        }
+
+        return g_steal_pointer(&self);
+}
+
+/**
+ * ldm_manager_rescan:
+ *
+ * Resynchronise the manager with the system, such as after resuming from
+ * suspend, without constructing a new manager. The devices are enumerated
+ * again and compared with those already known by their sysfs path, so that
+ * unchanged devices retain both their objects and any cached providers.
+ *
+ * The #LdmManager::device-added and #LdmManager::device-removed signals are
+ * emitted only for devices which really changed, followed by a single
+ * #LdmManager::devices-changed if there were any. Any hotplug events still
+ * pending are applied first.
+ *
+ * Note that hotplugged devices from a subsystem outside of
+ * #LdmManager:subsystems will not survive a rescan.
+ *
+ * While an asynchronous operation is reading the devices, the rescan is
+ * deferred until it completes, and FALSE is returned. Managers built from
+ * an offline #LdmManager:source have nothing to resynchronise with, so
+ * always return FALSE.
+ *
+ * Returns: TRUE if any device was added or removed
+ */
+gboolean ldm_manager_rescan(LdmManager *self)
+{
+        gboolean changed = FALSE;
+
+        g_return_val_if_fail(self != NULL, FALSE);
+
+        if (self->source.type != LDM_DEVICE_SOURCE_UDEV) {
+                return FALSE;
+        }
+
+        if (self->monitor.hold > 0) {
+                self->monitor.resync = TRUE;
+                return FALSE;
+        }
+
+        if (self->monitor.flush_source) {
+                g_source_destroy(self->monitor.flush_source);
+                g_clear_pointer(&self->monitor.flush_source, g_source_unref);
+        }
+        ldm_manager_flush_events(self);
+
+        changed = ldm_manager_resync(self);
+        ldm_manager_publish_table(self);
+        if (!changed) {
+                return FALSE;
+        }
+
+        g_signal_emit(self, obj_signals[SIGNAL_DEVICES_CHANGED], 0);
+        return TRUE;
+}
+
 /**
  * ldm_manager_get_devices:
  * @class_mask: Bitwise mask of LdmDeviceType
@@ -708,26 +2181,184 @@ LdmManager *ldm_manager_new(LdmManagerFlags flags)
  * Returns: (element-type Ldm.Device) (transfer container): a list of all currently known devices
  */
 GPtrArray *ldm_manager_get_devices(LdmManager *self, LdmDeviceType class_mask)
+{
+        LdmDeviceQuery query = { .types = class_mask };
+
+        g_return_val_if_fail(self != NULL, NULL);
+
+        return ldm_manager_query(self, &query);
+}
+
+/**
+ * ldm_manager_query_match:
+ *
+ * Test the device against the query, leaving the provider check for last
+ * as it may have to run the plugins. Only the type looks into the children,
+ * the remaining criteria are those of the root device alone.
+ */
+static gboolean ldm_manager_query_match(LdmManager *self, LdmDevice *device,
+                                        const LdmDeviceQuery *query)
+{
+        if (!ldm_device_has_type(device, query->types)) {
+                return FALSE;
+        }
+        if (query->vendor_id != 0 && device->id.vendor_id != query->vendor_id) {
+                return FALSE;
+        }
+        if (query->product_id != 0 && device->id.product_id != query->product_id) {
+                return FALSE;
+        }
+        if (query->subsystem && g_strcmp0(device->os.subsystem, query->subsystem) != 0) {
+                return FALSE;
+        }
+        if (query->attributes != LDM_DEVICE_ATTRIBUTE_ANY &&
+            !ldm_device_has_attribute(device, query->attributes)) {
+                return FALSE;
+        }
+        if (query->has_providers && !ldm_manager_has_providers(self, device)) {
+                return FALSE;
+        }
+
+        return TRUE;
+}
+
+/**
+ * ldm_manager_foreach:
+ * @query: Criteria the devices must match
+ * @func: (scope call): Function to call for each matching device
+ * @user_data: User data to pass to @func
+ *
+ * Call @func for every root device matching @query, in the same order as
+ * #ldm_manager_get_devices. Nothing is allocated, and each device is only
+ * borrowed for the duration of the call, so @func must take a reference
+ * of its own to keep it. The manager must not be modified from @func.
+ *
+ * C example:
+ *
+ * |[<!-- language="C" -->
+ *      static gboolean print_device(LdmDevice *device, gpointer user_data)
+ *      {
+ *              g_message("NVIDIA GPU: %s", ldm_device_get_name(device));
+ *              return TRUE;
+ *      }
+ *
+ *      LdmDeviceQuery query = {
+ *              .types = LDM_DEVICE_TYPE_GPU,
+ *              .vendor_id = LDM_PCI_VENDOR_ID_NVIDIA,
+ *      };
+ *      ldm_manager_foreach(manager, &query, print_device, NULL);
+ * ]|
+ *
+ * Returns: FALSE if @func stopped the iteration, otherwise TRUE
+ */
+gboolean ldm_manager_foreach(LdmManager *self, const LdmDeviceQuery *query, LdmDeviceFunc func,
+                             gpointer user_data)
+{
+        GPtrArray *candidates = NULL;
+
+        g_return_val_if_fail(self != NULL, FALSE);
+        g_return_val_if_fail(query != NULL, FALSE);
+        g_return_val_if_fail(func != NULL, FALSE);
+
+        candidates = ldm_manager_get_candidates(self, query->types);
+        for (guint i = 0; i < candidates->len; i++) {
+                LdmDevice *node = candidates->pdata[i];
+
+                if (!ldm_manager_query_match(self, node, query)) {
+                        continue;
+                }
+                if (!func(node, user_data)) {
+                        return FALSE;
+                }
+        }
+
+        return TRUE;
+}
+
+/**
+ * ldm_manager_query:
+ * @query: Criteria the devices must match
+ *
+ * Return every root device matching @query, in the same order as
+ * #ldm_manager_get_devices. Combining the criteria here saves filtering
+ * the result of #ldm_manager_get_devices once more by hand.
+ *
+ * Returns: (element-type Ldm.Device) (transfer container): The matching devices
+ */
+GPtrArray *ldm_manager_query(LdmManager *self, const LdmDeviceQuery *query)
 {
         GPtrArray *ret = NULL;
+        GPtrArray *candidates = NULL;
 
         g_return_val_if_fail(self != NULL, NULL);
+        g_return_val_if_fail(query != NULL, NULL);
 
         ret = g_ptr_array_new_with_free_func(g_object_unref);
 
-        for (guint i = 0; i < self->devices->len; i++) {
-                LdmDevice *node = NULL;
+        candidates = ldm_manager_get_candidates(self, query->types);
+        for (guint i = 0; i < candidates->len; i++) {
+                LdmDevice *node = candidates->pdata[i];
 
-                node = self->devices->pdata[i];
-                if (!ldm_device_has_type(node, class_mask)) {
-                        continue;
+                if (ldm_manager_query_match(self, node, query)) {
+                        g_ptr_array_add(ret, g_object_ref(node));
                 }
-                g_ptr_array_add(ret, g_object_ref(node));
         }
 
         return ret;
 }
 
+/**
+ * ldm_manager_describe_devices:
+ * @class_mask: Bitwise mask of LdmDeviceType
+ *
+ * Describe every device #ldm_manager_get_devices would return for
+ * @class_mask, in the same order, as a single #LDM_MANAGER_DEVICES_FORMAT
+ * variant. Bindings such as Python cross into the library once for the
+ * whole table, rather than once per device and again for each field.
+ *
+ * Python example:
+ *
+ * |[<!-- language="Python" -->
+ *      for record in manager.describe_devices(Ldm.DeviceType.USB).unpack():
+ *          print("USB Device: {} {}".format(record[2], record[1]))
+ * ]|
+ *
+ * Returns: (transfer full): The device records
+ */
+GVariant *ldm_manager_describe_devices(LdmManager *self, LdmDeviceType class_mask)
+{
+        g_autoptr(GPtrArray) devices = NULL;
+        GVariantBuilder builder = { 0 };
+
+        g_return_val_if_fail(self != NULL, NULL);
+
+        devices = ldm_manager_get_devices(self, class_mask);
+
+        g_variant_builder_init(&builder, G_VARIANT_TYPE(LDM_MANAGER_DEVICES_FORMAT));
+        for (guint i = 0; i < devices->len; i++) {
+                LdmDevice *device = devices->pdata[i];
+                const gchar *subsystem = ldm_device_get_subsystem(device);
+                /* hwdb strings aren't guaranteed UTF-8, which GVariant demands */
+                g_autofree gchar *name = ldm_utf8_dup(ldm_device_get_name(device));
+                g_autofree gchar *vendor = ldm_utf8_dup(ldm_device_get_vendor(device));
+                g_autofree gchar *modalias = ldm_utf8_dup(ldm_device_get_modalias(device));
+
+                g_variant_builder_add(&builder,
+                                      "(sssssuuuu)",
+                                      ldm_device_get_path(device),
+                                      name,
+                                      vendor,
+                                      modalias,
+                                      subsystem ? subsystem : "",
+                                      (guint32)ldm_device_get_device_type(device),
+                                      (guint32)ldm_device_get_vendor_id(device),
+                                      (guint32)ldm_device_get_product_id(device),
+                                      (guint32)ldm_device_get_attributes(device));
+        }
+
+        return g_variant_ref_sink(g_variant_builder_end(&builder));
+}
+
 /*
  * Editor modelines  -  https://www.wireshark.org/tools/modelines.html
  *
@@ -11,6 +11,7 @@
 
 #pragma once
 
+#include <gio/gio.h>
 #include <glib-object.h>
 
 #include <device.h>
@@ -26,6 +27,9 @@ typedef struct _LdmManagerClass LdmManagerClass;
  * @LDM_MANAGER_FLAGS_NONE: No special behaviour required
  * @LDM_MANAGER_FLAGS_NO_MONITOR: Disable hotplug events
  * @LDM_MANAGER_FLAGS_GPU_QUICK: Only allow GPU devices for fast initialisation
+ * @LDM_MANAGER_FLAGS_THREADED_MATCHING: Evaluate plugins concurrently on a worker pool
+ * @LDM_MANAGER_FLAGS_SNAPSHOT: Restore devices from a snapshot if the hardware is unchanged
+ * @LDM_MANAGER_FLAGS_MONITOR_THREAD: Service hotplug events on a dedicated thread
  *
  * Override the behaviour of the new LdmManager to allow disabling
  * of hotplug events, etc.
@@ -34,8 +38,108 @@ typedef enum {
         LDM_MANAGER_FLAGS_NONE = 0,
         LDM_MANAGER_FLAGS_NO_MONITOR = 1 << 0,
         LDM_MANAGER_FLAGS_GPU_QUICK = 1 << 1,
+        LDM_MANAGER_FLAGS_THREADED_MATCHING = 1 << 2,
+        LDM_MANAGER_FLAGS_SNAPSHOT = 1 << 3,
+        LDM_MANAGER_FLAGS_MONITOR_THREAD = 1 << 4,
 } LdmManagerFlags;
 
+/**
+ * LdmDeviceSource:
+ * @LDM_DEVICE_SOURCE_UDEV: Enumerate the live system through libudev
+ * @LDM_DEVICE_SOURCE_SNAPSHOT: Restore a file written by #ldm_manager_export_snapshot
+ * @LDM_DEVICE_SOURCE_UMOCKDEV: Replay a recording made by `umockdev-record`
+ *
+ * Where the devices of an #LdmManager come from. Anything other than
+ * #LDM_DEVICE_SOURCE_UDEV is an offline source, read once from a file at
+ * construction, and never monitored for hotplug events.
+ */
+typedef enum {
+        LDM_DEVICE_SOURCE_UDEV = 0,
+        LDM_DEVICE_SOURCE_SNAPSHOT,
+        LDM_DEVICE_SOURCE_UMOCKDEV,
+} LdmDeviceSource;
+
+/**
+ * LdmManagerStats:
+ * @enumerate_time: Nanoseconds spent enumerating devices, or restoring a snapshot
+ * @load_time: Nanoseconds spent loading modalias plugins
+ * @match_time: Nanoseconds spent resolving providers
+ * @apply_time: Nanoseconds spent applying configuration, such as X.Org files
+ * @devices_constructed: Number of #LdmDevice objects constructed
+ * @fnmatch_calls: Number of modalias patterns checked with fnmatch
+ * @plugins_evaluated: Number of calls to #ldm_plugin_get_provider
+ * @bytes_read: Number of bytes of modalias files read
+ *
+ * Totals accumulated by the library for the current process, as returned
+ * by #ldm_manager_get_stats.
+ */
+typedef struct {
+        guint64 enumerate_time;
+        guint64 load_time;
+        guint64 match_time;
+        guint64 apply_time;
+        guint64 devices_constructed;
+        guint64 fnmatch_calls;
+        guint64 plugins_evaluated;
+        guint64 bytes_read;
+} LdmManagerStats;
+
+/**
+ * LdmDeviceQuery:
+ * @types: Bitwise mask of #LdmDeviceType, every one of which the device must have
+ * @attributes: Bitwise mask of #LdmDeviceAttribute, every one of which the device must have
+ * @vendor_id: Vendor ID the device must have, or 0 for any
+ * @product_id: Product ID the device must have, or 0 for any
+ * @subsystem: (nullable): Kernel subsystem the device must belong to, i.e. "pci", or NULL for any
+ * @has_providers: Only match devices with at least one #LdmProvider
+ *
+ * Criteria for #ldm_manager_query and #ldm_manager_foreach, all of which
+ * must hold for a root device to match. A zeroed query matches every device.
+ *
+ * As with #ldm_manager_get_devices, @types is satisfied by the device or by
+ * any one of its children, so that a USB device is found through the type
+ * of its interfaces. Every other criterion is tested against the root device
+ * itself, so @types may be met by a child without the child meeting the rest.
+ */
+typedef struct {
+        LdmDeviceType types;
+        LdmDeviceAttribute attributes;
+        gint vendor_id;
+        gint product_id;
+        const gchar *subsystem;
+        gboolean has_providers;
+
+        /*< private >*/
+        gpointer padding[4];
+} LdmDeviceQuery;
+
+/**
+ * LdmDeviceFunc:
+ * @device: (transfer none): A device matching the query
+ * @user_data: User data passed to #ldm_manager_foreach
+ *
+ * Returns: TRUE to continue, or FALSE to stop iterating
+ */
+typedef gboolean (*LdmDeviceFunc)(LdmDevice *device, gpointer user_data);
+
+/**
+ * LDM_MANAGER_DEVICES_FORMAT:
+ *
+ * #GVariant type returned by #ldm_manager_describe_devices, with a record
+ * per device of its path, name, vendor, modalias, subsystem, #LdmDeviceType,
+ * vendor ID, product ID and #LdmDeviceAttribute. Missing strings are empty.
+ */
+#define LDM_MANAGER_DEVICES_FORMAT "a(sssssuuuu)"
+
+/**
+ * LDM_MANAGER_PROVIDERS_FORMAT:
+ *
+ * #GVariant type returned by #ldm_manager_describe_providers, with a record
+ * per provider of the device path, plugin name, package and kernel driver,
+ * the latter being empty when unknown to the plugin.
+ */
+#define LDM_MANAGER_PROVIDERS_FORMAT "a(ssss)"
+
 #define LDM_TYPE_MANAGER ldm_manager_get_type()
 #define LDM_MANAGER(o) (G_TYPE_CHECK_INSTANCE_CAST((o), LDM_TYPE_MANAGER, LdmManager))
 #define LDM_IS_MANAGER(o) (G_TYPE_CHECK_INSTANCE_TYPE((o), LDM_TYPE_MANAGER))
@@ -47,15 +151,56 @@ GType ldm_manager_get_type(void);
 
 /* Main API */
 LdmManager *ldm_manager_new(LdmManagerFlags flags);
+LdmManager *ldm_manager_new_full(LdmManagerFlags flags, const gchar *const *subsystems,
+                                 const gchar *const *monitor_subsystems);
+void ldm_manager_new_async(LdmManagerFlags flags, GCancellable *cancellable,
+                           GAsyncReadyCallback callback, gpointer user_data);
+LdmManager *ldm_manager_new_finish(GAsyncResult *result, GError **error);
+LdmManager *ldm_manager_new_from_source(LdmDeviceSource source, const gchar *path,
+                                        LdmManagerFlags flags, GError **error);
 GPtrArray *ldm_manager_get_devices(LdmManager *manager, LdmDeviceType class_mask);
+GPtrArray *ldm_manager_query(LdmManager *manager, const LdmDeviceQuery *query);
+gboolean ldm_manager_foreach(LdmManager *manager, const LdmDeviceQuery *query, LdmDeviceFunc func,
+                             gpointer user_data);
+GVariant *ldm_manager_describe_devices(LdmManager *manager, LdmDeviceType class_mask);
+gboolean ldm_manager_rescan(LdmManager *manager);
+gboolean ldm_manager_export_snapshot(LdmManager *manager, const gchar *path, GError **error);
 GPtrArray *ldm_manager_get_providers(LdmManager *manager, LdmDevice *device);
+void ldm_manager_get_providers_async(LdmManager *manager, LdmDevice *device,
+                                     GCancellable *cancellable, GAsyncReadyCallback callback,
+                                     gpointer user_data);
+GPtrArray *ldm_manager_get_providers_finish(LdmManager *manager, GAsyncResult *result,
+                                            GError **error);
+LdmProvider *ldm_manager_get_best_provider(LdmManager *manager, LdmDevice *device);
+guint ldm_manager_get_generation(LdmManager *manager);
+gboolean ldm_manager_get_stats(LdmManager *manager, LdmManagerStats *stats);
+GHashTable *ldm_manager_get_all_providers(LdmManager *manager, LdmDeviceType class_mask);
+GArray *ldm_manager_get_provider_infos(LdmManager *manager, LdmDeviceType class_mask);
+GVariant *ldm_manager_describe_providers(LdmManager *manager, LdmDeviceType class_mask);
+GPtrArray *ldm_manager_get_devices_for_package(LdmManager *manager, const gchar *package);
+GPtrArray *ldm_manager_get_devices_for_driver(LdmManager *manager, const gchar *driver);
 
 /* Plugin API */
 gboolean ldm_manager_add_modalias_plugin_for_path(LdmManager *manager, const gchar *path);
 gboolean ldm_manager_add_modalias_plugins_for_directory(LdmManager *manager,
                                                         const gchar *directory);
 gboolean ldm_manager_add_system_modalias_plugins(LdmManager *manager);
+void ldm_manager_add_modalias_plugins_for_directory_async(LdmManager *manager,
+                                                          const gchar *directory,
+                                                          GCancellable *cancellable,
+                                                          GAsyncReadyCallback callback,
+                                                          gpointer user_data);
+gboolean ldm_manager_add_modalias_plugins_for_directory_finish(LdmManager *manager,
+                                                               GAsyncResult *result,
+                                                               GError **error);
+void ldm_manager_add_system_modalias_plugins_async(LdmManager *manager,
+                                                   GCancellable *cancellable,
+                                                   GAsyncReadyCallback callback,
+                                                   gpointer user_data);
+gboolean ldm_manager_add_system_modalias_plugins_finish(LdmManager *manager,
+                                                        GAsyncResult *result, GError **error);
 void ldm_manager_add_plugin(LdmManager *manager, LdmPlugin *plugin);
+void ldm_manager_share_plugins(LdmManager *manager, LdmManager *source);
 
 G_DEFINE_AUTOPTR_CLEANUP_FUNC(LdmManager, g_object_unref)
 
@@ -0,0 +1,91 @@
+/*
+ * This file is part of linux-driver-management.
+ *
+ * Copyright © 2016-2018 Ikey Doherty
+ *
+ * linux-driver-management is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+#pragma once
+
+#include <glib.h>
+#include <string.h>
+
+#include "modalias-index.h"
+
+G_BEGIN_DECLS
+
+/*
+ * Precompiled modalias database, as emitted by `mkmodaliases --binary`.
+ *
+ * The file is designed to be mapped and used in place, with no parsing
+ * or copying. Everything is stored in host byte order, and is guarded by
+ * the byte order marker in the header. The layout is as follows:
+ *
+ *      LdmModaliasDbHeader
+ *      LdmModaliasDbRule      [n_rules]
+ *      LdmModaliasIndexNode   [n_nodes]
+ *      LdmModaliasIndexEntry  [n_entries]
+ *      gchar                  [strings_size]
+ *
+ * Every section is a multiple of 4 bytes in size, so all tables remain
+ * naturally aligned. Rules refer to NUL terminated strings by their
+ * offset in the string table, and each unique string is stored once.
+ * The index entries refer to rules by their position in the rule table.
+ */
+
+#define LDM_MODALIAS_DB_MAGIC "LDMALIAS"
+#define LDM_MODALIAS_DB_VERSION 1
+#define LDM_MODALIAS_DB_BYTE_ORDER 0x01020304
+
+typedef struct {
+        gchar magic[8];
+        guint32 version;
+        guint32 byte_order;
+        guint32 n_rules;
+        guint32 n_nodes;
+        guint32 n_entries;
+        guint32 strings_size;
+} LdmModaliasDbHeader;
+
+typedef struct {
+        guint32 match;
+        guint32 driver;
+        guint32 package;
+} LdmModaliasDbRule;
+
+G_STATIC_ASSERT(sizeof(LdmModaliasDbHeader) == 32);
+G_STATIC_ASSERT(sizeof(LdmModaliasDbRule) == 12);
+G_STATIC_ASSERT(sizeof(LdmModaliasIndexNode) == 16);
+G_STATIC_ASSERT(sizeof(LdmModaliasIndexEntry) == 8);
+
+/**
+ * ldm_modalias_db_is_db:
+ * @data: Start of the file contents
+ * @len: Length of the file contents
+ *
+ * Returns: TRUE if the data starts with the database magic
+ */
+static inline gboolean ldm_modalias_db_is_db(const gchar *data, gsize len)
+{
+        return len >= sizeof(LdmModaliasDbHeader) &&
+               memcmp(data, LDM_MODALIAS_DB_MAGIC, sizeof(((LdmModaliasDbHeader *)0)->magic)) == 0;
+}
+
+G_END_DECLS
+
+/*
+ * Editor modelines  -  https://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: nil
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 expandtab:
+ * :indentSize=8:tabSize=8:noTabs=true:
+ */
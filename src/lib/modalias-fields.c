@@ -0,0 +1,203 @@
+/*
+ * This file is part of linux-driver-management.
+ *
+ * Copyright © 2016-2018 Ikey Doherty
+ *
+ * linux-driver-management is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+#define _GNU_SOURCE
+
+#include <string.h>
+
+#include "modalias-fields.h"
+
+/* Room for the bus, and every tag with its separator */
+#define LDM_MODALIAS_MAX_SIGNATURE 64
+
+static inline gboolean ldm_modalias_fields_is_tag(gchar c)
+{
+        return c >= 'a' && c <= 'z';
+}
+
+static inline gboolean ldm_modalias_fields_is_hex(gchar c)
+{
+        return (c >= '0' && c <= '9') || (c >= 'A' && c <= 'F');
+}
+
+/**
+ * ldm_modalias_fields_is_ambiguous:
+ *
+ * A wildcard may only match the value of its own field. Were the tags on
+ * either side of it to appear together within some tag, fnmatch could let
+ * the wildcard match nothing and place both tags within that one, leaving
+ * the remaining fields misaligned with those of the device.
+ */
+static gboolean ldm_modalias_fields_is_ambiguous(const gchar *tags[], const guint tag_lens[],
+                                                 const gboolean wildcard[], guint n_fields)
+{
+        for (guint i = 0; i + 1 < n_fields; i++) {
+                gchar pair[LDM_MODALIAS_MAX_SIGNATURE] = { 0 };
+                gsize len = tag_lens[i] + tag_lens[i + 1];
+
+                if (!wildcard[i]) {
+                        continue;
+                }
+
+                memcpy(pair, tags[i], tag_lens[i]);
+                memcpy(pair + tag_lens[i], tags[i + 1], tag_lens[i + 1]);
+
+                for (guint j = 0; j < n_fields; j++) {
+                        if (tag_lens[j] >= len && memmem(tags[j], tag_lens[j], pair, len)) {
+                                return TRUE;
+                        }
+                }
+        }
+
+        return FALSE;
+}
+
+/**
+ * ldm_modalias_fields_split:
+ * @allow_wildcards: Whether values may be a lone `*`
+ *
+ * Split the input into its signature and values, failing on anything that
+ * doesn't follow the bus grammar exactly.
+ */
+static gboolean ldm_modalias_fields_split(const gchar *input, gboolean allow_wildcards,
+                                          LdmModaliasFields *out)
+{
+        gchar signature[LDM_MODALIAS_MAX_SIGNATURE] = { 0 };
+        const gchar *tags[LDM_MODALIAS_MAX_FIELDS] = { NULL };
+        guint tag_lens[LDM_MODALIAS_MAX_FIELDS] = { 0 };
+        gboolean wildcard[LDM_MODALIAS_MAX_FIELDS] = { FALSE };
+        gsize sig_len = 0;
+        const gchar *c = input;
+        guint n_fields = 0;
+
+        memset(out, 0, sizeof(*out));
+
+        /* Bus name, i.e. "pci:" */
+        while (ldm_modalias_fields_is_tag(*c) || g_ascii_isdigit(*c)) {
+                ++c;
+        }
+        if (c == input || *c != ':') {
+                return FALSE;
+        }
+        ++c;
+        sig_len = (gsize)(c - input);
+        if (sig_len >= sizeof(signature)) {
+                return FALSE;
+        }
+        memcpy(signature, input, sig_len);
+
+        while (*c) {
+                const gchar *tag = c;
+                guint32 value = 0;
+                guint n_digits = 0;
+
+                if (n_fields >= LDM_MODALIAS_MAX_FIELDS) {
+                        return FALSE;
+                }
+
+                while (ldm_modalias_fields_is_tag(*c)) {
+                        ++c;
+                }
+                if (c == tag || sig_len + (gsize)(c - tag) + 1 >= sizeof(signature)) {
+                        return FALSE;
+                }
+                tags[n_fields] = tag;
+                tag_lens[n_fields] = (guint)(c - tag);
+                memcpy(signature + sig_len, tag, tag_lens[n_fields]);
+                sig_len += tag_lens[n_fields];
+                signature[sig_len++] = ',';
+
+                if (allow_wildcards && *c == '*') {
+                        /* Must be followed by another tag, or the end */
+                        ++c;
+                        if (*c && !ldm_modalias_fields_is_tag(*c)) {
+                                return FALSE;
+                        }
+                        wildcard[n_fields++] = TRUE;
+                        continue;
+                }
+
+                for (; ldm_modalias_fields_is_hex(*c); c++, n_digits++) {
+                        value = (value << 4) | (guint32)g_ascii_xdigit_value(*c);
+                }
+                if (n_digits < 1 || n_digits > 8) {
+                        return FALSE;
+                }
+                if (*c && !ldm_modalias_fields_is_tag(*c)) {
+                        return FALSE;
+                }
+
+                out->value[n_fields] = value;
+                out->mask[n_fields] = G_MAXUINT32;
+                ++n_fields;
+        }
+
+        if (ldm_modalias_fields_is_ambiguous(tags, tag_lens, wildcard, n_fields)) {
+                return FALSE;
+        }
+
+        signature[sig_len] = '\0';
+        out->signature = g_intern_string(signature);
+        return TRUE;
+}
+
+/**
+ * ldm_modalias_fields_parse:
+ * @modalias: Device modalias
+ * @out: (out caller-allocates): Storage for the parsed fields
+ *
+ * Parse the modalias of a device into its numeric fields. Modaliases that
+ * don't follow the bus grammar, such as DMI, are left without a signature
+ * and are never rejected.
+ *
+ * Returns: TRUE if the modalias was regular
+ */
+gboolean ldm_modalias_fields_parse(const gchar *modalias, LdmModaliasFields *out)
+{
+        if (ldm_modalias_fields_split(modalias, FALSE, out)) {
+                return TRUE;
+        }
+        memset(out, 0, sizeof(*out));
+        return FALSE;
+}
+
+/**
+ * ldm_modalias_fields_compile:
+ * @pattern: fnmatch style pattern for a modalias
+ * @out: (out caller-allocates): Storage for the compiled fields
+ *
+ * Compile the literal values of the pattern into value and mask pairs.
+ * Irregular patterns are left without a signature, and must always be
+ * checked with fnmatch.
+ *
+ * Returns: TRUE if the pattern was regular
+ */
+gboolean ldm_modalias_fields_compile(const gchar *pattern, LdmModaliasFields *out)
+{
+        if (ldm_modalias_fields_split(pattern, TRUE, out)) {
+                return TRUE;
+        }
+        memset(out, 0, sizeof(*out));
+        return FALSE;
+}
+
+/*
+ * Editor modelines  -  https://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: nil
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 expandtab:
+ * :indentSize=8:tabSize=8:noTabs=true:
+ */
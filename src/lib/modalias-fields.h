@@ -0,0 +1,87 @@
+/*
+ * This file is part of linux-driver-management.
+ *
+ * Copyright © 2016-2018 Ikey Doherty
+ *
+ * linux-driver-management is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+#pragma once
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/*
+ * LdmModaliasFields
+ *
+ * Numeric view of a modalias, or of an fnmatch pattern for one, used to
+ * reject rules before falling back to fnmatch. Bus modaliases follow a
+ * fixed grammar of a bus name followed by lowercase tags, each tagging an
+ * uppercase hexadecimal value:
+ *
+ *      pci:v000010DEd00001C60sv00001558sd000065A4bc03sc00i00
+ *
+ * The signature is the interned bus and tag sequence. A pattern is only
+ * regular, and thus usable, if every value is either fully literal or a
+ * lone `*`. Tags are lowercase while values are uppercase, so with an
+ * identical signature each tag of the pattern can only land on the same
+ * tag of the device, and a differing literal value means fnmatch would
+ * fail too. Patterns where a wildcard could be skipped entirely to join
+ * two tags together are treated as irregular.
+ *
+ * Wildcard values have a mask of 0. Unused trailing fields have both a
+ * value and a mask of 0, so that comparisons are always over the full,
+ * fixed size arrays, which the compiler can vectorise.
+ */
+#define LDM_MODALIAS_MAX_FIELDS 10
+
+typedef struct {
+        const gchar *signature; /* Interned, or NULL when irregular */
+        guint32 value[LDM_MODALIAS_MAX_FIELDS];
+        guint32 mask[LDM_MODALIAS_MAX_FIELDS];
+} LdmModaliasFields;
+
+gboolean ldm_modalias_fields_parse(const gchar *modalias, LdmModaliasFields *out);
+gboolean ldm_modalias_fields_compile(const gchar *pattern, LdmModaliasFields *out);
+
+/**
+ * ldm_modalias_fields_reject:
+ * @rule: Fields compiled from a pattern
+ * @device: Fields parsed from a device modalias
+ *
+ * Returns: TRUE if @rule definitely cannot match @device
+ */
+static inline gboolean ldm_modalias_fields_reject(const LdmModaliasFields *rule,
+                                                  const LdmModaliasFields *device)
+{
+        guint32 diff = 0;
+
+        if (!rule->signature || rule->signature != device->signature) {
+                return FALSE;
+        }
+
+        for (guint i = 0; i < LDM_MODALIAS_MAX_FIELDS; i++) {
+                diff |= (rule->value[i] ^ device->value[i]) & rule->mask[i];
+        }
+
+        return diff != 0;
+}
+
+G_END_DECLS
+
+/*
+ * Editor modelines  -  https://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: nil
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 expandtab:
+ * :indentSize=8:tabSize=8:noTabs=true:
+ */
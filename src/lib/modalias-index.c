@@ -0,0 +1,278 @@
+/*
+ * This file is part of linux-driver-management.
+ *
+ * Copyright © 2016-2018 Ikey Doherty
+ *
+ * linux-driver-management is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+#define _GNU_SOURCE
+
+#include "modalias-index.h"
+
+#define NODE(i, n) (&g_array_index((i)->node_store, LdmModaliasIndexNode, (n)))
+
+/**
+ * ldm_modalias_index_sync:
+ *
+ * Point the lookup tables back at our backing storage, which may have
+ * moved after growing.
+ */
+static inline void ldm_modalias_index_sync(LdmModaliasIndex *self)
+{
+        self->nodes = (const LdmModaliasIndexNode *)self->node_store->data;
+        self->entries = (const LdmModaliasIndexEntry *)self->entry_store->data;
+        self->n_nodes = self->node_store->len;
+        self->n_entries = self->entry_store->len;
+}
+
+/**
+ * ldm_modalias_index_new:
+ *
+ * Construct a new, empty, modalias index containing only the root node.
+ *
+ * Returns: (transfer full): A newly allocated LdmModaliasIndex
+ */
+LdmModaliasIndex *ldm_modalias_index_new(void)
+{
+        LdmModaliasIndex *ret = NULL;
+        LdmModaliasIndexNode root = { 0 };
+        LdmModaliasIndexEntry reserved = { 0 };
+
+        ret = g_new0(LdmModaliasIndex, 1);
+        ret->node_store = g_array_new(FALSE, TRUE, sizeof(LdmModaliasIndexNode));
+        ret->entry_store = g_array_new(FALSE, TRUE, sizeof(LdmModaliasIndexEntry));
+
+        g_array_append_val(ret->node_store, root);
+        g_array_append_val(ret->entry_store, reserved);
+        ldm_modalias_index_sync(ret);
+
+        return ret;
+}
+
+/**
+ * ldm_modalias_index_new_static:
+ * @nodes: Previously serialised node table
+ * @n_nodes: Number of nodes in the table
+ * @entries: Previously serialised entry table
+ * @n_entries: Number of entries in the table
+ * @n_rules: Number of rules the caller knows about
+ *
+ * Construct a read-only index directly on top of existing tables, such as
+ * those found in a mapped modalias database. The tables are not copied, and
+ * must outlive the returned index.
+ *
+ * As the tables may come from an untrusted file, they are validated first.
+ * Node children must follow their parent, while siblings and entry chains
+ * must strictly descend, guaranteeing that every walk terminates.
+ *
+ * Returns: (transfer full) (nullable): A new read-only index, or NULL if invalid
+ */
+LdmModaliasIndex *ldm_modalias_index_new_static(const LdmModaliasIndexNode *nodes,
+                                                guint32 n_nodes,
+                                                const LdmModaliasIndexEntry *entries,
+                                                guint32 n_entries, guint32 n_rules)
+{
+        LdmModaliasIndex *ret = NULL;
+
+        if (!nodes || !entries || n_nodes < 1 || n_entries < 1) {
+                return NULL;
+        }
+
+        for (guint32 i = 0; i < n_nodes; i++) {
+                const LdmModaliasIndexNode *node = &nodes[i];
+
+                if (node->child != 0 && (node->child <= i || node->child >= n_nodes)) {
+                        return NULL;
+                }
+                if (node->sibling != 0 && (i == 0 || node->sibling >= i)) {
+                        return NULL;
+                }
+                if (node->entries >= n_entries) {
+                        return NULL;
+                }
+        }
+
+        for (guint32 i = 1; i < n_entries; i++) {
+                if (entries[i].next >= i || entries[i].rule >= n_rules) {
+                        return NULL;
+                }
+        }
+
+        ret = g_new0(LdmModaliasIndex, 1);
+        ret->nodes = nodes;
+        ret->entries = entries;
+        ret->n_nodes = n_nodes;
+        ret->n_entries = n_entries;
+
+        return ret;
+}
+
+/**
+ * ldm_modalias_index_free:
+ *
+ * Free a previously allocated LdmModaliasIndex
+ */
+void ldm_modalias_index_free(LdmModaliasIndex *self)
+{
+        if (!self) {
+                return;
+        }
+        if (self->node_store) {
+                g_array_unref(self->node_store);
+        }
+        if (self->entry_store) {
+                g_array_unref(self->entry_store);
+        }
+        g_free(self);
+}
+
+/**
+ * ldm_modalias_index_is_special:
+ *
+ * Determine if the character would be interpreted by fnmatch, terminating
+ * the literal prefix of a pattern.
+ */
+static inline gboolean ldm_modalias_index_is_special(gchar c)
+{
+        return c == '*' || c == '?' || c == '[' || c == '\\';
+}
+
+/**
+ * ldm_modalias_index_child:
+ *
+ * Find the child of the @parent node with the given @key, returning 0 if
+ * no such node exists.
+ */
+static guint32 ldm_modalias_index_child(LdmModaliasIndex *self, guint32 parent, guint8 key)
+{
+        guint32 node = self->nodes[parent].child;
+
+        while (node != 0) {
+                if (self->nodes[node].key == key) {
+                        return node;
+                }
+                node = self->nodes[node].sibling;
+        }
+
+        return 0;
+}
+
+/**
+ * ldm_modalias_index_insert:
+ * @pattern: fnmatch style pattern
+ * @rule: Caller defined rule ID to be returned by lookups
+ *
+ * Insert the rule into the index, keyed on the literal prefix of the
+ * pattern. Rules sharing a prefix are chained together on the same node.
+ * Only indexes built by ldm_modalias_index_new may be modified.
+ */
+void ldm_modalias_index_insert(LdmModaliasIndex *self, const gchar *pattern, guint32 rule)
+{
+        guint32 node = 0;
+        LdmModaliasIndexEntry entry = { 0 };
+
+        g_return_if_fail(self != NULL);
+        g_return_if_fail(self->node_store != NULL);
+        g_return_if_fail(pattern != NULL);
+
+        for (const gchar *c = pattern; *c && !ldm_modalias_index_is_special(*c); c++) {
+                guint8 key = (guint8)*c;
+                guint32 child = ldm_modalias_index_child(self, node, key);
+                LdmModaliasIndexNode new_node = { 0 };
+
+                if (child != 0) {
+                        node = child;
+                        continue;
+                }
+
+                /* Prepend a new child node to the parent */
+                new_node.key = key;
+                new_node.sibling = NODE(self, node)->child;
+                child = self->node_store->len;
+                g_array_append_val(self->node_store, new_node);
+                ldm_modalias_index_sync(self);
+                NODE(self, node)->child = child;
+                node = child;
+        }
+
+        /* Chain the rule onto the terminal node */
+        entry.rule = rule;
+        entry.next = NODE(self, node)->entries;
+        NODE(self, node)->entries = self->entry_store->len;
+        g_array_append_val(self->entry_store, entry);
+        ldm_modalias_index_sync(self);
+}
+
+/**
+ * ldm_modalias_index_emit:
+ *
+ * Pass each rule chained on the node to the callback, returning TRUE if
+ * the callback requested the lookup to stop.
+ */
+static gboolean ldm_modalias_index_emit(LdmModaliasIndex *self, guint32 node,
+                                        LdmModaliasIndexFunc func, gpointer user_data)
+{
+        for (guint32 e = self->nodes[node].entries; e != 0; e = self->entries[e].next) {
+                if (func(self->entries[e].rule, user_data)) {
+                        return TRUE;
+                }
+        }
+        return FALSE;
+}
+
+/**
+ * ldm_modalias_index_lookup:
+ * @modalias: Device modalias to look up
+ * @func: Callback for each candidate rule
+ * @user_data: User data for the callback
+ *
+ * Walk the index along @modalias, and pass every rule whose literal prefix
+ * is a prefix of @modalias to @func. Candidates are only guaranteed to
+ * share their literal prefix with @modalias, so the caller must still
+ * check the full pattern.
+ *
+ * Returns: TRUE if the callback stopped the lookup
+ */
+gboolean ldm_modalias_index_lookup(LdmModaliasIndex *self, const gchar *modalias,
+                                   LdmModaliasIndexFunc func, gpointer user_data)
+{
+        guint32 node = 0;
+
+        g_return_val_if_fail(self != NULL, FALSE);
+        g_return_val_if_fail(modalias != NULL, FALSE);
+        g_return_val_if_fail(func != NULL, FALSE);
+
+        /* Rules with no literal prefix */
+        if (ldm_modalias_index_emit(self, node, func, user_data)) {
+                return TRUE;
+        }
+
+        for (const gchar *c = modalias; *c; c++) {
+                node = ldm_modalias_index_child(self, node, (guint8)*c);
+                if (node == 0) {
+                        break;
+                }
+                if (ldm_modalias_index_emit(self, node, func, user_data)) {
+                        return TRUE;
+                }
+        }
+
+        return FALSE;
+}
+
+/*
+ * Editor modelines  -  https://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: nil
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 expandtab:
+ * :indentSize=8:tabSize=8:noTabs=true:
+ */
@@ -0,0 +1,90 @@
+/*
+ * This file is part of linux-driver-management.
+ *
+ * Copyright © 2016-2018 Ikey Doherty
+ *
+ * linux-driver-management is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+#pragma once
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/*
+ * LdmModaliasIndex
+ *
+ * Private prefix trie used to accelerate modalias matching. Each pattern is
+ * inserted keyed on its literal prefix, i.e. everything up until the first
+ * fnmatch special character. A lookup walks the trie along the device
+ * modalias, yielding only those rules whose literal prefix is a prefix of
+ * the modalias. The caller is then responsible for checking the wildcard
+ * tail of the candidates.
+ *
+ * The trie is stored as flat arrays of nodes and entries addressed by
+ * index, rather than pointers, so that it may be trivially serialised.
+ * Node 0 is always the root node, and entry 0 is reserved, so that an
+ * index of 0 can be used to mean "none".
+ */
+typedef struct {
+        guint32 child;   /* First child node */
+        guint32 sibling; /* Next sibling node */
+        guint32 entries; /* First entry in the rule chain for this node */
+        guint8 key;      /* Literal byte leading into this node */
+        guint8 padding[3];
+} LdmModaliasIndexNode;
+
+typedef struct {
+        guint32 rule; /* Caller defined rule ID */
+        guint32 next; /* Next entry in the chain */
+} LdmModaliasIndexEntry;
+
+typedef struct {
+        /* Backing storage, only set when built at runtime */
+        GArray *node_store;
+        GArray *entry_store;
+
+        /* Tables used for lookups, possibly pointing into a mapped file */
+        const LdmModaliasIndexNode *nodes;
+        const LdmModaliasIndexEntry *entries;
+        guint32 n_nodes;
+        guint32 n_entries;
+} LdmModaliasIndex;
+
+/**
+ * LdmModaliasIndexFunc:
+ * @rule: Rule ID as passed to ldm_modalias_index_insert
+ * @user_data: User data passed to ldm_modalias_index_lookup
+ *
+ * Returns: TRUE to stop the lookup
+ */
+typedef gboolean (*LdmModaliasIndexFunc)(guint32 rule, gpointer user_data);
+
+LdmModaliasIndex *ldm_modalias_index_new(void);
+LdmModaliasIndex *ldm_modalias_index_new_static(const LdmModaliasIndexNode *nodes,
+                                                guint32 n_nodes,
+                                                const LdmModaliasIndexEntry *entries,
+                                                guint32 n_entries, guint32 n_rules);
+void ldm_modalias_index_free(LdmModaliasIndex *self);
+void ldm_modalias_index_insert(LdmModaliasIndex *self, const gchar *pattern, guint32 rule);
+gboolean ldm_modalias_index_lookup(LdmModaliasIndex *self, const gchar *modalias,
+                                   LdmModaliasIndexFunc func, gpointer user_data);
+
+G_END_DECLS
+
+/*
+ * Editor modelines  -  https://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: nil
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 expandtab:
+ * :indentSize=8:tabSize=8:noTabs=true:
+ */
@@ -0,0 +1,315 @@
+/*
+ * This file is part of linux-driver-management.
+ *
+ * Copyright © 2016-2018 Ikey Doherty
+ *
+ * linux-driver-management is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+#define _GNU_SOURCE
+
+#include <fnmatch.h>
+
+#include "ldm-private.h"
+#include "modalias-index.h"
+#include "modalias-merged.h"
+#include "stats.h"
+
+/**
+ * LdmModaliasMergedRule:
+ *
+ * A distinct pattern, shared by every plugin rule using it
+ */
+typedef struct LdmModaliasMergedRule {
+        const gchar *match;        /* Owned by the first plugin using it */
+        LdmModaliasFields filter;  /* Prefilter, identical for every user */
+        guint32 refs;              /* First reference in the chain */
+} LdmModaliasMergedRule;
+
+/**
+ * LdmModaliasMergedRef:
+ *
+ * A single plugin rule using a pattern
+ */
+typedef struct LdmModaliasMergedRef {
+        guint32 slot; /* Plugin using the pattern */
+        guint32 rule; /* Rule ID within that plugin */
+        const gchar *driver;
+        const gchar *package;
+        guint32 next; /* Next reference, or 0 at the end of the chain */
+} LdmModaliasMergedRef;
+
+struct LdmModaliasMerged {
+        GPtrArray *plugins;      /* Owned, by slot */
+        guint *serials;          /* Plugin serial at build time, by slot */
+        GArray *rules;           /* LdmModaliasMergedRule, by merged ID */
+        GArray *refs;            /* LdmModaliasMergedRef, with 0 reserved */
+        LdmModaliasIndex *index; /* Pattern prefix to merged ID */
+};
+
+/**
+ * LdmModaliasMergedBuild:
+ *
+ * State for adding the rules of one plugin
+ */
+typedef struct LdmModaliasMergedBuild {
+        LdmModaliasMerged *merged;
+        GHashTable *known; /* Pattern to merged ID + 1 */
+        guint32 slot;
+} LdmModaliasMergedBuild;
+
+/**
+ * ldm_modalias_merged_add_rule:
+ *
+ * Reference the pattern of a plugin rule, adding it on first use
+ */
+static void ldm_modalias_merged_add_rule(guint32 rule, const gchar *match, const gchar *driver,
+                                         const gchar *package, const LdmModaliasFields *filter,
+                                         gpointer user_data)
+{
+        LdmModaliasMergedBuild *build = user_data;
+        LdmModaliasMerged *self = build->merged;
+        LdmModaliasMergedRule *merged_rule = NULL;
+        LdmModaliasMergedRef ref = {
+                .slot = build->slot,
+                .rule = rule,
+                .driver = driver,
+                .package = package,
+                .next = 0,
+        };
+        guint32 id = 0;
+
+        id = GPOINTER_TO_UINT(g_hash_table_lookup(build->known, match));
+        if (id == 0) {
+                LdmModaliasMergedRule new_rule = {
+                        .match = match,
+                        .filter = *filter,
+                        .refs = 0,
+                };
+
+                g_array_append_val(self->rules, new_rule);
+                id = self->rules->len;
+                g_hash_table_insert(build->known, (gpointer)match, GUINT_TO_POINTER(id));
+                ldm_modalias_index_insert(self->index, match, id - 1);
+        }
+
+        /* Chain order is irrelevant, each slot keeps its own best rule */
+        merged_rule = &g_array_index(self->rules, LdmModaliasMergedRule, id - 1);
+        ref.next = merged_rule->refs;
+        g_array_append_val(self->refs, ref);
+        merged_rule->refs = self->refs->len - 1;
+}
+
+/**
+ * ldm_modalias_merged_new:
+ * @plugins: (array length=n_plugins): Modalias plugins, one per slot
+ *
+ * Build a merged index over the current rules of the plugins, which are
+ * referenced for the lifetime of the index.
+ *
+ * Returns: (transfer full): A new merged index
+ */
+LdmModaliasMerged *ldm_modalias_merged_new(LdmPlugin **plugins, guint n_plugins)
+{
+        LdmModaliasMerged *self = NULL;
+        LdmModaliasMergedRef reserved = { 0 };
+        g_autoptr(GHashTable) known = NULL;
+
+        self = g_new0(LdmModaliasMerged, 1);
+        self->plugins = g_ptr_array_new_full(n_plugins, g_object_unref);
+        self->serials = g_new0(guint, MAX(n_plugins, 1));
+        self->rules = g_array_new(FALSE, FALSE, sizeof(LdmModaliasMergedRule));
+        self->refs = g_array_new(FALSE, FALSE, sizeof(LdmModaliasMergedRef));
+        self->index = ldm_modalias_index_new();
+        g_array_append_val(self->refs, reserved);
+
+        known = g_hash_table_new(g_str_hash, g_str_equal);
+        for (guint i = 0; i < n_plugins; i++) {
+                LdmModaliasPlugin *plugin = LDM_MODALIAS_PLUGIN(plugins[i]);
+                LdmModaliasMergedBuild build = {
+                        .merged = self,
+                        .known = known,
+                        .slot = i,
+                };
+
+                g_ptr_array_add(self->plugins, g_object_ref(plugin));
+                self->serials[i] = ldm_modalias_plugin_get_serial(plugin);
+                ldm_modalias_plugin_foreach_rule(plugin, ldm_modalias_merged_add_rule, &build);
+        }
+
+        return self;
+}
+
+void ldm_modalias_merged_free(LdmModaliasMerged *self)
+{
+        if (!self) {
+                return;
+        }
+
+        g_ptr_array_unref(self->plugins);
+        g_array_unref(self->rules);
+        g_array_unref(self->refs);
+        ldm_modalias_index_free(self->index);
+        g_free(self->serials);
+        g_free(self);
+}
+
+/**
+ * ldm_modalias_merged_is_current:
+ *
+ * Rules may still be added to a plugin after the index was built, in which
+ * case the index must be rebuilt before it is used again.
+ *
+ * Returns: TRUE if no plugin has changed since the index was built
+ */
+gboolean ldm_modalias_merged_is_current(LdmModaliasMerged *self)
+{
+        for (guint i = 0; i < self->plugins->len; i++) {
+                if (ldm_modalias_plugin_get_serial(self->plugins->pdata[i]) != self->serials[i]) {
+                        return FALSE;
+                }
+        }
+
+        return TRUE;
+}
+
+guint ldm_modalias_merged_get_n_plugins(LdmModaliasMerged *self)
+{
+        return self->plugins->len;
+}
+
+LdmPlugin *ldm_modalias_merged_get_plugin(LdmModaliasMerged *self, guint slot)
+{
+        return self->plugins->pdata[slot];
+}
+
+/**
+ * LdmModaliasMergedSearch:
+ *
+ * State for matching a single device
+ */
+typedef struct LdmModaliasMergedSearch {
+        LdmModaliasMerged *merged;
+        const gchar *modalias;
+        LdmModaliasFields fields; /* Parsed form of the modalias */
+        LdmProviderInfo *infos;   /* By slot */
+        guint32 *best;            /* Best rule ID by slot, G_MAXUINT32 for none */
+} LdmModaliasMergedSearch;
+
+/**
+ * ldm_modalias_merged_check_rule:
+ *
+ * Check a candidate pattern once, on behalf of every plugin using it. The
+ * pattern is skipped entirely when every plugin already has a better rule.
+ */
+static gboolean ldm_modalias_merged_check_rule(guint32 id, gpointer user_data)
+{
+        LdmModaliasMergedSearch *search = user_data;
+        const LdmModaliasMergedRule *rule = NULL;
+        const LdmModaliasMergedRef *refs = NULL;
+        gboolean wanted = FALSE;
+
+        rule = &g_array_index(search->merged->rules, LdmModaliasMergedRule, id);
+        refs = (const LdmModaliasMergedRef *)(gpointer)search->merged->refs->data;
+
+        for (guint32 r = rule->refs; r != 0 && !wanted; r = refs[r].next) {
+                wanted = refs[r].rule < search->best[refs[r].slot];
+        }
+        if (!wanted || ldm_modalias_fields_reject(&rule->filter, &search->fields)) {
+                return FALSE;
+        }
+
+        ldm_stats_add(LDM_STATS_FNMATCH_CALLS, 1);
+        if (fnmatch(rule->match, search->modalias, 0) != 0) {
+                return FALSE;
+        }
+
+        for (guint32 r = rule->refs; r != 0; r = refs[r].next) {
+                const LdmModaliasMergedRef *ref = &refs[r];
+
+                if (ref->rule >= search->best[ref->slot]) {
+                        continue;
+                }
+                search->best[ref->slot] = ref->rule;
+                search->infos[ref->slot].package = ref->package;
+                search->infos[ref->slot].driver = ref->driver;
+        }
+
+        return FALSE;
+}
+
+/**
+ * ldm_modalias_merged_match:
+ * @device: Device to match
+ * @infos: (out caller-allocates) (array): One record per slot
+ *
+ * Match the modaliases of the device subtree against every plugin at once.
+ * The record of each slot is filled just as #ldm_plugin_match on that
+ * plugin would have, while those of plugins not matching are zeroed.
+ *
+ * Returns: The number of plugins matching the device
+ */
+guint ldm_modalias_merged_match(LdmModaliasMerged *self, LdmDevice *device,
+                                LdmProviderInfo *infos)
+{
+        GPtrArray *modaliases = ldm_device_get_subtree_modaliases(device);
+        guint32 stack_best[32] = { 0 };
+        g_autofree guint32 *heap_best = NULL;
+        LdmModaliasMergedSearch search = {
+                .merged = self,
+                .modalias = NULL,
+                .fields = { 0 },
+                .infos = infos,
+                .best = stack_best,
+        };
+        guint n_plugins = self->plugins->len;
+        guint n_matched = 0;
+
+        if (n_plugins > G_N_ELEMENTS(stack_best)) {
+                heap_best = g_new(guint32, n_plugins);
+                search.best = heap_best;
+        }
+        for (guint i = 0; i < n_plugins; i++) {
+                search.best[i] = G_MAXUINT32;
+                infos[i] = (LdmProviderInfo){ 0 };
+        }
+
+        for (guint i = 0; i < modaliases->len; i++) {
+                search.modalias = modaliases->pdata[i];
+                ldm_modalias_fields_parse(search.modalias, &search.fields);
+                ldm_modalias_index_lookup(self->index,
+                                          search.modalias,
+                                          ldm_modalias_merged_check_rule,
+                                          &search);
+        }
+
+        for (guint i = 0; i < n_plugins; i++) {
+                if (search.best[i] == G_MAXUINT32) {
+                        continue;
+                }
+                infos[i].plugin = self->plugins->pdata[i];
+                infos[i].device = device;
+                ++n_matched;
+        }
+
+        /* Every plugin was evaluated, even if just the once */
+        ldm_stats_add(LDM_STATS_PLUGINS_EVALUATED, n_plugins);
+
+        return n_matched;
+}
+
+/*
+ * Editor modelines  -  https://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: nil
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 expandtab:
+ * :indentSize=8:tabSize=8:noTabs=true:
+ */
@@ -0,0 +1,79 @@
+/*
+ * This file is part of linux-driver-management.
+ *
+ * Copyright © 2016-2018 Ikey Doherty
+ *
+ * linux-driver-management is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+#pragma once
+
+#include <glib.h>
+
+#include "device.h"
+#include "modalias-fields.h"
+#include "plugins/modalias-plugin.h"
+#include "provider.h"
+
+G_BEGIN_DECLS
+
+/*
+ * LdmModaliasMerged
+ *
+ * Private match index spanning several modalias plugins, so that a device
+ * is looked up once rather than once per plugin. Driver series ship heavily
+ * overlapping alias sets, so each distinct pattern is stored and checked
+ * just once, carrying a reference to every (plugin, rule) using it.
+ *
+ * Each plugin is assigned a slot, in the order given at construction. A
+ * match yields the same result per slot as matching that plugin alone
+ * would have, i.e. the lowest rule ID of the plugin matching any modalias
+ * in the device subtree.
+ */
+typedef struct LdmModaliasMerged LdmModaliasMerged;
+
+LdmModaliasMerged *ldm_modalias_merged_new(LdmPlugin **plugins, guint n_plugins);
+void ldm_modalias_merged_free(LdmModaliasMerged *merged);
+gboolean ldm_modalias_merged_is_current(LdmModaliasMerged *merged);
+guint ldm_modalias_merged_get_n_plugins(LdmModaliasMerged *merged);
+LdmPlugin *ldm_modalias_merged_get_plugin(LdmModaliasMerged *merged, guint slot);
+guint ldm_modalias_merged_match(LdmModaliasMerged *merged, LdmDevice *device,
+                                LdmProviderInfo *infos);
+
+/**
+ * LdmModaliasRuleFunc:
+ * @rule: Rule ID within the plugin, lower IDs take precedence
+ * @match: fnmatch pattern of the rule
+ * @driver: Kernel driver of the rule
+ * @package: Package of the rule
+ * @filter: Compiled prefilter of the pattern
+ * @user_data: User data passed to ldm_modalias_plugin_foreach_rule
+ *
+ * Every string is owned by the plugin, and stays valid until it changes.
+ */
+typedef void (*LdmModaliasRuleFunc)(guint32 rule, const gchar *match, const gchar *driver,
+                                    const gchar *package, const LdmModaliasFields *filter,
+                                    gpointer user_data);
+
+/* Private LdmModaliasPlugin API, used to build the index */
+void ldm_modalias_plugin_foreach_rule(LdmModaliasPlugin *plugin, LdmModaliasRuleFunc func,
+                                      gpointer user_data);
+guint ldm_modalias_plugin_get_serial(LdmModaliasPlugin *plugin);
+
+G_END_DECLS
+
+/*
+ * Editor modelines  -  https://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: nil
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 expandtab:
+ * :indentSize=8:tabSize=8:noTabs=true:
+ */
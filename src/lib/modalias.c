@@ -13,7 +13,9 @@
 
 #include <fnmatch.h>
 
+#include "ldm-private.h"
 #include "modalias.h"
+#include "stats.h"
 #include "util.h"
 
 struct _LdmModaliasClass {
@@ -63,11 +65,11 @@ struct _LdmModalias {
         /* What do we match? */
         gchar *match;
 
-        /* What kernel driver enables this? */
-        gchar *driver;
+        /* What kernel driver enables this? (interned) */
+        const gchar *driver;
 
-        /* Who do we belong to? */
-        gchar *package;
+        /* Who do we belong to? (interned) */
+        const gchar *package;
 };
 
 G_DEFINE_TYPE(LdmModalias, ldm_modalias, G_TYPE_INITIALLY_UNOWNED)
@@ -92,8 +94,6 @@ static void ldm_modalias_dispose(GObject *obj)
         LdmModalias *self = LDM_MODALIAS(obj);
 
         g_clear_pointer(&self->match, g_free);
-        g_clear_pointer(&self->driver, g_free);
-        g_clear_pointer(&self->package, g_free);
 
         G_OBJECT_CLASS(ldm_modalias_parent_class)->dispose(obj);
 }
@@ -162,12 +162,10 @@ static void ldm_modalias_set_property(GObject *object, guint id, const GValue *v
                 self->match = g_value_dup_string(value);
                 break;
         case PROP_DRIVER:
-                g_clear_pointer(&self->driver, g_free);
-                self->driver = g_value_dup_string(value);
+                self->driver = g_intern_string(g_value_get_string(value));
                 break;
         case PROP_PACKAGE:
-                g_clear_pointer(&self->package, g_free);
-                self->package = g_value_dup_string(value);
+                self->package = g_intern_string(g_value_get_string(value));
                 break;
         default:
                 G_OBJECT_WARN_INVALID_PROPERTY_ID(object, id, spec);
@@ -281,6 +279,7 @@ gboolean ldm_modalias_matches(LdmModalias *self, const gchar *match_string)
         g_return_val_if_fail(self->match != NULL, FALSE);
         g_return_val_if_fail(match_string != NULL, FALSE);
 
+        ldm_stats_add(LDM_STATS_FNMATCH_CALLS, 1);
         return fnmatch(self->match, match_string, 0) == 0 ? TRUE : FALSE;
 }
 
@@ -296,28 +295,12 @@ gboolean ldm_modalias_matches(LdmModalias *self, const gchar *match_string)
 gboolean ldm_modalias_matches_device(LdmModalias *self, LdmDevice *match_device)
 {
         g_return_val_if_fail(match_device != NULL, FALSE);
-        g_autoptr(GList) kids = NULL;
-        GList *elem = NULL;
-        const gchar *id = NULL;
-
-        /* Root match? */
-        id = ldm_device_get_modalias(match_device);
-        if (id && ldm_modalias_matches(self, id)) {
-                return TRUE;
-        }
-
-        /* Any kids? */
-        kids = ldm_device_get_children(match_device);
-        if (!kids) {
-                return FALSE;
-        }
-
-        /* Try matching child devices (interfaces) */
-        for (elem = kids; elem; elem = elem->next) {
-                LdmDevice *child_device = NULL;
+        GPtrArray *modaliases = NULL;
 
-                child_device = LDM_DEVICE(elem->data);
-                if (ldm_modalias_matches_device(self, child_device)) {
+        /* Root first, then the child devices (interfaces) */
+        modaliases = ldm_device_get_subtree_modaliases(match_device);
+        for (guint i = 0; i < modaliases->len; i++) {
+                if (ldm_modalias_matches(self, modaliases->pdata[i])) {
                         return TRUE;
                 }
         }
@@ -15,6 +15,7 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "ldm-private.h"
 #include "pci-device.h"
@@ -41,6 +42,11 @@ struct _LdmPCIDeviceClass {
  * The primary use case within LDM is to detect GPUs, which will all
  * carry the #LdmDevice:device-type of #LDM_DEVICE_TYPE_PCI | #LDM_DEVICE_TYPE_GPU.
  *
+ * The locality of the device, i.e. its NUMA node, local CPUs and PCIe link,
+ * is only read from sysfs the first time any of it is requested, so that
+ * schedulers may place work near the device without the common case paying
+ * for it.
+ *
  * Users can test if a device is a PCI device without having to cast, by
  * simply checking the #LdmDevice:device-type:
  *
@@ -60,10 +66,21 @@ struct _LdmPCIDevice {
 
         /* Store address so an X.Org PCI Address can be extracted */
         struct {
+                guint domain;
                 guint bus;
                 guint dev;
                 gint func;
         } address;
+
+        /* Where the device sits, read on first use */
+        struct {
+                gint numa_node;       /* -1 when unknown */
+                gchar *local_cpulist; /* i.e. "0-7,16-23", NULL when unknown */
+                guint link_width;     /* Lanes, 0 when unknown */
+                guint link_speed;     /* MT/s per lane, 0 when unknown */
+                guint max_link_width; /* Supported by the device and slot */
+                guint max_link_speed;
+        } locality;
 };
 
 G_DEFINE_TYPE(LdmPCIDevice, ldm_pci_device, LDM_TYPE_DEVICE)
@@ -75,6 +92,10 @@ G_DEFINE_TYPE(LdmPCIDevice, ldm_pci_device, LDM_TYPE_DEVICE)
  */
 static void ldm_pci_device_dispose(GObject *obj)
 {
+        LdmPCIDevice *self = LDM_PCI_DEVICE(obj);
+
+        g_clear_pointer(&self->locality.local_cpulist, g_free);
+
         G_OBJECT_CLASS(ldm_pci_device_parent_class)->dispose(obj);
 }
 
@@ -100,19 +121,29 @@ static void ldm_pci_device_init(LdmPCIDevice *self)
 {
         LdmDevice *ldm = LDM_DEVICE(self);
         ldm->os.devtype |= LDM_DEVICE_TYPE_PCI;
+        self->locality.numa_node = -1;
 }
 
 /**
  * ldm_pci_device_assign_pvid:
  *
- * Assign product/vendor ID to the device from the PCI sysfs attributes
+ * Assign product/vendor ID to the device from the PCI_ID uevent property,
+ * i.e. 10DE:1C8C, falling back to the PCI sysfs attributes
  */
-static void ldm_pci_device_assign_pvid(LdmDevice *self, udev_device *device)
+static void ldm_pci_device_assign_pvid(LdmDevice *self, LdmDeviceRecord *record)
 {
         const char *sysattr = NULL;
+        unsigned int vendor_id = 0, product_id = 0;
+
+        sysattr = ldm_device_record_get_property(record, "PCI_ID");
+        if (sysattr && sscanf(sysattr, "%x:%x", &vendor_id, &product_id) == 2) {
+                self->id.vendor_id = (gint)vendor_id;
+                self->id.product_id = (gint)product_id;
+                return;
+        }
 
         /* Grab the vendor */
-        sysattr = udev_device_get_sysattr_value(device, "vendor");
+        sysattr = ldm_device_record_get_sysattr(record, "vendor");
         if (!sysattr) {
                 goto product;
         }
@@ -122,7 +153,7 @@ static void ldm_pci_device_assign_pvid(LdmDevice *self, udev_device *device)
 product:
 
         /* Grab the product */
-        sysattr = udev_device_get_sysattr_value(device, "device");
+        sysattr = ldm_device_record_get_sysattr(record, "device");
         if (!sysattr) {
                 return;
         }
@@ -131,57 +162,240 @@ product:
 
 /**
  * ldm_pci_device_assign_address:
+ * @sysname: Kernel name of the device, i.e. 0000:01:00.0
  *
- * Query and set up our PCI device address.
+ * Query and set up our PCI device address, including the domain, which is
+ * only non-zero on systems with several PCI segments.
  */
-static void ldm_pci_device_assign_address(LdmDevice *self, udev_device *device)
+static void ldm_pci_device_assign_address(LdmDevice *self, const char *sysname)
 {
         LdmPCIDevice *pci = LDM_PCI_DEVICE(self);
-        const char *sys = NULL;
 
         /* Push this address into our internal notation */
-        sys = udev_device_get_sysname(device);
-        if (sscanf(sys,
-                   "0000:%x:%x.%d",
+        if (sscanf(sysname,
+                   "%x:%x:%x.%d",
+                   &pci->address.domain,
                    &pci->address.bus,
                    &pci->address.dev,
-                   &pci->address.func) != 3) {
+                   &pci->address.func) != 4) {
                 g_warning("Failed to parse PCI address");
         }
 }
 
 /**
- * ldm_pci_device_init_private:
- * @device: The udev device that we're being created from
+ * ldm_pci_device_get_class:
  *
- * Handle PCI specific initialisation
+ * Find the class and subclass of the device, preferring the PCI_CLASS
+ * uevent property (bare hex) over the "class" sysfs attribute.
+ *
+ * Returns: The class and subclass, or -1 if unknown
  */
-void ldm_pci_device_init_private(LdmDevice *self, udev_device *device)
+static int ldm_pci_device_get_class(LdmDeviceRecord *record)
 {
         const char *sysattr = NULL;
+
+        sysattr = ldm_device_record_get_property(record, "PCI_CLASS");
+        if (sysattr) {
+                return (int)(strtoll(sysattr, NULL, 16) >> 8);
+        }
+
+        sysattr = ldm_device_record_get_sysattr(record, "class");
+        if (sysattr) {
+                return (int)(strtoll(sysattr, NULL, 0) >> 8);
+        }
+
+        return -1;
+}
+
+/**
+ * ldm_pci_device_init_private:
+ * @record: The record that we're being created from
+ *
+ * Handle PCI specific initialisation. Only the uevent properties are
+ * used here, and boot_vga is deferred until the attributes are needed,
+ * as is the locality of the device.
+ */
+void ldm_pci_device_init_private(LdmDevice *self, LdmDeviceRecord *record)
+{
         int pci_class = 0;
 
-        ldm_pci_device_assign_pvid(self, device);
-        ldm_pci_device_assign_address(self, device);
+        ldm_pci_device_assign_pvid(self, record);
+        ldm_pci_device_assign_address(self, ldm_device_record_get_sysname(record));
+        self->os.deferred |= LDM_DEVICE_DEFERRED_ATTRIBUTES;
+
+        /* Does it look like a display device? */
+        pci_class = ldm_pci_device_get_class(record);
+        if (pci_class >= PCI_CLASS_DISPLAY_VGA && pci_class <= PCI_CLASS_DISPLAY_OTHER) {
+                self->os.devtype |= LDM_DEVICE_TYPE_GPU;
+        }
+}
+
+/**
+ * ldm_pci_device_parse_link_speed:
+ * @sysattr: Link speed as shown by the kernel, i.e. "8.0 GT/s PCIe"
+ *
+ * Returns: The transfer rate in MT/s, or 0 if unknown
+ */
+static guint ldm_pci_device_parse_link_speed(const char *sysattr)
+{
+        gchar *end = NULL;
+        gdouble rate = 0;
+
+        rate = g_ascii_strtod(sysattr, &end);
+        if (end == sysattr || rate <= 0 || !g_str_has_prefix(g_strchug(end), "GT/s")) {
+                return 0;
+        }
+
+        return (guint)(rate * 1000 + 0.5);
+}
+
+/**
+ * ldm_pci_device_read_link:
+ * @width_attr: sysfs attribute holding the link width
+ * @speed_attr: sysfs attribute holding the link speed
+ *
+ * Read one pair of PCIe link attributes, leaving either at 0 if missing
+ */
+static void ldm_pci_device_read_link(LdmDeviceRecord *record, const gchar *width_attr,
+                                     const gchar *speed_attr, guint *width, guint *speed)
+{
+        const char *sysattr = NULL;
+        g_autofree gchar *copy = NULL;
+
+        sysattr = ldm_device_record_get_sysattr(record, width_attr);
+        if (sysattr) {
+                *width = (guint)strtoul(sysattr, NULL, 10);
+        }
+
+        /* Parsed from a copy, as the whitespace is stripped in place */
+        sysattr = ldm_device_record_get_sysattr(record, speed_attr);
+        if (sysattr) {
+                copy = g_strdup(sysattr);
+                *speed = ldm_pci_device_parse_link_speed(copy);
+        }
+}
+
+/**
+ * ldm_pci_device_resolve_locality:
+ *
+ * Read the NUMA node, local CPUs and PCIe link of the device. Devices that
+ * aren't PCIe, such as integrated GPUs, simply have no link attributes.
+ */
+static void ldm_pci_device_resolve_locality(LdmPCIDevice *self, LdmDeviceRecord *record)
+{
+        const char *sysattr = NULL;
+
+        sysattr = ldm_device_record_get_sysattr(record, "numa_node");
+        if (sysattr) {
+                self->locality.numa_node = (gint)strtol(sysattr, NULL, 10);
+        }
+
+        sysattr = ldm_device_record_get_sysattr(record, "local_cpulist");
+        if (sysattr) {
+                self->locality.local_cpulist = g_strstrip(g_strdup(sysattr));
+        }
+
+        ldm_pci_device_read_link(record,
+                                 "current_link_width",
+                                 "current_link_speed",
+                                 &self->locality.link_width,
+                                 &self->locality.link_speed);
+        ldm_pci_device_read_link(record,
+                                 "max_link_width",
+                                 "max_link_speed",
+                                 &self->locality.max_link_width,
+                                 &self->locality.max_link_speed);
+}
+
+/**
+ * ldm_pci_device_resolve_private:
+ * @record: The record that we were created from
+ * @deferred: The #LdmDeviceDeferred fields to resolve
+ *
+ * Handle the deferred PCI specific initialisation
+ */
+void ldm_pci_device_resolve_private(LdmDevice *self, LdmDeviceRecord *record, guint deferred)
+{
+        const char *sysattr = NULL;
+
+        if ((deferred & LDM_DEVICE_DEFERRED_ATTRIBUTES) == 0) {
+                return;
+        }
+
+        ldm_pci_device_resolve_locality(LDM_PCI_DEVICE(self), record);
+
+        /* The kernel only exposes boot_vga for display devices */
+        if ((self->os.devtype & LDM_DEVICE_TYPE_GPU) == 0) {
+                return;
+        }
 
         /* Are we boot_vga ? */
-        sysattr = udev_device_get_sysattr_value(device, "boot_vga");
+        sysattr = ldm_device_record_get_sysattr(record, "boot_vga");
         if (sysattr && g_str_equal(sysattr, "1")) {
                 self->os.attributes |= LDM_DEVICE_ATTRIBUTE_BOOT_VGA;
         }
-        sysattr = NULL;
+}
 
-        /* Grab the device class */
-        sysattr = udev_device_get_sysattr_value(device, "class");
-        if (!sysattr) {
-                return;
-        }
+/**
+ * ldm_pci_device_save_private:
+ *
+ * Store the locality of the device in the private snapshot field, as the
+ * NUMA node, then the current and maximum link width and speed, in
+ * hexadecimal, followed by the local CPU list. Attributes have already
+ * been resolved by the caller.
+ */
+void ldm_pci_device_save_private(LdmDevice *self, GString *line)
+{
+        LdmPCIDevice *pci = LDM_PCI_DEVICE(self);
+        g_autofree gchar *locality = NULL;
 
-        /* Does it look like a display device? */
-        pci_class = (int)(strtoll(sysattr, NULL, 0) >> 8);
-        if (pci_class >= PCI_CLASS_DISPLAY_VGA && pci_class <= PCI_CLASS_DISPLAY_OTHER) {
-                self->os.devtype |= LDM_DEVICE_TYPE_GPU;
+        locality = g_strdup_printf("%d %x %x %x %x %s",
+                                   pci->locality.numa_node,
+                                   pci->locality.link_width,
+                                   pci->locality.link_speed,
+                                   pci->locality.max_link_width,
+                                   pci->locality.max_link_speed,
+                                   pci->locality.local_cpulist ? pci->locality.local_cpulist : "");
+        ldm_snapshot_append_field(line, locality);
+}
+
+/**
+ * ldm_pci_device_restore_private:
+ * @field: Private snapshot field stored by #ldm_pci_device_save_private
+ *
+ * Handle PCI specific initialisation for a device restored from a snapshot.
+ * The address is recovered from the sysfs path, and the locality from the
+ * private field, everything else is stored by the base device.
+ *
+ * Returns: FALSE if the private field is invalid
+ */
+gboolean ldm_pci_device_restore_private(LdmDevice *self, const gchar *field)
+{
+        LdmPCIDevice *pci = LDM_PCI_DEVICE(self);
+        g_autofree gchar *sysname = NULL;
+        g_autofree gchar *cpulist = NULL;
+        gint n_read = 0;
+
+        sysname = g_path_get_basename(self->os.sysfs_path);
+        ldm_pci_device_assign_address(self, sysname);
+
+        cpulist = g_new0(gchar, strlen(field) + 1);
+        n_read = sscanf(field,
+                        "%d %x %x %x %x %s",
+                        &pci->locality.numa_node,
+                        &pci->locality.link_width,
+                        &pci->locality.link_speed,
+                        &pci->locality.max_link_width,
+                        &pci->locality.max_link_speed,
+                        cpulist);
+        if (n_read < 5) {
+                return FALSE;
         }
+        if (n_read == 6) {
+                pci->locality.local_cpulist = g_steal_pointer(&cpulist);
+        }
+
+        return TRUE;
 }
 
 /**
@@ -212,6 +426,144 @@ void ldm_pci_device_get_address(LdmPCIDevice *self, guint *bus, guint *dev, gint
         }
 }
 
+/**
+ * ldm_pci_device_get_domain:
+ *
+ * Get the PCI domain, or segment, of the device. This is 0 on all but
+ * larger servers, which may have several host bridges.
+ *
+ * Returns: The PCI domain of the device
+ */
+guint ldm_pci_device_get_domain(LdmPCIDevice *self)
+{
+        g_return_val_if_fail(self != NULL, 0);
+
+        return self->address.domain;
+}
+
+/**
+ * ldm_pci_device_get_xorg_bus_id:
+ *
+ * Construct the X.Org BusID of the device. The address is decimal, not
+ * hex, and the domain is only given when non-zero, as bus@domain.
+ *
+ * Returns: (transfer full): The BusID, i.e. "PCI:1:0:0" or "PCI:1@1:0:0"
+ */
+gchar *ldm_pci_device_get_xorg_bus_id(LdmPCIDevice *self)
+{
+        g_return_val_if_fail(self != NULL, NULL);
+
+        if (self->address.domain != 0) {
+                return g_strdup_printf("PCI:%u@%u:%u:%d",
+                                       self->address.bus,
+                                       self->address.domain,
+                                       self->address.dev,
+                                       self->address.func);
+        }
+
+        return g_strdup_printf("PCI:%u:%u:%d",
+                               self->address.bus,
+                               self->address.dev,
+                               self->address.func);
+}
+
+/**
+ * ldm_pci_device_get_numa_node:
+ *
+ * Get the NUMA node the device is attached to, as reported by the kernel.
+ * Systems without NUMA, or with firmware not describing the locality of
+ * the device, report no node at all.
+ *
+ * Returns: The NUMA node of the device, or -1 if unknown
+ */
+gint ldm_pci_device_get_numa_node(LdmPCIDevice *self)
+{
+        g_return_val_if_fail(self != NULL, -1);
+
+        ldm_device_resolve(LDM_DEVICE(self), LDM_DEVICE_DEFERRED_ATTRIBUTES);
+        return self->locality.numa_node;
+}
+
+/**
+ * ldm_pci_device_get_link_width:
+ *
+ * Get the number of lanes currently negotiated for the PCIe link of the
+ * device. This may be lower than the device supports, i.e. when a x16
+ * card sits in a x8 slot.
+ *
+ * Returns: The link width in lanes, or 0 for devices without a PCIe link
+ */
+guint ldm_pci_device_get_link_width(LdmPCIDevice *self)
+{
+        g_return_val_if_fail(self != NULL, 0);
+
+        ldm_device_resolve(LDM_DEVICE(self), LDM_DEVICE_DEFERRED_ATTRIBUTES);
+        return self->locality.link_width;
+}
+
+/**
+ * ldm_pci_device_get_link_speed:
+ *
+ * Get the transfer rate currently negotiated for each lane of the PCIe
+ * link, i.e. 8000 for a PCIe 3.0 link running at 8 GT/s. Power managed
+ * devices may drop to a lower rate while idle.
+ *
+ * Returns: The link speed in MT/s, or 0 for devices without a PCIe link
+ */
+guint ldm_pci_device_get_link_speed(LdmPCIDevice *self)
+{
+        g_return_val_if_fail(self != NULL, 0);
+
+        ldm_device_resolve(LDM_DEVICE(self), LDM_DEVICE_DEFERRED_ATTRIBUTES);
+        return self->locality.link_speed;
+}
+
+/**
+ * ldm_pci_device_get_max_link_width:
+ *
+ * Get the maximum number of lanes supported by the PCIe link of the device
+ *
+ * Returns: The maximum link width in lanes, or 0 for devices without a PCIe link
+ */
+guint ldm_pci_device_get_max_link_width(LdmPCIDevice *self)
+{
+        g_return_val_if_fail(self != NULL, 0);
+
+        ldm_device_resolve(LDM_DEVICE(self), LDM_DEVICE_DEFERRED_ATTRIBUTES);
+        return self->locality.max_link_width;
+}
+
+/**
+ * ldm_pci_device_get_max_link_speed:
+ *
+ * Get the maximum transfer rate supported by each lane of the PCIe link
+ *
+ * Returns: The maximum link speed in MT/s, or 0 for devices without a PCIe link
+ */
+guint ldm_pci_device_get_max_link_speed(LdmPCIDevice *self)
+{
+        g_return_val_if_fail(self != NULL, 0);
+
+        ldm_device_resolve(LDM_DEVICE(self), LDM_DEVICE_DEFERRED_ATTRIBUTES);
+        return self->locality.max_link_speed;
+}
+
+/**
+ * ldm_pci_device_get_local_cpulist:
+ *
+ * Get the CPUs local to the device, in the kernel list format, i.e.
+ * "0-7,16-23". Work using the device is best scheduled on these CPUs.
+ *
+ * Returns: (transfer none) (nullable): The local CPU list, or NULL if unknown
+ */
+const gchar *ldm_pci_device_get_local_cpulist(LdmPCIDevice *self)
+{
+        g_return_val_if_fail(self != NULL, NULL);
+
+        ldm_device_resolve(LDM_DEVICE(self), LDM_DEVICE_DEFERRED_ATTRIBUTES);
+        return self->locality.local_cpulist;
+}
+
 /*
  * Editor modelines  -  https://www.wireshark.org/tools/modelines.html
  *
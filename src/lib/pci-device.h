@@ -30,6 +30,14 @@ typedef struct _LdmPCIDeviceClass LdmPCIDeviceClass;
 GType ldm_pci_device_get_type(void);
 
 void ldm_pci_device_get_address(LdmPCIDevice *device, guint *bus, guint *dev, gint *func);
+guint ldm_pci_device_get_domain(LdmPCIDevice *device);
+gchar *ldm_pci_device_get_xorg_bus_id(LdmPCIDevice *device);
+gint ldm_pci_device_get_numa_node(LdmPCIDevice *device);
+const gchar *ldm_pci_device_get_local_cpulist(LdmPCIDevice *device);
+guint ldm_pci_device_get_link_width(LdmPCIDevice *device);
+guint ldm_pci_device_get_link_speed(LdmPCIDevice *device);
+guint ldm_pci_device_get_max_link_width(LdmPCIDevice *device);
+guint ldm_pci_device_get_max_link_speed(LdmPCIDevice *device);
 
 G_END_DECLS
 
@@ -12,6 +12,7 @@
 #define _GNU_SOURCE
 
 #include "plugin.h"
+#include "stats.h"
 #include "util.h"
 
 /**
@@ -42,6 +43,7 @@ static GParamSpec *obj_properties[N_PROPS] = {
 static void ldm_plugin_set_property(GObject *object, guint id, const GValue *value,
                                     GParamSpec *spec);
 static void ldm_plugin_get_property(GObject *object, guint id, GValue *value, GParamSpec *spec);
+static LdmProvider *ldm_plugin_real_get_provider(LdmPlugin *self, LdmDevice *device);
 
 /**
  * ldm_plugin_dispose:
@@ -71,6 +73,9 @@ static void ldm_plugin_class_init(LdmPluginClass *klazz)
         obj_class->get_property = ldm_plugin_get_property;
         obj_class->set_property = ldm_plugin_set_property;
 
+        /* plugin vtable hookup */
+        klazz->get_provider = ldm_plugin_real_get_provider;
+
         /**
          * LdmPlugin:name
          *
@@ -214,9 +219,77 @@ LdmProvider *ldm_plugin_get_provider(LdmPlugin *self, LdmDevice *device)
         g_return_val_if_fail(device != NULL, NULL);
         LdmPluginClass *klazz = LDM_PLUGIN_GET_CLASS(self);
         g_return_val_if_fail(klazz->get_provider != NULL, NULL);
+        ldm_stats_add(LDM_STATS_PLUGINS_EVALUATED, 1);
         return klazz->get_provider(self, device);
 }
 
+/**
+ * ldm_plugin_real_get_provider:
+ *
+ * Default get_provider implementation, wrapping the result of the match
+ * vfunc for plugins that only provide that.
+ */
+static LdmProvider *ldm_plugin_real_get_provider(LdmPlugin *self, LdmDevice *device)
+{
+        LdmPluginClass *klazz = LDM_PLUGIN_GET_CLASS(self);
+        LdmProviderInfo info = { 0 };
+
+        if (!klazz->match || !klazz->match(self, device, &info)) {
+                return NULL;
+        }
+
+        return ldm_provider_new_from_info(&info);
+}
+
+/**
+ * ldm_plugin_match:
+ * @device: Device to find a provider for
+ * @info: (out caller-allocates): Location to store the match
+ *
+ * Find the provider for the given hardware, exactly like
+ * #ldm_plugin_get_provider, but store the result in @info rather than
+ * constructing a new #LdmProvider. For plugins implementing the match
+ * vfunc, this performs no allocations at all.
+ *
+ * Plugins only implementing get_provider are still supported, though the
+ * provider is constructed and discarded internally. Their package and
+ * driver names are interned, so remain valid.
+ *
+ * Returns: TRUE if the plugin supports the device, filling @info
+ */
+gboolean ldm_plugin_match(LdmPlugin *self, LdmDevice *device, LdmProviderInfo *info)
+{
+        LdmPluginClass *klazz = NULL;
+        g_autoptr(LdmProvider) provider = NULL;
+
+        g_return_val_if_fail(self != NULL, FALSE);
+        g_return_val_if_fail(device != NULL, FALSE);
+        g_return_val_if_fail(info != NULL, FALSE);
+
+        klazz = LDM_PLUGIN_GET_CLASS(self);
+        ldm_stats_add(LDM_STATS_PLUGINS_EVALUATED, 1);
+
+        if (klazz->match) {
+                return klazz->match(self, device, info);
+        }
+
+        g_return_val_if_fail(klazz->get_provider != NULL, FALSE);
+        provider = klazz->get_provider(self, device);
+        if (!provider) {
+                return FALSE;
+        }
+        if (g_object_is_floating(provider)) {
+                g_object_ref_sink(provider);
+        }
+
+        info->plugin = self;
+        info->device = device;
+        info->package = ldm_provider_get_package(provider);
+        info->driver = ldm_provider_get_driver(provider);
+
+        return TRUE;
+}
+
 /*
  * Editor modelines  -  https://www.wireshark.org/tools/modelines.html
  *
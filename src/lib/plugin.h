@@ -28,14 +28,20 @@ typedef struct _LdmPluginClass LdmPluginClass;
  * LdmPluginClass:
  * @parent_class: The parent class
  * @get_provider: Virtual get_provider function
+ * @match: Virtual match function, filling an #LdmProviderInfo without allocating
+ *
+ * Plugins need only implement one of @get_provider or @match. When only
+ * @match is implemented, the default @get_provider builds a new
+ * #LdmProvider from its result.
  */
 struct _LdmPluginClass {
         GInitiallyUnownedClass parent_class;
 
         LdmProvider *(*get_provider)(LdmPlugin *plugin, LdmDevice *device);
+        gboolean (*match)(LdmPlugin *plugin, LdmDevice *device, LdmProviderInfo *info);
 
         /*< private >*/
-        gpointer padding[12];
+        gpointer padding[11];
 };
 
 struct _LdmPlugin {
@@ -59,6 +65,7 @@ gint ldm_plugin_get_priority(LdmPlugin *plugin);
 void ldm_plugin_set_priority(LdmPlugin *plugin, gint priority);
 
 LdmProvider *ldm_plugin_get_provider(LdmPlugin *self, LdmDevice *device);
+gboolean ldm_plugin_match(LdmPlugin *self, LdmDevice *device, LdmProviderInfo *info);
 
 G_DEFINE_AUTOPTR_CLEANUP_FUNC(LdmPlugin, g_object_unref)
 
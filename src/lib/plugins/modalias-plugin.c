@@ -13,19 +13,29 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <fnmatch.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
+#include "ldm-private.h"
+#include "modalias-db.h"
+#include "modalias-fields.h"
+#include "modalias-index.h"
+#include "modalias-merged.h"
 #include "modalias-plugin.h"
+#include "stats.h"
 #include "util.h"
 
 struct _LdmModaliasPluginClass {
         LdmPluginClass parent_class;
 };
 
-static LdmProvider *ldm_modalias_plugin_get_provider(LdmPlugin *plugin, LdmDevice *device);
+static gboolean ldm_modalias_plugin_match(LdmPlugin *plugin, LdmDevice *device,
+                                          LdmProviderInfo *info);
+static void ldm_modalias_plugin_add_rule(LdmModaliasPlugin *self, const gchar *match,
+                                         const gchar *driver, const gchar *package);
 
 /**
  * SECTION:modalias-plugin
@@ -59,12 +69,64 @@ static LdmProvider *ldm_modalias_plugin_get_provider(LdmPlugin *plugin, LdmDevic
  * If a hardware device matching `pci:v000014E4d*sv*sd*bc02sc80i` is discovered,
  * it requires `wl.ko` to operate correctly (or to enhance it). The user can find
  * `wl.ko` in the `broadcom-sta` package.
+ *
+ * Alternatively, the file may be a precompiled database produced by
+ * `mkmodaliases --binary`. Such files are mapped and used in place, without
+ * any parsing, and are detected automatically.
+ *
+ * Rules are stored internally as plain records rather than #LdmModalias
+ * objects, which are only constructed on request through
+ * ldm_modalias_plugin_get_modalias().
+ *
+ * The literal IDs of each rule are also kept in numeric form, so that most
+ * candidates can be rejected by comparing a handful of integers against the
+ * parsed device modalias, without ever reaching fnmatch.
+ */
+
+/**
+ * LdmModaliasRule:
+ *
+ * Packed representation of a single rule. The match string lives in the
+ * plugin string arena, while the driver and package are interned.
  */
+typedef struct LdmModaliasRule {
+        const gchar *match;
+        const gchar *driver;
+        const gchar *package;
+} LdmModaliasRule;
+
 struct _LdmModaliasPlugin {
         LdmPlugin parent;
 
-        /* Our known modalias implementations */
+        /* Map match to rule ID */
         GHashTable *modaliases;
+
+        /* Our known rules (LdmModaliasRule), indexed by rule ID */
+        GArray *rules;
+
+        /* Arena backing the match strings */
+        GStringChunk *strings;
+
+        /* Compiled prefix index over the rules */
+        LdmModaliasIndex *index;
+
+        /* Prefilters for the runtime rules (LdmModaliasFields), in rule order */
+        GArray *filters;
+
+        /* Precompiled database rules, occupying the first rule IDs */
+        struct {
+                GMappedFile *file;
+                const LdmModaliasDbRule *rules;
+                const gchar *strings;
+                guint32 n_rules;
+                LdmModaliasIndex *index;
+                GHashTable *overrides; /* Replaced rules, ID to LdmModaliasRule */
+                LdmModaliasFields *filters; /* Compiled on first search */
+                gsize filters_ready;
+        } db;
+
+        /* Bumped on every rule change, so merged indexes know to rebuild */
+        guint serial;
 };
 
 G_DEFINE_TYPE(LdmModaliasPlugin, ldm_modalias_plugin, LDM_TYPE_PLUGIN)
@@ -79,6 +141,14 @@ static void ldm_modalias_plugin_dispose(GObject *obj)
         LdmModaliasPlugin *self = LDM_MODALIAS_PLUGIN(obj);
 
         g_clear_pointer(&self->modaliases, g_hash_table_unref);
+        g_clear_pointer(&self->rules, g_array_unref);
+        g_clear_pointer(&self->strings, g_string_chunk_free);
+        g_clear_pointer(&self->index, ldm_modalias_index_free);
+        g_clear_pointer(&self->filters, g_array_unref);
+        g_clear_pointer(&self->db.filters, g_free);
+        g_clear_pointer(&self->db.index, ldm_modalias_index_free);
+        g_clear_pointer(&self->db.overrides, g_hash_table_unref);
+        g_clear_pointer(&self->db.file, g_mapped_file_unref);
 
         G_OBJECT_CLASS(ldm_modalias_plugin_parent_class)->dispose(obj);
 }
@@ -97,7 +167,7 @@ static void ldm_modalias_plugin_class_init(LdmModaliasPluginClass *klazz)
         obj_class->dispose = ldm_modalias_plugin_dispose;
 
         /* plugin vtable hookup */
-        plug_class->get_provider = ldm_modalias_plugin_get_provider;
+        plug_class->match = ldm_modalias_plugin_match;
 }
 
 /**
@@ -107,8 +177,11 @@ static void ldm_modalias_plugin_class_init(LdmModaliasPluginClass *klazz)
  */
 static void ldm_modalias_plugin_init(LdmModaliasPlugin *self)
 {
-        /* Map name to modalias */
-        self->modaliases = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_object_unref);
+        /* Map name to rule ID, keys are owned by the string arena */
+        self->modaliases = g_hash_table_new(g_str_hash, g_str_equal);
+        self->rules = g_array_new(FALSE, FALSE, sizeof(LdmModaliasRule));
+        self->index = ldm_modalias_index_new();
+        self->filters = g_array_new(FALSE, FALSE, sizeof(LdmModaliasFields));
 }
 
 /**
@@ -124,109 +197,445 @@ LdmPlugin *ldm_modalias_plugin_new(const gchar *name)
         return g_object_new(LDM_TYPE_MODALIAS_PLUGIN, "name", name, "priority", 0, NULL);
 }
 
+/**
+ * ldm_modalias_plugin_load_db:
+ *
+ * Validate the mapped database and point our rule tables directly at it.
+ * Nothing is copied, so the mapping is retained for the plugin lifetime.
+ */
+static gboolean ldm_modalias_plugin_load_db(LdmModaliasPlugin *self, GMappedFile *file)
+{
+        const gchar *data = g_mapped_file_get_contents(file);
+        gsize len = g_mapped_file_get_length(file);
+        const LdmModaliasDbHeader *header = NULL;
+        const LdmModaliasIndexNode *nodes = NULL;
+        const LdmModaliasIndexEntry *entries = NULL;
+        guint64 expected = 0;
+
+        if (!ldm_modalias_db_is_db(data, len)) {
+                return FALSE;
+        }
+
+        header = (const LdmModaliasDbHeader *)data;
+        if (header->version != LDM_MODALIAS_DB_VERSION ||
+            header->byte_order != LDM_MODALIAS_DB_BYTE_ORDER) {
+                return FALSE;
+        }
+
+        expected = sizeof(LdmModaliasDbHeader) +
+                   (guint64)header->n_rules * sizeof(LdmModaliasDbRule) +
+                   (guint64)header->n_nodes * sizeof(LdmModaliasIndexNode) +
+                   (guint64)header->n_entries * sizeof(LdmModaliasIndexEntry) +
+                   header->strings_size;
+        if (expected != len) {
+                return FALSE;
+        }
+
+        self->db.rules = (const LdmModaliasDbRule *)(data + sizeof(LdmModaliasDbHeader));
+        nodes = (const LdmModaliasIndexNode *)(self->db.rules + header->n_rules);
+        entries = (const LdmModaliasIndexEntry *)(nodes + header->n_nodes);
+        self->db.strings = (const gchar *)(entries + header->n_entries);
+
+        /* Strings must be terminated, and every rule must point within them */
+        if (header->strings_size < 1 || self->db.strings[header->strings_size - 1] != '\0') {
+                return FALSE;
+        }
+        for (guint32 i = 0; i < header->n_rules; i++) {
+                const LdmModaliasDbRule *rule = &self->db.rules[i];
+
+                if (rule->match >= header->strings_size || rule->driver >= header->strings_size ||
+                    rule->package >= header->strings_size) {
+                        return FALSE;
+                }
+        }
+
+        self->db.index = ldm_modalias_index_new_static(nodes,
+                                                       header->n_nodes,
+                                                       entries,
+                                                       header->n_entries,
+                                                       header->n_rules);
+        if (!self->db.index) {
+                return FALSE;
+        }
+
+        self->db.n_rules = header->n_rules;
+        self->db.file = g_mapped_file_ref(file);
+
+        return TRUE;
+}
+
+/**
+ * ldm_modalias_plugin_is_blank:
+ *
+ * Field separators within a line
+ */
+static inline gboolean ldm_modalias_plugin_is_blank(gchar c)
+{
+        return c == ' ' || c == '\t' || c == '\r';
+}
+
+/**
+ * ldm_modalias_plugin_parse_line:
+ *
+ * Tokenise a single NUL terminated line in place, splitting it into at most
+ * 4 fields. The final field takes the remainder of the line, minus any
+ * trailing blanks.
+ *
+ * Returns: The number of fields found
+ */
+static guint ldm_modalias_plugin_parse_line(gchar *line, gchar *fields[4])
+{
+        gchar *cursor = line;
+        guint n_fields = 0;
+
+        while (n_fields < 4) {
+                while (ldm_modalias_plugin_is_blank(*cursor)) {
+                        ++cursor;
+                }
+                if (*cursor == '\0') {
+                        break;
+                }
+
+                fields[n_fields++] = cursor;
+                if (n_fields == 4) {
+                        break;
+                }
+
+                while (*cursor != '\0' && !ldm_modalias_plugin_is_blank(*cursor)) {
+                        ++cursor;
+                }
+                if (*cursor != '\0') {
+                        *cursor++ = '\0';
+                }
+        }
+
+        if (n_fields == 4) {
+                cursor = fields[3] + strlen(fields[3]);
+                while (cursor > fields[3] && ldm_modalias_plugin_is_blank(cursor[-1])) {
+                        *--cursor = '\0';
+                }
+        }
+
+        return n_fields;
+}
+
+/**
+ * ldm_modalias_plugin_parse:
+ * @source: Name of the input, used for diagnostics
+ * @data: Writable buffer containing the file contents
+ * @len: Length of the buffer
+ *
+ * Walk the buffer line by line, tokenising it in place so that no memory is
+ * allocated per line. Rules are copied into our own storage, so the buffer
+ * is scratch space and may be discarded afterwards. Malformed lines are
+ * reported with their location, and skipped.
+ */
+static void ldm_modalias_plugin_parse(LdmModaliasPlugin *self, const gchar *source, gchar *data,
+                                      gsize len)
+{
+        gchar *end = data + len;
+        g_autofree gchar *tail = NULL;
+        guint line_no = 0;
+
+        /* Size the arena for the whole input, so that it is a single block */
+        if (!self->strings) {
+                self->strings = g_string_chunk_new(MAX(len, 1));
+        }
+
+        for (gchar *line = data; line < end;) {
+                gchar *eol = memchr(line, '\n', (size_t)(end - line));
+                gchar *fields[4] = { NULL };
+                guint n_fields = 0;
+
+                ++line_no;
+
+                if (eol) {
+                        *eol = '\0';
+                } else {
+                        /* Final line without a newline, we can't terminate it in place */
+                        tail = g_strndup(line, (gsize)(end - line));
+                        eol = end;
+                        line = tail;
+                }
+
+                n_fields = ldm_modalias_plugin_parse_line(line, fields);
+                line = eol + 1;
+
+                /* Empty lines and comments are uninteresting. */
+                if (n_fields == 0 || fields[0][0] == '#') {
+                        continue;
+                }
+
+                if (n_fields != 4) {
+                        g_warning("%s:%u: expected 4 fields, found %u", source, line_no, n_fields);
+                        continue;
+                }
+
+                if (!g_str_equal(fields[0], "alias")) {
+                        g_warning("%s:%u: unknown directive '%s'", source, line_no, fields[0]);
+                        continue;
+                }
+
+                /* Add the rule, without constructing an LdmModalias */
+                ldm_modalias_plugin_add_rule(self, fields[1], fields[2], fields[3]);
+        }
+}
+
 /**
  * ldm_modalias_plugin_new_from_filename:
  * @filename: Path to a modaliases file
  *
  * Create a new LdmPlugin for modalias detection. The named file will be
- * opened and the resulting plugin will be seeded from that file.
+ * opened and the resulting plugin will be seeded from that file, which may
+ * either be a plain text `.modaliases` file or a precompiled database.
  *
  * Returns: (transfer full): A newly initialised LdmModaliasPlugin
  */
 LdmPlugin *ldm_modalias_plugin_new_from_filename(const gchar *filename)
 {
-        FILE *fp = NULL;
-        char *bfr = NULL;
-        size_t n = 0;
-        ssize_t read = 0;
         LdmPlugin *ret = NULL;
         g_autofree gchar *path = NULL;
+        g_autoptr(GMappedFile) mapped = NULL;
+        g_autoptr(GError) error = NULL;
+        int fd = -1;
 
         g_return_val_if_fail(filename != NULL, NULL);
         if (access(filename, F_OK) != 0) {
                 return NULL;
         }
 
-        fp = fopen(filename, "r");
-        if (!fp) {
-                fprintf(stderr, "Failed to open %s: %s\n", filename, strerror(errno));
-                return NULL;
-        }
-
         /* Strip suffix if set */
         path = g_path_get_basename(filename);
         if (g_str_has_suffix(path, ".modaliases")) {
                 path[strlen(path) - strlen(".modaliases")] = '\0';
         }
 
+        /* Private writable mapping, as the text parser tokenises in place.
+         * Changes are never written back to the file. */
+        fd = open(filename, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+                fprintf(stderr, "Failed to open %s: %s\n", filename, strerror(errno));
+                return NULL;
+        }
+        mapped = g_mapped_file_new_from_fd(fd, TRUE, &error);
+        close(fd);
+        if (!mapped) {
+                fprintf(stderr, "Failed to map %s: %s\n", filename, error->message);
+                return NULL;
+        }
+
         ret = ldm_modalias_plugin_new(path);
+        ldm_stats_add(LDM_STATS_BYTES_READ, g_mapped_file_get_length(mapped));
+
+        /* Precompiled database? Use it in place. */
+        if (ldm_modalias_db_is_db(g_mapped_file_get_contents(mapped),
+                                  g_mapped_file_get_length(mapped))) {
+                if (!ldm_modalias_plugin_load_db(LDM_MODALIAS_PLUGIN(ret), mapped)) {
+                        g_warning("invalid modalias database '%s'", filename);
+                        g_object_unref(g_object_ref_sink(ret));
+                        return NULL;
+                }
+                return ret;
+        }
 
-        /* Walk the line. */
-        while ((read = getline(&bfr, &n, fp)) > 0) {
-                gchar *work = NULL;
-                gchar **splits = NULL;
-                LdmModalias *alias = NULL;
+        ldm_modalias_plugin_parse(LDM_MODALIAS_PLUGIN(ret),
+                                  filename,
+                                  g_mapped_file_get_contents(mapped),
+                                  g_mapped_file_get_length(mapped));
 
-                /* Strip the newline from it */
-                if (bfr[read - 1] == '\n') {
-                        bfr[read - 1] = '\0';
-                        --read;
-                }
+        return ret;
+}
 
-                /* Empty lines are uninteresting. */
-                if (read < 1) {
-                        continue;
-                }
+/**
+ * ldm_modalias_plugin_new_from_data:
+ * @name: Name for this plugin instance
+ * @data: (array length=len): Contents of a plain text `.modaliases` file
+ * @len: Length of @data in bytes
+ *
+ * Create a new LdmPlugin for modalias detection, seeded from an in-memory
+ * copy of a `.modaliases` file. The data need not be NUL terminated, and is
+ * not retained. Precompiled databases are not supported here.
+ *
+ * Returns: (transfer full): A newly initialised LdmModaliasPlugin
+ */
+LdmPlugin *ldm_modalias_plugin_new_from_data(const gchar *name, const gchar *data, gsize len)
+{
+        LdmPlugin *ret = NULL;
+        g_autofree gchar *buffer = NULL;
 
-                work = g_strstrip(bfr);
+        g_return_val_if_fail(name != NULL, NULL);
+        g_return_val_if_fail(data != NULL || len == 0, NULL);
 
-                /* Comment? */
-                if (g_str_has_prefix(work, "#")) {
-                        goto next_line;
-                }
+        ret = ldm_modalias_plugin_new(name);
+        if (len == 0) {
+                return ret;
+        }
 
-                splits = g_strsplit(work, " ", 4);
-                if (!splits || g_strv_length(splits) != 4) {
-                        goto next_line;
-                }
+        ldm_stats_add(LDM_STATS_BYTES_READ, len);
 
-                if (!g_str_equal(splits[0], "alias")) {
-                        g_warning("unknown directive '%s'", splits[0]);
-                        goto next_line;
-                }
+        /* One copy of the whole input, to tokenise in place */
+        buffer = g_malloc(len);
+        memcpy(buffer, data, len);
+        ldm_modalias_plugin_parse(LDM_MODALIAS_PLUGIN(ret), name, buffer, len);
 
-                alias = ldm_modalias_new(splits[1], splits[2], splits[3]);
-                if (!alias) {
-                        g_warning("invalid alias '%s'", work);
-                        goto next_line;
-                }
+        return ret;
+}
+
+/**
+ * ldm_modalias_plugin_get_rule:
+ *
+ * Resolve a rule ID to its strings, whether it lives in the precompiled
+ * database or was added at runtime.
+ */
+static void ldm_modalias_plugin_get_rule(LdmModaliasPlugin *self, guint rule,
+                                         LdmModaliasRule *out)
+{
+        const LdmModaliasRule *override = NULL;
+        const LdmModaliasDbRule *db_rule = NULL;
 
-                /* Add modalias. */
-                ldm_modalias_plugin_add_modalias(LDM_MODALIAS_PLUGIN(ret), alias);
+        if (rule >= self->db.n_rules) {
+                *out = g_array_index(self->rules, LdmModaliasRule, rule - self->db.n_rules);
+                return;
+        }
 
-        next_line:
-                if (splits) {
-                        g_strfreev(splits);
+        if (self->db.overrides) {
+                override = g_hash_table_lookup(self->db.overrides, GUINT_TO_POINTER(rule));
+                if (override) {
+                        *out = *override;
+                        return;
                 }
-                free(bfr);
-                bfr = NULL;
         }
 
-        if (bfr) {
-                free(bfr);
+        db_rule = &self->db.rules[rule];
+        out->match = self->db.strings + db_rule->match;
+        out->driver = self->db.strings + db_rule->driver;
+        out->package = self->db.strings + db_rule->package;
+}
+
+/**
+ * LdmModaliasDbSearch:
+ *
+ * State for finding an exact match within the precompiled database
+ */
+typedef struct LdmModaliasDbSearch {
+        LdmModaliasPlugin *plugin;
+        const gchar *match;
+        guint rule;
+        gboolean found;
+} LdmModaliasDbSearch;
+
+/**
+ * ldm_modalias_plugin_check_db_rule:
+ *
+ * Stop at the first candidate whose full match string is identical
+ */
+static gboolean ldm_modalias_plugin_check_db_rule(guint32 rule, gpointer user_data)
+{
+        LdmModaliasDbSearch *search = user_data;
+        const gchar *match = search->plugin->db.strings + search->plugin->db.rules[rule].match;
+
+        if (!g_str_equal(match, search->match)) {
+                return FALSE;
         }
 
-        fclose(fp);
+        search->rule = rule;
+        search->found = TRUE;
+        return TRUE;
+}
 
-        return ret;
+/**
+ * ldm_modalias_plugin_find_db_rule:
+ *
+ * Find the database rule for the exact match string, if any. Walking the
+ * index along the match string itself yields every rule whose literal
+ * prefix it starts with, which includes the rule we're looking for.
+ */
+static gboolean ldm_modalias_plugin_find_db_rule(LdmModaliasPlugin *self, const gchar *match,
+                                                 guint *rule)
+{
+        LdmModaliasDbSearch search = {
+                .plugin = self,
+                .match = match,
+                .rule = 0,
+                .found = FALSE,
+        };
+
+        if (!self->db.index) {
+                return FALSE;
+        }
+
+        ldm_modalias_index_lookup(self->db.index,
+                                  match,
+                                  ldm_modalias_plugin_check_db_rule,
+                                  &search);
+        *rule = search.rule;
+        return search.found;
+}
+
+/**
+ * ldm_modalias_plugin_add_rule:
+ *
+ * Store a new rule in our table, or replace the driver and package of an
+ * existing rule with the same match. Replacing a rule keeps its ID, and
+ * therefore its position in the index.
+ */
+static void ldm_modalias_plugin_add_rule(LdmModaliasPlugin *self, const gchar *match,
+                                         const gchar *driver, const gchar *package)
+{
+        LdmModaliasRule new_rule = { 0 };
+        LdmModaliasFields filter = { 0 };
+        LdmModaliasRule *existing = NULL;
+        gchar *match_copy = NULL;
+        gpointer v = NULL;
+        guint rule = 0;
+
+        new_rule.driver = g_intern_string(driver);
+        new_rule.package = g_intern_string(package);
+        ++self->serial;
+
+        /* Existing runtime rule */
+        if (g_hash_table_lookup_extended(self->modaliases, match, NULL, &v)) {
+                rule = GPOINTER_TO_UINT(v) - self->db.n_rules;
+                existing = &g_array_index(self->rules, LdmModaliasRule, rule);
+                existing->driver = new_rule.driver;
+                existing->package = new_rule.package;
+                return;
+        }
+
+        /* Rules from the precompiled database are overridden by ID */
+        if (ldm_modalias_plugin_find_db_rule(self, match, &rule)) {
+                if (!self->db.overrides) {
+                        self->db.overrides =
+                            g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_free);
+                }
+                existing = g_new(LdmModaliasRule, 1);
+                existing->match = self->db.strings + self->db.rules[rule].match;
+                existing->driver = new_rule.driver;
+                existing->package = new_rule.package;
+                g_hash_table_replace(self->db.overrides, GUINT_TO_POINTER(rule), existing);
+                return;
+        }
+
+        if (!self->strings) {
+                self->strings = g_string_chunk_new(4096);
+        }
+        match_copy = g_string_chunk_insert(self->strings, match);
+        new_rule.match = match_copy;
+
+        rule = self->db.n_rules + self->rules->len;
+        g_array_append_val(self->rules, new_rule);
+        ldm_modalias_fields_compile(match_copy, &filter);
+        g_array_append_val(self->filters, filter);
+        g_hash_table_insert(self->modaliases, match_copy, GUINT_TO_POINTER(rule));
+        ldm_modalias_index_insert(self->index, match_copy, rule);
 }
 
 /**
  * ldm_modalias_plugin_add_modalias:
  * @modalias: (transfer full): Modalias object to add to the table
  *
- * Add a new modalias object to the plugin table. This method will take a new
- * reference to the modalias.
+ * Add a new modalias rule to the plugin table. The rule is copied into the
+ * internal table, and the floating reference of the modalias is consumed.
  */
 void ldm_modalias_plugin_add_modalias(LdmModaliasPlugin *self, LdmModalias *modalias)
 {
@@ -235,41 +644,233 @@ void ldm_modalias_plugin_add_modalias(LdmModaliasPlugin *self, LdmModalias *moda
         g_return_if_fail(self != NULL);
         g_return_if_fail(modalias != NULL);
 
+        g_object_ref_sink(modalias);
+
         id = ldm_modalias_get_match(modalias);
         g_assert(id != NULL);
 
-        g_hash_table_replace(self->modaliases, g_strdup(id), g_object_ref_sink(modalias));
+        ldm_modalias_plugin_add_rule(self,
+                                     id,
+                                     ldm_modalias_get_driver(modalias),
+                                     ldm_modalias_get_package(modalias));
+        g_object_unref(modalias);
 }
 
 /**
- * ldm_modalias_plugin_get_provider:
- * @device: Test input device
+ * ldm_modalias_plugin_get_modalias:
+ * @match: Exact match string of the rule
  *
- * Walk our modaliases and attempt to find a match from one of those lines. If
- * we match the device off against our table, return a new #LdmProvider to help
- * configure that device.
+ * Look up the rule with the given match string, and construct a new
+ * #LdmModalias describing it.
  *
- * Returns: (transfer full) (nullable): A new #LdmProvider for the device
+ * Returns: (transfer full) (nullable): A new #LdmModalias if the rule exists
  */
-static LdmProvider *ldm_modalias_plugin_get_provider(LdmPlugin *plugin, LdmDevice *device)
+LdmModalias *ldm_modalias_plugin_get_modalias(LdmModaliasPlugin *self, const gchar *match)
 {
-        LdmModaliasPlugin *self = LDM_MODALIAS_PLUGIN(plugin);
-        LdmProvider *ret = NULL;
-        GHashTableIter iter = { 0 };
-        __ldm_unused__ gpointer key = NULL;
-        LdmModalias *modalias = NULL;
-
-        g_hash_table_iter_init(&iter, self->modaliases);
-        while (g_hash_table_iter_next(&iter, &key, (void **)&modalias)) {
-                if (!ldm_modalias_matches_device(modalias, device)) {
-                        continue;
+        LdmModaliasRule rule = { 0 };
+        gpointer v = NULL;
+        guint id = 0;
+
+        g_return_val_if_fail(self != NULL, NULL);
+        g_return_val_if_fail(match != NULL, NULL);
+
+        if (g_hash_table_lookup_extended(self->modaliases, match, NULL, &v)) {
+                id = GPOINTER_TO_UINT(v);
+        } else if (!ldm_modalias_plugin_find_db_rule(self, match, &id)) {
+                return NULL;
+        }
+
+        ldm_modalias_plugin_get_rule(self, id, &rule);
+        return g_object_ref_sink(ldm_modalias_new(rule.match, rule.driver, rule.package));
+}
+
+/**
+ * ldm_modalias_plugin_get_filter:
+ *
+ * Resolve a rule ID to its prefilter. The match string of a rule never
+ * changes once it has an ID, so overrides need no special handling.
+ */
+static inline const LdmModaliasFields *ldm_modalias_plugin_get_filter(LdmModaliasPlugin *self,
+                                                                     guint rule)
+{
+        if (rule >= self->db.n_rules) {
+                return &g_array_index(self->filters, LdmModaliasFields, rule - self->db.n_rules);
+        }
+        return &self->db.filters[rule];
+}
+
+/**
+ * ldm_modalias_plugin_compile_db_filters:
+ *
+ * Compile the prefilters for the precompiled database the first time it is
+ * searched, keeping loading itself free of any parsing. Searches may run on
+ * several threads at once, so this only ever happens once.
+ */
+static void ldm_modalias_plugin_compile_db_filters(LdmModaliasPlugin *self)
+{
+        if (!g_once_init_enter(&self->db.filters_ready)) {
+                return;
+        }
+
+        self->db.filters = g_new0(LdmModaliasFields, MAX(self->db.n_rules, 1));
+        for (guint32 i = 0; i < self->db.n_rules; i++) {
+                ldm_modalias_fields_compile(self->db.strings + self->db.rules[i].match,
+                                            &self->db.filters[i]);
+        }
+
+        g_once_init_leave(&self->db.filters_ready, 1);
+}
+
+/**
+ * ldm_modalias_plugin_foreach_rule:
+ * @func: Function to call for each rule
+ *
+ * Walk every rule in rule ID order, database rules first, with overrides
+ * applied. Used to build a #LdmModaliasMerged index over several plugins.
+ */
+void ldm_modalias_plugin_foreach_rule(LdmModaliasPlugin *self, LdmModaliasRuleFunc func,
+                                      gpointer user_data)
+{
+        guint32 n_rules = self->db.n_rules + self->rules->len;
+
+        if (self->db.index) {
+                ldm_modalias_plugin_compile_db_filters(self);
+        }
+
+        for (guint32 i = 0; i < n_rules; i++) {
+                LdmModaliasRule rule = { 0 };
+
+                ldm_modalias_plugin_get_rule(self, i, &rule);
+                func(i,
+                     rule.match,
+                     rule.driver,
+                     rule.package,
+                     ldm_modalias_plugin_get_filter(self, i),
+                     user_data);
+        }
+}
+
+/**
+ * ldm_modalias_plugin_get_serial:
+ *
+ * Returns: A counter bumped whenever a rule is added or replaced
+ */
+guint ldm_modalias_plugin_get_serial(LdmModaliasPlugin *self)
+{
+        return self->serial;
+}
+
+/**
+ * LdmModaliasSearch:
+ *
+ * State for a single lookup through our index
+ */
+typedef struct LdmModaliasSearch {
+        LdmModaliasPlugin *plugin;
+        const gchar *modalias;
+        LdmModaliasFields fields; /* Parsed form of the modalias */
+        guint best;
+} LdmModaliasSearch;
+
+/**
+ * ldm_modalias_plugin_check_rule:
+ *
+ * Check the wildcard portion of a candidate rule. We retain the lowest
+ * rule ID that matches so that results follow file order, and we can
+ * stop looking the moment the very first rule matches. Candidates whose
+ * literal IDs differ from those of the device are rejected up front.
+ */
+static gboolean ldm_modalias_plugin_check_rule(guint32 rule, gpointer user_data)
+{
+        LdmModaliasSearch *search = user_data;
+        LdmModaliasRule candidate = { 0 };
+
+        if (rule >= search->best) {
+                return FALSE;
+        }
+
+        if (ldm_modalias_fields_reject(ldm_modalias_plugin_get_filter(search->plugin, rule),
+                                       &search->fields)) {
+                return FALSE;
+        }
+
+        ldm_modalias_plugin_get_rule(search->plugin, rule, &candidate);
+        ldm_stats_add(LDM_STATS_FNMATCH_CALLS, 1);
+        if (fnmatch(candidate.match, search->modalias, 0) != 0) {
+                return FALSE;
+        }
+
+        search->best = rule;
+        return rule == 0;
+}
+
+/**
+ * ldm_modalias_plugin_search:
+ *
+ * Look up each modalias from the device subtree in our index to find the
+ * best matching rule, stopping early if the very first rule matches. Each
+ * modalias is parsed just once, up front, for the candidate prefilter.
+ */
+static void ldm_modalias_plugin_search(LdmModaliasSearch *search, LdmDevice *device)
+{
+        GPtrArray *modaliases = ldm_device_get_subtree_modaliases(device);
+
+        if (search->plugin->db.index) {
+                ldm_modalias_plugin_compile_db_filters(search->plugin);
+        }
+
+        for (guint i = 0; i < modaliases->len && search->best != 0; i++) {
+                search->modalias = modaliases->pdata[i];
+                ldm_modalias_fields_parse(search->modalias, &search->fields);
+                if (search->plugin->db.index) {
+                        ldm_modalias_index_lookup(search->plugin->db.index,
+                                                  search->modalias,
+                                                  ldm_modalias_plugin_check_rule,
+                                                  search);
                 }
+                ldm_modalias_index_lookup(search->plugin->index,
+                                          search->modalias,
+                                          ldm_modalias_plugin_check_rule,
+                                          search);
+        }
+}
 
-                ret = ldm_provider_new(plugin, device, ldm_modalias_get_package(modalias));
-                return ret;
+/**
+ * ldm_modalias_plugin_match:
+ * @device: Test input device
+ *
+ * Look up the device modalias (and those of its children) in our compiled
+ * index, only checking the wildcard portion of rules sharing a literal
+ * prefix with the modalias. If we match the device off against our table,
+ * fill @info to help configure that device. The strings are either
+ * interned or owned by our database, so nothing is allocated here.
+ *
+ * Returns: TRUE if a rule matched the device
+ */
+static gboolean ldm_modalias_plugin_match(LdmPlugin *plugin, LdmDevice *device,
+                                          LdmProviderInfo *info)
+{
+        LdmModaliasPlugin *self = LDM_MODALIAS_PLUGIN(plugin);
+        LdmModaliasSearch search = {
+                .plugin = self,
+                .modalias = NULL,
+                .fields = { 0 },
+                .best = G_MAXUINT,
+        };
+        LdmModaliasRule rule = { 0 };
+
+        ldm_modalias_plugin_search(&search, device);
+        if (search.best == G_MAXUINT) {
+                return FALSE;
         }
 
-        return NULL;
+        ldm_modalias_plugin_get_rule(self, search.best, &rule);
+        info->plugin = plugin;
+        info->device = device;
+        info->package = rule.package;
+        info->driver = rule.driver;
+
+        return TRUE;
 }
 
 /*
@@ -37,8 +37,10 @@ GType ldm_modalias_plugin_get_type(void);
 
 LdmPlugin *ldm_modalias_plugin_new(const gchar *name);
 LdmPlugin *ldm_modalias_plugin_new_from_filename(const gchar *filename);
+LdmPlugin *ldm_modalias_plugin_new_from_data(const gchar *name, const gchar *data, gsize len);
 
 void ldm_modalias_plugin_add_modalias(LdmModaliasPlugin *driver, LdmModalias *modalias);
+LdmModalias *ldm_modalias_plugin_get_modalias(LdmModaliasPlugin *driver, const gchar *match);
 
 G_END_DECLS
 
@@ -33,7 +33,8 @@ struct _LdmProvider {
 
         LdmDevice *device;
         LdmPlugin *plugin;
-        gchar *package;
+        const gchar *package; /* Interned */
+        const gchar *driver;  /* Interned, may be NULL */
         gboolean installed;
 };
 
@@ -44,7 +45,7 @@ static void ldm_provider_get_property(GObject *object, guint id, GValue *value,
 G_DEFINE_TYPE(LdmProvider, ldm_provider, G_TYPE_INITIALLY_UNOWNED)
 
 /* Property IDs */
-enum { PROP_DEVICE = 1, PROP_PLUGIN, PROP_PACKAGE, N_PROPS };
+enum { PROP_DEVICE = 1, PROP_PLUGIN, PROP_PACKAGE, PROP_DRIVER, N_PROPS };
 
 static GParamSpec *obj_properties[N_PROPS] = {
         NULL,
@@ -57,9 +58,6 @@ static GParamSpec *obj_properties[N_PROPS] = {
  */
 static void ldm_provider_dispose(GObject *obj)
 {
-        LdmProvider *self = LDM_PROVIDER(obj);
-        g_clear_pointer(&self->package, g_free);
-
         G_OBJECT_CLASS(ldm_provider_parent_class)->dispose(obj);
 }
 
@@ -114,6 +112,19 @@ static void ldm_provider_class_init(LdmProviderClass *klazz)
                                 NULL,
                                 G_PARAM_CONSTRUCT_ONLY | G_PARAM_READWRITE);
 
+        /**
+         * LdmProvider:driver: (nullable)
+         *
+         * The kernel driver supporting the device, when known to the
+         * #LdmProvider:plugin, such as the driver of a matching #LdmModalias.
+         */
+        obj_properties[PROP_DRIVER] =
+            g_param_spec_string("driver",
+                                "Kernel driver",
+                                "Kernel driver supporting the device",
+                                NULL,
+                                G_PARAM_CONSTRUCT_ONLY | G_PARAM_READWRITE);
+
         g_object_class_install_properties(obj_class, N_PROPS, obj_properties);
 }
 
@@ -130,8 +141,10 @@ static void ldm_provider_set_property(GObject *object, guint id, const GValue *v
                 self->plugin = g_value_get_pointer(value);
                 break;
         case PROP_PACKAGE:
-                g_clear_pointer(&self->package, g_free);
-                self->package = g_value_dup_string(value);
+                self->package = g_intern_string(g_value_get_string(value));
+                break;
+        case PROP_DRIVER:
+                self->driver = g_intern_string(g_value_get_string(value));
                 break;
         default:
                 G_OBJECT_WARN_INVALID_PROPERTY_ID(object, id, spec);
@@ -153,6 +166,9 @@ static void ldm_provider_get_property(GObject *object, guint id, GValue *value,
         case PROP_PACKAGE:
                 g_value_set_string(value, self->package);
                 break;
+        case PROP_DRIVER:
+                g_value_set_string(value, self->driver);
+                break;
         default:
                 G_OBJECT_WARN_INVALID_PROPERTY_ID(object, id, spec);
                 break;
@@ -192,6 +208,31 @@ LdmProvider *ldm_provider_new(LdmPlugin *parent_plugin, LdmDevice *device,
                             NULL);
 }
 
+/**
+ * ldm_provider_new_from_info:
+ * @info: A match result, as filled by #ldm_plugin_match
+ *
+ * Construct a new #LdmProvider holding the same information as @info,
+ * for callers or bindings needing a full object.
+ *
+ * Returns: (transfer full): A new #LdmProvider instance
+ */
+LdmProvider *ldm_provider_new_from_info(const LdmProviderInfo *info)
+{
+        g_return_val_if_fail(info != NULL, NULL);
+
+        return g_object_new(LDM_TYPE_PROVIDER,
+                            "plugin",
+                            info->plugin,
+                            "device",
+                            info->device,
+                            "package",
+                            info->package,
+                            "driver",
+                            info->driver,
+                            NULL);
+}
+
 /**
  * ldm_provider_get_device:
  *
@@ -233,6 +274,19 @@ const gchar *ldm_provider_get_package(LdmProvider *self)
         return (const gchar *)self->package;
 }
 
+/**
+ * ldm_provider_get_driver:
+ *
+ * Get the kernel driver supporting the device, if the plugin knows it.
+ *
+ * Returns: (transfer none) (nullable): The kernel driver name.
+ */
+const gchar *ldm_provider_get_driver(LdmProvider *self)
+{
+        g_return_val_if_fail(self != NULL, NULL);
+        return self->driver;
+}
+
 /*
  * Editor modelines  -  https://www.wireshark.org/tools/modelines.html
  *
@@ -19,10 +19,32 @@ G_BEGIN_DECLS
 
 typedef struct _LdmProvider LdmProvider;
 typedef struct _LdmProviderClass LdmProviderClass;
+typedef struct _LdmProviderInfo LdmProviderInfo;
 
 /* Fix circular references between Provider and Plugin */
 #include <plugin.h>
 
+/**
+ * LdmProviderInfo:
+ * @plugin: (transfer none): The plugin that matched
+ * @device: (transfer none): The device that was matched
+ * @package: (transfer none): The package or bundle name to install
+ * @driver: (transfer none) (nullable): The kernel driver, if known to the plugin
+ *
+ * A lightweight match result, holding the same information as an
+ * #LdmProvider without any allocation or references. Nothing is owned by
+ * the record, so it is only valid for as long as the plugin and device
+ * are, typically while the #LdmManager that produced it keeps them.
+ *
+ * Use #ldm_provider_new_from_info to obtain a full #LdmProvider.
+ */
+struct _LdmProviderInfo {
+        LdmPlugin *plugin;
+        LdmDevice *device;
+        const gchar *package;
+        const gchar *driver;
+};
+
 #define LDM_TYPE_PROVIDER ldm_provider_get_type()
 #define LDM_PROVIDER(o) (G_TYPE_CHECK_INSTANCE_CAST((o), LDM_TYPE_PROVIDER, LdmProvider))
 #define LDM_IS_PROVIDER(o) (G_TYPE_CHECK_INSTANCE_TYPE((o), LDM_TYPE_PROVIDER))
@@ -37,9 +59,11 @@ GType ldm_provider_get_type(void);
 
 LdmProvider *ldm_provider_new(LdmPlugin *parent_plugin, LdmDevice *device,
                               const gchar *package_name);
+LdmProvider *ldm_provider_new_from_info(const LdmProviderInfo *info);
 LdmDevice *ldm_provider_get_device(LdmProvider *provider);
 LdmPlugin *ldm_provider_get_plugin(LdmProvider *provider);
 const gchar *ldm_provider_get_package(LdmProvider *provider);
+const gchar *ldm_provider_get_driver(LdmProvider *provider);
 
 G_DEFINE_AUTOPTR_CLEANUP_FUNC(LdmProvider, g_object_unref)
 
@@ -0,0 +1,103 @@
+/*
+ * This file is part of linux-driver-management.
+ *
+ * Copyright © 2016-2018 Ikey Doherty
+ *
+ * linux-driver-management is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+#define _GNU_SOURCE
+
+#include <time.h>
+
+#include "stats.h"
+
+/* Only built with instrumentation enabled */
+
+guint64 ldm_stats_counters[LDM_STATS_N_COUNTERS] = { 0 };
+static guint64 ldm_stats_phases[LDM_STATS_N_PHASES] = { 0 };
+
+static const gchar *ldm_stats_phase_names[LDM_STATS_N_PHASES] = {
+        [LDM_STATS_PHASE_ENUMERATE] = "enumerate",
+        [LDM_STATS_PHASE_LOAD] = "load",
+        [LDM_STATS_PHASE_MATCH] = "match",
+        [LDM_STATS_PHASE_APPLY] = "apply",
+};
+
+/**
+ * ldm_stats_now:
+ *
+ * Monotonic time in nanoseconds
+ */
+static inline guint64 ldm_stats_now(void)
+{
+        struct timespec ts = { 0 };
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (guint64)ts.tv_sec * G_GUINT64_CONSTANT(1000000000) + (guint64)ts.tv_nsec;
+}
+
+/**
+ * ldm_stats_begin:
+ * @phase: Phase being entered
+ *
+ * Returns: An opaque start time, to be passed to ldm_stats_end
+ */
+guint64 ldm_stats_begin(__ldm_unused__ LdmStatsPhase phase)
+{
+        return ldm_stats_now();
+}
+
+/**
+ * ldm_stats_end:
+ * @phase: Phase being left
+ * @start: Value returned from the matching ldm_stats_begin
+ *
+ * Account the time spent in @phase, and emit a trace mark for it
+ */
+void ldm_stats_end(LdmStatsPhase phase, guint64 start)
+{
+        guint64 elapsed = ldm_stats_now() - start;
+
+        __atomic_add_fetch(&ldm_stats_phases[phase], elapsed, __ATOMIC_RELAXED);
+        g_log(LDM_STATS_TRACE_DOMAIN,
+              G_LOG_LEVEL_DEBUG,
+              "%s: %" G_GUINT64_FORMAT " ns",
+              ldm_stats_phase_names[phase],
+              elapsed);
+}
+
+/**
+ * ldm_stats_collect:
+ *
+ * Take a snapshot of the current totals
+ */
+void ldm_stats_collect(LdmManagerStats *stats)
+{
+#define LOAD(a) __atomic_load_n(&(a), __ATOMIC_RELAXED)
+        stats->enumerate_time = LOAD(ldm_stats_phases[LDM_STATS_PHASE_ENUMERATE]);
+        stats->load_time = LOAD(ldm_stats_phases[LDM_STATS_PHASE_LOAD]);
+        stats->match_time = LOAD(ldm_stats_phases[LDM_STATS_PHASE_MATCH]);
+        stats->apply_time = LOAD(ldm_stats_phases[LDM_STATS_PHASE_APPLY]);
+        stats->devices_constructed = LOAD(ldm_stats_counters[LDM_STATS_DEVICES_CONSTRUCTED]);
+        stats->fnmatch_calls = LOAD(ldm_stats_counters[LDM_STATS_FNMATCH_CALLS]);
+        stats->plugins_evaluated = LOAD(ldm_stats_counters[LDM_STATS_PLUGINS_EVALUATED]);
+        stats->bytes_read = LOAD(ldm_stats_counters[LDM_STATS_BYTES_READ]);
+#undef LOAD
+}
+
+/*
+ * Editor modelines  -  https://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: nil
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 expandtab:
+ * :indentSize=8:tabSize=8:noTabs=true:
+ */
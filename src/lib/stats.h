@@ -0,0 +1,108 @@
+/*
+ * This file is part of linux-driver-management.
+ *
+ * Copyright © 2016-2018 Ikey Doherty
+ *
+ * linux-driver-management is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+#pragma once
+
+#include <glib.h>
+#include <string.h>
+
+#include "config.h"
+#include "manager.h"
+#include "util.h"
+
+G_BEGIN_DECLS
+
+/*
+ * Private instrumentation API
+ *
+ * The counters are process wide, as plugins and devices don't know which
+ * manager they belong to, and are updated atomically as matching may run
+ * on the worker pool. Phase timers are accumulated in nanoseconds, and each
+ * completed phase is logged to the "ldm-trace" domain, so that running with
+ * G_MESSAGES_DEBUG=ldm-trace gives a simple trace of where time went.
+ *
+ * Instrumentation is off unless configured with -Dwith-instrumentation=true,
+ * and when built without it the whole API compiles away.
+ */
+#define LDM_STATS_TRACE_DOMAIN "ldm-trace"
+
+typedef enum {
+        LDM_STATS_PHASE_ENUMERATE = 0,
+        LDM_STATS_PHASE_LOAD,
+        LDM_STATS_PHASE_MATCH,
+        LDM_STATS_PHASE_APPLY,
+        LDM_STATS_N_PHASES,
+} LdmStatsPhase;
+
+typedef enum {
+        LDM_STATS_DEVICES_CONSTRUCTED = 0,
+        LDM_STATS_FNMATCH_CALLS,
+        LDM_STATS_PLUGINS_EVALUATED,
+        LDM_STATS_BYTES_READ,
+        LDM_STATS_N_COUNTERS,
+} LdmStatsCounter;
+
+#if LDM_ENABLE_INSTRUMENTATION
+
+extern guint64 ldm_stats_counters[LDM_STATS_N_COUNTERS];
+
+/**
+ * ldm_stats_add:
+ *
+ * Bump a counter by @n
+ */
+static inline void ldm_stats_add(LdmStatsCounter counter, guint64 n)
+{
+        __atomic_add_fetch(&ldm_stats_counters[counter], n, __ATOMIC_RELAXED);
+}
+
+guint64 ldm_stats_begin(LdmStatsPhase phase);
+void ldm_stats_end(LdmStatsPhase phase, guint64 start);
+void ldm_stats_collect(LdmManagerStats *stats);
+
+#else
+
+static inline void ldm_stats_add(__ldm_unused__ LdmStatsCounter counter,
+                                 __ldm_unused__ guint64 n)
+{
+}
+
+static inline guint64 ldm_stats_begin(__ldm_unused__ LdmStatsPhase phase)
+{
+        return 0;
+}
+
+static inline void ldm_stats_end(__ldm_unused__ LdmStatsPhase phase,
+                                 __ldm_unused__ guint64 start)
+{
+}
+
+static inline void ldm_stats_collect(LdmManagerStats *stats)
+{
+        memset(stats, 0, sizeof(*stats));
+}
+
+#endif
+
+G_END_DECLS
+
+/*
+ * Editor modelines  -  https://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: nil
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 expandtab:
+ * :indentSize=8:tabSize=8:noTabs=true:
+ */
@@ -12,6 +12,7 @@
 #define _GNU_SOURCE
 
 #include <libusb.h>
+#include <stdio.h>
 #include <stdlib.h>
 
 #include "device.h"
@@ -156,12 +157,26 @@ static void ldm_usb_device_assign_class(LdmDevice *self, int bDeviceClass)
         }
 }
 
-static void ldm_usb_device_assign_pvid(LdmDevice *self, udev_device *device)
+/**
+ * ldm_usb_device_assign_pvid:
+ *
+ * Assign product/vendor ID to the device from the PRODUCT uevent property,
+ * i.e. 46d/c52b/1211, falling back to the USB sysfs attributes
+ */
+static void ldm_usb_device_assign_pvid(LdmDevice *self, LdmDeviceRecord *record)
 {
         const char *sysattr = NULL;
+        unsigned int vendor_id = 0, product_id = 0;
+
+        sysattr = ldm_device_record_get_property(record, "PRODUCT");
+        if (sysattr && sscanf(sysattr, "%x/%x", &vendor_id, &product_id) == 2) {
+                self->id.vendor_id = (gint)vendor_id;
+                self->id.product_id = (gint)product_id;
+                return;
+        }
 
         /* Grab the idVendor (hex) */
-        sysattr = udev_device_get_sysattr_value(device, "idVendor");
+        sysattr = ldm_device_record_get_sysattr(record, "idVendor");
         if (!sysattr) {
                 goto product;
         }
@@ -171,7 +186,7 @@ static void ldm_usb_device_assign_pvid(LdmDevice *self, udev_device *device)
 product:
 
         /* Grab the idProduct (hex) */
-        sysattr = udev_device_get_sysattr_value(device, "idProduct");
+        sysattr = ldm_device_record_get_sysattr(record, "idProduct");
         if (!sysattr) {
                 return;
         }
@@ -180,27 +195,40 @@ product:
 
 /**
  * ldm_usb_device_init_private:
- * @device: The udev device that we're being created from
+ * @record: The record that we're being created from
  *
- * Handle USB specific initialisation
+ * Handle USB specific initialisation, preferring the uevent properties so
+ * that no sysfs attributes need reading
  */
-void ldm_usb_device_init_private(LdmDevice *self, udev_device *device)
+void ldm_usb_device_init_private(LdmDevice *self, LdmDeviceRecord *record)
 {
         const gchar *devtype = NULL;
         const gchar *sysattr = NULL;
+        const gchar *property = NULL;
+        const gchar *attribute = NULL;
         int iface_class = 0;
 
         /* Is this a USB interface? If so, we're gonna need a parent. */
-        devtype = udev_device_get_devtype(device);
+        devtype = ldm_device_record_get_devtype(record);
         if (devtype && g_str_equal(devtype, "usb_interface")) {
                 self->os.attributes |= LDM_DEVICE_ATTRIBUTE_INTERFACE;
-                sysattr = udev_device_get_sysattr_value(device, "bInterfaceClass");
+                property = "INTERFACE";
+                attribute = "bInterfaceClass";
         } else {
-                sysattr = udev_device_get_sysattr_value(device, "bDeviceClass");
+                property = "TYPE";
+                attribute = "bDeviceClass";
         }
 
-        ldm_usb_device_assign_pvid(self, device);
+        ldm_usb_device_assign_pvid(self, record);
+
+        /* The uevent has the class in decimal, i.e. INTERFACE=3/1/2 */
+        sysattr = ldm_device_record_get_property(record, property);
+        if (sysattr) {
+                ldm_usb_device_assign_class(self, (int)strtoll(sysattr, NULL, 10));
+                return;
+        }
 
+        sysattr = ldm_device_record_get_sysattr(record, attribute);
         if (!sysattr) {
                 return;
         }
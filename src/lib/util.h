@@ -11,6 +11,8 @@
 
 #pragma once
 
+#include <glib.h>
+
 /**
  * Utility macro to silence unused variable warnings
  */
@@ -35,6 +37,22 @@
  */
 #define autofree(N) __attribute__((cleanup(_autofree_func_##N))) N
 
+/**
+ * Copy a string for a GVariant "s", which must be valid UTF-8. hwdb and
+ * sysfs strings are just bytes, so invalid sequences are replaced, and
+ * NULL becomes the empty string.
+ */
+static inline gchar *ldm_utf8_dup(const gchar *str)
+{
+        if (!str) {
+                return g_strdup("");
+        }
+        if (g_utf8_validate(str, -1, NULL)) {
+                return g_strdup(str);
+        }
+        return g_utf8_make_valid(str, -1);
+}
+
 /*
  * Editor modelines  -  https://www.wireshark.org/tools/modelines.html
  *
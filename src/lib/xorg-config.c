@@ -0,0 +1,266 @@
+/*
+ * This file is part of linux-driver-management.
+ *
+ * Copyright © 2016-2018 Ikey Doherty
+ *
+ * linux-driver-management is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+#define _GNU_SOURCE
+
+#include <string.h>
+
+#include "xorg-config.h"
+
+static void ldm_xorg_section_free(LdmXorgSection *section)
+{
+        g_free(section->name);
+        g_free(section->identifier);
+        g_free(section->driver);
+        g_free(section->bus_id);
+        g_free(section);
+}
+
+/**
+ * ldm_xorg_config_keyword_is:
+ * @expected: Keyword without underscores
+ *
+ * Compare a keyword as X.Org does, ignoring case and underscores
+ */
+static gboolean ldm_xorg_config_keyword_is(const gchar *keyword, const gchar *expected)
+{
+        const gchar *k = keyword;
+
+        for (const gchar *e = expected; *e; e++, k++) {
+                while (*k == '_') {
+                        k++;
+                }
+                if (g_ascii_tolower(*k) != g_ascii_tolower(*e)) {
+                        return FALSE;
+                }
+        }
+        while (*k == '_') {
+                k++;
+        }
+
+        return *k == '\0';
+}
+
+/**
+ * ldm_xorg_config_tokenize:
+ * @line: Line to split in place
+ * @value: (out): First quoted argument, if any
+ *
+ * Split a line into its keyword and first quoted argument, dropping any
+ * comment. Further arguments are of no interest to us.
+ *
+ * Returns: The keyword, or NULL for a blank or comment line
+ */
+static gchar *ldm_xorg_config_tokenize(gchar *line, gchar **value)
+{
+        gchar *keyword = NULL;
+        gchar *c = line;
+        gchar end = '\0';
+
+        *value = NULL;
+
+        while (g_ascii_isspace(*c)) {
+                c++;
+        }
+        if (*c == '\0' || *c == '#') {
+                return NULL;
+        }
+
+        keyword = c;
+        while (*c && !g_ascii_isspace(*c) && *c != '"' && *c != '#') {
+                c++;
+        }
+        end = *c;
+        if (end == '\0') {
+                return keyword;
+        }
+        *c = '\0';
+        if (end == '#') {
+                return keyword;
+        }
+
+        /* Find the opening quote, unless we're already sat on it */
+        if (end != '"') {
+                c++;
+                while (g_ascii_isspace(*c)) {
+                        c++;
+                }
+                if (*c != '"') {
+                        return keyword;
+                }
+        }
+
+        *value = ++c;
+        while (*c && *c != '"') {
+                c++;
+        }
+        *c = '\0';
+
+        return keyword;
+}
+
+/**
+ * ldm_xorg_config_scan_data:
+ * @data: Contents of the configuration, modified in place
+ *
+ * Scan configuration data already in memory. Nothing in the result points
+ * into @data, so it may be freed straight away.
+ *
+ * Returns: (transfer full): The scanned configuration
+ */
+LdmXorgConfig *ldm_xorg_config_scan_data(gchar *data)
+{
+        LdmXorgConfig *self = NULL;
+        LdmXorgSection *section = NULL;
+        guint depth = 0; /* SubSection nesting within the current section */
+
+        self = g_new0(LdmXorgConfig, 1);
+        self->sections = g_ptr_array_new_with_free_func((GDestroyNotify)ldm_xorg_section_free);
+        self->drivers = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+
+        for (gchar *line = data, *next = NULL; line; line = next) {
+                gchar *keyword = NULL;
+                gchar *value = NULL;
+
+                next = strchr(line, '\n');
+                if (next) {
+                        *next++ = '\0';
+                }
+
+                keyword = ldm_xorg_config_tokenize(line, &value);
+                if (!keyword) {
+                        continue;
+                }
+
+                if (ldm_xorg_config_keyword_is(keyword, "Section")) {
+                        section = g_new0(LdmXorgSection, 1);
+                        section->name = g_strdup(value ? value : "");
+                        g_ptr_array_add(self->sections, section);
+                        depth = 0;
+                        continue;
+                }
+                if (ldm_xorg_config_keyword_is(keyword, "EndSection")) {
+                        section = NULL;
+                        depth = 0;
+                        continue;
+                }
+                if (ldm_xorg_config_keyword_is(keyword, "SubSection")) {
+                        ++depth;
+                        continue;
+                }
+                if (ldm_xorg_config_keyword_is(keyword, "EndSubSection")) {
+                        depth = depth > 0 ? depth - 1 : 0;
+                        continue;
+                }
+                if (!value) {
+                        continue;
+                }
+
+                /* Every driver counts, wherever it appears */
+                if (ldm_xorg_config_keyword_is(keyword, "Driver")) {
+                        g_hash_table_add(self->drivers, g_strdup(value));
+                        if (section && depth == 0 && !section->driver) {
+                                section->driver = g_strdup(value);
+                        }
+                        continue;
+                }
+
+                if (!section || depth > 0) {
+                        continue;
+                }
+                if (!section->identifier && ldm_xorg_config_keyword_is(keyword, "Identifier")) {
+                        section->identifier = g_strdup(value);
+                } else if (!section->bus_id && ldm_xorg_config_keyword_is(keyword, "BusID")) {
+                        section->bus_id = g_strdup(value);
+                }
+        }
+
+        return self;
+}
+
+/**
+ * ldm_xorg_config_scan:
+ * @path: X.Org configuration file to read
+ *
+ * Read and scan the configuration file in a single pass
+ *
+ * Returns: (transfer full) (nullable): The scanned configuration, or NULL on error
+ */
+LdmXorgConfig *ldm_xorg_config_scan(const gchar *path, GError **error)
+{
+        g_autofree gchar *contents = NULL;
+
+        if (!g_file_get_contents(path, &contents, NULL, error)) {
+                return NULL;
+        }
+
+        return ldm_xorg_config_scan_data(contents);
+}
+
+void ldm_xorg_config_free(LdmXorgConfig *self)
+{
+        if (!self) {
+                return;
+        }
+
+        g_ptr_array_unref(self->sections);
+        g_hash_table_unref(self->drivers);
+        g_free(self);
+}
+
+/**
+ * ldm_xorg_config_has_driver:
+ * @driver: X.Org driver module name, i.e. "nvidia"
+ *
+ * Returns: TRUE if the driver is referenced anywhere in the configuration
+ */
+gboolean ldm_xorg_config_has_driver(LdmXorgConfig *self, const gchar *driver)
+{
+        return g_hash_table_contains(self->drivers, driver);
+}
+
+/**
+ * ldm_xorg_config_find_section:
+ * @name: Section type, i.e. "Device"
+ * @driver: (nullable): Driver the section must use, or NULL for any
+ *
+ * Returns: (transfer none) (nullable): The first matching section, if any
+ */
+LdmXorgSection *ldm_xorg_config_find_section(LdmXorgConfig *self, const gchar *name,
+                                             const gchar *driver)
+{
+        for (guint i = 0; i < self->sections->len; i++) {
+                LdmXorgSection *section = self->sections->pdata[i];
+
+                if (!ldm_xorg_config_keyword_is(section->name, name)) {
+                        continue;
+                }
+                if (driver && g_strcmp0(section->driver, driver) != 0) {
+                        continue;
+                }
+                return section;
+        }
+
+        return NULL;
+}
+
+/*
+ * Editor modelines  -  https://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: nil
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 expandtab:
+ * :indentSize=8:tabSize=8:noTabs=true:
+ */
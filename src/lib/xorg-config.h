@@ -0,0 +1,64 @@
+/*
+ * This file is part of linux-driver-management.
+ *
+ * Copyright © 2016-2018 Ikey Doherty
+ *
+ * linux-driver-management is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+#pragma once
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/*
+ * LdmXorgConfig
+ *
+ * Private result of scanning an X.Org configuration file in a single pass.
+ * Only the handful of entries we act upon are kept: every top level section
+ * with its Identifier, Driver and BusID, along with the set of all Driver
+ * values appearing anywhere in the file, subsections included.
+ *
+ * Keywords are matched the way X.Org does, ignoring case and underscores,
+ * and comments are dropped, so a commented out Driver is never reported.
+ */
+typedef struct LdmXorgSection {
+        gchar *name;       /* Section type, i.e. "Device" */
+        gchar *identifier; /* Nullable */
+        gchar *driver;     /* Nullable */
+        gchar *bus_id;     /* Nullable */
+} LdmXorgSection;
+
+typedef struct LdmXorgConfig {
+        GPtrArray *sections; /* LdmXorgSection, in file order */
+        GHashTable *drivers; /* Set of every Driver value */
+} LdmXorgConfig;
+
+LdmXorgConfig *ldm_xorg_config_scan(const gchar *path, GError **error);
+LdmXorgConfig *ldm_xorg_config_scan_data(gchar *data);
+void ldm_xorg_config_free(LdmXorgConfig *config);
+
+gboolean ldm_xorg_config_has_driver(LdmXorgConfig *config, const gchar *driver);
+LdmXorgSection *ldm_xorg_config_find_section(LdmXorgConfig *config, const gchar *name,
+                                             const gchar *driver);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(LdmXorgConfig, ldm_xorg_config_free)
+
+G_END_DECLS
+
+/*
+ * Editor modelines  -  https://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: nil
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 expandtab:
+ * :indentSize=8:tabSize=8:noTabs=true:
+ */
@@ -17,6 +17,7 @@
 #include <stdlib.h>
 #include <unistd.h>
 
+#include "ldm-dbus.h"
 #include "util.h"
 #include <ldm.h>
 
@@ -49,13 +50,46 @@ static int ldm_session_init_configure_optimus(void)
         return EXIT_SUCCESS;
 }
 
+/**
+ * Apply the session configuration for the given GPU topology
+ */
+static int ldm_session_init_apply(LdmGPUType gpu_type)
+{
+        /* We only know Optimus right now.. */
+        if ((gpu_type & LDM_GPU_TYPE_OPTIMUS) == LDM_GPU_TYPE_OPTIMUS) {
+                return ldm_session_init_configure_optimus();
+        }
+
+        g_warning("ldm-session-init invoked with an unknown configuration!");
+        return EXIT_FAILURE;
+}
+
 static int ldm_session_init_configure(void)
 {
         g_autoptr(LdmManager) manager = NULL;
         g_autoptr(LdmGPUConfig) config = NULL;
+        g_autoptr(GVariant) reply = NULL;
+        LdmGPUType gpu_type = LDM_GPU_TYPE_SIMPLE;
+
+        /* Topology persisted by `ldm configure` is still valid, skip udev entirely */
+        if (ldm_gpu_config_read_cache(LDM_GPU_CACHE_FILE, &gpu_type)) {
+                return ldm_session_init_apply(gpu_type);
+        }
+
+        /* Otherwise a running ldm-daemon already knows the answer */
+        reply = ldm_dbus_call("GetGPUConfig",
+                              NULL,
+                              G_VARIANT_TYPE("(" LDM_DBUS_GPU_CONFIG_TYPE ")"));
+        if (reply) {
+                guint32 daemon_type = 0;
+
+                g_variant_get(reply, "((u&s&s&s))", &daemon_type, NULL, NULL, NULL);
+                return ldm_session_init_apply((LdmGPUType)daemon_type);
+        }
 
         /* Grab manager now */
-        manager = ldm_manager_new(LDM_MANAGER_FLAGS_NO_MONITOR | LDM_MANAGER_FLAGS_GPU_QUICK);
+        manager = ldm_manager_new(LDM_MANAGER_FLAGS_NO_MONITOR | LDM_MANAGER_FLAGS_GPU_QUICK |
+                                  LDM_MANAGER_FLAGS_SNAPSHOT);
         if (!manager) {
                 return EXIT_FAILURE;
         }
@@ -66,13 +100,7 @@ static int ldm_session_init_configure(void)
                 return EXIT_FAILURE;
         }
 
-        /* We only know Optimus right now.. */
-        if (ldm_gpu_config_has_type(config, LDM_GPU_TYPE_OPTIMUS)) {
-                return ldm_session_init_configure_optimus();
-        }
-
-        g_warning("ldm-session-init invoked with an unknown configuration!");
-        return EXIT_FAILURE;
+        return ldm_session_init_apply(ldm_gpu_config_get_gpu_type(config));
 }
 
 /**
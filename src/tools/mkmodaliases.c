@@ -11,8 +11,11 @@
 
 #define _GNU_SOURCE
 
+#include "../lib/modalias-db.h"
+#include "../lib/modalias-index.h"
 #include "../lib/util.h"
 #include "config.h"
+#include "modalias-optimise.h"
 
 #include <errno.h>
 #include <glib.h>
@@ -26,7 +29,6 @@ typedef struct kmod_ctx kmod_ctx;
 typedef struct kmod_module kmod_module;
 typedef struct kmod_list kmod_list;
 
-DEF_AUTOFREE(kmod_ctx, kmod_unref)
 DEF_AUTOFREE(kmod_module, kmod_module_unref)
 DEF_AUTOFREE(kmod_list, kmod_module_info_free_list)
 
@@ -53,6 +55,10 @@ the Free Software Foundation; either version 2.1 of the License, or\n\
  */
 
 static gboolean opt_version = FALSE;
+static gboolean opt_binary = FALSE;
+static gboolean opt_incremental = FALSE;
+static gboolean opt_optimise = FALSE;
+static gint opt_jobs = 0;
 static gchar *opt_filename = NULL;
 static gchar **opt_strings = NULL;
 
@@ -65,6 +71,34 @@ static GOptionEntry cli_entries[] = {
           &opt_filename,
           "Redirect to the given file",
           NULL },
+        { "binary",
+          'b',
+          0,
+          G_OPTION_ARG_NONE,
+          &opt_binary,
+          "Emit a precompiled modalias database",
+          NULL },
+        { "jobs",
+          'j',
+          0,
+          G_OPTION_ARG_INT,
+          &opt_jobs,
+          "Number of modules to examine concurrently",
+          "N" },
+        { "incremental",
+          'i',
+          0,
+          G_OPTION_ARG_NONE,
+          &opt_incremental,
+          "Skip modules left unchanged since the last run",
+          NULL },
+        { "optimise",
+          'O',
+          0,
+          G_OPTION_ARG_NONE,
+          &opt_optimise,
+          "Drop duplicate and redundant aliases",
+          NULL },
         { G_OPTION_REMAINING,
           0,
           0,
@@ -76,19 +110,215 @@ static GOptionEntry cli_entries[] = {
 };
 
 /**
- * Examine just one kmod module and emit the info to the output file.
+ * In-memory representation of a precompiled database while we build it
+ */
+typedef struct ModaliasDb {
+        GArray *rules;       /* LdmModaliasDbRule */
+        GString *strings;    /* Interned string table */
+        GHashTable *offsets; /* String to offset within the table */
+        GHashTable *matches; /* Match to rule ID */
+        LdmModaliasIndex *index;
+} ModaliasDb;
+
+static ModaliasDb *modalias_db_new(void)
+{
+        ModaliasDb *ret = g_new0(ModaliasDb, 1);
+
+        ret->rules = g_array_new(FALSE, TRUE, sizeof(LdmModaliasDbRule));
+        ret->strings = g_string_new(NULL);
+        ret->offsets = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+        ret->matches = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+        ret->index = ldm_modalias_index_new();
+
+        return ret;
+}
+
+static void modalias_db_free(ModaliasDb *db)
+{
+        g_array_unref(db->rules);
+        g_string_free(db->strings, TRUE);
+        g_hash_table_unref(db->offsets);
+        g_hash_table_unref(db->matches);
+        ldm_modalias_index_free(db->index);
+        g_free(db);
+}
+
+DEF_AUTOFREE(ModaliasDb, modalias_db_free)
+
+/**
+ * Return the offset of the string within the string table, storing it
+ * only if we haven't seen it yet.
+ */
+static guint32 modalias_db_intern(ModaliasDb *db, const gchar *str)
+{
+        gpointer v = NULL;
+        guint32 offset = 0;
+
+        if (g_hash_table_lookup_extended(db->offsets, str, NULL, &v)) {
+                return GPOINTER_TO_UINT(v);
+        }
+
+        offset = (guint32)db->strings->len;
+        g_string_append_len(db->strings, str, (gssize)strlen(str) + 1);
+        g_hash_table_insert(db->offsets, g_strdup(str), GUINT_TO_POINTER(offset));
+
+        return offset;
+}
+
+/**
+ * Add a rule to the database. As with the text format, a later rule with
+ * the same match replaces the earlier one, retaining its position.
+ */
+static void modalias_db_add(ModaliasDb *db, const gchar *match, const gchar *driver,
+                            const gchar *package)
+{
+        LdmModaliasDbRule rule = { 0 };
+        gpointer v = NULL;
+        guint32 id = 0;
+
+        rule.match = modalias_db_intern(db, match);
+        rule.driver = modalias_db_intern(db, driver);
+        rule.package = modalias_db_intern(db, package);
+
+        if (g_hash_table_lookup_extended(db->matches, match, NULL, &v)) {
+                g_array_index(db->rules, LdmModaliasDbRule, GPOINTER_TO_UINT(v)) = rule;
+                return;
+        }
+
+        id = db->rules->len;
+        g_array_append_val(db->rules, rule);
+        g_hash_table_insert(db->matches, g_strdup(match), GUINT_TO_POINTER(id));
+        ldm_modalias_index_insert(db->index, match, id);
+}
+
+/**
+ * Serialise the database to the output file, in the layout described
+ * within modalias-db.h
+ */
+static gboolean modalias_db_write(ModaliasDb *db, FILE *fileh)
+{
+        LdmModaliasDbHeader header = { 0 };
+
+        /* Pad the string table to keep the file size aligned */
+        while (db->strings->len % 4 != 0) {
+                g_string_append_c(db->strings, '\0');
+        }
+        if (db->strings->len == 0) {
+                g_string_append_len(db->strings, "\0\0\0\0", 4);
+        }
+
+        memcpy(header.magic, LDM_MODALIAS_DB_MAGIC, sizeof(header.magic));
+        header.version = LDM_MODALIAS_DB_VERSION;
+        header.byte_order = LDM_MODALIAS_DB_BYTE_ORDER;
+        header.n_rules = db->rules->len;
+        header.n_nodes = db->index->n_nodes;
+        header.n_entries = db->index->n_entries;
+        header.strings_size = (guint32)db->strings->len;
+
+        if (fwrite(&header, sizeof(header), 1, fileh) != 1) {
+                return FALSE;
+        }
+        if (db->rules->len > 0 &&
+            fwrite(db->rules->data, sizeof(LdmModaliasDbRule), db->rules->len, fileh) !=
+                db->rules->len) {
+                return FALSE;
+        }
+        if (fwrite(db->index->nodes, sizeof(LdmModaliasIndexNode), db->index->n_nodes, fileh) !=
+            db->index->n_nodes) {
+                return FALSE;
+        }
+        if (fwrite(db->index->entries,
+                   sizeof(LdmModaliasIndexEntry),
+                   db->index->n_entries,
+                   fileh) != db->index->n_entries) {
+                return FALSE;
+        }
+        if (fwrite(db->strings->str, 1, db->strings->len, fileh) != db->strings->len) {
+                return FALSE;
+        }
+
+        return TRUE;
+}
+
+/* Version of the incremental manifest format */
+#define MANIFEST_VERSION 1
+
+/**
+ * A single module to examine, whose aliases are gathered by a worker and
+ * then merged on the main thread in the order given on the command line.
+ */
+typedef struct ModuleJob {
+        const gchar *path;
+        gchar *checksum;        /* Content hash, only in incremental mode */
+        gchar *name;            /* Kernel module name */
+        GPtrArray *aliases;     /* Alias patterns, in module order */
+        gchar *error;           /* Set if the module couldn't be examined */
+        gchar *cached_checksum; /* From the manifest, if the module was known */
+        gchar *cached_name;
+        gchar **cached_aliases;
+} ModuleJob;
+
+static void module_job_clear(ModuleJob *job)
+{
+        g_free(job->checksum);
+        g_free(job->name);
+        if (job->aliases) {
+                g_ptr_array_unref(job->aliases);
+        }
+        g_free(job->error);
+        g_free(job->cached_checksum);
+        g_free(job->cached_name);
+        g_strfreev(job->cached_aliases);
+}
+
+/**
+ * Each worker thread keeps its own kmod context, as they cannot be shared
+ */
+static GPrivate worker_ctx = G_PRIVATE_INIT((GDestroyNotify)kmod_unref);
+
+static kmod_ctx *worker_get_ctx(void)
+{
+        kmod_ctx *ctx = g_private_get(&worker_ctx);
+
+        if (!ctx) {
+                /* Open kmod context with no host kernel knowledge */
+                ctx = kmod_new(NULL, NULL);
+                g_private_set(&worker_ctx, ctx);
+        }
+
+        return ctx;
+}
+
+/**
+ * Hash the contents of the module, mapping rather than reading it in
+ */
+static gchar *module_checksum(const gchar *path, GError **error)
+{
+        g_autoptr(GMappedFile) mapped = NULL;
+
+        mapped = g_mapped_file_new(path, FALSE, error);
+        if (!mapped) {
+                return NULL;
+        }
+
+        return g_compute_checksum_for_data(G_CHECKSUM_SHA256,
+                                           (const guchar *)g_mapped_file_get_contents(mapped),
+                                           g_mapped_file_get_length(mapped));
+}
+
+/**
+ * Examine just one kmod module, gathering its aliases into the job
  */
-static gboolean examine_module(const gchar *package_name, FILE *fileh, kmod_module *module)
+static gboolean examine_module(ModuleJob *job, kmod_module *module)
 {
-        const char *kname = NULL;
         autofree(kmod_list) *list = NULL;
         kmod_list *iter = NULL;
 
-        kname = kmod_module_get_name(module);
+        job->name = g_strdup(kmod_module_get_name(module));
 
         /* Attempt probe */
         if (kmod_module_get_info(module, &list) < 0) {
-                fprintf(stderr, "Couldn't probe module '%s'\n", kname);
+                job->error = g_strdup_printf("Couldn't probe module '%s'", job->name);
                 return FALSE;
         };
 
@@ -99,27 +329,137 @@ static gboolean examine_module(const gchar *package_name, FILE *fileh, kmod_modu
                 if (!key || !g_str_equal(key, "alias")) {
                         continue;
                 }
-                const char *value = kmod_module_info_get_value(iter);
-                if (fprintf(fileh, "alias %s %s %s\n", value, kname, package_name) < 0) {
-                        return FALSE;
-                }
+                g_ptr_array_add(job->aliases, g_strdup(kmod_module_info_get_value(iter)));
         };
 
         return TRUE;
 }
 
+/**
+ * Runs on the worker pool. Modules left unchanged since the manifest was
+ * written are never opened by kmod at all.
+ */
+static void module_worker(gpointer data, __ldm_unused__ gpointer user_data)
+{
+        ModuleJob *job = data;
+        autofree(kmod_module) *module = NULL;
+        g_autoptr(GError) error = NULL;
+        kmod_ctx *ctx = NULL;
+
+        job->aliases = g_ptr_array_new_with_free_func(g_free);
+
+        if (opt_incremental) {
+                job->checksum = module_checksum(job->path, &error);
+                if (!job->checksum) {
+                        job->error = g_strdup_printf("Couldn't read module: %s", error->message);
+                        return;
+                }
+                if (job->cached_checksum && job->cached_name &&
+                    g_str_equal(job->checksum, job->cached_checksum)) {
+                        job->name = g_strdup(job->cached_name);
+                        for (guint i = 0; job->cached_aliases && job->cached_aliases[i]; i++) {
+                                g_ptr_array_add(job->aliases, g_strdup(job->cached_aliases[i]));
+                        }
+                        return;
+                }
+        }
+
+        ctx = worker_get_ctx();
+        if (!ctx) {
+                job->error = g_strdup_printf("Cannot init kmod: %s", strerror(errno));
+                return;
+        }
+
+        if (kmod_module_new_from_path(ctx, job->path, &module) != 0) {
+                job->error = g_strdup_printf("Couldn't open module: %s %s",
+                                             job->path,
+                                             strerror(errno));
+                return;
+        }
+
+        examine_module(job, module);
+}
+
+/**
+ * Path of the sidecar manifest used in incremental mode
+ */
+static gchar *manifest_path(void)
+{
+        return g_strconcat(opt_filename, ".manifest", NULL);
+}
+
+/**
+ * Seed the jobs with whatever the manifest knows of each module. A missing
+ * or unreadable manifest simply means every module is examined.
+ */
+static void manifest_load(ModuleJob *jobs, guint n_jobs)
+{
+        g_autoptr(GKeyFile) file = NULL;
+        g_autofree gchar *path = manifest_path();
+
+        file = g_key_file_new();
+        if (!g_key_file_load_from_file(file, path, G_KEY_FILE_NONE, NULL) ||
+            g_key_file_get_integer(file, "Manifest", "Version", NULL) != MANIFEST_VERSION) {
+                return;
+        }
+
+        for (guint i = 0; i < n_jobs; i++) {
+                if (!g_key_file_has_group(file, jobs[i].path)) {
+                        continue;
+                }
+                jobs[i].cached_checksum =
+                    g_key_file_get_string(file, jobs[i].path, "Checksum", NULL);
+                jobs[i].cached_name = g_key_file_get_string(file, jobs[i].path, "Name", NULL);
+                jobs[i].cached_aliases =
+                    g_key_file_get_string_list(file, jobs[i].path, "Aliases", NULL, NULL);
+        }
+}
+
+/**
+ * Record every module of this run, dropping any no longer given. Failure
+ * is not fatal, the next run will just examine everything again.
+ */
+static void manifest_save(ModuleJob *jobs, guint n_jobs)
+{
+        g_autoptr(GKeyFile) file = NULL;
+        g_autoptr(GError) error = NULL;
+        g_autofree gchar *path = manifest_path();
+
+        file = g_key_file_new();
+        g_key_file_set_integer(file, "Manifest", "Version", MANIFEST_VERSION);
+        for (guint i = 0; i < n_jobs; i++) {
+                ModuleJob *job = &jobs[i];
+
+                g_key_file_set_string(file, job->path, "Checksum", job->checksum);
+                g_key_file_set_string(file, job->path, "Name", job->name);
+                g_key_file_set_string_list(file,
+                                           job->path,
+                                           "Aliases",
+                                           (const gchar *const *)job->aliases->pdata,
+                                           job->aliases->len);
+        }
+
+        if (!g_key_file_save_to_file(file, path, &error)) {
+                fprintf(stderr, "Failed to write manifest %s: %s\n", path, error->message);
+        }
+}
+
 /**
  * Construct a modaliases file for the given package name and module paths.
  */
 static int mkmodaliases(const char *package_name, gchar **paths, guint n_paths)
 {
         FILE *output_file = NULL;
-        autofree(kmod_ctx) *ctx = NULL;
+        autofree(ModaliasDb) *db = NULL;
+        g_autofree ModuleJob *jobs = NULL;
+        g_autoptr(GArray) entries = NULL;
+        GThreadPool *pool = NULL;
+        guint n_threads = 0;
         int ret = EXIT_FAILURE;
 
         /* Default to stdout if no path is set */
         if (opt_filename) {
-                output_file = fopen(opt_filename, "w");
+                output_file = fopen(opt_filename, opt_binary ? "wb" : "w");
         } else {
                 output_file = stdout;
         }
@@ -130,25 +470,85 @@ static int mkmodaliases(const char *package_name, gchar **paths, guint n_paths)
                 return EXIT_FAILURE;
         }
 
-        /* Open kmod context with no host kernel knowledge */
-        ctx = kmod_new(NULL, NULL);
-        if (!ctx) {
-                fprintf(stderr, "Cannot init kmod: %s\n", strerror(errno));
-                goto cleanup;
+        if (opt_binary) {
+                db = modalias_db_new();
         }
 
-        /* Walk all modules and pass our fileh */
+        jobs = g_new0(ModuleJob, n_paths);
         for (guint i = 0; i < n_paths; i++) {
-                const gchar *kpath = paths[i];
-                autofree(kmod_module) *module = NULL;
+                jobs[i].path = paths[i];
+        }
+        if (opt_incremental) {
+                manifest_load(jobs, n_paths);
+        }
 
-                int ret = kmod_module_new_from_path(ctx, kpath, &module);
-                if (ret != 0) {
-                        fprintf(stderr, "Couldn't open module: %s %s\n", kpath, strerror(errno));
+        /* Examine every module concurrently */
+        n_threads = opt_jobs > 0 ? (guint)opt_jobs : g_get_num_processors();
+        n_threads = MIN(n_threads, n_paths);
+        if (n_threads > 1) {
+                pool = g_thread_pool_new(module_worker, NULL, (gint)n_threads, FALSE, NULL);
+        }
+        for (guint i = 0; i < n_paths; i++) {
+                if (!pool || !g_thread_pool_push(pool, &jobs[i], NULL)) {
+                        module_worker(&jobs[i], NULL);
+                }
+        }
+        if (pool) {
+                g_thread_pool_free(pool, FALSE, TRUE);
+        }
+
+        /* Merge in the order given, so the output never depends on timing */
+        for (guint i = 0; i < n_paths; i++) {
+                if (jobs[i].error) {
+                        fprintf(stderr, "%s\n", jobs[i].error);
                         goto cleanup;
                 }
+        }
+
+        entries = g_array_new(FALSE, FALSE, sizeof(ModaliasEntry));
+        for (guint i = 0; i < n_paths; i++) {
+                for (guint j = 0; j < jobs[i].aliases->len; j++) {
+                        ModaliasEntry entry = {
+                                .match = jobs[i].aliases->pdata[j],
+                                .driver = jobs[i].name,
+                        };
+                        g_array_append_val(entries, entry);
+                }
+        }
+        if (opt_optimise) {
+                GArray *optimised = modalias_optimise_entries(entries);
 
-                if (!examine_module(package_name, output_file, module)) {
+                g_array_unref(entries);
+                entries = optimised;
+        }
+
+        if (db) {
+                for (guint i = 0; i < entries->len; i++) {
+                        ModaliasEntry *entry = &g_array_index(entries, ModaliasEntry, i);
+
+                        modalias_db_add(db, entry->match, entry->driver, package_name);
+                }
+
+                /* Flush the complete database now */
+                if (!modalias_db_write(db, output_file)) {
+                        fprintf(stderr, "Failed to write modalias database: %s\n", strerror(errno));
+                        goto cleanup;
+                }
+        } else {
+                g_autoptr(GString) text = g_string_new(NULL);
+
+                for (guint i = 0; i < entries->len; i++) {
+                        ModaliasEntry *entry = &g_array_index(entries, ModaliasEntry, i);
+
+                        g_string_append_printf(text,
+                                               "alias %s %s %s\n",
+                                               entry->match,
+                                               entry->driver,
+                                               package_name);
+                }
+
+                if (fwrite(text->str, 1, text->len, output_file) != text->len) {
+                        fprintf(stderr, "Failed to write modaliases: %s\n", strerror(errno));
                         goto cleanup;
                 }
         }
@@ -158,7 +558,10 @@ static int mkmodaliases(const char *package_name, gchar **paths, guint n_paths)
 
 cleanup:
         if (output_file != stdout) {
-                fflush(output_file);
+                if (fflush(output_file) != 0 && ret == EXIT_SUCCESS) {
+                        fprintf(stderr, "Failed to write %s: %s\n", opt_filename, strerror(errno));
+                        ret = EXIT_FAILURE;
+                }
                 fclose(output_file);
 
                 if (ret != EXIT_SUCCESS && unlink(opt_filename) != 0) {
@@ -169,6 +572,15 @@ cleanup:
                 }
         }
 
+        /* Only a complete run may seed the next one */
+        if (ret == EXIT_SUCCESS && opt_incremental) {
+                manifest_save(jobs, n_paths);
+        }
+
+        for (guint i = 0; i < n_paths; i++) {
+                module_job_clear(&jobs[i]);
+        }
+
         return ret;
 }
 
@@ -203,6 +615,12 @@ int main(int argc, char **argv)
 
         package_name = opt_strings[0];
 
+        /* The manifest lives alongside the output */
+        if (opt_incremental && !opt_filename) {
+                fprintf(stderr, "--incremental requires --output\n");
+                goto cleanup;
+        }
+
         /* Make sure they all exist now */
         for (guint i = 1; i < n_strings; i++) {
                 if (access(opt_strings[i], F_OK) != 0) {
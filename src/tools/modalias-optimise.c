@@ -0,0 +1,355 @@
+/*
+ * This file is part of linux-driver-management.
+ *
+ * Copyright © 2016-2018 Ikey Doherty
+ *
+ * linux-driver-management is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+#define _GNU_SOURCE
+
+#include <fnmatch.h>
+#include <string.h>
+
+#include "modalias-optimise.h"
+
+typedef enum {
+        GLOB_LITERAL = 0,
+        GLOB_ANY,   /* ? */
+        GLOB_STAR,  /* * */
+        GLOB_CLASS, /* [...] */
+} GlobKind;
+
+typedef struct GlobToken {
+        GlobKind kind;
+        gchar c;            /* GLOB_LITERAL only */
+        const gchar *start; /* GLOB_CLASS only, brackets included */
+        gsize len;
+} GlobToken;
+
+/**
+ * Split a pattern into glob tokens, collapsing runs of stars. Escapes and
+ * character classes beyond a plain set or range are refused, and such
+ * patterns are simply left alone by the optimiser.
+ */
+static GArray *glob_tokenize(const gchar *pattern)
+{
+        g_autoptr(GArray) tokens = g_array_new(FALSE, TRUE, sizeof(GlobToken));
+
+        for (const gchar *c = pattern; *c; c++) {
+                GlobToken token = { 0 };
+
+                switch (*c) {
+                case '\\':
+                        return NULL;
+                case '?':
+                        token.kind = GLOB_ANY;
+                        break;
+                case '*':
+                        if (tokens->len > 0 &&
+                            g_array_index(tokens, GlobToken, tokens->len - 1).kind == GLOB_STAR) {
+                                continue;
+                        }
+                        token.kind = GLOB_STAR;
+                        break;
+                case '[':
+                        token.kind = GLOB_CLASS;
+                        token.start = c++;
+                        if (*c == '!' || *c == '^') {
+                                c++;
+                        }
+                        if (*c == ']') {
+                                c++;
+                        }
+                        while (*c && *c != ']') {
+                                if (*c == '[' || *c == '\\') {
+                                        return NULL;
+                                }
+                                c++;
+                        }
+                        if (*c != ']') {
+                                return NULL;
+                        }
+                        token.len = (gsize)(c - token.start) + 1;
+                        break;
+                default:
+                        token.kind = GLOB_LITERAL;
+                        token.c = *c;
+                        break;
+                }
+                g_array_append_val(tokens, token);
+        }
+
+        return g_steal_pointer(&tokens);
+}
+
+/**
+ * Determine whether the broader token matches every character the other
+ * one could
+ */
+static gboolean glob_token_covers(const GlobToken *broad, const GlobToken *narrow)
+{
+        g_autofree gchar *class = NULL;
+        const gchar single[2] = { narrow->c, '\0' };
+
+        switch (broad->kind) {
+        case GLOB_ANY:
+                return TRUE;
+        case GLOB_LITERAL:
+                return narrow->kind == GLOB_LITERAL && narrow->c == broad->c;
+        case GLOB_CLASS:
+                if (narrow->kind == GLOB_CLASS) {
+                        return narrow->len == broad->len &&
+                               strncmp(narrow->start, broad->start, broad->len) == 0;
+                }
+                if (narrow->kind != GLOB_LITERAL) {
+                        return FALSE;
+                }
+                class = g_strndup(broad->start, broad->len);
+                return fnmatch(class, single, 0) == 0;
+        default:
+                return FALSE;
+        }
+}
+
+/**
+ * Determine whether every string matched by the narrow pattern is also
+ * matched by the broad one. This errs on the side of caution, and may
+ * well say no for some pattern pairs where the answer is yes.
+ *
+ * covers[j] holds whether the broad tokens from i onwards cover the narrow
+ * tokens from j onwards, computed from the last broad token backwards.
+ */
+static gboolean glob_subsumes(GArray *broad, GArray *narrow)
+{
+        g_autofree gboolean *next = g_new0(gboolean, narrow->len + 1);
+        g_autofree gboolean *covers = g_new0(gboolean, narrow->len + 1);
+        const GlobToken *b = (const GlobToken *)(gpointer)broad->data;
+        const GlobToken *n = (const GlobToken *)(gpointer)narrow->data;
+
+        next[narrow->len] = TRUE;
+        for (guint i = broad->len; i-- > 0;) {
+                gboolean *swap = NULL;
+
+                for (guint j = narrow->len + 1; j-- > 0;) {
+                        if (b[i].kind == GLOB_STAR) {
+                                /* A star absorbs any number of narrow tokens, stars included */
+                                covers[j] = next[j] || (j < narrow->len && covers[j + 1]);
+                        } else if (j == narrow->len || n[j].kind == GLOB_STAR) {
+                                covers[j] = FALSE;
+                        } else {
+                                covers[j] = glob_token_covers(&b[i], &n[j]) && next[j + 1];
+                        }
+                }
+                swap = next;
+                next = covers;
+                covers = swap;
+        }
+
+        return next[0];
+}
+
+/**
+ * State for optimising the aliases of one run
+ */
+typedef struct ModaliasOptimiser {
+        ModaliasEntry *entries;
+        guint n_entries;
+        guint *blocks;        /* Runs of consecutive entries sharing a driver */
+        GArray **tokens;      /* NULL where the pattern isn't understood */
+        gsize *prefix_len;    /* Length of the leading literal text */
+        GHashTable *prefixes; /* Literal prefix to GArray of entry indices */
+        gboolean *live;
+} ModaliasOptimiser;
+
+static gint optimiser_compare(gconstpointer a, gconstpointer b, gpointer user_data)
+{
+        ModaliasOptimiser *self = user_data;
+        guint i = *(const guint *)a;
+        guint j = *(const guint *)b;
+        gint ret = 0;
+
+        if (self->blocks[i] != self->blocks[j]) {
+                return self->blocks[i] < self->blocks[j] ? -1 : 1;
+        }
+        ret = strcmp(self->entries[i].match, self->entries[j].match);
+        if (ret != 0) {
+                return ret;
+        }
+
+        return i < j ? -1 : i > j ? 1 : 0;
+}
+
+/**
+ * Find a live entry covering every device matched by entry @i, either
+ * within the same block or anywhere before it.
+ *
+ * A pattern can only cover another if its literal prefix is a prefix of
+ * the other's, so just those sharing a prefix are ever compared.
+ */
+static gboolean optimiser_find_cover(ModaliasOptimiser *self, guint i, gboolean same_block)
+{
+        g_autofree gchar *prefix = NULL;
+
+        if (!self->tokens[i]) {
+                return FALSE;
+        }
+
+        prefix = g_strndup(self->entries[i].match, self->prefix_len[i]);
+        for (gsize len = self->prefix_len[i] + 1; len-- > 0;) {
+                GArray *candidates = NULL;
+
+                prefix[len] = '\0';
+                candidates = g_hash_table_lookup(self->prefixes, prefix);
+                for (guint k = 0; candidates && k < candidates->len; k++) {
+                        guint j = g_array_index(candidates, guint, k);
+
+                        if (j == i || !self->live[j]) {
+                                continue;
+                        }
+                        if (same_block ? self->blocks[j] != self->blocks[i] : j > i) {
+                                continue;
+                        }
+                        if (glob_subsumes(self->tokens[j], self->tokens[i])) {
+                                return TRUE;
+                        }
+                }
+        }
+
+        return FALSE;
+}
+
+/**
+ * Reduce the aliases to a smaller set yielding the very same driver for
+ * every device, with the first matching alias still winning:
+ *
+ *  - Exact duplicates are merged, the last driver taking the position of
+ *    the first, just as they would be when loaded.
+ *  - Within a run of consecutive aliases sharing a driver, an alias is
+ *    dropped when another of the run covers it, as it can only ever
+ *    resolve to the same driver. Of two equivalent patterns the earliest
+ *    is kept.
+ *  - Any alias covered by an earlier one can never match first, and goes.
+ *  - Order within a run is irrelevant, so each run is sorted to group the
+ *    aliases sharing a literal prefix.
+ *
+ * Returns: (transfer full): The optimised entries
+ */
+GArray *modalias_optimise_entries(GArray *input)
+{
+        g_autoptr(GArray) entries = g_array_new(FALSE, FALSE, sizeof(ModaliasEntry));
+        g_autoptr(GHashTable) known = g_hash_table_new(g_str_hash, g_str_equal);
+        g_autoptr(GArray) order = g_array_new(FALSE, FALSE, sizeof(guint));
+        g_autofree gboolean *keep = NULL;
+        GArray *ret = NULL;
+        ModaliasOptimiser self = { 0 };
+
+        for (guint i = 0; i < input->len; i++) {
+                ModaliasEntry *entry = &g_array_index(input, ModaliasEntry, i);
+                gpointer v = NULL;
+
+                if (g_hash_table_lookup_extended(known, entry->match, NULL, &v)) {
+                        g_array_index(entries, ModaliasEntry, GPOINTER_TO_UINT(v)).driver =
+                            entry->driver;
+                        continue;
+                }
+                g_hash_table_insert(known, (gpointer)entry->match, GUINT_TO_POINTER(entries->len));
+                g_array_append_val(entries, *entry);
+        }
+
+        self.entries = (ModaliasEntry *)(gpointer)entries->data;
+        self.n_entries = entries->len;
+        self.blocks = g_new0(guint, MAX(self.n_entries, 1));
+        self.tokens = g_new0(GArray *, MAX(self.n_entries, 1));
+        self.prefix_len = g_new0(gsize, MAX(self.n_entries, 1));
+        self.live = g_new0(gboolean, MAX(self.n_entries, 1));
+        self.prefixes =
+            g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify)g_array_unref);
+
+        for (guint i = 0; i < self.n_entries; i++) {
+                const gchar *match = self.entries[i].match;
+                GArray *bucket = NULL;
+                gchar *prefix = NULL;
+
+                if (i > 0 && !g_str_equal(self.entries[i].driver, self.entries[i - 1].driver)) {
+                        self.blocks[i] = self.blocks[i - 1] + 1;
+                } else if (i > 0) {
+                        self.blocks[i] = self.blocks[i - 1];
+                }
+                self.live[i] = TRUE;
+                self.tokens[i] = glob_tokenize(match);
+                if (!self.tokens[i]) {
+                        continue;
+                }
+
+                self.prefix_len[i] = strcspn(match, "*?[");
+                prefix = g_strndup(match, self.prefix_len[i]);
+                bucket = g_hash_table_lookup(self.prefixes, prefix);
+                if (!bucket) {
+                        bucket = g_array_new(FALSE, FALSE, sizeof(guint));
+                        g_hash_table_insert(self.prefixes, prefix, bucket);
+                } else {
+                        g_free(prefix);
+                }
+                g_array_append_val(bucket, i);
+        }
+
+        /* Backwards, so that the earliest of equivalent patterns survives */
+        for (guint i = self.n_entries; i-- > 0;) {
+                if (optimiser_find_cover(&self, i, TRUE)) {
+                        self.live[i] = FALSE;
+                }
+        }
+
+        /* Dead rules are all judged against the same set, then dropped at once */
+        keep = g_new0(gboolean, MAX(self.n_entries, 1));
+        memcpy(keep, self.live, sizeof(gboolean) * self.n_entries);
+        for (guint i = 0; i < self.n_entries; i++) {
+                if (keep[i] && optimiser_find_cover(&self, i, FALSE)) {
+                        keep[i] = FALSE;
+                }
+        }
+
+        for (guint i = 0; i < self.n_entries; i++) {
+                if (keep[i]) {
+                        g_array_append_val(order, i);
+                }
+        }
+        g_array_sort_with_data(order, optimiser_compare, &self);
+
+        ret = g_array_sized_new(FALSE, FALSE, sizeof(ModaliasEntry), order->len);
+        for (guint i = 0; i < order->len; i++) {
+                g_array_append_val(ret, self.entries[g_array_index(order, guint, i)]);
+        }
+
+        for (guint i = 0; i < self.n_entries; i++) {
+                if (self.tokens[i]) {
+                        g_array_unref(self.tokens[i]);
+                }
+        }
+        g_hash_table_unref(self.prefixes);
+        g_free(self.blocks);
+        g_free(self.tokens);
+        g_free(self.prefix_len);
+        g_free(self.live);
+
+        g_debug("Optimised %u aliases down to %u", input->len, ret->len);
+
+        return ret;
+}
+
+/*
+ * Editor modelines  -  https://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: nil
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 expandtab:
+ * :indentSize=8:tabSize=8:noTabs=true:
+ */
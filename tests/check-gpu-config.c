@@ -11,12 +11,16 @@
 
 #define _GNU_SOURCE
 
+#include "config.h"
+
 #include <check.h>
+#include <glib/gstdio.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <umockdev.h>
 
 #include "ldm-private.h"
+#include "ldm-test.h"
 #include "ldm.h"
 #include "util.h"
 
@@ -117,6 +121,379 @@ START_TEST(test_gpu_config_desktop_nvidia)
 }
 END_TEST
 
+/**
+ * Every GPU must be exposed in topology order along with its PCIe link, and
+ * the selection policies must pick from that topology.
+ */
+START_TEST(test_gpu_config_topology)
+{
+        g_autoptr(LdmManager) manager = NULL;
+        autofree(UMockdevTestbed) *bed = NULL;
+        g_autoptr(LdmGPUConfig) gpu = NULL;
+        g_autoptr(GPtrArray) gpus = NULL;
+        LdmPCIDevice *nvidia = NULL;
+        LdmPCIDevice *intel = NULL;
+
+        bed = create_bed_from(DESKTOP_NVIDIA_MOCKDEV_FILE);
+        manager = ldm_manager_new(0);
+        gpu = ldm_gpu_config_new(manager);
+
+        gpus = ldm_gpu_config_get_gpus(gpu);
+        fail_if(gpus->len != 2, "Expected 2 GPUs in the topology, got %u", gpus->len);
+
+        /* boot_vga always comes first */
+        fail_if(ldm_device_get_vendor_id(gpus->pdata[0]) != LDM_PCI_VENDOR_ID_NVIDIA,
+                "boot_vga GPU should be first");
+        fail_if(gpus->pdata[0] != ldm_gpu_config_get_primary_device(gpu),
+                "First GPU should be the primary");
+        nvidia = LDM_PCI_DEVICE(gpus->pdata[0]);
+        intel = LDM_PCI_DEVICE(gpus->pdata[1]);
+
+        fail_if(ldm_pci_device_get_link_width(nvidia) != 16,
+                "Wrong link width: %u",
+                ldm_pci_device_get_link_width(nvidia));
+        fail_if(ldm_pci_device_get_link_speed(nvidia) != 8000,
+                "Wrong link speed: %u",
+                ldm_pci_device_get_link_speed(nvidia));
+        fail_if(ldm_pci_device_get_max_link_width(nvidia) != 16 ||
+                    ldm_pci_device_get_max_link_speed(nvidia) != 8000,
+                "Wrong maximum link");
+        fail_if(ldm_pci_device_get_numa_node(nvidia) != -1, "NUMA node should be unknown");
+        fail_if(g_strcmp0(ldm_pci_device_get_local_cpulist(nvidia), "0-7") != 0,
+                "Wrong local CPU list");
+        fail_if(ldm_pci_device_get_domain(nvidia) != 0, "Wrong PCI domain");
+        fail_if(ldm_pci_device_get_link_width(intel) != 0, "iGPU shouldn't have a PCIe link");
+
+        fail_if(ldm_gpu_config_select(gpu, LDM_GPU_SELECT_BOOT, 0) != LDM_DEVICE(nvidia),
+                "Wrong boot GPU selected");
+        fail_if(ldm_gpu_config_select(gpu, LDM_GPU_SELECT_FASTEST_DISCRETE, 0) !=
+                    LDM_DEVICE(nvidia),
+                "Wrong discrete GPU selected");
+        fail_if(ldm_gpu_config_select(gpu, LDM_GPU_SELECT_NUMA_NODE, 0) != NULL,
+                "Selected a GPU on a NUMA node that doesn't exist");
+}
+END_TEST
+
+/**
+ * Ensure the iGPU of an APU isn't mistaken for the fastest discrete GPU,
+ * despite its x16 link being wider than that of the real dGPU.
+ */
+START_TEST(test_gpu_config_apu)
+{
+        g_autoptr(LdmManager) manager = NULL;
+        autofree(UMockdevTestbed) *bed = NULL;
+        g_autoptr(LdmGPUConfig) gpu = NULL;
+        g_autofree gchar *apu = NULL;
+        g_autofree gchar *dgpu = NULL;
+        LdmDevice *device = NULL;
+
+        bed = umockdev_testbed_new();
+        apu = umockdev_testbed_add_device(bed,
+                                          "pci",
+                                          "0000:05:00.0",
+                                          NULL,
+                                          /* attributes */
+                                          "class",
+                                          "0x030000",
+                                          "vendor",
+                                          "0x1002",
+                                          "device",
+                                          "0x15d8",
+                                          "boot_vga",
+                                          "1",
+                                          "current_link_width",
+                                          "16",
+                                          "current_link_speed",
+                                          "8.0 GT/s PCIe",
+                                          NULL,
+                                          /* properties */
+                                          "PCI_CLASS",
+                                          "30000",
+                                          NULL);
+        fail_if(!apu, "Failed to add APU");
+        dgpu = umockdev_testbed_add_device(bed,
+                                           "pci",
+                                           "0000:01:00.0",
+                                           NULL,
+                                           /* attributes */
+                                           "class",
+                                           "0x030000",
+                                           "vendor",
+                                           "0x10de",
+                                           "device",
+                                           "0x1c8d",
+                                           "boot_vga",
+                                           "0",
+                                           "current_link_width",
+                                           "8",
+                                           "current_link_speed",
+                                           "8.0 GT/s PCIe",
+                                           NULL,
+                                           /* properties */
+                                           "PCI_CLASS",
+                                           "30000",
+                                           NULL);
+        fail_if(!dgpu, "Failed to add dGPU");
+
+        manager = ldm_manager_new(LDM_MANAGER_FLAGS_NO_MONITOR);
+        gpu = ldm_gpu_config_new(manager);
+        fail_if(ldm_gpu_config_count(gpu) != 2, "Expected 2 GPUs");
+
+        device = ldm_gpu_config_select(gpu, LDM_GPU_SELECT_BOOT, 0);
+        fail_if(!device || !g_str_equal(ldm_device_get_path(device), apu),
+                "APU should be the boot GPU");
+        device = ldm_gpu_config_select(gpu, LDM_GPU_SELECT_FASTEST_DISCRETE, 0);
+        fail_if(!device || !g_str_equal(ldm_device_get_path(device), dgpu),
+                "APU was selected as the fastest discrete GPU");
+}
+END_TEST
+
+/**
+ * Ensure the PCI domain is parsed, and the X.Org BusID is decimal with the
+ * domain only given when it isn't 0.
+ */
+START_TEST(test_gpu_config_bus_id)
+{
+        g_autoptr(LdmManager) manager = NULL;
+        autofree(UMockdevTestbed) *bed = NULL;
+        g_autoptr(GPtrArray) gpus = NULL;
+        g_autofree gchar *remote = NULL;
+        g_autofree gchar *local = NULL;
+
+        bed = umockdev_testbed_new();
+        remote = ldm_test_add_pci_device(bed, "0001:01:00.0", "0x030000", "0x10de", "0x1b80");
+        local = ldm_test_add_pci_device(bed, "0000:0a:00.0", "0x030000", "0x10de", "0x1b80");
+        manager = ldm_manager_new(LDM_MANAGER_FLAGS_NO_MONITOR);
+
+        gpus = ldm_manager_get_devices(manager, LDM_DEVICE_TYPE_GPU);
+        fail_if(gpus->len != 2, "Expected 2 GPUs, got %u", gpus->len);
+
+        for (guint i = 0; i < gpus->len; i++) {
+                LdmPCIDevice *pci = LDM_PCI_DEVICE(gpus->pdata[i]);
+                g_autofree gchar *bus_id = ldm_pci_device_get_xorg_bus_id(pci);
+                guint bus = 0, dev = 0;
+                gint func = -1;
+
+                ldm_pci_device_get_address(pci, &bus, &dev, &func);
+                fail_if(dev != 0 || func != 0, "Wrong device address");
+
+                if (g_str_equal(ldm_device_get_path(gpus->pdata[i]), remote)) {
+                        fail_if(ldm_pci_device_get_domain(pci) != 1,
+                                "Wrong PCI domain: %u",
+                                ldm_pci_device_get_domain(pci));
+                        fail_if(bus != 1, "Wrong PCI bus: %u", bus);
+                        fail_if(g_strcmp0(bus_id, "PCI:1@1:0:0") != 0,
+                                "Wrong BusID for domain 1: %s",
+                                bus_id);
+                } else {
+                        fail_if(ldm_pci_device_get_domain(pci) != 0, "Wrong PCI domain");
+                        fail_if(bus != 10, "Wrong PCI bus: %u", bus);
+                        fail_if(g_strcmp0(bus_id, "PCI:10:0:0") != 0,
+                                "BusID should be decimal, got %s",
+                                bus_id);
+                }
+        }
+}
+END_TEST
+
+static void ldm_test_count_changes(__ldm_unused__ LdmGPUConfig *config, gpointer v)
+{
+        guint *n_changes = v;
+        ++*n_changes;
+}
+
+/**
+ * Ensure an external GPU plugged in at runtime is picked up by an existing
+ * GPU config, and dropped again once it goes away.
+ */
+START_TEST(test_gpu_config_hotplug)
+{
+        g_autoptr(LdmManager) manager = NULL;
+        autofree(UMockdevTestbed) *bed = NULL;
+        g_autoptr(LdmGPUConfig) gpu = NULL;
+        g_autofree gchar *egpu = NULL;
+        guint n_changes = 0;
+
+        bed = create_bed_from(NV_MOCKDEV_FILE);
+        manager = ldm_manager_new(0);
+        gpu = ldm_gpu_config_new(manager);
+        fail_if(ldm_gpu_config_count(gpu) != 1, "Expected a single GPU before hotplug");
+
+        g_signal_connect(gpu, "changed", G_CALLBACK(ldm_test_count_changes), &n_changes);
+
+        egpu = ldm_test_add_pci_device(bed, "0000:05:00.0", "0x030000", "0x10de", "0x1b80");
+
+        ldm_test_wait_changes(&n_changes, 1);
+        fail_if(n_changes != 1, "GPU config didn't change for the new GPU");
+        fail_if(ldm_gpu_config_count(gpu) != 2, "External GPU wasn't added");
+        fail_if(!ldm_gpu_config_has_type(gpu, LDM_GPU_TYPE_SLI), "Expected an SLI config");
+
+        umockdev_testbed_uevent(bed, egpu, "remove");
+
+        ldm_test_wait_changes(&n_changes, 2);
+        fail_if(n_changes != 2, "GPU config didn't change for the removed GPU");
+        fail_if(ldm_gpu_config_count(gpu) != 1, "External GPU wasn't removed");
+        fail_if(ldm_gpu_config_get_gpu_type(gpu) != LDM_GPU_TYPE_SIMPLE, "GPU type isn't simple");
+}
+END_TEST
+
+/**
+ * GPU_QUICK must only ever construct display devices, yet still find the
+ * same GPU configuration.
+ */
+START_TEST(test_gpu_config_quick)
+{
+        g_autoptr(LdmManager) manager = NULL;
+        autofree(UMockdevTestbed) *bed = NULL;
+        g_autoptr(LdmGPUConfig) gpu = NULL;
+        g_autoptr(GPtrArray) devices = NULL;
+        g_autofree gchar *audio = NULL;
+
+        bed = create_bed_from(DESKTOP_NVIDIA_MOCKDEV_FILE);
+
+        /* Non-display PCI device which must be filtered out */
+        audio = ldm_test_add_pci_device(bed, "0000:00:1b.0", "0x040300", "0x8086", "0x8c20");
+
+        manager = ldm_manager_new(LDM_MANAGER_FLAGS_NO_MONITOR | LDM_MANAGER_FLAGS_GPU_QUICK);
+
+        devices = ldm_manager_get_devices(manager, LDM_DEVICE_TYPE_ANY);
+        fail_if(devices->len != 2, "Expected only 2 devices, got %u", devices->len);
+        for (guint i = 0; i < devices->len; i++) {
+                fail_if(!ldm_device_has_type(devices->pdata[i], LDM_DEVICE_TYPE_GPU),
+                        "Non-GPU device constructed in GPU_QUICK mode");
+        }
+
+        gpu = ldm_gpu_config_new(manager);
+        fail_if(ldm_gpu_config_count(gpu) != 2, "Invalid number of GPUs");
+        fail_if(ldm_gpu_config_get_gpu_type(gpu) != LDM_GPU_TYPE_SIMPLE,
+                "Config type should be simple ONLY");
+}
+END_TEST
+
+/**
+ * Ensure the persisted topology round trips, and is rejected once the stored
+ * devices no longer match the hardware.
+ */
+START_TEST(test_gpu_config_cache)
+{
+        g_autoptr(LdmManager) manager = NULL;
+        autofree(UMockdevTestbed) *bed = NULL;
+        g_autoptr(LdmGPUConfig) gpu = NULL;
+        g_autoptr(GKeyFile) file = NULL;
+        g_autofree gchar *directory = NULL;
+        g_autofree gchar *cache = NULL;
+        LdmGPUType gpu_type = LDM_GPU_TYPE_SIMPLE;
+
+        bed = create_bed_from(OPTIMUS_MOCKDEV_FILE);
+        manager = ldm_manager_new(0);
+        gpu = ldm_gpu_config_new(manager);
+
+        directory = g_dir_make_tmp("ldm-gpu-cache-XXXXXX", NULL);
+        fail_if(!directory, "Failed to create cache directory");
+        cache = g_build_filename(directory, "gpu", NULL);
+
+        fail_if(ldm_gpu_config_read_cache(cache, &gpu_type), "Read a cache that doesn't exist");
+        fail_if(!ldm_gpu_config_save_cache(gpu, cache), "Failed to save GPU cache");
+        fail_if(!ldm_gpu_config_read_cache(cache, &gpu_type), "Failed to read GPU cache");
+        fail_if(gpu_type != ldm_gpu_config_get_gpu_type(gpu), "Cached GPU type is wrong");
+
+        /* Pretend the secondary GPU was swapped out */
+        file = g_key_file_new();
+        fail_if(!g_key_file_load_from_file(file, cache, G_KEY_FILE_NONE, NULL),
+                "Failed to load GPU cache");
+        g_key_file_set_integer(file, "Secondary", "ProductID", 0);
+        fail_if(!g_key_file_save_to_file(file, cache, NULL), "Failed to modify GPU cache");
+        fail_if(ldm_gpu_config_read_cache(cache, &gpu_type), "Stale GPU cache was accepted");
+
+        g_unlink(cache);
+        g_rmdir(directory);
+}
+END_TEST
+
+static guint64 ldm_test_inode(const gchar *path)
+{
+        GStatBuf st = { 0 };
+
+        fail_if(g_stat(path, &st) != 0, "Failed to stat %s", path);
+        return (guint64)st.st_ino;
+}
+
+/**
+ * Ensure applying the same configuration twice leaves every file alone,
+ * while touching any of the files we inspect forces it to be written again.
+ */
+START_TEST(test_gpu_config_glx_state)
+{
+        g_autoptr(LdmManager) manager = NULL;
+        autofree(UMockdevTestbed) *bed = NULL;
+        g_autoptr(LdmGPUConfig) gpu = NULL;
+        g_autoptr(LdmGLXManager) glx = NULL;
+        g_autofree gchar *root = NULL;
+        g_autofree gchar *modules = NULL;
+        g_autofree gchar *driver = NULL;
+        g_autofree gchar *snippet = NULL;
+        g_autofree gchar *state = NULL;
+        gchar *touched[3] = { NULL };
+        guint64 snippet_inode = 0;
+
+        bed = create_bed_from(NV_MOCKDEV_FILE);
+        manager = ldm_manager_new(LDM_MANAGER_FLAGS_NO_MONITOR);
+        gpu = ldm_gpu_config_new(manager);
+
+        root = g_dir_make_tmp("ldm-glx-XXXXXX", NULL);
+        fail_if(!root, "Failed to create GLX root");
+
+        /* Pretend the proprietary driver is installed */
+        modules = g_build_filename(root, XORG_MODULE_DIRECTORY, "drivers", NULL);
+        fail_if(g_mkdir_with_parents(modules, 00755) != 0, "Failed to create %s", modules);
+        driver = g_build_filename(modules, "nvidia_drv.so", NULL);
+        fail_if(!g_file_set_contents(driver, "", 0, NULL), "Failed to create %s", driver);
+
+        snippet = g_build_filename(root, SYSCONFDIR, "X11", "xorg.conf.d", "00-ldm.conf", NULL);
+        state = g_build_filename(root, LDM_GLX_STATE_FILE, NULL);
+        touched[0] = g_build_filename(root, LDM_HYBRID_FILE, NULL);
+        touched[1] = g_build_filename(root, LDM_GPU_CACHE_FILE, NULL);
+        touched[2] = g_build_filename(root, SYSCONFDIR, "X11", "xorg.conf", NULL);
+
+        glx = g_object_new(LDM_TYPE_GLX_MANAGER, "root", root, NULL);
+        fail_if(!ldm_glx_manager_apply_configuration(glx, gpu), "Failed to apply configuration");
+        fail_if(!g_file_test(state, G_FILE_TEST_EXISTS), "GLX state wasn't saved");
+        snippet_inode = ldm_test_inode(snippet);
+
+        /* Nothing changed, so nothing may be written */
+        fail_if(!ldm_glx_manager_apply_configuration(glx, gpu), "Failed to reapply configuration");
+        fail_if(ldm_test_inode(snippet) != snippet_inode, "Unchanged configuration was rewritten");
+
+        for (guint i = 0; i < G_N_ELEMENTS(touched); i++) {
+                fail_if(!g_file_set_contents(touched[i], "# Touched\n", -1, NULL),
+                        "Failed to touch %s",
+                        touched[i]);
+
+                fail_if(!ldm_glx_manager_apply_configuration(glx, gpu),
+                        "Failed to apply configuration");
+                fail_if(ldm_test_inode(snippet) == snippet_inode,
+                        "Touching %s didn't force a rewrite",
+                        touched[i]);
+                snippet_inode = ldm_test_inode(snippet);
+
+                /* Settled again */
+                fail_if(!ldm_glx_manager_apply_configuration(glx, gpu),
+                        "Failed to reapply configuration");
+                fail_if(ldm_test_inode(snippet) != snippet_inode,
+                        "Configuration was rewritten after touching %s",
+                        touched[i]);
+        }
+
+        for (guint i = 0; i < G_N_ELEMENTS(touched); i++) {
+                g_unlink(touched[i]);
+                g_free(touched[i]);
+        }
+        g_unlink(driver);
+        g_unlink(snippet);
+        g_unlink(state);
+}
+END_TEST
+
 /**
  * Standard helper for running a test suite
  */
@@ -145,6 +522,13 @@ static Suite *test_create(void)
         tcase_add_test(tc, test_gpu_config_simple);
         tcase_add_test(tc, test_gpu_config_optimus);
         tcase_add_test(tc, test_gpu_config_desktop_nvidia);
+        tcase_add_test(tc, test_gpu_config_topology);
+        tcase_add_test(tc, test_gpu_config_apu);
+        tcase_add_test(tc, test_gpu_config_bus_id);
+        tcase_add_test(tc, test_gpu_config_quick);
+        tcase_add_test(tc, test_gpu_config_hotplug);
+        tcase_add_test(tc, test_gpu_config_cache);
+        tcase_add_test(tc, test_gpu_config_glx_state);
 
         return s;
 }
@@ -12,11 +12,14 @@
 #define _GNU_SOURCE
 
 #include <check.h>
+#include <glib/gstdio.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <umockdev.h>
 
+#include "ldm-dbus.h"
 #include "ldm-private.h"
+#include "ldm-test.h"
 #include "ldm.h"
 #include "util.h"
 
@@ -180,6 +183,1162 @@ START_TEST(test_manager_wifi_pci)
 }
 END_TEST
 
+/**
+ * Ensure a second manager rebuilds an identical device tree from the
+ * snapshot written by the first, without going back to udev.
+ */
+START_TEST(test_manager_snapshot)
+{
+        g_autoptr(LdmManager) manager = NULL;
+        g_autoptr(LdmManager) restored = NULL;
+        g_autoptr(LdmManager) quick = NULL;
+        autofree(UMockdevTestbed) *bed = NULL;
+        g_autoptr(GPtrArray) devices = NULL;
+        g_autoptr(GPtrArray) restored_devices = NULL;
+        g_autofree gchar *directory = NULL;
+        g_autofree gchar *snapshot = NULL;
+
+        bed = umockdev_testbed_new();
+        fail_if(!umockdev_testbed_add_from_file(bed, OPTIMUS_MOCKDEV_FILE, NULL),
+                "Failed to create Optimus device");
+
+        directory = g_dir_make_tmp("ldm-snapshot-XXXXXX", NULL);
+        fail_if(!directory, "Failed to create snapshot directory");
+        snapshot = g_build_filename(directory, "snapshot", NULL);
+
+        manager = g_object_new(LDM_TYPE_MANAGER,
+                               "flags",
+                               LDM_MANAGER_FLAGS_NO_MONITOR | LDM_MANAGER_FLAGS_SNAPSHOT,
+                               "snapshot-file",
+                               snapshot,
+                               NULL);
+        fail_if(!g_file_test(snapshot, G_FILE_TEST_EXISTS), "Snapshot was not written");
+
+        restored = g_object_new(LDM_TYPE_MANAGER,
+                                "flags",
+                                LDM_MANAGER_FLAGS_NO_MONITOR | LDM_MANAGER_FLAGS_SNAPSHOT,
+                                "snapshot-file",
+                                snapshot,
+                                NULL);
+
+        devices = ldm_manager_get_devices(manager, LDM_DEVICE_TYPE_ANY);
+        restored_devices = ldm_manager_get_devices(restored, LDM_DEVICE_TYPE_ANY);
+        fail_if(devices->len != restored_devices->len, "Snapshot has the wrong device count");
+
+        for (guint i = 0; i < devices->len; i++) {
+                LdmDevice *device = devices->pdata[i];
+                LdmDevice *copy = restored_devices->pdata[i];
+
+                fail_if(copy->os.record != NULL, "Device was not restored from the snapshot");
+                fail_if(G_OBJECT_TYPE(device) != G_OBJECT_TYPE(copy), "Wrong device type");
+                fail_if(!g_str_equal(ldm_device_get_path(device), ldm_device_get_path(copy)),
+                        "Snapshot lost the device order");
+                fail_if(!g_str_equal(ldm_device_get_name(device), ldm_device_get_name(copy)),
+                        "Device name not restored");
+                fail_if(ldm_device_get_vendor(device) != ldm_device_get_vendor(copy),
+                        "Device vendor not restored");
+                fail_if(ldm_device_get_device_type(device) != ldm_device_get_device_type(copy),
+                        "Device type not restored");
+                fail_if(ldm_device_get_attributes(device) != ldm_device_get_attributes(copy),
+                        "Device attributes not restored");
+                if (!LDM_IS_PCI_DEVICE(device)) {
+                        continue;
+                }
+                fail_if(g_strcmp0(ldm_pci_device_get_local_cpulist(LDM_PCI_DEVICE(device)),
+                                  ldm_pci_device_get_local_cpulist(LDM_PCI_DEVICE(copy))) != 0,
+                        "PCI locality not restored");
+        }
+
+        g_clear_pointer(&restored_devices, g_ptr_array_unref);
+        restored_devices = ldm_manager_get_devices(restored, LDM_DEVICE_TYPE_GPU);
+        fail_if(restored_devices->len != 2, "Snapshot lost the GPUs");
+        fail_if(!ldm_device_has_attribute(restored_devices->pdata[0],
+                                          LDM_DEVICE_ATTRIBUTE_BOOT_VGA),
+                "iGPU lost boot_vga attribute");
+
+        /* GPU_QUICK must use the full snapshot, narrowed to the GPUs */
+        g_unlink(snapshot);
+        quick = g_object_new(LDM_TYPE_MANAGER,
+                             "flags",
+                             LDM_MANAGER_FLAGS_NO_MONITOR | LDM_MANAGER_FLAGS_SNAPSHOT |
+                                 LDM_MANAGER_FLAGS_GPU_QUICK,
+                             "snapshot-file",
+                             snapshot,
+                             NULL);
+        fail_if(g_file_test(snapshot, G_FILE_TEST_EXISTS), "GPU_QUICK wrote a partial snapshot");
+        g_clear_object(&quick);
+
+        fail_if(!ldm_manager_export_snapshot(manager, snapshot, NULL), "Failed to export");
+        quick = g_object_new(LDM_TYPE_MANAGER,
+                             "flags",
+                             LDM_MANAGER_FLAGS_NO_MONITOR | LDM_MANAGER_FLAGS_SNAPSHOT |
+                                 LDM_MANAGER_FLAGS_GPU_QUICK,
+                             "snapshot-file",
+                             snapshot,
+                             NULL);
+        g_clear_pointer(&restored_devices, g_ptr_array_unref);
+        restored_devices = ldm_manager_get_devices(quick, LDM_DEVICE_TYPE_ANY);
+        fail_if(restored_devices->len != 2, "Expected 2 GPUs, got %u", restored_devices->len);
+        fail_if(devices->len <= restored_devices->len, "Fixture should have more than GPUs");
+        for (guint i = 0; i < restored_devices->len; i++) {
+                LdmDevice *device = restored_devices->pdata[i];
+
+                fail_if(device->os.record != NULL, "GPU_QUICK did not use the snapshot");
+                fail_if(!ldm_device_has_type(device, LDM_DEVICE_TYPE_GPU), "Kept a non-GPU");
+        }
+
+        g_unlink(snapshot);
+        g_rmdir(directory);
+}
+END_TEST
+
+/**
+ * Ensure the enumeration profile restricts what the manager constructs.
+ */
+START_TEST(test_manager_profile)
+{
+        g_autoptr(LdmManager) manager = NULL;
+        g_autoptr(LdmManager) filtered = NULL;
+        autofree(UMockdevTestbed) *bed = NULL;
+        g_autoptr(GPtrArray) devices = NULL;
+        const gchar *usb_only[] = { "usb", NULL };
+        const gchar *pci_only[] = { "pci", NULL };
+        const gchar *boot_vga[] = { "boot_vga=1", NULL };
+
+        bed = umockdev_testbed_new();
+        fail_if(!umockdev_testbed_add_from_file(bed, OPTIMUS_MOCKDEV_FILE, NULL),
+                "Failed to create Optimus device");
+
+        manager = ldm_manager_new_full(LDM_MANAGER_FLAGS_NO_MONITOR, usb_only, NULL);
+        fail_if(!manager, "Failed to get the LdmManager");
+        devices = ldm_manager_get_devices(manager, LDM_DEVICE_TYPE_GPU);
+        fail_if(devices->len != 0, "Enumerated a subsystem outside the profile");
+
+        filtered = g_object_new(LDM_TYPE_MANAGER,
+                                "flags",
+                                LDM_MANAGER_FLAGS_NO_MONITOR,
+                                "subsystems",
+                                pci_only,
+                                "sysattr-matches",
+                                boot_vga,
+                                NULL);
+        g_clear_pointer(&devices, g_ptr_array_unref);
+        devices = ldm_manager_get_devices(filtered, LDM_DEVICE_TYPE_GPU);
+        fail_if(devices->len != 1, "Sysattr match was not applied");
+        fail_if(!ldm_device_has_attribute(devices->pdata[0], LDM_DEVICE_ATTRIBUTE_BOOT_VGA),
+                "Wrong GPU matched");
+}
+END_TEST
+
+/**
+ * Ensure profiles which differ only in how entries are split never share a
+ * snapshot, and that property matches without a pattern are rejected.
+ */
+START_TEST(test_manager_profile_key)
+{
+        g_autoptr(LdmManager) joined = NULL;
+        g_autoptr(LdmManager) split = NULL;
+        g_autoptr(LdmManager) unmatched = NULL;
+        autofree(UMockdevTestbed) *bed = NULL;
+        g_autoptr(GPtrArray) devices = NULL;
+        g_auto(GStrv) matches = NULL;
+        g_autofree gchar *directory = NULL;
+        g_autofree gchar *snapshot = NULL;
+        const gchar *one_entry[] = { "pci,usb", NULL };
+        const gchar *two_entries[] = { "pci", "usb", NULL };
+        const gchar *no_pattern[] = { "PCI_CLASS", NULL };
+
+        bed = umockdev_testbed_new();
+        fail_if(!umockdev_testbed_add_from_file(bed, OPTIMUS_MOCKDEV_FILE, NULL),
+                "Failed to create Optimus device");
+
+        directory = g_dir_make_tmp("ldm-snapshot-XXXXXX", NULL);
+        fail_if(!directory, "Failed to create snapshot directory");
+        snapshot = g_build_filename(directory, "snapshot", NULL);
+
+        /* No such subsystem, so this stores an empty tree */
+        joined = g_object_new(LDM_TYPE_MANAGER,
+                              "flags",
+                              LDM_MANAGER_FLAGS_NO_MONITOR | LDM_MANAGER_FLAGS_SNAPSHOT,
+                              "snapshot-file",
+                              snapshot,
+                              "subsystems",
+                              one_entry,
+                              NULL);
+        fail_if(!g_file_test(snapshot, G_FILE_TEST_EXISTS), "Snapshot was not written");
+
+        split = g_object_new(LDM_TYPE_MANAGER,
+                             "flags",
+                             LDM_MANAGER_FLAGS_NO_MONITOR | LDM_MANAGER_FLAGS_SNAPSHOT,
+                             "snapshot-file",
+                             snapshot,
+                             "subsystems",
+                             two_entries,
+                             NULL);
+        devices = ldm_manager_get_devices(split, LDM_DEVICE_TYPE_GPU);
+        fail_if(devices->len != 2, "Restored the snapshot of a different profile");
+
+        unmatched = g_object_new(LDM_TYPE_MANAGER,
+                                 "flags",
+                                 LDM_MANAGER_FLAGS_NO_MONITOR,
+                                 "property-matches",
+                                 no_pattern,
+                                 NULL);
+        g_object_get(unmatched, "property-matches", &matches, NULL);
+        fail_if(!matches || matches[0] != NULL, "Property match without a pattern was kept");
+        g_clear_pointer(&devices, g_ptr_array_unref);
+        devices = ldm_manager_get_devices(unmatched, LDM_DEVICE_TYPE_GPU);
+        fail_if(devices->len != 2, "Expected 2 GPUs, got %u", devices->len);
+
+        g_unlink(snapshot);
+        g_rmdir(directory);
+}
+END_TEST
+
+static void ldm_test_count_changes(__ldm_unused__ LdmManager *manager, gpointer v)
+{
+        guint *n_changes = v;
+        ++*n_changes;
+}
+
+static void ldm_test_count_added(__ldm_unused__ LdmManager *manager,
+                                 __ldm_unused__ LdmDevice *device, gpointer v)
+{
+        guint *n_added = v;
+        ++*n_added;
+}
+
+static void ldm_test_check_added(__ldm_unused__ LdmManager *manager, LdmDevice *device,
+                                 gpointer v)
+{
+        g_autoptr(GList) kids = ldm_device_get_children(device);
+        guint *n_added = v;
+
+        fail_if(!kids, "USB device was announced before its interfaces");
+        ++*n_added;
+}
+
+/**
+ * Ensure a burst of hotplug events is coalesced into a single batch, and
+ * that a device which comes and goes within the window is never seen. The
+ * interfaces of a USB device arrive after it, but it must not be announced
+ * until they are in place.
+ */
+static void ldm_test_hotplug(LdmManagerFlags flags)
+{
+        g_autoptr(LdmManager) manager = NULL;
+        autofree(UMockdevTestbed) *bed = NULL;
+        g_autofree gchar *dock = NULL;
+        g_autofree gchar *dock_interface = NULL;
+        g_autofree gchar *transient = NULL;
+        g_autoptr(GPtrArray) devices = NULL;
+        g_autoptr(GList) kids = NULL;
+        guint n_changes = 0;
+        guint n_added = 0;
+
+        bed = umockdev_testbed_new();
+        manager = g_object_new(LDM_TYPE_MANAGER, "flags", flags, "coalesce-timeout", 200, NULL);
+        fail_if(!manager, "Failed to get the LdmManager");
+
+        g_signal_connect(manager,
+                         "devices-changed",
+                         G_CALLBACK(ldm_test_count_changes),
+                         &n_changes);
+        g_signal_connect(manager, "device-added", G_CALLBACK(ldm_test_check_added), &n_added);
+
+        dock = umockdev_testbed_add_device(bed,
+                                           "usb",
+                                           "1-1",
+                                           NULL,
+                                           /* attributes */
+                                           "idVendor",
+                                           "17ef",
+                                           "idProduct",
+                                           "1010",
+                                           NULL,
+                                           /* properties */
+                                           "DEVTYPE",
+                                           "usb_device",
+                                           NULL);
+        transient = umockdev_testbed_add_device(bed,
+                                                "usb",
+                                                "1-2",
+                                                NULL,
+                                                /* attributes */
+                                                "idVendor",
+                                                "046d",
+                                                "idProduct",
+                                                "c52b",
+                                                NULL,
+                                                /* properties */
+                                                "DEVTYPE",
+                                                "usb_device",
+                                                NULL);
+
+        dock_interface = umockdev_testbed_add_device(bed,
+                                                     "usb",
+                                                     "1-1:1.0",
+                                                     dock,
+                                                     /* attributes */
+                                                     "bInterfaceClass",
+                                                     "03",
+                                                     NULL,
+                                                     /* properties */
+                                                     "DEVTYPE",
+                                                     "usb_interface",
+                                                     NULL);
+
+        /* umockdev already emitted "add" for each, finish the sequences */
+        umockdev_testbed_uevent(bed, dock, "bind");
+        umockdev_testbed_uevent(bed, transient, "remove");
+
+        ldm_test_wait_changes(&n_changes, 1);
+
+        fail_if(n_changes != 1, "Events were not coalesced into one batch");
+        fail_if(n_added != 1, "Expected a single device-added for the dock");
+
+        devices = ldm_manager_get_devices(manager, LDM_DEVICE_TYPE_USB);
+        fail_if(devices->len != 1, "Transient device should never be added");
+        fail_if(!g_str_equal(ldm_device_get_path(devices->pdata[0]), dock), "Wrong device added");
+        kids = ldm_device_get_children(devices->pdata[0]);
+        fail_if(g_list_length(kids) != 1, "Dock is missing its interface");
+}
+
+START_TEST(test_manager_coalesce)
+{
+        ldm_test_hotplug(LDM_MANAGER_FLAGS_NONE);
+}
+END_TEST
+
+/**
+ * Ensure events received on the monitor thread are delivered to our context.
+ */
+START_TEST(test_manager_monitor_thread)
+{
+        ldm_test_hotplug(LDM_MANAGER_FLAGS_MONITOR_THREAD);
+}
+END_TEST
+
+/**
+ * Ensure a `subsystem/devtype` monitor filter only lets that device type
+ * through, with the receive buffer enlarged.
+ */
+START_TEST(test_manager_monitor_devtype)
+{
+        g_autoptr(LdmManager) manager = NULL;
+        autofree(UMockdevTestbed) *bed = NULL;
+        g_autoptr(GPtrArray) devices = NULL;
+        g_autofree gchar *usb = NULL;
+        g_autofree gchar *gpu = NULL;
+        const gchar *filters[] = { "pci", "usb/usb_interface", NULL };
+        guint n_changes = 0;
+
+        bed = umockdev_testbed_new();
+        manager = g_object_new(LDM_TYPE_MANAGER,
+                               "monitor-subsystems",
+                               filters,
+                               "monitor-buffer-size",
+                               1024 * 1024,
+                               NULL);
+        fail_if(!manager, "Failed to get the LdmManager");
+        g_signal_connect(manager,
+                         "devices-changed",
+                         G_CALLBACK(ldm_test_count_changes),
+                         &n_changes);
+
+        /* Filtered out by its devtype, and must never be built */
+        usb = umockdev_testbed_add_device(bed,
+                                          "usb",
+                                          "1-1",
+                                          NULL,
+                                          /* attributes */
+                                          "idVendor",
+                                          "17ef",
+                                          "idProduct",
+                                          "1010",
+                                          NULL,
+                                          /* properties */
+                                          "DEVTYPE",
+                                          "usb_device",
+                                          NULL);
+        fail_if(!usb, "Failed to add USB device");
+
+        /* Events arrive in order, so once the GPU is in the USB device was seen */
+        gpu = ldm_test_add_pci_device(bed, "0000:05:00.0", "0x030000", "0x10de", "0x1b80");
+        ldm_test_wait_changes(&n_changes, 1);
+        fail_if(n_changes == 0, "PCI event was filtered");
+
+        devices = ldm_manager_get_devices(manager, LDM_DEVICE_TYPE_GPU);
+        fail_if(devices->len != 1, "Expected 1 GPU, got %u", devices->len);
+        g_clear_pointer(&devices, g_ptr_array_unref);
+        devices = ldm_manager_get_devices(manager, LDM_DEVICE_TYPE_USB);
+        fail_if(devices->len != 0, "usb_device passed a usb_interface filter");
+}
+END_TEST
+
+/**
+ * Ensure a rescan only touches the devices which actually changed.
+ */
+START_TEST(test_manager_rescan)
+{
+        g_autoptr(LdmManager) manager = NULL;
+        autofree(UMockdevTestbed) *bed = NULL;
+        g_autoptr(GPtrArray) devices = NULL;
+        g_autoptr(GPtrArray) rescanned = NULL;
+        g_autoptr(GPtrArray) gpus = NULL;
+        g_autoptr(GPtrArray) rescanned_gpus = NULL;
+        g_autofree gchar *audio = NULL;
+        g_autofree gchar *usb_controller = NULL;
+        gboolean found_controller = FALSE;
+        guint n_added = 0;
+        guint n_removed = 0;
+
+        bed = umockdev_testbed_new();
+        fail_if(!umockdev_testbed_add_from_file(bed, OPTIMUS_MOCKDEV_FILE, NULL),
+                "Failed to create Optimus device");
+
+        manager = ldm_manager_new(LDM_MANAGER_FLAGS_NO_MONITOR);
+        fail_if(!manager, "Failed to get the LdmManager");
+        g_signal_connect(manager, "device-added", G_CALLBACK(ldm_test_count_added), &n_added);
+        g_signal_connect(manager,
+                         "device-removed",
+                         G_CALLBACK(ldm_test_count_added),
+                         &n_removed);
+
+        devices = ldm_manager_get_devices(manager, LDM_DEVICE_TYPE_ANY);
+        gpus = ldm_manager_get_devices(manager, LDM_DEVICE_TYPE_GPU);
+        fail_if(ldm_manager_rescan(manager), "Rescan of an unchanged system reported changes");
+
+        audio = ldm_test_add_pci_device(bed, "0000:00:1b.0", "0x040300", "0x8086", "0x8c20");
+        fail_if(!ldm_manager_rescan(manager), "Rescan missed the new device");
+        fail_if(n_added != 1, "Expected one device-added for the new device");
+
+        rescanned = ldm_manager_get_devices(manager, LDM_DEVICE_TYPE_ANY);
+        fail_if(rescanned->len != devices->len + 1, "Rescan has the wrong device count");
+        rescanned_gpus = ldm_manager_get_devices(manager, LDM_DEVICE_TYPE_GPU);
+        fail_if(rescanned_gpus->pdata[0] != gpus->pdata[0], "Unchanged device was rebuilt");
+
+        umockdev_testbed_remove_device(bed, audio);
+        fail_if(!ldm_manager_rescan(manager), "Rescan missed the removed device");
+        g_clear_pointer(&rescanned, g_ptr_array_unref);
+        rescanned = ldm_manager_get_devices(manager, LDM_DEVICE_TYPE_ANY);
+        fail_if(rescanned->len != devices->len, "Removed device survived the rescan");
+
+        /* Missed both an add and a remove, as after a monitor overrun */
+        n_added = n_removed = 0;
+        usb_controller =
+            ldm_test_add_pci_device(bed, "0000:00:14.0", "0x0c0330", "0x8086", "0x8c31");
+        umockdev_testbed_remove_device(bed, "/sys/devices/pci0000:00/0000:00:01.0");
+        fail_if(!ldm_manager_rescan(manager), "Rescan missed the changes");
+        fail_if(n_added != 1 || n_removed != 1, "Expected one device-added and device-removed");
+
+        g_clear_pointer(&rescanned, g_ptr_array_unref);
+        rescanned = ldm_manager_get_devices(manager, LDM_DEVICE_TYPE_ANY);
+        fail_if(rescanned->len != devices->len, "Rescan has the wrong device count");
+        for (guint i = 0; i < rescanned->len; i++) {
+                const gchar *path = ldm_device_get_path(rescanned->pdata[i]);
+
+                fail_if(g_str_has_suffix(path, "0000:00:01.0"), "Removed bridge survived");
+                found_controller |= g_str_equal(path, usb_controller);
+        }
+        fail_if(!found_controller, "New device is missing");
+}
+END_TEST
+
+/**
+ * Ensure sysfs reads are deferred until the fields are used, while the
+ * identity needed for filtering is available straight away.
+ */
+START_TEST(test_manager_deferred)
+{
+        g_autoptr(LdmManager) manager = NULL;
+        autofree(UMockdevTestbed) *bed = NULL;
+        g_autoptr(GPtrArray) devices = NULL;
+        g_autoptr(GPtrArray) platforms = NULL;
+        g_autofree gchar *dmi = NULL;
+        LdmDevice *gpu = NULL;
+        LdmDevice *platform = NULL;
+
+        bed = umockdev_testbed_new();
+        fail_if(!umockdev_testbed_add_from_file(bed, NV_MOCKDEV_FILE, NULL),
+                "Failed to create NVIDIA device");
+        dmi = umockdev_testbed_add_device(bed,
+                                          "dmi",
+                                          "id",
+                                          NULL,
+                                          /* attributes */
+                                          "board_vendor",
+                                          "Acme",
+                                          "board_name",
+                                          "Rocket",
+                                          NULL,
+                                          /* properties */
+                                          NULL);
+        fail_if(!dmi, "Failed to add DMI device");
+
+        manager = ldm_manager_new(LDM_MANAGER_FLAGS_NO_MONITOR);
+        devices = ldm_manager_get_devices(manager, LDM_DEVICE_TYPE_GPU);
+        fail_if(devices->len != 1, "Expected 1 GPU, got %u", devices->len);
+        gpu = devices->pdata[0];
+
+        /* Identity comes from the uevent */
+        fail_if(ldm_device_get_vendor_id(gpu) != 0x10de, "Wrong vendor ID from PCI_ID");
+        fail_if(ldm_device_get_product_id(gpu) != 0x1c60, "Wrong product ID from PCI_ID");
+        fail_if(!ldm_device_get_modalias(gpu), "Missing modalias from the uevent");
+
+        fail_if((gpu->os.deferred & LDM_DEVICE_DEFERRED_ATTRIBUTES) == 0,
+                "boot_vga was not deferred");
+        fail_if(!ldm_device_has_attribute(gpu, LDM_DEVICE_ATTRIBUTE_BOOT_VGA),
+                "Deferred boot_vga was not resolved");
+        fail_if(gpu->os.deferred != 0, "GPU still has deferred fields");
+
+        platforms = ldm_manager_get_devices(manager, LDM_DEVICE_TYPE_PLATFORM);
+        fail_if(platforms->len != 1, "Expected 1 platform device, got %u", platforms->len);
+        platform = platforms->pdata[0];
+
+        fail_if((platform->os.deferred & LDM_DEVICE_DEFERRED_IDENTITY) == 0,
+                "DMI identity was not deferred");
+        fail_if(!g_str_equal(ldm_device_get_name(platform), "Rocket"),
+                "Wrong board name, got %s",
+                ldm_device_get_name(platform));
+        fail_if(!g_str_equal(ldm_device_get_vendor(platform), "Acme"),
+                "Wrong board vendor, got %s",
+                ldm_device_get_vendor(platform));
+        fail_if(platform->os.deferred != 0, "Platform still has deferred fields");
+}
+END_TEST
+
+static gboolean ldm_test_collect_first(LdmDevice *device, gpointer v)
+{
+        LdmDevice **first = v;
+        *first = device;
+        return FALSE;
+}
+
+/**
+ * Ensure queries combine each criteria, and iteration can be cut short.
+ */
+START_TEST(test_manager_query)
+{
+        g_autoptr(LdmManager) manager = NULL;
+        autofree(UMockdevTestbed) *bed = NULL;
+        g_autoptr(GPtrArray) gpus = NULL;
+        g_autoptr(GPtrArray) devices = NULL;
+        g_autoptr(GPtrArray) pci = NULL;
+        LdmDeviceQuery query = { 0 };
+        LdmDevice *first = NULL;
+
+        bed = umockdev_testbed_new();
+        fail_if(!umockdev_testbed_add_from_file(bed, OPTIMUS_MOCKDEV_FILE, NULL),
+                "Failed to create Optimus device");
+        manager = ldm_manager_new(LDM_MANAGER_FLAGS_NO_MONITOR);
+        gpus = ldm_manager_get_devices(manager, LDM_DEVICE_TYPE_GPU);
+        fail_if(gpus->len != 2, "Expected 2 GPUs, got %u", gpus->len);
+
+        query.types = LDM_DEVICE_TYPE_GPU;
+        query.vendor_id = LDM_PCI_VENDOR_ID_NVIDIA;
+        devices = ldm_manager_query(manager, &query);
+        fail_if(devices->len != 1, "Expected only the NVIDIA GPU, got %u", devices->len);
+        fail_if(devices->pdata[0] != gpus->pdata[1], "Wrong GPU for the vendor");
+        g_clear_pointer(&devices, g_ptr_array_unref);
+
+        query = (LdmDeviceQuery){
+                .types = LDM_DEVICE_TYPE_GPU,
+                .attributes = LDM_DEVICE_ATTRIBUTE_BOOT_VGA,
+        };
+        devices = ldm_manager_query(manager, &query);
+        fail_if(devices->len != 1, "Expected only the boot_vga GPU, got %u", devices->len);
+        fail_if(devices->pdata[0] != gpus->pdata[0], "Wrong GPU for boot_vga");
+        g_clear_pointer(&devices, g_ptr_array_unref);
+
+        query = (LdmDeviceQuery){ .subsystem = "pci" };
+        devices = ldm_manager_query(manager, &query);
+        pci = ldm_manager_get_devices(manager, LDM_DEVICE_TYPE_PCI);
+        fail_if(devices->len != pci->len, "Subsystem query didn't find every PCI device");
+        g_clear_pointer(&devices, g_ptr_array_unref);
+
+        /* No plugins, so nothing can have a provider */
+        query = (LdmDeviceQuery){ .types = LDM_DEVICE_TYPE_GPU, .has_providers = TRUE };
+        devices = ldm_manager_query(manager, &query);
+        fail_if(devices->len != 0, "Device without providers matched");
+
+        query = (LdmDeviceQuery){ .types = LDM_DEVICE_TYPE_GPU };
+        fail_if(ldm_manager_foreach(manager, &query, ldm_test_collect_first, &first),
+                "Iteration should have been stopped");
+        fail_if(first != gpus->pdata[0], "Iteration didn't stop at the first GPU");
+}
+END_TEST
+
+/**
+ * Ensure typed lookups through the buckets find exactly what filtering every
+ * device would, in the same order, including types only found on children.
+ */
+START_TEST(test_manager_buckets)
+{
+        g_autoptr(LdmManager) manager = NULL;
+        autofree(UMockdevTestbed) *bed = NULL;
+        g_autoptr(GPtrArray) all = NULL;
+
+        bed = umockdev_testbed_new();
+        fail_if(!umockdev_testbed_add_from_file(bed, OPTIMUS_MOCKDEV_FILE, NULL),
+                "Failed to create Optimus device");
+        fail_if(!umockdev_testbed_add_from_file(bed, BLUETOOTH_UMOCKDEV_FILE, NULL),
+                "Failed to create Bluetooth device");
+        manager = ldm_manager_new(LDM_MANAGER_FLAGS_NO_MONITOR);
+        all = ldm_manager_get_devices(manager, LDM_DEVICE_TYPE_ANY);
+
+        for (guint type = 1; type < LDM_DEVICE_TYPE_MAX; type <<= 1) {
+                g_autoptr(GPtrArray) devices = NULL;
+                guint n = 0;
+
+                devices = ldm_manager_get_devices(manager, (LdmDeviceType)type);
+                for (guint i = 0; i < all->len; i++) {
+                        if (!ldm_device_has_type(all->pdata[i], (LdmDeviceType)type)) {
+                                continue;
+                        }
+                        fail_if(n >= devices->len || devices->pdata[n] != all->pdata[i],
+                                "Bucket for type %x differs from a full scan",
+                                type);
+                        ++n;
+                }
+                fail_if(n != devices->len, "Bucket for type %x has extra devices", type);
+        }
+}
+END_TEST
+
+static gboolean ldm_test_collect_all(LdmDevice *device, gpointer v)
+{
+        g_ptr_array_add(v, device);
+        return TRUE;
+}
+
+static gpointer ldm_test_read_table(gpointer v)
+{
+        g_autoptr(LdmDeviceTable) table = NULL;
+        guint n_gpus = 0;
+
+        table = ldm_manager_get_device_table(v);
+        for (guint i = 0; i < ldm_device_table_get_n_devices(table); i++) {
+                LdmDevice *device = ldm_device_table_get_device(table, i);
+
+                if ((ldm_device_get_device_type(device) & LDM_DEVICE_TYPE_GPU) != 0 &&
+                    ldm_device_get_name(device) != NULL) {
+                        ++n_gpus;
+                }
+        }
+
+        return GUINT_TO_POINTER(n_gpus);
+}
+
+/**
+ * Ensure the published table matches the manager, including types only found
+ * on children, and that an older table is left untouched by later changes.
+ */
+START_TEST(test_manager_device_table)
+{
+        g_autoptr(LdmManager) manager = NULL;
+        autofree(UMockdevTestbed) *bed = NULL;
+        g_autoptr(LdmDeviceTable) table = NULL;
+        g_autoptr(LdmDeviceTable) rescanned = NULL;
+        g_autoptr(GPtrArray) all = NULL;
+        g_autofree gchar *audio = NULL;
+        GThread *reader = NULL;
+
+        bed = umockdev_testbed_new();
+        fail_if(!umockdev_testbed_add_from_file(bed, OPTIMUS_MOCKDEV_FILE, NULL),
+                "Failed to create Optimus device");
+        fail_if(!umockdev_testbed_add_from_file(bed, BLUETOOTH_UMOCKDEV_FILE, NULL),
+                "Failed to create Bluetooth device");
+        manager = ldm_manager_new(LDM_MANAGER_FLAGS_NO_MONITOR);
+        all = ldm_manager_get_devices(manager, LDM_DEVICE_TYPE_ANY);
+
+        table = ldm_manager_get_device_table(manager);
+        fail_if(ldm_device_table_get_generation(table) == 0, "Enumeration wasn't published");
+        fail_if(ldm_device_table_get_n_devices(table) != all->len, "Table has the wrong size");
+        for (guint i = 0; i < all->len; i++) {
+                fail_if(ldm_device_table_get_device(table, i) != all->pdata[i],
+                        "Table order differs from the manager");
+        }
+
+        for (guint type = 1; type < LDM_DEVICE_TYPE_MAX; type <<= 1) {
+                g_autoptr(GPtrArray) devices = NULL;
+                g_autoptr(GPtrArray) published = NULL;
+
+                devices = ldm_manager_get_devices(manager, (LdmDeviceType)type);
+                published = g_ptr_array_new();
+                ldm_device_table_foreach(table,
+                                         (LdmDeviceType)type,
+                                         ldm_test_collect_all,
+                                         published);
+                fail_if(published->len != devices->len,
+                        "Table bucket %x has the wrong size",
+                        type);
+                for (guint i = 0; i < devices->len; i++) {
+                        fail_if(published->pdata[i] != devices->pdata[i],
+                                "Table bucket %x differs from the manager",
+                                type);
+                }
+        }
+
+        reader = g_thread_new("table-reader", ldm_test_read_table, manager);
+        fail_if(GPOINTER_TO_UINT(g_thread_join(reader)) != 2,
+                "Reader thread didn't find both GPUs");
+
+        audio = ldm_test_add_pci_device(bed, "0000:00:1b.0", "0x040300", "0x8086", "0x8c20");
+        fail_if(!ldm_manager_rescan(manager), "Rescan missed the new device");
+
+        rescanned = ldm_manager_get_device_table(manager);
+        fail_if(ldm_device_table_get_generation(rescanned) <=
+                    ldm_device_table_get_generation(table),
+                "Rescan wasn't published");
+        fail_if(ldm_device_table_get_n_devices(rescanned) != all->len + 1,
+                "New table is missing the new device");
+        fail_if(ldm_device_table_get_n_devices(table) != all->len, "Old table was modified");
+}
+END_TEST
+
+typedef struct {
+        LdmManager *manager;
+        guint n_devices; /* Without the device added by the writer */
+        gint stop;       /* Atomic */
+} LdmTestTableStress;
+
+static gpointer ldm_test_stress_table(gpointer v)
+{
+        LdmTestTableStress *stress = v;
+        guint n_bad = 0;
+
+        while (!g_atomic_int_get(&stress->stop)) {
+                g_autoptr(LdmDeviceTable) table = ldm_manager_get_device_table(stress->manager);
+                guint n_devices = ldm_device_table_get_n_devices(table);
+
+                if (n_devices != stress->n_devices && n_devices != stress->n_devices + 1) {
+                        ++n_bad;
+                }
+                for (guint i = 0; i < n_devices; i++) {
+                        LdmDevice *device = ldm_device_table_get_device(table, i);
+
+                        /* Published devices were resolved, so this reads no sysfs */
+                        if (g_atomic_int_get((gint *)&device->os.deferred) != 0 ||
+                            !ldm_device_get_path(device)) {
+                                ++n_bad;
+                        }
+                        (void)ldm_device_get_name(device);
+                        (void)ldm_device_get_vendor(device);
+                }
+        }
+
+        return GUINT_TO_POINTER(n_bad);
+}
+
+/**
+ * Ensure readers on several threads always see a whole, resolved table while
+ * the manager keeps publishing new ones, and that publishing isn't starved.
+ */
+START_TEST(test_manager_device_table_stress)
+{
+        g_autoptr(LdmManager) manager = NULL;
+        autofree(UMockdevTestbed) *bed = NULL;
+        g_autoptr(GPtrArray) all = NULL;
+        LdmTestTableStress stress = { 0 };
+        GThread *readers[4] = { NULL };
+
+        bed = umockdev_testbed_new();
+        fail_if(!umockdev_testbed_add_from_file(bed, OPTIMUS_MOCKDEV_FILE, NULL),
+                "Failed to create Optimus device");
+        manager = ldm_manager_new(LDM_MANAGER_FLAGS_NO_MONITOR);
+        all = ldm_manager_get_devices(manager, LDM_DEVICE_TYPE_ANY);
+
+        stress.manager = manager;
+        stress.n_devices = all->len;
+        for (guint i = 0; i < G_N_ELEMENTS(readers); i++) {
+                readers[i] = g_thread_new("table-stress", ldm_test_stress_table, &stress);
+        }
+
+        for (guint i = 0; i < 50; i++) {
+                g_autofree gchar *audio = NULL;
+
+                audio =
+                    ldm_test_add_pci_device(bed, "0000:00:1b.0", "0x040300", "0x8086", "0x8c20");
+                fail_if(!ldm_manager_rescan(manager), "Rescan missed the new device");
+                umockdev_testbed_remove_device(bed, audio);
+                fail_if(!ldm_manager_rescan(manager), "Rescan missed the removed device");
+        }
+
+        g_atomic_int_set(&stress.stop, 1);
+        for (guint i = 0; i < G_N_ELEMENTS(readers); i++) {
+                fail_if(GPOINTER_TO_UINT(g_thread_join(readers[i])) != 0,
+                        "Reader thread saw an inconsistent table");
+        }
+}
+END_TEST
+
+/**
+ * Ensure the bulk records describe the same devices, in the same order.
+ */
+START_TEST(test_manager_describe_devices)
+{
+        g_autoptr(LdmManager) manager = NULL;
+        autofree(UMockdevTestbed) *bed = NULL;
+        g_autoptr(GPtrArray) devices = NULL;
+        g_autoptr(GVariant) records = NULL;
+
+        bed = umockdev_testbed_new();
+        fail_if(!umockdev_testbed_add_from_file(bed, OPTIMUS_MOCKDEV_FILE, NULL),
+                "Failed to create Optimus device");
+        manager = ldm_manager_new(LDM_MANAGER_FLAGS_NO_MONITOR);
+
+        devices = ldm_manager_get_devices(manager, LDM_DEVICE_TYPE_GPU);
+        records = ldm_manager_describe_devices(manager, LDM_DEVICE_TYPE_GPU);
+        fail_if(g_variant_is_floating(records), "Records should not be floating");
+        fail_if(!g_variant_is_of_type(records, G_VARIANT_TYPE(LDM_MANAGER_DEVICES_FORMAT)),
+                "Records have the wrong type");
+        fail_if(g_variant_n_children(records) != devices->len, "Wrong number of records");
+
+        for (guint i = 0; i < devices->len; i++) {
+                LdmDevice *device = devices->pdata[i];
+                const gchar *path = NULL;
+                const gchar *name = NULL;
+                guint32 types = 0;
+                guint32 vendor_id = 0;
+                guint32 attributes = 0;
+
+                g_variant_get_child(records,
+                                    i,
+                                    "(&s&s&s&s&suuuu)",
+                                    &path,
+                                    &name,
+                                    NULL,
+                                    NULL,
+                                    NULL,
+                                    &types,
+                                    &vendor_id,
+                                    NULL,
+                                    &attributes);
+                fail_if(!g_str_equal(path, ldm_device_get_path(device)),
+                        "Record has the wrong path");
+                fail_if(!g_str_equal(name, ldm_device_get_name(device)),
+                        "Record has the wrong name");
+                fail_if(types != (guint32)ldm_device_get_device_type(device),
+                        "Record has the wrong type");
+                fail_if(vendor_id != (guint32)ldm_device_get_vendor_id(device),
+                        "Record has the wrong vendor ID");
+                fail_if(attributes != (guint32)ldm_device_get_attributes(device),
+                        "Record has the wrong attributes");
+        }
+}
+END_TEST
+
+/**
+ * Ensure hwdb strings that aren't UTF-8 are replaced in the daemon records
+ * and the bulk records, rather than failing to build the variant at all.
+ */
+START_TEST(test_manager_dbus_utf8)
+{
+        g_autoptr(LdmManager) manager = NULL;
+        autofree(UMockdevTestbed) *bed = NULL;
+        g_autoptr(GVariant) records = NULL;
+        g_autoptr(GVariant) record = NULL;
+        g_autofree gchar *path = NULL;
+        g_autofree gchar *expected = NULL;
+        const gchar *invalid = "Acme\xff Graphics";
+        const gchar *vendor = NULL;
+
+        bed = umockdev_testbed_new();
+        path = umockdev_testbed_add_device(bed,
+                                           "pci",
+                                           "0000:01:00.0",
+                                           NULL,
+                                           /* attributes */
+                                           "class",
+                                           "0x030000",
+                                           "vendor",
+                                           "0x10de",
+                                           "device",
+                                           "0x1b80",
+                                           NULL,
+                                           /* properties */
+                                           "PCI_CLASS",
+                                           "30000",
+                                           "ID_VENDOR_FROM_DATABASE",
+                                           invalid,
+                                           NULL);
+        fail_if(!path, "Failed to add PCI device");
+        manager = ldm_manager_new(LDM_MANAGER_FLAGS_NO_MONITOR);
+
+        records = g_variant_ref_sink(ldm_dbus_build_devices(manager, LDM_DEVICE_TYPE_GPU));
+        fail_if(g_variant_n_children(records) != 1,
+                "Expected 1 record, got %" G_GSIZE_FORMAT,
+                g_variant_n_children(records));
+
+        expected = g_utf8_make_valid(invalid, -1);
+        record = g_variant_get_child_value(records, 0);
+        g_variant_get_child(record, 2, "&s", &vendor);
+        fail_if(!g_str_equal(vendor, expected),
+                "Vendor should be '%s', got '%s'",
+                expected,
+                vendor);
+        g_clear_pointer(&record, g_variant_unref);
+        g_clear_pointer(&records, g_variant_unref);
+
+        records = ldm_manager_describe_devices(manager, LDM_DEVICE_TYPE_GPU);
+        fail_if(g_variant_n_children(records) != 1,
+                "Expected 1 bulk record, got %" G_GSIZE_FORMAT,
+                g_variant_n_children(records));
+        record = g_variant_get_child_value(records, 0);
+        g_variant_get_child(record, 2, "&s", &vendor);
+        fail_if(!g_str_equal(vendor, expected),
+                "Bulk vendor should be '%s', got '%s'",
+                expected,
+                vendor);
+}
+END_TEST
+
+/**
+ * Ensure replaying a recording builds the same tree as umockdev does, without
+ * touching udev, including the USB interface parents.
+ */
+START_TEST(test_manager_source_umockdev)
+{
+        const gchar *recordings[] = { OPTIMUS_MOCKDEV_FILE, BLUETOOTH_UMOCKDEV_FILE };
+
+        for (guint r = 0; r < G_N_ELEMENTS(recordings); r++) {
+                g_autoptr(LdmManager) manager = NULL;
+                g_autoptr(LdmManager) replayed = NULL;
+                autofree(UMockdevTestbed) *bed = NULL;
+                g_autoptr(GPtrArray) devices = NULL;
+                g_autoptr(GPtrArray) replayed_devices = NULL;
+                g_autoptr(GError) error = NULL;
+
+                replayed = ldm_manager_new_from_source(LDM_DEVICE_SOURCE_UMOCKDEV,
+                                                       recordings[r],
+                                                       0,
+                                                       &error);
+                fail_if(!replayed, "Failed to replay %s: %s", recordings[r], error->message);
+                fail_if(ldm_manager_rescan(replayed), "Offline source should not rescan");
+
+                bed = umockdev_testbed_new();
+                fail_if(!umockdev_testbed_add_from_file(bed, recordings[r], NULL),
+                        "Failed to create device: %s",
+                        recordings[r]);
+                manager = ldm_manager_new(LDM_MANAGER_FLAGS_NO_MONITOR);
+
+                devices = ldm_manager_get_devices(manager, LDM_DEVICE_TYPE_ANY);
+                replayed_devices = ldm_manager_get_devices(replayed, LDM_DEVICE_TYPE_ANY);
+                fail_if(devices->len == 0, "No devices in %s", recordings[r]);
+                fail_if(devices->len != replayed_devices->len,
+                        "Replay has the wrong device count");
+
+                for (guint i = 0; i < devices->len; i++) {
+                        LdmDevice *device = devices->pdata[i];
+                        LdmDevice *copy = replayed_devices->pdata[i];
+
+                        fail_if(G_OBJECT_TYPE(device) != G_OBJECT_TYPE(copy), "Wrong device type");
+                        fail_if(!g_str_equal(ldm_device_get_path(device),
+                                             ldm_device_get_path(copy)),
+                                "Replay changed the device order");
+                        fail_if(g_strcmp0(ldm_device_get_name(device),
+                                          ldm_device_get_name(copy)) != 0,
+                                "Device name not replayed");
+                        fail_if(ldm_device_get_device_type(device) !=
+                                    ldm_device_get_device_type(copy),
+                                "Device type not replayed");
+                        fail_if(ldm_device_get_attributes(device) !=
+                                    ldm_device_get_attributes(copy),
+                                "Device attributes not replayed");
+                }
+        }
+}
+END_TEST
+
+/**
+ * Ensure a snapshot can be used as a source regardless of the live system,
+ * and that a missing source is reported.
+ */
+START_TEST(test_manager_source_snapshot)
+{
+        g_autoptr(LdmManager) manager = NULL;
+        g_autoptr(LdmManager) restored = NULL;
+        g_autoptr(LdmManager) missing = NULL;
+        g_autoptr(GPtrArray) devices = NULL;
+        g_autoptr(GError) error = NULL;
+        g_autofree gchar *directory = NULL;
+        g_autofree gchar *snapshot = NULL;
+
+        directory = g_dir_make_tmp("ldm-snapshot-XXXXXX", NULL);
+        fail_if(!directory, "Failed to create snapshot directory");
+        snapshot = g_build_filename(directory, "snapshot", NULL);
+
+        {
+                autofree(UMockdevTestbed) *bed = umockdev_testbed_new();
+
+                fail_if(!umockdev_testbed_add_from_file(bed, NV_MOCKDEV_FILE, NULL),
+                        "Failed to create NVIDIA device");
+                manager = g_object_new(LDM_TYPE_MANAGER,
+                                       "flags",
+                                       LDM_MANAGER_FLAGS_NO_MONITOR | LDM_MANAGER_FLAGS_SNAPSHOT,
+                                       "snapshot-file",
+                                       snapshot,
+                                       NULL);
+        }
+
+        restored = ldm_manager_new_from_source(LDM_DEVICE_SOURCE_SNAPSHOT, snapshot, 0, &error);
+        fail_if(!restored, "Failed to restore snapshot: %s", error->message);
+
+        devices = ldm_manager_get_devices(restored, LDM_DEVICE_TYPE_GPU);
+        fail_if(devices->len != 1, "Snapshot source lost the GPU");
+        fail_if(ldm_device_get_vendor_id(devices->pdata[0]) != 0x10DE, "Wrong GPU vendor");
+
+        g_unlink(snapshot);
+        missing = ldm_manager_new_from_source(LDM_DEVICE_SOURCE_SNAPSHOT, snapshot, 0, &error);
+        fail_if(missing != NULL, "Missing snapshot should fail");
+        fail_if(error == NULL, "Missing snapshot should set an error");
+
+        g_rmdir(directory);
+}
+END_TEST
+
+/**
+ * Ensure an exported snapshot restores the same tree, and that files in
+ * another format are refused.
+ */
+START_TEST(test_manager_export_snapshot)
+{
+        g_autoptr(LdmManager) manager = NULL;
+        g_autoptr(LdmManager) restored = NULL;
+        g_autoptr(LdmManager) invalid = NULL;
+        g_autoptr(GPtrArray) devices = NULL;
+        g_autoptr(GPtrArray) restored_devices = NULL;
+        g_autoptr(GError) error = NULL;
+        g_autofree gchar *directory = NULL;
+        g_autofree gchar *snapshot = NULL;
+
+        directory = g_dir_make_tmp("ldm-snapshot-XXXXXX", NULL);
+        fail_if(!directory, "Failed to create snapshot directory");
+        snapshot = g_build_filename(directory, "snapshot", NULL);
+
+        manager = ldm_manager_new_from_source(LDM_DEVICE_SOURCE_UMOCKDEV,
+                                              BLUETOOTH_UMOCKDEV_FILE,
+                                              0,
+                                              &error);
+        fail_if(!manager, "Failed to replay recording: %s", error->message);
+        fail_if(!ldm_manager_export_snapshot(manager, snapshot, &error),
+                "Failed to export snapshot: %s",
+                error->message);
+
+        restored = ldm_manager_new_from_source(LDM_DEVICE_SOURCE_SNAPSHOT, snapshot, 0, &error);
+        fail_if(!restored, "Failed to restore snapshot: %s", error->message);
+
+        devices = ldm_manager_get_devices(manager, LDM_DEVICE_TYPE_ANY);
+        restored_devices = ldm_manager_get_devices(restored, LDM_DEVICE_TYPE_ANY);
+        fail_if(devices->len != restored_devices->len, "Snapshot has the wrong device count");
+        for (guint i = 0; i < devices->len; i++) {
+                LdmDevice *device = devices->pdata[i];
+                LdmDevice *copy = restored_devices->pdata[i];
+
+                fail_if(!g_str_equal(ldm_device_get_path(device), ldm_device_get_path(copy)),
+                        "Snapshot lost the device order");
+                fail_if(g_strcmp0(ldm_device_get_modalias(device),
+                                  ldm_device_get_modalias(copy)) != 0,
+                        "Device modalias not restored");
+                fail_if(ldm_device_get_product_id(device) != ldm_device_get_product_id(copy),
+                        "Device product not restored");
+                fail_if(g_strcmp0(ldm_device_get_name(device), ldm_device_get_name(copy)) != 0,
+                        "Device name not restored");
+                fail_if(g_strcmp0(ldm_device_get_vendor(device), ldm_device_get_vendor(copy)) != 0,
+                        "Device vendor not restored");
+                fail_if(ldm_device_get_attributes(device) != ldm_device_get_attributes(copy),
+                        "Device attributes not restored");
+                fail_if(ldm_device_get_n_children(device) != ldm_device_get_n_children(copy),
+                        "Device children not restored");
+        }
+
+        invalid = ldm_manager_new_from_source(LDM_DEVICE_SOURCE_SNAPSHOT,
+                                              BLUETOOTH_UMOCKDEV_FILE,
+                                              0,
+                                              &error);
+        fail_if(invalid != NULL, "Recording should not restore as a snapshot");
+        fail_if(!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED),
+                "Recording should be an unsupported snapshot");
+
+        g_unlink(snapshot);
+        g_rmdir(directory);
+}
+END_TEST
+
+/**
+ * Ensure empty hwdb strings are treated as absent, both by the live
+ * constructor and by the snapshot, which cannot tell empty from missing.
+ */
+START_TEST(test_manager_snapshot_empty_strings)
+{
+        g_autoptr(LdmManager) manager = NULL;
+        g_autoptr(LdmManager) restored = NULL;
+        autofree(UMockdevTestbed) *bed = NULL;
+        g_autoptr(GPtrArray) devices = NULL;
+        g_autoptr(GError) error = NULL;
+        g_autofree gchar *path = NULL;
+        g_autofree gchar *directory = NULL;
+        g_autofree gchar *snapshot = NULL;
+        LdmManager *managers[2] = { NULL };
+
+        directory = g_dir_make_tmp("ldm-snapshot-XXXXXX", NULL);
+        fail_if(!directory, "Failed to create snapshot directory");
+        snapshot = g_build_filename(directory, "snapshot", NULL);
+
+        bed = umockdev_testbed_new();
+        path = umockdev_testbed_add_device(bed,
+                                           "pci",
+                                           "0000:01:00.0",
+                                           NULL,
+                                           /* attributes */
+                                           "class",
+                                           "0x030000",
+                                           "vendor",
+                                           "0x10de",
+                                           "device",
+                                           "0x1b80",
+                                           NULL,
+                                           /* properties */
+                                           "PCI_CLASS",
+                                           "30000",
+                                           "ID_VENDOR_FROM_DATABASE",
+                                           "",
+                                           "ID_MODEL_FROM_DATABASE",
+                                           "",
+                                           NULL);
+        fail_if(!path, "Failed to add PCI device");
+
+        manager = ldm_manager_new(LDM_MANAGER_FLAGS_NO_MONITOR);
+        fail_if(!ldm_manager_export_snapshot(manager, snapshot, &error),
+                "Failed to export snapshot: %s",
+                error->message);
+        restored = ldm_manager_new_from_source(LDM_DEVICE_SOURCE_SNAPSHOT, snapshot, 0, &error);
+        fail_if(!restored, "Failed to restore snapshot: %s", error->message);
+
+        managers[0] = manager;
+        managers[1] = restored;
+        for (guint i = 0; i < G_N_ELEMENTS(managers); i++) {
+                LdmDevice *device = NULL;
+
+                devices = ldm_manager_get_devices(managers[i], LDM_DEVICE_TYPE_GPU);
+                fail_if(devices->len != 1, "Expected 1 GPU, found %u", devices->len);
+                device = devices->pdata[0];
+
+                fail_if(!g_str_equal(ldm_device_get_name(device), "Device 1b80"),
+                        "Empty name should fall back, got '%s'",
+                        ldm_device_get_name(device));
+                fail_if(ldm_device_get_vendor(device) != NULL,
+                        "Empty vendor should be NULL, got '%s'",
+                        ldm_device_get_vendor(device));
+                g_clear_pointer(&devices, g_ptr_array_unref);
+        }
+
+        g_unlink(snapshot);
+        g_rmdir(directory);
+}
+END_TEST
+
 /**
  * Standard helper for running a test suite
  */
@@ -209,6 +1368,24 @@ static Suite *test_create(void)
         tcase_add_test(tc, test_manager_optimus);
         tcase_add_test(tc, test_manager_bluetooth_usb);
         tcase_add_test(tc, test_manager_wifi_pci);
+        tcase_add_test(tc, test_manager_snapshot);
+        tcase_add_test(tc, test_manager_profile);
+        tcase_add_test(tc, test_manager_profile_key);
+        tcase_add_test(tc, test_manager_coalesce);
+        tcase_add_test(tc, test_manager_monitor_thread);
+        tcase_add_test(tc, test_manager_monitor_devtype);
+        tcase_add_test(tc, test_manager_rescan);
+        tcase_add_test(tc, test_manager_deferred);
+        tcase_add_test(tc, test_manager_query);
+        tcase_add_test(tc, test_manager_buckets);
+        tcase_add_test(tc, test_manager_device_table);
+        tcase_add_test(tc, test_manager_device_table_stress);
+        tcase_add_test(tc, test_manager_describe_devices);
+        tcase_add_test(tc, test_manager_dbus_utf8);
+        tcase_add_test(tc, test_manager_source_umockdev);
+        tcase_add_test(tc, test_manager_source_snapshot);
+        tcase_add_test(tc, test_manager_export_snapshot);
+        tcase_add_test(tc, test_manager_snapshot_empty_strings);
 
         return s;
 }
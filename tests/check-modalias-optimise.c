@@ -0,0 +1,209 @@
+/*
+ * This file is part of linux-driver-management.
+ *
+ * Copyright © 2016-2018 Ikey Doherty
+ *
+ * linux-driver-management is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+#define _GNU_SOURCE
+
+#include <check.h>
+#include <fnmatch.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "modalias-optimise.h"
+#include "util.h"
+
+#define OPTIMISE_MODALIAS_FILE TEST_DATA_ROOT "/optimise.modaliases"
+
+/**
+ * Load the "alias match driver package" lines of a modaliases file, the
+ * strings being owned by @storage
+ */
+static GArray *ldm_test_load_entries(GPtrArray *storage)
+{
+        g_autofree gchar *contents = NULL;
+        g_auto(GStrv) lines = NULL;
+        GArray *entries = NULL;
+
+        fail_if(!g_file_get_contents(OPTIMISE_MODALIAS_FILE, &contents, NULL, NULL),
+                "Failed to read %s",
+                OPTIMISE_MODALIAS_FILE);
+
+        lines = g_strsplit(contents, "\n", -1);
+        entries = g_array_new(FALSE, FALSE, sizeof(ModaliasEntry));
+        for (guint i = 0; lines[i]; i++) {
+                gchar **fields = g_strsplit(lines[i], " ", -1);
+                ModaliasEntry entry = { 0 };
+
+                g_ptr_array_add(storage, fields);
+                if (g_strv_length(fields) != 4 || !g_str_equal(fields[0], "alias")) {
+                        continue;
+                }
+                entry.match = fields[1];
+                entry.driver = fields[2];
+                g_array_append_val(entries, entry);
+        }
+
+        return entries;
+}
+
+/**
+ * Resolve the driver for @modalias as a loaded plugin would: the first
+ * matching alias wins, and a duplicated alias has the last driver given.
+ */
+static const gchar *ldm_test_first_match(GArray *entries, const gchar *modalias)
+{
+        const gchar *match = NULL;
+        const gchar *driver = NULL;
+
+        for (guint i = 0; i < entries->len; i++) {
+                ModaliasEntry *entry = &g_array_index(entries, ModaliasEntry, i);
+
+                if (!match && fnmatch(entry->match, modalias, 0) == 0) {
+                        match = entry->match;
+                }
+                if (match && g_str_equal(entry->match, match)) {
+                        driver = entry->driver;
+                }
+        }
+
+        return driver;
+}
+
+/**
+ * Build a device modalias matched by @pattern, expanding each star to
+ * @star and picking the first or last character of each class.
+ */
+static gchar *ldm_test_concretise(const gchar *pattern, const gchar *star, gboolean last)
+{
+        GString *ret = g_string_new(NULL);
+
+        for (const gchar *c = pattern; *c; c++) {
+                const gchar *end = NULL;
+
+                switch (*c) {
+                case '*':
+                        g_string_append(ret, star);
+                        break;
+                case '?':
+                        g_string_append_c(ret, 'F');
+                        break;
+                case '[':
+                        end = strchr(c, ']');
+                        fail_if(!end, "Unterminated class in %s", pattern);
+                        g_string_append_c(ret, last ? end[-1] : c[1]);
+                        c = end;
+                        break;
+                default:
+                        g_string_append_c(ret, *c);
+                        break;
+                }
+        }
+
+        return g_string_free(ret, FALSE);
+}
+
+/**
+ * Ensure optimising the aliases drops some of them, and yet every device
+ * the fixture could match still resolves to the very same driver.
+ */
+START_TEST(test_modalias_optimise_first_match)
+{
+        g_autoptr(GPtrArray) storage = NULL;
+        g_autoptr(GArray) entries = NULL;
+        g_autoptr(GArray) optimised = NULL;
+        g_autoptr(GPtrArray) probes = NULL;
+        const gchar *stars[] = { "", "0", "00001043", "03" };
+
+        storage = g_ptr_array_new_with_free_func((GDestroyNotify)g_strfreev);
+        entries = ldm_test_load_entries(storage);
+        fail_if(entries->len != 15, "Expected 15 aliases, got %u", entries->len);
+
+        optimised = modalias_optimise_entries(entries);
+        fail_if(optimised->len >= entries->len,
+                "Nothing was optimised away, still have %u aliases",
+                optimised->len);
+
+        probes = g_ptr_array_new_with_free_func(g_free);
+        g_ptr_array_add(probes, g_strdup("pci:v000010DEd00001B80sv00001043sd00008599bc03sc00i00"));
+        g_ptr_array_add(probes, g_strdup("pci:v000010DEd00001C60sv00001043sd00008599bc03sc00i00"));
+        g_ptr_array_add(probes, g_strdup("pci:v00001AF4d00001050sv00001AF4sd00001100bc03sc00i00"));
+        g_ptr_array_add(probes, g_strdup("pci:v00001AF4d00001050sv00001AF4sd00001100bc02sc00i00"));
+        g_ptr_array_add(probes, g_strdup("usb:v046DpC52Bd1201dc00dsc00dp00ic03isc01ip02in00"));
+        g_ptr_array_add(probes, g_strdup("usb:v1D6Bp0002d0415dc09dsc00dp01ic09isc00ip00in00"));
+        for (guint i = 0; i < entries->len; i++) {
+                const gchar *match = g_array_index(entries, ModaliasEntry, i).match;
+
+                for (guint j = 0; j < G_N_ELEMENTS(stars); j++) {
+                        g_ptr_array_add(probes, ldm_test_concretise(match, stars[j], FALSE));
+                        g_ptr_array_add(probes, ldm_test_concretise(match, stars[j], TRUE));
+                }
+        }
+
+        for (guint i = 0; i < probes->len; i++) {
+                const gchar *probe = probes->pdata[i];
+                const gchar *expected = ldm_test_first_match(entries, probe);
+                const gchar *driver = ldm_test_first_match(optimised, probe);
+
+                fail_if(g_strcmp0(expected, driver) != 0,
+                        "%s should resolve to %s, not %s",
+                        probe,
+                        expected ? expected : "nothing",
+                        driver ? driver : "nothing");
+        }
+}
+END_TEST
+
+/**
+ * Standard helper for running a test suite
+ */
+static int ldm_test_run(Suite *suite)
+{
+        SRunner *runner = NULL;
+        int n_failed = 0;
+
+        runner = srunner_create(suite);
+        srunner_run_all(runner, CK_VERBOSE);
+        n_failed = srunner_ntests_failed(runner);
+        srunner_free(runner);
+
+        return n_failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static Suite *test_create(void)
+{
+        Suite *s = NULL;
+        TCase *tc = NULL;
+
+        s = suite_create(__FILE__);
+        tc = tcase_create(__FILE__);
+        suite_add_tcase(s, tc);
+
+        tcase_add_test(tc, test_modalias_optimise_first_match);
+
+        return s;
+}
+
+int main(__ldm_unused__ int argc, __ldm_unused__ char **argv)
+{
+        return ldm_test_run(test_create());
+}
+
+/*
+ * Editor modelines  -  https://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: nil
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 expandtab:
+ * :indentSize=8:tabSize=8:noTabs=true:
+ */
@@ -14,6 +14,7 @@
 #include <check.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "ldm-private.h"
 #include "ldm.h"
@@ -24,6 +25,8 @@
  */
 #define NVIDIA_MODALIAS "pci:v000010DEd00001C60sv00001558sd000065A4bc03sc00i00"
 
+#define AMD_MODALIAS "pci:v00001002d000067DFsv00001043sd00000517bc03sc00i00"
+
 #define GLX_MATCH "pci:v000010DEd00001C60sv*sd*bc03sc*i*"
 #define GLX_NO_MATCH "pci:v000010DEd00001B84sv*sd*bc03sc*i*"
 
@@ -42,7 +45,7 @@ static LdmDevice *create_fake_device(const char *name, const char *vendor, const
         ck_assert(ret != NULL);
 
         ret->id.name = g_strdup(name);
-        ret->id.vendor = g_strdup(vendor);
+        ret->id.vendor = g_intern_string(vendor);
         if (modalias) {
                 ret->os.modalias = g_strdup(modalias);
         }
@@ -104,6 +107,222 @@ START_TEST(test_modalias_file)
 }
 END_TEST
 
+/**
+ * Rules loaded from a file are only materialised as LdmModalias on request
+ */
+START_TEST(test_modalias_plugin_get_modalias)
+{
+        g_autoptr(LdmPlugin) plugin = NULL;
+        g_autoptr(LdmModalias) alias = NULL;
+        LdmModaliasPlugin *modalias_plugin = NULL;
+
+        plugin = ldm_modalias_plugin_new_from_filename(NV_MODALIAS_FILE);
+        fail_if(!plugin, "Failed to construct driver from modalias file");
+        modalias_plugin = LDM_MODALIAS_PLUGIN(plugin);
+
+        alias = ldm_modalias_plugin_get_modalias(modalias_plugin, GLX_MATCH);
+        fail_if(!alias, "Failed to find rule by match");
+        fail_if(!g_str_equal(ldm_modalias_get_match(alias), GLX_MATCH), "Wrong rule returned");
+        fail_if(!g_str_equal(ldm_modalias_get_driver(alias), "nvidia"), "Invalid driver");
+        fail_if(!g_str_equal(ldm_modalias_get_package(alias), "nvidia-glx-driver"),
+                "Invalid package");
+
+        fail_if(ldm_modalias_plugin_get_modalias(modalias_plugin, "pci:nope") != NULL,
+                "Found a rule that doesn't exist");
+}
+END_TEST
+
+/**
+ * Return a copy of the package for @match, or NULL if the plugin has no such rule
+ */
+static gchar *ldm_test_get_package(LdmPlugin *plugin, const gchar *match)
+{
+        g_autoptr(LdmModalias) alias = NULL;
+
+        alias = ldm_modalias_plugin_get_modalias(LDM_MODALIAS_PLUGIN(plugin), match);
+        return alias ? g_strdup(ldm_modalias_get_package(alias)) : NULL;
+}
+
+/**
+ * Tokeniser must cope with odd whitespace, comments, junk lines and a final
+ * line without a newline, as well as truncated input at any offset.
+ */
+START_TEST(test_modalias_plugin_new_from_data)
+{
+        static const gchar data[] = "# comment\n"
+                                    "\n"
+                                    "   \t\n"
+                                    "alias\t" GLX_MATCH "  nvidia   nvidia-glx-driver  \r\n"
+                                    "bogus a b c\n"
+                                    "alias too-short\n"
+                                    "alias " GLX_NO_MATCH " nvidia last line";
+        const gsize len = sizeof(data) - 1;
+        const gsize last_line = (gsize)(strstr(data, "alias " GLX_NO_MATCH) - data);
+        g_autoptr(LdmPlugin) plugin = NULL;
+        g_autoptr(LdmModalias) alias = NULL;
+        LdmModaliasPlugin *modalias_plugin = NULL;
+
+        plugin = ldm_modalias_plugin_new_from_data("data-test", data, len);
+        fail_if(!plugin, "Failed to construct plugin from data");
+        modalias_plugin = LDM_MODALIAS_PLUGIN(plugin);
+
+        alias = ldm_modalias_plugin_get_modalias(modalias_plugin, GLX_MATCH);
+        fail_if(!alias, "Failed to parse rule with odd whitespace");
+        fail_if(!g_str_equal(ldm_modalias_get_driver(alias), "nvidia"), "Invalid driver");
+        fail_if(!g_str_equal(ldm_modalias_get_package(alias), "nvidia-glx-driver"),
+                "Trailing blanks not stripped from package");
+        g_clear_object(&alias);
+
+        alias = ldm_modalias_plugin_get_modalias(modalias_plugin, GLX_NO_MATCH);
+        fail_if(!alias, "Failed to parse final line");
+        fail_if(!g_str_equal(ldm_modalias_get_package(alias), "last line"),
+                "Final field should take the rest of the line");
+        g_clear_object(&alias);
+
+        fail_if(ldm_modalias_plugin_get_modalias(modalias_plugin, "a") != NULL,
+                "Unknown directive should be skipped");
+
+        fail_if(ldm_modalias_plugin_get_modalias(modalias_plugin, "too-short") != NULL,
+                "Incomplete rule should be skipped");
+
+        /* Every truncation must parse cleanly, keeping only whole rules */
+        for (gsize i = 0; i <= len; i++) {
+                g_autoptr(LdmPlugin) truncated = NULL;
+                g_autofree gchar *first = NULL;
+                g_autofree gchar *last = NULL;
+                guint n_rules = 0;
+
+                truncated = ldm_modalias_plugin_new_from_data("truncated", data, i);
+                fail_if(!truncated, "Failed to construct plugin from truncated data");
+
+                first = ldm_test_get_package(truncated, GLX_MATCH);
+                last = ldm_test_get_package(truncated, GLX_NO_MATCH);
+                n_rules = (first ? 1 : 0) + (last ? 1 : 0);
+
+                if (i >= last_line) {
+                        fail_if(!first || !g_str_equal(first, "nvidia-glx-driver"),
+                                "Lost a complete rule at offset %zu", i);
+                } else {
+                        fail_if(last != NULL, "Parsed a rule beyond the input at %zu", i);
+                }
+                if (last) {
+                        fail_if(!g_str_has_prefix("last line", last),
+                                "Final rule runs past the input at offset %zu",
+                                i);
+                }
+                if (i == len - strlen(" line")) {
+                        fail_if(!last || !g_str_equal(last, "last"),
+                                "Final field should end with the input");
+                }
+                if (i == len) {
+                        fail_if(n_rules != 2, "Expected 2 rules, found %u", n_rules);
+                }
+        }
+}
+END_TEST
+
+/**
+ * Ensure the compiled index in the plugin honours literal prefixes, prefix-less
+ * wildcards, rule order, and replacement of an existing match.
+ */
+START_TEST(test_modalias_plugin_index)
+{
+        g_autoptr(LdmPlugin) plugin = NULL;
+        g_autoptr(LdmDevice) nvidia_device = NULL;
+        g_autoptr(LdmDevice) amd_device = NULL;
+        g_autoptr(LdmProvider) provider = NULL;
+        LdmModaliasPlugin *modalias_plugin = NULL;
+        LdmModalias *alias = NULL;
+
+        plugin = ldm_modalias_plugin_new("index-test");
+        modalias_plugin = LDM_MODALIAS_PLUGIN(plugin);
+
+        alias = ldm_modalias_new(GLX_MATCH, "nvidia", "nvidia-glx-driver");
+        ldm_modalias_plugin_add_modalias(modalias_plugin, alias);
+        alias = ldm_modalias_new(GLX_NO_MATCH, "nvidia", "nope");
+        ldm_modalias_plugin_add_modalias(modalias_plugin, alias);
+        alias = ldm_modalias_new("*bc03sc*", "generic", "generic");
+        ldm_modalias_plugin_add_modalias(modalias_plugin, alias);
+
+        nvidia_device = create_fake_device("GTX 1060", "NVIDIA", NVIDIA_MODALIAS);
+        amd_device = create_fake_device("RX 580", "AMD", AMD_MODALIAS);
+
+        /* Earliest rule must win over the later prefix-less wildcard */
+        provider = ldm_plugin_get_provider(plugin, nvidia_device);
+        fail_if(!provider, "Failed to find provider via index");
+        fail_if(!g_str_equal(ldm_provider_get_package(provider), "nvidia-glx-driver"),
+                "Index returned the wrong rule");
+        g_clear_object(&provider);
+
+        /* Only the prefix-less wildcard can match here */
+        provider = ldm_plugin_get_provider(plugin, amd_device);
+        fail_if(!provider, "Failed to find wildcard provider via index");
+        fail_if(!g_str_equal(ldm_provider_get_package(provider), "generic"),
+                "Index failed to match prefix-less rule");
+        g_clear_object(&provider);
+
+        /* Replacing a match must keep its place in the index */
+        alias = ldm_modalias_new(GLX_MATCH, "nvidia", "replaced");
+        ldm_modalias_plugin_add_modalias(modalias_plugin, alias);
+        provider = ldm_plugin_get_provider(plugin, nvidia_device);
+        fail_if(!provider, "Lost provider after replacing rule");
+        fail_if(!g_str_equal(ldm_provider_get_package(provider), "replaced"),
+                "Replaced rule not used by index");
+}
+END_TEST
+
+/**
+ * Ensure the numeric prefilter only ever rejects rules that fnmatch would,
+ * and leaves irregular rules and modaliases to fnmatch.
+ */
+START_TEST(test_modalias_plugin_prefilter)
+{
+        g_autoptr(LdmPlugin) plugin = NULL;
+        g_autoptr(LdmDevice) nvidia_device = NULL;
+        g_autoptr(LdmDevice) amd_device = NULL;
+        g_autoptr(LdmDevice) dmi_device = NULL;
+        g_autoptr(LdmProvider) provider = NULL;
+        LdmModaliasPlugin *modalias_plugin = NULL;
+        LdmModalias *alias = NULL;
+
+        plugin = ldm_modalias_plugin_new("prefilter-test");
+        modalias_plugin = LDM_MODALIAS_PLUGIN(plugin);
+
+        alias = ldm_modalias_new("pci:v000010DEd00001C60sv*sd*bc02sc*i*", "nvidia", "wrong-class");
+        ldm_modalias_plugin_add_modalias(modalias_plugin, alias);
+        alias = ldm_modalias_new("pci:v000010DEd00001C60sv*sd*bc0[0-9]sc*i*", "nvidia", "bracket");
+        ldm_modalias_plugin_add_modalias(modalias_plugin, alias);
+        alias = ldm_modalias_new("pci:v*d*sv00001043sd*bc03sc*i*", "amdgpu", "asus");
+        ldm_modalias_plugin_add_modalias(modalias_plugin, alias);
+        alias = ldm_modalias_new("dmi:*svnLENOVO*", "thinkpad_acpi", "lenovo");
+        ldm_modalias_plugin_add_modalias(modalias_plugin, alias);
+
+        nvidia_device = create_fake_device("GTX 1060", "NVIDIA", NVIDIA_MODALIAS);
+        amd_device = create_fake_device("RX 580", "AMD", AMD_MODALIAS);
+        dmi_device = create_fake_device("ThinkPad", "LENOVO", "dmi:bvnLENOVO:svnLENOVO:pn20HR");
+
+        /* Literal class differs, leaving only the irregular bracket rule */
+        provider = ldm_plugin_get_provider(plugin, nvidia_device);
+        fail_if(!provider, "Prefilter rejected an irregular rule");
+        fail_if(!g_str_equal(ldm_provider_get_package(provider), "bracket"),
+                "Prefilter failed to reject a differing literal ID");
+        g_clear_object(&provider);
+
+        /* Literal fields after wildcards must still match */
+        provider = ldm_plugin_get_provider(plugin, amd_device);
+        fail_if(!provider, "Prefilter rejected a matching rule");
+        fail_if(!g_str_equal(ldm_provider_get_package(provider), "asus"),
+                "Prefilter returned the wrong rule");
+        g_clear_object(&provider);
+
+        /* Modaliases outside the bus grammar are never prefiltered */
+        provider = ldm_plugin_get_provider(plugin, dmi_device);
+        fail_if(!provider, "Prefilter rejected an irregular modalias");
+        fail_if(!g_str_equal(ldm_provider_get_package(provider), "lenovo"),
+                "Prefilter returned the wrong rule for an irregular modalias");
+}
+END_TEST
+
 /**
  * Standard helper for running a test suite
  */
@@ -132,6 +351,10 @@ static Suite *test_create(void)
         tcase_add_test(tc, test_modalias_simple);
         tcase_add_test(tc, test_modalias_device);
         tcase_add_test(tc, test_modalias_file);
+        tcase_add_test(tc, test_modalias_plugin_get_modalias);
+        tcase_add_test(tc, test_modalias_plugin_new_from_data);
+        tcase_add_test(tc, test_modalias_plugin_index);
+        tcase_add_test(tc, test_modalias_plugin_prefilter);
 
         return s;
 }
@@ -28,6 +28,7 @@ DEF_AUTOFREE(UMockdevTestbed, g_object_unref)
 #define NV_MAIN_MODALIAS TEST_DATA_ROOT "/nvidia-glx-driver.modaliases"
 #define NV_340_MODALIAS TEST_DATA_ROOT "/nvidia-340-glx-driver.modaliases"
 #define MODALIAS_DIR TEST_DATA_ROOT "/"
+#define NV_MAIN_MODALIAS_DB TEST_DATA_ROOT "/binary/nvidia-glx-driver.modaliases"
 
 #define RAZER_MOCKDEV_FILE TEST_DATA_ROOT "/razer-ornata-chroma.umockdev"
 #define RAZER_MODALIAS TEST_DATA_ROOT "razer-drivers.modaliases"
@@ -115,6 +116,43 @@ START_TEST(test_plugins_nvidia_multiple)
 }
 END_TEST
 
+/**
+ * Ensure the short-circuit query yields the top candidate, both with and
+ * without previously cached results.
+ */
+START_TEST(test_plugins_best_provider)
+{
+        g_autoptr(LdmManager) manager = NULL;
+        autofree(UMockdevTestbed) *bed = NULL;
+        g_autoptr(LdmGPUConfig) gpu = NULL;
+        g_autoptr(LdmProvider) best = NULL;
+        g_autoptr(GPtrArray) providers = NULL;
+        const gchar *plugin_id = NULL;
+
+        bed = create_bed_from(OPTIMUS_MOCKDEV_FILE);
+        manager = ldm_manager_new(0);
+
+        fail_if(!ldm_manager_add_modalias_plugin_for_path(manager, NV_340_MODALIAS),
+                "Failed to add 340 modalias file");
+        fail_if(!ldm_manager_add_modalias_plugin_for_path(manager, NV_MAIN_MODALIAS),
+                "Failed to add main modalias file");
+
+        gpu = ldm_gpu_config_new(manager);
+        best = ldm_gpu_config_get_best_provider(gpu);
+        fail_if(!best, "Failed to find best provider");
+        plugin_id = ldm_plugin_get_name(ldm_provider_get_plugin(best));
+        fail_if(!g_str_equal(plugin_id, "nvidia-glx-driver"),
+                "Best candidate should be nvidia-glx-driver, got %s",
+                plugin_id);
+        g_clear_object(&best);
+
+        /* Now with full results cached */
+        providers = ldm_gpu_config_get_providers(gpu);
+        best = ldm_gpu_config_get_best_provider(gpu);
+        fail_if(best != providers->pdata[0], "Best provider must match the cached results");
+}
+END_TEST
+
 /**
  * Identical to test_plugins_nvidia_multiple except we don't manually add
  * the plugins, we add them from the search path.
@@ -152,6 +190,568 @@ START_TEST(test_plugins_nvidia_multiple_glob)
 }
 END_TEST
 
+/**
+ * Identical to test_plugins_nvidia_multiple except the main driver is loaded
+ * from a precompiled (little endian) modalias database.
+ */
+START_TEST(test_plugins_nvidia_binary)
+{
+        g_autoptr(LdmManager) manager = NULL;
+        autofree(UMockdevTestbed) *bed = NULL;
+        g_autoptr(LdmGPUConfig) gpu = NULL;
+        g_autoptr(GPtrArray) providers = NULL;
+        const gchar *plugin_id = NULL;
+
+        bed = create_bed_from(OPTIMUS_MOCKDEV_FILE);
+        manager = ldm_manager_new(0);
+
+        fail_if(!ldm_manager_add_modalias_plugin_for_path(manager, NV_340_MODALIAS),
+                "Failed to add 340 modalias file");
+        fail_if(!ldm_manager_add_modalias_plugin_for_path(manager, NV_MAIN_MODALIAS_DB),
+                "Failed to add main modalias database");
+
+        gpu = ldm_gpu_config_new(manager);
+        fail_if(!gpu, "Failed to create GPUConfig");
+
+        providers = ldm_gpu_config_get_providers(gpu);
+        fail_if(providers->len != 2, "Expected 2 providers, got %u providers", providers->len);
+
+        plugin_id = ldm_plugin_get_name(ldm_provider_get_plugin(providers->pdata[0]));
+        fail_if(!g_str_equal(plugin_id, "nvidia-glx-driver"),
+                "First candidate should be nvidia-glx-driver, got %s",
+                plugin_id);
+        fail_if(!g_str_equal(ldm_provider_get_package(providers->pdata[0]), "nvidia-glx-driver"),
+                "Invalid package from modalias database");
+}
+END_TEST
+
+/**
+ * Ensure provider results are memoised, and invalidated by plugin changes
+ */
+START_TEST(test_plugins_cache)
+{
+        g_autoptr(LdmManager) manager = NULL;
+        autofree(UMockdevTestbed) *bed = NULL;
+        g_autoptr(LdmGPUConfig) gpu = NULL;
+        g_autoptr(GPtrArray) providers = NULL;
+        g_autoptr(GPtrArray) cached = NULL;
+        g_autoptr(GPtrArray) refreshed = NULL;
+        LdmDevice *device = NULL;
+        guint generation = 0;
+
+        bed = create_bed_from(OPTIMUS_MOCKDEV_FILE);
+        manager = ldm_manager_new(0);
+
+        fail_if(!ldm_manager_add_modalias_plugin_for_path(manager, NV_MAIN_MODALIAS),
+                "Failed to add main modalias file");
+
+        gpu = ldm_gpu_config_new(manager);
+        device = ldm_gpu_config_get_detection_device(gpu);
+        fail_if(!device, "Failed to find detection device");
+
+        generation = ldm_manager_get_generation(manager);
+        providers = ldm_manager_get_providers(manager, device);
+        cached = ldm_manager_get_providers(manager, device);
+        fail_if(providers->len != 1, "Expected 1 provider, got %u providers", providers->len);
+        fail_if(cached == providers, "Cached results must be a new container");
+        fail_if(cached->len != 1 || cached->pdata[0] != providers->pdata[0],
+                "Provider results were not memoised");
+        fail_if(ldm_manager_get_generation(manager) != generation,
+                "Generation changed without any plugin changes");
+
+        fail_if(!ldm_manager_add_modalias_plugin_for_path(manager, NV_340_MODALIAS),
+                "Failed to add 340 modalias file");
+        fail_if(ldm_manager_get_generation(manager) == generation,
+                "Generation unchanged after adding plugin");
+
+        refreshed = ldm_manager_get_providers(manager, device);
+        fail_if(refreshed->len != 2, "Expected 2 providers, got %u providers", refreshed->len);
+}
+END_TEST
+
+/**
+ * Ensure the bulk API agrees with the per-device API, including ordering
+ */
+START_TEST(test_plugins_all_providers)
+{
+        g_autoptr(LdmManager) manager = NULL;
+        autofree(UMockdevTestbed) *bed = NULL;
+        g_autoptr(LdmGPUConfig) gpu = NULL;
+        g_autoptr(GHashTable) all_providers = NULL;
+        g_autoptr(GPtrArray) devices = NULL;
+        GPtrArray *providers = NULL;
+        const gchar *plugin_id = NULL;
+
+        bed = create_bed_from(OPTIMUS_MOCKDEV_FILE);
+        manager = ldm_manager_new(0);
+
+        fail_if(!ldm_manager_add_modalias_plugin_for_path(manager, NV_340_MODALIAS),
+                "Failed to add 340 modalias file");
+        fail_if(!ldm_manager_add_modalias_plugin_for_path(manager, NV_MAIN_MODALIAS),
+                "Failed to add main modalias file");
+
+        all_providers = ldm_manager_get_all_providers(manager, LDM_DEVICE_TYPE_ANY);
+        devices = ldm_manager_get_devices(manager, LDM_DEVICE_TYPE_ANY);
+        fail_if(g_hash_table_size(all_providers) != devices->len,
+                "Expected %u devices, got %u",
+                devices->len,
+                g_hash_table_size(all_providers));
+
+        gpu = ldm_gpu_config_new(manager);
+        providers = g_hash_table_lookup(all_providers, ldm_gpu_config_get_detection_device(gpu));
+        fail_if(!providers, "Missing detection device from bulk providers");
+        fail_if(providers->len != 2, "Expected 2 providers, got %u providers", providers->len);
+
+        plugin_id = ldm_plugin_get_name(ldm_provider_get_plugin(providers->pdata[0]));
+        fail_if(!g_str_equal(plugin_id, "nvidia-glx-driver"),
+                "First candidate should be nvidia-glx-driver, got %s",
+                plugin_id);
+}
+END_TEST
+
+/**
+ * Ensure the lightweight records agree with the providers, cached or not
+ */
+START_TEST(test_plugins_provider_infos)
+{
+        g_autoptr(LdmManager) manager = NULL;
+        autofree(UMockdevTestbed) *bed = NULL;
+        g_autoptr(LdmGPUConfig) gpu = NULL;
+        g_autoptr(GArray) infos = NULL;
+        g_autoptr(GArray) cached_infos = NULL;
+        g_autoptr(GHashTable) all_providers = NULL;
+        g_autoptr(LdmProvider) provider = NULL;
+        LdmProviderInfo *matches[2] = { NULL };
+        LdmDevice *device = NULL;
+        guint n_matches = 0;
+
+        bed = create_bed_from(OPTIMUS_MOCKDEV_FILE);
+        manager = ldm_manager_new(0);
+
+        fail_if(!ldm_manager_add_modalias_plugin_for_path(manager, NV_340_MODALIAS),
+                "Failed to add 340 modalias file");
+        fail_if(!ldm_manager_add_modalias_plugin_for_path(manager, NV_MAIN_MODALIAS),
+                "Failed to add main modalias file");
+
+        /* Nothing is cached yet, so everything goes through the match vfunc */
+        infos = ldm_manager_get_provider_infos(manager, LDM_DEVICE_TYPE_ANY);
+        gpu = ldm_gpu_config_new(manager);
+        device = ldm_gpu_config_get_detection_device(gpu);
+
+        for (guint i = 0; i < infos->len; i++) {
+                LdmProviderInfo *info = &g_array_index(infos, LdmProviderInfo, i);
+
+                if (info->device != device) {
+                        continue;
+                }
+                fail_if(n_matches >= G_N_ELEMENTS(matches), "Too many matches for the GPU");
+                matches[n_matches++] = info;
+        }
+        fail_if(n_matches != 2, "Expected 2 matches, got %u matches", n_matches);
+        fail_if(!g_str_equal(matches[0]->package, "nvidia-glx-driver"),
+                "First match should be nvidia-glx-driver, got %s",
+                matches[0]->package);
+        fail_if(!g_str_equal(matches[1]->package, "nvidia-340-glx-driver"),
+                "Second match should be nvidia-340-glx-driver, got %s",
+                matches[1]->package);
+        fail_if(!matches[0]->driver || !g_str_equal(matches[0]->driver, "nvidia"),
+                "Match is missing its driver");
+
+        provider = g_object_ref_sink(ldm_provider_new_from_info(matches[0]));
+        fail_if(ldm_provider_get_device(provider) != device, "Provider has the wrong device");
+        fail_if(ldm_provider_get_plugin(provider) != matches[0]->plugin,
+                "Provider has the wrong plugin");
+        fail_if(!g_str_equal(ldm_provider_get_package(provider), "nvidia-glx-driver"),
+                "Provider has the wrong package");
+
+        /* Memoised providers give identical records */
+        all_providers = ldm_manager_get_all_providers(manager, LDM_DEVICE_TYPE_ANY);
+        cached_infos = ldm_manager_get_provider_infos(manager, LDM_DEVICE_TYPE_ANY);
+        fail_if(cached_infos->len != infos->len,
+                "Expected %u cached records, got %u",
+                infos->len,
+                cached_infos->len);
+        for (guint i = 0; i < infos->len; i++) {
+                LdmProviderInfo *a = &g_array_index(infos, LdmProviderInfo, i);
+                LdmProviderInfo *b = &g_array_index(cached_infos, LdmProviderInfo, i);
+
+                fail_if(a->plugin != b->plugin || a->device != b->device, "Records differ");
+                fail_if(!g_str_equal(a->package, b->package), "Record packages differ");
+        }
+}
+END_TEST
+
+/**
+ * Ensure the bulk provider records agree with the lightweight records
+ */
+START_TEST(test_plugins_describe_providers)
+{
+        g_autoptr(LdmManager) manager = NULL;
+        autofree(UMockdevTestbed) *bed = NULL;
+        g_autoptr(GArray) infos = NULL;
+        g_autoptr(GVariant) records = NULL;
+
+        bed = create_bed_from(OPTIMUS_MOCKDEV_FILE);
+        manager = ldm_manager_new(0);
+
+        fail_if(!ldm_manager_add_modalias_plugin_for_path(manager, NV_340_MODALIAS),
+                "Failed to add 340 modalias file");
+        fail_if(!ldm_manager_add_modalias_plugin_for_path(manager, NV_MAIN_MODALIAS),
+                "Failed to add main modalias file");
+
+        infos = ldm_manager_get_provider_infos(manager, LDM_DEVICE_TYPE_ANY);
+        records = ldm_manager_describe_providers(manager, LDM_DEVICE_TYPE_ANY);
+        fail_if(!g_variant_is_of_type(records, G_VARIANT_TYPE(LDM_MANAGER_PROVIDERS_FORMAT)),
+                "Records have the wrong type");
+        fail_if(infos->len == 0, "Expected matches for the NVIDIA GPU");
+        fail_if(g_variant_n_children(records) != infos->len,
+                "Expected %u records, got %u",
+                infos->len,
+                (guint)g_variant_n_children(records));
+
+        for (guint i = 0; i < infos->len; i++) {
+                LdmProviderInfo *info = &g_array_index(infos, LdmProviderInfo, i);
+                const gchar *path = NULL;
+                const gchar *plugin = NULL;
+                const gchar *package = NULL;
+                const gchar *driver = NULL;
+
+                g_variant_get_child(records, i, "(&s&s&s&s)", &path, &plugin, &package, &driver);
+                fail_if(!g_str_equal(path, ldm_device_get_path(info->device)),
+                        "Record has the wrong device");
+                fail_if(!g_str_equal(plugin, ldm_plugin_get_name(info->plugin)),
+                        "Record has the wrong plugin");
+                fail_if(!g_str_equal(package, info->package), "Record has the wrong package");
+                fail_if(!g_str_equal(driver, info->driver ? info->driver : ""),
+                        "Record has the wrong driver");
+        }
+}
+END_TEST
+
+/**
+ * Ensure plugin strings that aren't UTF-8 are replaced in the bulk provider
+ * records, rather than failing to build the variant at all.
+ */
+START_TEST(test_plugins_describe_providers_utf8)
+{
+        g_autoptr(LdmManager) manager = NULL;
+        autofree(UMockdevTestbed) *bed = NULL;
+        g_autoptr(GVariant) records = NULL;
+        g_autofree gchar *expected_plugin = NULL;
+        g_autofree gchar *expected_package = NULL;
+        g_autofree gchar *expected_driver = NULL;
+        const gchar *plugin_name = "acme\xff-plugin";
+        const gchar *package_name = "acme\xff-driver";
+        const gchar *driver_name = "acme\xff";
+        const gchar *path = NULL;
+        const gchar *plugin = NULL;
+        const gchar *package = NULL;
+        const gchar *driver = NULL;
+        LdmPlugin *custom = NULL;
+
+        bed = create_bed_from(OPTIMUS_MOCKDEV_FILE);
+        manager = ldm_manager_new(LDM_MANAGER_FLAGS_NO_MONITOR);
+
+        custom = ldm_modalias_plugin_new(plugin_name);
+        ldm_modalias_plugin_add_modalias(LDM_MODALIAS_PLUGIN(custom),
+                                         ldm_modalias_new("pci:v000010DEd*",
+                                                          driver_name,
+                                                          package_name));
+        ldm_manager_add_plugin(manager, custom);
+
+        records = ldm_manager_describe_providers(manager, LDM_DEVICE_TYPE_GPU);
+        fail_if(g_variant_n_children(records) != 1,
+                "Expected 1 record, got %u",
+                (guint)g_variant_n_children(records));
+
+        expected_plugin = g_utf8_make_valid(plugin_name, -1);
+        expected_package = g_utf8_make_valid(package_name, -1);
+        expected_driver = g_utf8_make_valid(driver_name, -1);
+        g_variant_get_child(records, 0, "(&s&s&s&s)", &path, &plugin, &package, &driver);
+        fail_if(!g_str_equal(plugin, expected_plugin), "Record has the wrong plugin");
+        fail_if(!g_str_equal(package, expected_package), "Record has the wrong package");
+        fail_if(!g_str_equal(driver, expected_driver), "Record has the wrong driver");
+}
+END_TEST
+
+/**
+ * Identical to test_plugins_nvidia_multiple, with threaded matching enabled
+ * to ensure results are still merged in priority order.
+ */
+START_TEST(test_plugins_threaded)
+{
+        g_autoptr(LdmManager) manager = NULL;
+        autofree(UMockdevTestbed) *bed = NULL;
+        g_autoptr(LdmGPUConfig) gpu = NULL;
+        g_autoptr(GPtrArray) providers = NULL;
+        const gchar *plugin_id = NULL;
+
+        bed = create_bed_from(OPTIMUS_MOCKDEV_FILE);
+        manager = ldm_manager_new(LDM_MANAGER_FLAGS_THREADED_MATCHING);
+
+        fail_if(!ldm_manager_add_modalias_plugin_for_path(manager, NV_340_MODALIAS),
+                "Failed to add 340 modalias file");
+        fail_if(!ldm_manager_add_modalias_plugin_for_path(manager, NV_MAIN_MODALIAS),
+                "Failed to add main modalias file");
+
+        gpu = ldm_gpu_config_new(manager);
+        fail_if(!gpu, "Failed to create GPUConfig");
+
+        providers = ldm_gpu_config_get_providers(gpu);
+        fail_if(providers->len != 2, "Expected 2 providers, got %u providers", providers->len);
+
+        plugin_id = ldm_plugin_get_name(ldm_provider_get_plugin(providers->pdata[0]));
+        fail_if(!g_str_equal(plugin_id, "nvidia-glx-driver"),
+                "First candidate should be nvidia-glx-driver, got %s",
+                plugin_id);
+
+        plugin_id = ldm_plugin_get_name(ldm_provider_get_plugin(providers->pdata[1]));
+        fail_if(!g_str_equal(plugin_id, "nvidia-340-glx-driver"),
+                "Second candidate should be nvidia-340-glx-driver, got %s",
+                plugin_id);
+}
+END_TEST
+
+/**
+ * Ensure matching through the merged index agrees with each plugin matched
+ * alone, and picks up rules added after the index was built.
+ */
+START_TEST(test_plugins_merged)
+{
+        g_autoptr(LdmManager) manager = NULL;
+        autofree(UMockdevTestbed) *bed = NULL;
+        g_autoptr(LdmGPUConfig) gpu = NULL;
+        g_autoptr(GArray) infos = NULL;
+        g_autoptr(LdmPlugin) custom = NULL;
+        g_autoptr(GPtrArray) providers = NULL;
+        const gchar *packages[] = { "nvidia-glx-driver", "nvidia-340-glx-driver", "custom" };
+        LdmDevice *device = NULL;
+        guint n_matches = 0;
+
+        bed = create_bed_from(OPTIMUS_MOCKDEV_FILE);
+        manager = ldm_manager_new(0);
+
+        fail_if(!ldm_manager_add_modalias_plugin_for_path(manager, NV_340_MODALIAS),
+                "Failed to add 340 modalias file");
+        fail_if(!ldm_manager_add_modalias_plugin_for_path(manager, NV_MAIN_MODALIAS),
+                "Failed to add main modalias file");
+        custom = ldm_modalias_plugin_new("custom");
+        ldm_manager_add_plugin(manager, custom);
+
+        gpu = ldm_gpu_config_new(manager);
+        device = ldm_gpu_config_get_detection_device(gpu);
+
+        for (guint pass = 0; pass < 2; pass++) {
+                g_clear_pointer(&infos, g_array_unref);
+                infos = ldm_manager_get_provider_infos(manager, LDM_DEVICE_TYPE_ANY);
+                n_matches = 0;
+
+                for (guint i = 0; i < infos->len; i++) {
+                        LdmProviderInfo *info = &g_array_index(infos, LdmProviderInfo, i);
+                        LdmProviderInfo alone = { 0 };
+
+                        fail_if(!ldm_plugin_match(info->plugin, info->device, &alone),
+                                "Plugin doesn't match alone");
+                        fail_if(!g_str_equal(info->package, alone.package) ||
+                                    !g_str_equal(info->driver, alone.driver),
+                                "Merged match differs from the plugin alone");
+
+                        if (info->device != device) {
+                                continue;
+                        }
+                        fail_if(n_matches >= G_N_ELEMENTS(packages), "Too many matches");
+                        fail_if(!g_str_equal(info->package, packages[n_matches]),
+                                "Match %u should be %s, got %s",
+                                n_matches,
+                                packages[n_matches],
+                                info->package);
+                        ++n_matches;
+                }
+                fail_if(n_matches != pass + 2, "Expected %u matches, got %u", pass + 2, n_matches);
+
+                /* Lowest priority, so it must come last */
+                if (pass == 0) {
+                        ldm_modalias_plugin_add_modalias(LDM_MODALIAS_PLUGIN(custom),
+                                                         ldm_modalias_new("pci:v000010DEd*",
+                                                                          "nvidia",
+                                                                          "custom"));
+                }
+        }
+
+        /* Full providers go through the same index */
+        providers = ldm_gpu_config_get_providers(gpu);
+        fail_if(providers->len != 3, "Expected 3 providers, got %u providers", providers->len);
+        fail_if(!g_str_equal(ldm_provider_get_package(providers->pdata[2]), "custom"),
+                "Third provider should be custom");
+}
+END_TEST
+
+/**
+ * Ensure the sorted plugin registry follows priority changes after insertion
+ */
+START_TEST(test_plugins_priority)
+{
+        g_autoptr(LdmManager) manager = NULL;
+        autofree(UMockdevTestbed) *bed = NULL;
+        g_autoptr(LdmGPUConfig) gpu = NULL;
+        g_autoptr(GPtrArray) providers = NULL;
+        LdmPlugin *legacy = NULL;
+        const gchar *plugin_id = NULL;
+
+        bed = create_bed_from(OPTIMUS_MOCKDEV_FILE);
+        manager = ldm_manager_new(0);
+
+        fail_if(!ldm_manager_add_modalias_plugin_for_path(manager, NV_MAIN_MODALIAS),
+                "Failed to add main modalias file");
+        legacy = ldm_modalias_plugin_new_from_filename(NV_340_MODALIAS);
+        fail_if(!legacy, "Failed to load 340 modalias file");
+        ldm_manager_add_plugin(manager, legacy);
+
+        gpu = ldm_gpu_config_new(manager);
+        providers = ldm_gpu_config_get_providers(gpu);
+        fail_if(providers->len != 2, "Expected 2 providers, got %u providers", providers->len);
+        plugin_id = ldm_plugin_get_name(ldm_provider_get_plugin(providers->pdata[0]));
+        fail_if(!g_str_equal(plugin_id, "nvidia-glx-driver"),
+                "First candidate should be nvidia-glx-driver, got %s",
+                plugin_id);
+        g_clear_pointer(&providers, g_ptr_array_unref);
+
+        /* Now bump the legacy driver above the main driver */
+        ldm_plugin_set_priority(legacy, 100);
+        providers = ldm_gpu_config_get_providers(gpu);
+        fail_if(providers->len != 2, "Expected 2 providers, got %u providers", providers->len);
+        plugin_id = ldm_plugin_get_name(ldm_provider_get_plugin(providers->pdata[0]));
+        fail_if(!g_str_equal(plugin_id, "nvidia-340-glx-driver"),
+                "First candidate should now be nvidia-340-glx-driver, got %s",
+                plugin_id);
+}
+END_TEST
+
+/**
+ * Ensure the reverse index follows plugin registration and replacement
+ */
+START_TEST(test_plugins_reverse_index)
+{
+        g_autoptr(LdmManager) manager = NULL;
+        autofree(UMockdevTestbed) *bed = NULL;
+        g_autoptr(LdmGPUConfig) gpu = NULL;
+        g_autoptr(GPtrArray) devices = NULL;
+        LdmDevice *device = NULL;
+
+        bed = create_bed_from(OPTIMUS_MOCKDEV_FILE);
+        manager = ldm_manager_new(0);
+
+        fail_if(!ldm_manager_add_modalias_plugin_for_path(manager, NV_MAIN_MODALIAS),
+                "Failed to add main modalias file");
+        gpu = ldm_gpu_config_new(manager);
+        device = ldm_gpu_config_get_detection_device(gpu);
+        fail_if(!device, "Failed to find detection device");
+
+        devices = ldm_manager_get_devices_for_package(manager, "nvidia-glx-driver");
+        fail_if(devices->len != 1, "Expected 1 device, got %u devices", devices->len);
+        fail_if(devices->pdata[0] != device, "Reverse index returned the wrong device");
+        g_clear_pointer(&devices, g_ptr_array_unref);
+
+        devices = ldm_manager_get_devices_for_package(manager, "nvidia-340-glx-driver");
+        fail_if(devices->len != 0, "Package matched before its plugin was added");
+        g_clear_pointer(&devices, g_ptr_array_unref);
+
+        /* New plugins are folded into the existing index */
+        fail_if(!ldm_manager_add_modalias_plugin_for_path(manager, NV_340_MODALIAS),
+                "Failed to add 340 modalias file");
+        devices = ldm_manager_get_devices_for_package(manager, "nvidia-340-glx-driver");
+        fail_if(devices->len != 1, "Expected 1 device, got %u devices", devices->len);
+        g_clear_pointer(&devices, g_ptr_array_unref);
+
+        /* Both plugins use the same driver, and the device is listed once */
+        devices = ldm_manager_get_devices_for_driver(manager, "nvidia");
+        fail_if(devices->len != 1, "Expected 1 device, got %u devices", devices->len);
+        fail_if(devices->pdata[0] != device, "Driver index returned the wrong device");
+        g_clear_pointer(&devices, g_ptr_array_unref);
+
+        /* Replacing a plugin drops its matches */
+        ldm_manager_add_plugin(manager, ldm_modalias_plugin_new("nvidia-340-glx-driver"));
+        devices = ldm_manager_get_devices_for_package(manager, "nvidia-340-glx-driver");
+        fail_if(devices->len != 0, "Replaced plugin still matched");
+        g_clear_pointer(&devices, g_ptr_array_unref);
+
+        devices = ldm_manager_get_devices_for_driver(manager, "nvidia");
+        fail_if(devices->len != 1, "Driver lost after replacing one of its plugins");
+}
+END_TEST
+
+/**
+ * Ensure queries for devices with providers run the loaded plugins, and
+ * combine with the other criteria.
+ */
+START_TEST(test_plugins_query_providers)
+{
+        g_autoptr(LdmManager) manager = NULL;
+        autofree(UMockdevTestbed) *bed = NULL;
+        g_autoptr(LdmGPUConfig) gpu = NULL;
+        g_autoptr(GPtrArray) devices = NULL;
+        LdmDeviceQuery query = { .types = LDM_DEVICE_TYPE_GPU, .has_providers = TRUE };
+
+        bed = create_bed_from(OPTIMUS_MOCKDEV_FILE);
+        manager = ldm_manager_new(LDM_MANAGER_FLAGS_NO_MONITOR);
+
+        fail_if(!ldm_manager_add_modalias_plugin_for_path(manager, NV_MAIN_MODALIAS),
+                "Failed to add main modalias file");
+        gpu = ldm_gpu_config_new(manager);
+
+        devices = ldm_manager_query(manager, &query);
+        fail_if(devices->len != 1, "Expected only the NVIDIA GPU, got %u", devices->len);
+        fail_if(devices->pdata[0] != ldm_gpu_config_get_detection_device(gpu),
+                "Wrong GPU has providers");
+        g_clear_pointer(&devices, g_ptr_array_unref);
+
+        query.vendor_id = LDM_PCI_VENDOR_ID_INTEL;
+        devices = ldm_manager_query(manager, &query);
+        fail_if(devices->len != 0, "Intel GPU matched the NVIDIA driver");
+        g_clear_pointer(&devices, g_ptr_array_unref);
+
+        /* Replacing the plugin with an empty one drops the cached match */
+        query.vendor_id = 0;
+        ldm_manager_add_plugin(manager, ldm_modalias_plugin_new("nvidia-glx-driver"));
+        devices = ldm_manager_query(manager, &query);
+        fail_if(devices->len != 0, "Replaced plugin still provided for the GPU");
+}
+END_TEST
+
+START_TEST(test_plugins_stats)
+{
+        g_autoptr(LdmManager) manager = NULL;
+        autofree(UMockdevTestbed) *bed = NULL;
+        g_autoptr(LdmGPUConfig) gpu = NULL;
+        g_autoptr(GPtrArray) providers = NULL;
+        LdmManagerStats before = { 0 };
+        LdmManagerStats after = { 0 };
+
+        bed = create_bed_from(OPTIMUS_MOCKDEV_FILE);
+        manager = ldm_manager_new(0);
+
+        /* Built without instrumentation, so nothing else to check */
+        if (!ldm_manager_get_stats(manager, &before)) {
+                fail_if(before.devices_constructed != 0, "Disabled stats were not zeroed");
+                return;
+        }
+        fail_if(before.devices_constructed < 1, "No devices were counted");
+
+        fail_if(!ldm_manager_add_modalias_plugin_for_path(manager, NV_MAIN_MODALIAS),
+                "Failed to add main modalias file");
+        gpu = ldm_gpu_config_new(manager);
+        providers = ldm_manager_get_providers(manager, ldm_gpu_config_get_detection_device(gpu));
+        fail_if(!providers || providers->len != 1, "Expected a provider for the GPU");
+
+        ldm_manager_get_stats(manager, &after);
+        fail_if(after.plugins_evaluated <= before.plugins_evaluated, "Plugin calls not counted");
+        fail_if(after.fnmatch_calls <= before.fnmatch_calls, "fnmatch calls not counted");
+        fail_if(after.bytes_read <= before.bytes_read, "Modalias bytes not counted");
+        fail_if(after.load_time <= before.load_time, "Load phase not timed");
+        fail_if(after.match_time <= before.match_time, "Match phase not timed");
+}
+END_TEST
+
 /**
  * This test ensures we're able to identify `hid:` style modaliases on HID
  * devices in a USB device tree.
@@ -192,6 +792,208 @@ END_TEST
 /**
  * Standard helper for running a test suite
  */
+/**
+ * State shared by the async callbacks, each of which quits the loop.
+ */
+typedef struct {
+        GMainLoop *loop;
+        LdmManager *manager;
+        gboolean added;
+        GPtrArray *providers;
+} LdmTestAsync;
+
+static void test_async_new_ready(__ldm_unused__ GObject *source, GAsyncResult *result,
+                                 gpointer v)
+{
+        LdmTestAsync *state = v;
+        g_autoptr(GError) error = NULL;
+
+        state->manager = ldm_manager_new_finish(result, &error);
+        fail_if(error != NULL, "Failed to construct manager: %s", error ? error->message : "");
+        g_main_loop_quit(state->loop);
+}
+
+static void test_async_plugins_ready(GObject *source, GAsyncResult *result, gpointer v)
+{
+        LdmTestAsync *state = v;
+
+        state->added = ldm_manager_add_modalias_plugins_for_directory_finish(LDM_MANAGER(source),
+                                                                             result,
+                                                                             NULL);
+        g_main_loop_quit(state->loop);
+}
+
+static void test_async_providers_ready(GObject *source, GAsyncResult *result, gpointer v)
+{
+        LdmTestAsync *state = v;
+
+        state->providers = ldm_manager_get_providers_finish(LDM_MANAGER(source), result, NULL);
+        g_main_loop_quit(state->loop);
+}
+
+/**
+ * Construct, load plugins and query providers without blocking, and ensure
+ * we see exactly what test_plugins_nvidia does.
+ */
+START_TEST(test_plugins_async)
+{
+        autofree(UMockdevTestbed) *bed = NULL;
+        g_autoptr(GMainLoop) loop = NULL;
+        g_autoptr(GPtrArray) devices = NULL;
+        g_autoptr(GPtrArray) providers = NULL;
+        LdmTestAsync state = { 0 };
+        LdmDevice *device = NULL;
+        const gchar *plugin_id = NULL;
+
+        bed = create_bed_from(NV_MOCKDEV_FILE);
+        loop = g_main_loop_new(NULL, FALSE);
+        state.loop = loop;
+
+        ldm_manager_new_async(LDM_MANAGER_FLAGS_NO_MONITOR, NULL, test_async_new_ready, &state);
+        g_main_loop_run(loop);
+        fail_if(!state.manager, "Failed to construct manager asynchronously");
+
+        devices = ldm_manager_get_devices(state.manager, LDM_DEVICE_TYPE_GPU);
+        fail_if(devices->len != 1, "Expected 1 GPU, found %u", devices->len);
+        device = devices->pdata[0];
+
+        ldm_manager_add_modalias_plugins_for_directory_async(state.manager,
+                                                             MODALIAS_DIR,
+                                                             NULL,
+                                                             test_async_plugins_ready,
+                                                             &state);
+        g_main_loop_run(loop);
+        fail_if(!state.added, "Failed to add modalias directory asynchronously");
+
+        ldm_manager_get_providers_async(state.manager,
+                                        device,
+                                        NULL,
+                                        test_async_providers_ready,
+                                        &state);
+        g_main_loop_run(loop);
+        fail_if(!state.providers, "Failed to get providers asynchronously");
+        fail_if(state.providers->len != 1, "Expected 1 provider, got %u", state.providers->len);
+
+        plugin_id = ldm_plugin_get_name(ldm_provider_get_plugin(state.providers->pdata[0]));
+        fail_if(!g_str_equal(plugin_id, "nvidia-glx-driver"),
+                "Candidate should be nvidia-glx-driver, got %s",
+                plugin_id);
+
+        /* The async result is memoised for the synchronous API */
+        providers = ldm_manager_get_providers(state.manager, device);
+        fail_if(providers->len != 1, "Expected 1 cached provider, got %u", providers->len);
+        fail_if(providers->pdata[0] != state.providers->pdata[0],
+                "Async result was not memoised");
+
+        g_ptr_array_unref(state.providers);
+        g_object_unref(state.manager);
+}
+END_TEST
+
+/**
+ * Ensure a binding constructing through GAsyncInitable itself gets the same
+ * deferred enumeration as ldm_manager_new_async, by way of the property.
+ */
+START_TEST(test_plugins_async_initable)
+{
+        autofree(UMockdevTestbed) *bed = NULL;
+        g_autoptr(GMainLoop) loop = NULL;
+        g_autoptr(LdmManager) pending = NULL;
+        g_autoptr(GPtrArray) devices = NULL;
+        LdmTestAsync state = { 0 };
+
+        bed = create_bed_from(NV_MOCKDEV_FILE);
+        loop = g_main_loop_new(NULL, FALSE);
+        state.loop = loop;
+
+        /* Nothing is enumerated until the manager is initialised */
+        pending = g_object_new(LDM_TYPE_MANAGER,
+                               "flags",
+                               LDM_MANAGER_FLAGS_NO_MONITOR,
+                               "deferred-init",
+                               TRUE,
+                               NULL);
+        devices = ldm_manager_get_devices(pending, LDM_DEVICE_TYPE_ANY);
+        fail_if(devices->len != 0, "Deferred manager enumerated %u devices", devices->len);
+        g_clear_pointer(&devices, g_ptr_array_unref);
+
+        g_async_initable_new_async(LDM_TYPE_MANAGER,
+                                   G_PRIORITY_DEFAULT,
+                                   NULL,
+                                   test_async_new_ready,
+                                   &state,
+                                   "flags",
+                                   LDM_MANAGER_FLAGS_NO_MONITOR,
+                                   "deferred-init",
+                                   TRUE,
+                                   NULL);
+        g_main_loop_run(loop);
+        fail_if(!state.manager, "Failed to initialise manager asynchronously");
+
+        devices = ldm_manager_get_devices(state.manager, LDM_DEVICE_TYPE_GPU);
+        fail_if(devices->len != 1, "Expected 1 GPU, found %u", devices->len);
+
+        g_object_unref(state.manager);
+}
+END_TEST
+
+/**
+ * Ensure offline managers can share the plugins of another manager, and
+ * resolve the same providers from them.
+ */
+START_TEST(test_plugins_shared)
+{
+        g_autoptr(LdmManager) plugins = NULL;
+        g_autoptr(GPtrArray) gpus = NULL;
+        g_autoptr(GPtrArray) expected = NULL;
+        const gchar *recordings[] = { NV_MOCKDEV_FILE, OPTIMUS_MOCKDEV_FILE };
+
+        plugins = ldm_manager_new_from_source(LDM_DEVICE_SOURCE_UMOCKDEV,
+                                              NV_MOCKDEV_FILE,
+                                              0,
+                                              NULL);
+        fail_if(!plugins, "Failed to replay NVIDIA recording");
+        fail_if(!ldm_manager_add_modalias_plugin_for_path(plugins, NV_MAIN_MODALIAS),
+                "Failed to add main modalias file");
+        fail_if(!ldm_manager_add_modalias_plugin_for_path(plugins, NV_340_MODALIAS),
+                "Failed to add 340 modalias file");
+
+        gpus = ldm_manager_get_devices(plugins, LDM_DEVICE_TYPE_GPU);
+        fail_if(gpus->len != 1, "Expected 1 GPU, found %u", gpus->len);
+        expected = ldm_manager_get_providers(plugins, gpus->pdata[0]);
+        fail_if(expected->len != 1, "Expected 1 provider, got %u", expected->len);
+
+        for (guint i = 0; i < G_N_ELEMENTS(recordings); i++) {
+                g_autoptr(LdmManager) manager = NULL;
+                g_autoptr(GPtrArray) devices = NULL;
+                g_autoptr(GPtrArray) providers = NULL;
+                g_autoptr(GError) error = NULL;
+                LdmDevice *nvidia = NULL;
+
+                manager = ldm_manager_new_from_source(LDM_DEVICE_SOURCE_UMOCKDEV,
+                                                      recordings[i],
+                                                      0,
+                                                      &error);
+                fail_if(!manager, "Failed to replay %s: %s", recordings[i], error->message);
+                ldm_manager_share_plugins(manager, plugins);
+
+                devices = ldm_manager_get_devices(manager, LDM_DEVICE_TYPE_GPU);
+                for (guint j = 0; j < devices->len; j++) {
+                        if (ldm_device_get_vendor_id(devices->pdata[j]) == 0x10DE) {
+                                nvidia = devices->pdata[j];
+                        }
+                }
+                fail_if(!nvidia, "No NVIDIA GPU in %s", recordings[i]);
+
+                providers = ldm_manager_get_providers(manager, nvidia);
+                fail_if(providers->len == 0, "No providers from the shared plugins");
+                fail_if(ldm_provider_get_plugin(providers->pdata[0]) !=
+                            ldm_provider_get_plugin(expected->pdata[0]),
+                        "Provider does not come from the shared plugin");
+        }
+}
+END_TEST
+
 static int ldm_test_run(Suite *suite)
 {
         SRunner *runner = NULL;
@@ -216,8 +1018,26 @@ static Suite *test_create(void)
 
         tcase_add_test(tc, test_plugins_nvidia);
         tcase_add_test(tc, test_plugins_nvidia_multiple);
+        tcase_add_test(tc, test_plugins_best_provider);
         tcase_add_test(tc, test_plugins_nvidia_multiple_glob);
+#if G_BYTE_ORDER == G_LITTLE_ENDIAN
+        tcase_add_test(tc, test_plugins_nvidia_binary);
+#endif
         tcase_add_test(tc, test_plugins_razer);
+        tcase_add_test(tc, test_plugins_cache);
+        tcase_add_test(tc, test_plugins_all_providers);
+        tcase_add_test(tc, test_plugins_provider_infos);
+        tcase_add_test(tc, test_plugins_describe_providers);
+        tcase_add_test(tc, test_plugins_describe_providers_utf8);
+        tcase_add_test(tc, test_plugins_threaded);
+        tcase_add_test(tc, test_plugins_merged);
+        tcase_add_test(tc, test_plugins_priority);
+        tcase_add_test(tc, test_plugins_reverse_index);
+        tcase_add_test(tc, test_plugins_query_providers);
+        tcase_add_test(tc, test_plugins_stats);
+        tcase_add_test(tc, test_plugins_async);
+        tcase_add_test(tc, test_plugins_async_initable);
+        tcase_add_test(tc, test_plugins_shared);
 
         return s;
 }
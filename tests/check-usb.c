@@ -49,6 +49,46 @@ START_TEST(test_manager_usb_simple)
 }
 END_TEST
 
+/**
+ * Ensure the interfaces are reachable through the child iterator, and that
+ * it agrees with the list based API.
+ */
+START_TEST(test_manager_usb_children)
+{
+        g_autoptr(LdmManager) manager = NULL;
+        autofree(UMockdevTestbed) *bed = NULL;
+        g_autoptr(GPtrArray) devices = NULL;
+        g_autoptr(GList) kids = NULL;
+        LdmDevice *device = NULL;
+        guint n_kids = 0;
+
+        bed = umockdev_testbed_new();
+        fail_if(!umockdev_testbed_add_from_file(bed, YETI_UMOCKDEV_FILE, NULL),
+                "Failed to create Blue Yeti device");
+        manager = ldm_manager_new(LDM_MANAGER_FLAGS_NO_MONITOR);
+        fail_if(!manager, "Failed to get the LdmManager");
+
+        devices = ldm_manager_get_devices(manager, LDM_DEVICE_TYPE_USB | LDM_DEVICE_TYPE_AUDIO);
+        fail_if(devices->len != 1, "Expected 1 device, got %u devices", devices->len);
+        device = devices->pdata[0];
+
+        n_kids = ldm_device_get_n_children(device);
+        fail_if(n_kids == 0, "Yeti should have interfaces");
+
+        kids = ldm_device_get_children(device);
+        fail_if(g_list_length(kids) != n_kids, "Child APIs disagree on the count");
+
+        for (guint i = 0; i < n_kids; i++) {
+                LdmDevice *child = ldm_device_get_child(device, i);
+
+                fail_if(g_list_nth_data(kids, i) != child, "Child APIs disagree on the order");
+                fail_if(ldm_device_get_parent(child) != device, "Child has the wrong parent");
+                fail_if(!g_str_has_prefix(ldm_device_get_path(child), ldm_device_get_path(device)),
+                        "Child path is outside the parent");
+        }
+}
+END_TEST
+
 /**
  * Identify the USB printer in a noisy environment
  */
@@ -124,6 +164,7 @@ static Suite *test_create(void)
         suite_add_tcase(s, tc);
 
         tcase_add_test(tc, test_manager_usb_simple);
+        tcase_add_test(tc, test_manager_usb_children);
         tcase_add_test(tc, test_manager_usb_noisy);
 
         return s;
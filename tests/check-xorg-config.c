@@ -0,0 +1,230 @@
+/*
+ * This file is part of linux-driver-management.
+ *
+ * Copyright © 2016-2018 Ikey Doherty
+ *
+ * linux-driver-management is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+#define _GNU_SOURCE
+
+#include <check.h>
+#include <stdlib.h>
+
+#include "util.h"
+#include "xorg-config.h"
+
+/**
+ * Scan a copy of @data, as the scanner modifies it in place
+ */
+static LdmXorgConfig *ldm_test_scan(const gchar *data)
+{
+        g_autofree gchar *copy = g_strdup(data);
+
+        return ldm_xorg_config_scan_data(copy);
+}
+
+static LdmXorgSection *ldm_test_section(LdmXorgConfig *config, guint index)
+{
+        fail_if(index >= config->sections->len,
+                "Missing section %u, only have %u",
+                index,
+                config->sections->len);
+        return config->sections->pdata[index];
+}
+
+/**
+ * Ensure full line and trailing comments are dropped, so a commented out
+ * driver is never reported.
+ */
+START_TEST(test_xorg_config_comments)
+{
+        g_autoptr(LdmXorgConfig) config = NULL;
+        LdmXorgSection *section = NULL;
+        const gchar *data = "# Section \"Device\"\n"
+                            "#     Driver \"fglrx\"\n"
+                            "Section \"Device\" # Trailing\n"
+                            "    Identifier \"Card0\" # Name\n"
+                            "    #Driver \"nvidia\"\n"
+                            "    Driver \"nouveau\"#Inline\n"
+                            "EndSection\n";
+
+        config = ldm_test_scan(data);
+        fail_if(config->sections->len != 1, "Expected 1 section, got %u", config->sections->len);
+
+        section = ldm_test_section(config, 0);
+        fail_if(g_strcmp0(section->name, "Device") != 0, "Wrong section name");
+        fail_if(g_strcmp0(section->identifier, "Card0") != 0, "Wrong identifier");
+        fail_if(g_strcmp0(section->driver, "nouveau") != 0, "Wrong driver");
+        fail_if(ldm_xorg_config_has_driver(config, "fglrx"), "Commented section was scanned");
+        fail_if(ldm_xorg_config_has_driver(config, "nvidia"), "Commented driver was scanned");
+}
+END_TEST
+
+/**
+ * Ensure keywords match regardless of case and underscores, as X.Org does
+ */
+START_TEST(test_xorg_config_keywords)
+{
+        g_autoptr(LdmXorgConfig) config = NULL;
+        LdmXorgSection *section = NULL;
+        const gchar *data = "SECTION \"device\"\n"
+                            "    identifier \"Card0\"\n"
+                            "    Bus_ID \"PCI:1:0:0\"\n"
+                            "    DRIVER \"nvidia\"\n"
+                            "end_section\n"
+                            "Section \"Screen\"\n"
+                            "    Identifier \"Screen0\"\n"
+                            "EndSection\n";
+
+        config = ldm_test_scan(data);
+        fail_if(config->sections->len != 2, "Expected 2 sections, got %u", config->sections->len);
+
+        section = ldm_xorg_config_find_section(config, "Device", "nvidia");
+        fail_if(!section, "Failed to find lower case Device section");
+        fail_if(g_strcmp0(section->identifier, "Card0") != 0, "Wrong identifier");
+        fail_if(g_strcmp0(section->bus_id, "PCI:1:0:0") != 0, "Bus_ID wasn't matched as BusID");
+
+        section = ldm_test_section(config, 1);
+        fail_if(g_strcmp0(section->identifier, "Screen0") != 0,
+                "end_section didn't end the first section");
+}
+END_TEST
+
+/**
+ * Ensure entries within subsections, however deeply nested, never leak into
+ * the section itself, while their drivers are still reported.
+ */
+START_TEST(test_xorg_config_subsections)
+{
+        g_autoptr(LdmXorgConfig) config = NULL;
+        LdmXorgSection *section = NULL;
+        const gchar *data = "Section \"Screen\"\n"
+                            "    Identifier \"Screen0\"\n"
+                            "    SubSection \"Display\"\n"
+                            "        Identifier \"Nested\"\n"
+                            "        SubSection \"Deeper\"\n"
+                            "            Driver \"inner\"\n"
+                            "        EndSubSection\n"
+                            "        BusID \"PCI:9:0:0\"\n"
+                            "    EndSubSection\n"
+                            "    Driver \"nvidia\"\n"
+                            "EndSection\n";
+
+        config = ldm_test_scan(data);
+        fail_if(config->sections->len != 1, "Expected 1 section, got %u", config->sections->len);
+
+        section = ldm_test_section(config, 0);
+        fail_if(g_strcmp0(section->identifier, "Screen0") != 0, "Subsection identifier leaked");
+        fail_if(section->bus_id != NULL, "Subsection BusID leaked");
+        fail_if(g_strcmp0(section->driver, "nvidia") != 0, "Wrong section driver");
+        fail_if(!ldm_xorg_config_has_driver(config, "inner"), "Nested driver wasn't reported");
+}
+END_TEST
+
+/**
+ * Ensure a # within a quoted value is part of the value, not a comment
+ */
+START_TEST(test_xorg_config_quoted_hash)
+{
+        g_autoptr(LdmXorgConfig) config = NULL;
+        LdmXorgSection *section = NULL;
+        const gchar *data = "Section \"Device\"\n"
+                            "    Identifier \"Card #1\" # Comment\n"
+                            "    Driver \"nvidia\"\n"
+                            "EndSection\n";
+
+        config = ldm_test_scan(data);
+        section = ldm_test_section(config, 0);
+        fail_if(g_strcmp0(section->identifier, "Card #1") != 0,
+                "Quoted # was treated as a comment, got '%s'",
+                section->identifier);
+        fail_if(g_strcmp0(section->driver, "nvidia") != 0, "Wrong driver");
+}
+END_TEST
+
+/**
+ * Ensure malformed files are scanned as far as is sensible: an unterminated
+ * quote runs to the end of its line, and a missing EndSection is implied by
+ * the next Section, or the end of the file.
+ */
+START_TEST(test_xorg_config_malformed)
+{
+        g_autoptr(LdmXorgConfig) config = NULL;
+        LdmXorgSection *section = NULL;
+        const gchar *data = "Section \"Device\"\n"
+                            "    Identifier \"Card0\n"
+                            "    Driver \"nvidia\"\n"
+                            "Section \"Screen\"\n"
+                            "    Identifier \"Screen0\"";
+
+        config = ldm_test_scan(data);
+        fail_if(config->sections->len != 2, "Expected 2 sections, got %u", config->sections->len);
+
+        section = ldm_test_section(config, 0);
+        fail_if(g_strcmp0(section->identifier, "Card0") != 0,
+                "Unterminated quote should end with the line, got '%s'",
+                section->identifier);
+        fail_if(g_strcmp0(section->driver, "nvidia") != 0, "Driver after bad quote was lost");
+
+        section = ldm_test_section(config, 1);
+        fail_if(g_strcmp0(section->name, "Screen") != 0, "Wrong section name");
+        fail_if(g_strcmp0(section->identifier, "Screen0") != 0, "Unterminated section was lost");
+        fail_if(section->driver != NULL, "Driver leaked into the next section");
+}
+END_TEST
+
+/**
+ * Standard helper for running a test suite
+ */
+static int ldm_test_run(Suite *suite)
+{
+        SRunner *runner = NULL;
+        int n_failed = 0;
+
+        runner = srunner_create(suite);
+        srunner_run_all(runner, CK_VERBOSE);
+        n_failed = srunner_ntests_failed(runner);
+        srunner_free(runner);
+
+        return n_failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static Suite *test_create(void)
+{
+        Suite *s = NULL;
+        TCase *tc = NULL;
+
+        s = suite_create(__FILE__);
+        tc = tcase_create(__FILE__);
+        suite_add_tcase(s, tc);
+
+        tcase_add_test(tc, test_xorg_config_comments);
+        tcase_add_test(tc, test_xorg_config_keywords);
+        tcase_add_test(tc, test_xorg_config_subsections);
+        tcase_add_test(tc, test_xorg_config_quoted_hash);
+        tcase_add_test(tc, test_xorg_config_malformed);
+
+        return s;
+}
+
+int main(__ldm_unused__ int argc, __ldm_unused__ char **argv)
+{
+        return ldm_test_run(test_create());
+}
+
+/*
+ * Editor modelines  -  https://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: nil
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 expandtab:
+ * :indentSize=8:tabSize=8:noTabs=true:
+ */
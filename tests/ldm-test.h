@@ -0,0 +1,92 @@
+/*
+ * This file is part of linux-driver-management.
+ *
+ * Copyright © 2016-2018 Ikey Doherty
+ *
+ * linux-driver-management is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+#pragma once
+
+#include <check.h>
+#include <glib.h>
+#include <umockdev.h>
+
+/**
+ * Add a PCI device to the testbed, with the class, vendor and device given
+ * as the kernel shows them in sysfs, i.e. "0x030000", "0x10de", "0x1b80"
+ *
+ * Returns: The sysfs path of the new device, to be freed
+ */
+static inline gchar *ldm_test_add_pci_device(UMockdevTestbed *bed, const gchar *sysname,
+                                             const gchar *pci_class, const gchar *vendor,
+                                             const gchar *device)
+{
+        g_autofree gchar *class_property = NULL;
+        gchar *path = NULL;
+
+        /* udev drops the prefix and leading zeroes for PCI_CLASS */
+        class_property = g_strdup_printf("%" G_GINT64_MODIFIER "X",
+                                         g_ascii_strtoull(pci_class, NULL, 16));
+
+        path = umockdev_testbed_add_device(bed,
+                                           "pci",
+                                           sysname,
+                                           NULL,
+                                           /* attributes */
+                                           "class",
+                                           pci_class,
+                                           "vendor",
+                                           vendor,
+                                           "device",
+                                           device,
+                                           NULL,
+                                           /* properties */
+                                           "PCI_CLASS",
+                                           class_property,
+                                           NULL);
+        fail_if(!path, "Failed to add PCI device %s", sysname);
+
+        return path;
+}
+
+static inline gboolean ldm_test_timeout(gpointer v)
+{
+        gboolean *timed_out = v;
+        *timed_out = TRUE;
+        return G_SOURCE_REMOVE;
+}
+
+/**
+ * Spin the default main context until @n_changes reaches @expected, or we
+ * give up waiting after a couple of seconds.
+ */
+static inline void ldm_test_wait_changes(guint *n_changes, guint expected)
+{
+        gboolean timed_out = FALSE;
+        guint timeout = 0;
+
+        timeout = g_timeout_add(2000, ldm_test_timeout, &timed_out);
+        while (*n_changes < expected && !timed_out) {
+                g_main_context_iteration(NULL, TRUE);
+        }
+        if (!timed_out) {
+                g_source_remove(timeout);
+        }
+}
+
+/*
+ * Editor modelines  -  https://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: nil
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 expandtab:
+ * :indentSize=8:tabSize=8:noTabs=true:
+ */